@@ -0,0 +1,1569 @@
+#include "budget_scan.h"
+#include "dump_source.h"
+#include "heap_report.h"
+#include "memory_source.h"
+#include "output_sink.h"
+#include "page_classifier.h"
+#include "pattern_engine.h"
+#include "reference_scanner.h"
+#include "scan_scheduler.h"
+#include "snapshot_diff.h"
+#include "string_index.h"
+#include "string_store.h"
+#include "synthetic_image.h"
+#include "text_scanner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <thread>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Every allocation in the process goes through these, so that a benchmark
+// can report how many it made and how many bytes they asked for. They are
+// kept out of line so GCC does not pair the malloc and free inside them
+// with the new and delete of their callers.
+static std::atomic<uint64_t> allocationCount{0};
+static std::atomic<uint64_t> allocationBytes{0};
+
+[[gnu::noinline]] void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+[[gnu::noinline]] void operator delete(void* memory) noexcept { std::free(memory); }
+[[gnu::noinline]] void operator delete[](void* memory) noexcept { std::free(memory); }
+[[gnu::noinline]] void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+[[gnu::noinline]] void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
+
+// Page-aligned buffers (read_planner.h) come through the aligned forms
+[[gnu::noinline]] void* operator new(size_t size, std::align_val_t alignment) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+#ifdef _WIN32
+    if (void* memory = _aligned_malloc(size ? size : 1, static_cast<size_t>(alignment))) return memory;
+#else
+    void* memory = NULL;
+    size_t align = (std::max)(static_cast<size_t>(alignment), sizeof(void*));
+    if (posix_memalign(&memory, align, size ? size : 1) == 0) return memory;
+#endif
+    throw std::bad_alloc();
+}
+
+#ifdef _WIN32
+[[gnu::noinline]] void operator delete(void* memory, std::align_val_t) noexcept { _aligned_free(memory); }
+#else
+[[gnu::noinline]] void operator delete(void* memory, std::align_val_t) noexcept { std::free(memory); }
+#endif
+void operator delete(void* memory, size_t, std::align_val_t alignment) noexcept { operator delete(memory, alignment); }
+
+// Starts a new peak resident set size where the OS allows it (Linux 4.0 and
+// later), so each benchmark reports its own peak rather than the process's.
+static void ResetPeakMemory() {
+#ifdef __linux__
+    if (FILE* file = std::fopen("/proc/self/clear_refs", "w")) {
+        std::fputs("5", file);
+        std::fclose(file);
+    }
+#endif
+}
+
+static uint64_t PeakMemory() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    if (FILE* file = std::fopen("/proc/self/status", "r")) {
+        char line[256];
+        unsigned long long kilobytes = 0;
+        while (std::fgets(line, sizeof(line), file)) {
+            if (std::sscanf(line, "VmHWM: %llu kB", &kilobytes) == 1) break;
+        }
+        std::fclose(file);
+        if (kilobytes) return kilobytes * 1024;
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+struct BenchmarkResult {
+    std::string name;
+    double seconds;
+    uint64_t bytes;             // Input bytes processed; 0 when not byte-oriented
+    uint64_t items;
+    std::string unit;           // What items counts: strings, regions, lines, ...
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+    uint64_t peakMemory;        // Peak resident set size during the benchmark
+};
+
+// Everything measured so far, in order, for --json
+static std::vector<BenchmarkResult> results;
+
+// Times a benchmark and counts its allocations from construction to Finish.
+class Measurement {
+public:
+    Measurement() {
+        ResetPeakMemory();
+        allocations = allocationCount.load();
+        allocatedBytes = allocationBytes.load();
+        start = std::chrono::steady_clock::now();
+    }
+
+    const BenchmarkResult& Finish(const std::string& name, uint64_t bytes, uint64_t items, const char* unit) {
+        BenchmarkResult result;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.name = name;
+        result.bytes = bytes;
+        result.items = items;
+        result.unit = unit;
+        result.allocations = allocationCount.load() - allocations;
+        result.allocatedBytes = allocationBytes.load() - allocatedBytes;
+        result.peakMemory = PeakMemory();
+        results.push_back(result);
+        return results.back();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+};
+
+static void PrintResult(const BenchmarkResult& result) {
+    std::cout << "  " << std::left << std::setw(26) << result.name << std::right << std::fixed << std::setprecision(1);
+    if (result.bytes) {
+        std::cout << std::setw(9) << result.bytes / (1024.0 * 1024.0) / result.seconds << " MB/s";
+    } else {
+        std::cout << std::setw(14) << "";
+    }
+    std::cout << std::setw(9) << result.items / 1e6 / result.seconds << " M " << std::left << std::setw(8) << (result.unit + "/s")
+              << std::right << std::setw(10) << result.allocations << " allocs " << std::setw(9)
+              << result.allocatedBytes / (1024.0 * 1024.0) << " MB allocated " << std::setw(8)
+              << result.peakMemory / (1024.0 * 1024.0) << " MB peak" << std::endl;
+}
+
+// The original ExtractTextFromMemory loop, kept as the oracle the SIMD kernels
+// must agree with. Only the size guard differs: the original underflowed on
+// buffers of 32 bytes or less.
+static void ScanTextReference(const char* buffer, size_t bytesRead, std::vector<std::string>& texts) {
+    if (bytesRead <= 32) return;
+
+    size_t i = 0;
+    while (i < bytesRead - 32) {
+        bool isUTF16 = false;
+        int printableCount = 0;
+        int nullCount = 0;
+
+        for (size_t j = 0; j < 20 && (i + j + 1) < bytesRead; j += 2) {
+            if (buffer[i + j] >= 32 && buffer[i + j] <= 126) {
+                printableCount++;
+            }
+            if (buffer[i + j + 1] == 0) {
+                nullCount++;
+            }
+        }
+
+        if (printableCount > 5 && nullCount > 2) {
+            isUTF16 = true;
+        }
+
+        if (isUTF16) {
+            std::string text;
+            size_t textEnd = i;
+
+            for (size_t j = 0; j < 200 && (i + j + 1) < bytesRead; j += 2) {
+                if (buffer[i + j] >= 32 && buffer[i + j] <= 126 && buffer[i + j + 1] == 0) {
+                    text += buffer[i + j];
+                    textEnd = i + j + 2;
+                } else if (buffer[i + j] == 0 && buffer[i + j + 1] == 0) {
+                    break;
+                }
+            }
+
+            if (text.length() > 3) {
+                texts.push_back(text);
+            }
+
+            if (textEnd > i) {
+                i = textEnd;
+            } else {
+                i += 2;
+            }
+        } else {
+            i += 2;
+        }
+    }
+}
+
+static bool VerifyKernel(ScanKernel kernel, const std::vector<char>& corpus) {
+    static const size_t sliceSizes[] = {17, 32, 33, 34, 63, 200, 4099, 65536};
+
+    TextScanner scanner(kernel);
+    std::vector<TextSpan> spans;
+    std::vector<std::string> expected;
+    std::string text;
+    size_t slices = 0;
+
+    for (size_t sliceSize : sliceSizes) {
+        for (size_t offset = 0; offset + sliceSize <= corpus.size(); offset += sliceSize * 7 + 1) {
+            const char* data = corpus.data() + offset;
+            expected.clear();
+            spans.clear();
+            ScanTextReference(data, sliceSize, expected);
+            scanner.Scan(data, sliceSize, spans);
+            slices++;
+
+            bool match = expected.size() == spans.size();
+            for (size_t i = 0; match && i < spans.size(); i++) {
+                TextScanner::Materialize(data, spans[i], text);
+                match = text == expected[i];
+            }
+            if (!match) {
+                std::cout << "  MISMATCH: kernel " << TextScanner::KernelName(kernel)
+                          << " at offset " << offset << ", size " << sliceSize
+                          << " (expected " << expected.size() << " strings, got " << spans.size() << ")" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    std::cout << "  " << std::left << std::setw(8) << TextScanner::KernelName(kernel)
+              << "matches reference on " << slices << " slices" << std::endl;
+    return true;
+}
+
+// Scans the corpus in 64 KB slices, the read size ExtractTextFromMemory uses.
+template <typename ScanFn>
+static double MeasureThroughput(const std::vector<char>& corpus, int iterations, ScanFn scan) {
+    const size_t sliceSize = 64 * 1024;
+    auto start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        for (size_t offset = 0; offset < corpus.size(); offset += sliceSize) {
+            size_t size = (std::min)(sliceSize, corpus.size() - offset);
+            scan(corpus.data() + offset, size);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(corpus.size()) * iterations / (1024.0 * 1024.0) / seconds;
+}
+
+// Synthetic extracted strings: path/identifier-like text of 4-100
+// characters where roughly every third string repeats an earlier one.
+static std::vector<std::string> BuildStrings(size_t count, uint64_t seed) {
+    std::vector<std::string> strings;
+    strings.reserve(count);
+    Random rng(seed);
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0 && rng.Below(3) == 0) {
+            strings.push_back(strings[rng.Below(i)]);
+            continue;
+        }
+        size_t length = 4 + rng.Below(rng.Below(8) == 0 ? 97 : 28);
+        std::string text(length, ' ');
+        for (size_t c = 0; c < length; c++) {
+            text[c] = static_cast<char>(32 + rng.Below(95));
+        }
+        strings.push_back(text);
+    }
+    return strings;
+}
+
+static void BenchmarkDedup() {
+    std::cout << "\nString deduplication:" << std::endl;
+    std::vector<std::string> strings = BuildStrings(1000000, 0xD5D5);
+
+    for (size_t count : {2000, 4000, 8000, 16000}) {
+        std::vector<std::string> texts;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i++) {
+            bool found = false;
+            for (const auto& existing : texts) {
+                if (existing == strings[i]) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) texts.push_back(strings[i]);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  linear scan " << std::right << std::setw(8) << count << " strings: "
+                  << std::fixed << std::setprecision(2) << std::setw(9) << seconds * 1000.0 << " ms  "
+                  << std::setprecision(1) << std::setw(8) << seconds * 1e9 / count << " ns/string" << std::endl;
+    }
+
+    for (size_t count : {125000, 250000, 500000, 1000000}) {
+        StringStore store;
+        Measurement measurement;
+        for (size_t i = 0; i < count; i++) {
+            store.Intern(strings[i], i * 16);
+        }
+        double seconds = measurement.Finish("dedup/intern-" + std::to_string(count), 0, count, "strings").seconds;
+        std::cout << "  interning   " << std::right << std::setw(8) << count << " strings: "
+                  << std::fixed << std::setprecision(2) << std::setw(9) << seconds * 1000.0 << " ms  "
+                  << std::setprecision(1) << std::setw(8) << seconds * 1e9 / count << " ns/string  "
+                  << store.size() << " unique, "
+                  << std::setprecision(2) << store.MemoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+    }
+}
+
+// Splits the corpus into page-aligned ranges of 4 KB to 8 MB, like the
+// regions of a process, back to back from a made-up base address.
+static std::vector<ScanRange> BuildRanges(size_t corpusSize, uint64_t base) {
+    std::vector<ScanRange> ranges;
+    Random rng(0xA11CE);
+    uint64_t offset = 0;
+    while (offset < corpusSize) {
+        uint64_t size = 4096 * (1 + rng.Below(rng.Below(4) == 0 ? 2048 : 64));
+        size = (std::min)(size, static_cast<uint64_t>(corpusSize - offset));
+        ScanRange range;
+        range.address = base + offset;
+        range.size = size;
+        ranges.push_back(range);
+        offset += size;
+    }
+    return ranges;
+}
+
+// Hides View, so the scheduler has to read the memory like it does from a
+// live process.
+class CopyingMemorySource : public MemorySource {
+public:
+    explicit CopyingMemorySource(MemorySource& inner) : inner(inner) {}
+
+    bool EnumerateRegions(std::vector<MemoryRegion>& regions) override { return inner.EnumerateRegions(regions); }
+    size_t Read(uint64_t address, char* buffer, size_t size) override { return inner.Read(address, buffer, size); }
+    bool Describe(ProcessDescription& description) override { return inner.Describe(description); }
+
+private:
+    MemorySource& inner;
+};
+
+static bool SameStrings(const StringStore& a, const StringStore& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i] != b[i] || a.Count(i) != b.Count(i) || a.FirstAddress(i) != b.FirstAddress(i)) return false;
+    }
+    return true;
+}
+
+static bool BenchmarkScheduler(const std::vector<char>& corpus, size_t maxThreads) {
+    const uint64_t base = 0x10000000;
+    std::vector<ScanRange> ranges = BuildRanges(corpus.size(), base);
+    std::vector<MemoryRegion> regions;
+    for (const auto& range : ranges) {
+        MemoryRegion region = {range.address, range.size, MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE};
+        regions.push_back(region);
+    }
+    BufferMemorySource mapped(corpus.data(), regions, "corpus");
+    CopyingMemorySource copied(mapped);
+
+    // Reference: the ranges are back to back, so they are scanned as one
+    // buffer on this thread
+    StringStore expected;
+    TextScanner scanner;
+    std::vector<TextSpan> spans;
+    std::string text;
+    scanner.Scan(corpus.data(), corpus.size(), spans);
+    for (const auto& span : spans) {
+        TextScanner::Materialize(corpus.data(), span, text);
+        expected.Intern(text, base + span.offset);
+    }
+
+    std::cout << "\nParallel region scan (" << ranges.size() << " ranges):" << std::endl;
+    bool allMatch = true;
+    std::vector<size_t> threadCounts;
+    for (size_t threads = 1; threads < maxThreads; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    for (size_t threads : threadCounts) {
+        for (MemorySource* source : {static_cast<MemorySource*>(&mapped), static_cast<MemorySource*>(&copied)}) {
+            // Small tasks so that most strings near task boundaries are exercised
+            ScanScheduler scheduler(threads, 64 * 1024);
+            StringStore texts;
+            auto start = std::chrono::steady_clock::now();
+            scheduler.Scan(ranges, *source, texts);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            bool match = SameStrings(texts, expected);
+            allMatch = allMatch && match;
+            std::cout << "  " << std::right << std::setw(3) << threads << " threads, "
+                      << (source == &mapped ? "in place:" : "copied:  ")
+                      << std::fixed << std::setprecision(1) << std::setw(9) << corpus.size() / (1024.0 * 1024.0) / seconds
+                      << " MB/s  " << texts.size() << " strings"
+                      << (match ? "" : "  MISMATCH against sequential scan") << std::endl;
+        }
+    }
+    return allMatch;
+}
+
+// Strings of a that are not in b
+static std::vector<std::string> MissingStrings(const StringStore& a, const StringStore& b) {
+    std::vector<std::string> missing;
+    for (size_t id = 0; id < a.size(); id++) {
+        if (b.Find(a[id]) == StringStore::kInvalidId) missing.push_back(std::string(a[id]));
+    }
+    return missing;
+}
+
+// Takes snapshots of a changing copy of the corpus and checks every
+// incremental pass against a full scan of the same memory.
+static bool BenchmarkSnapshots(const std::vector<char>& corpus, size_t maxThreads) {
+    const uint64_t base = 0x10000000;
+    std::vector<ScanRange> allRanges = BuildRanges(corpus.size(), base);
+    std::vector<char> memory(corpus);
+    std::vector<char> text = BuildCorpus(1024 * 1024, 0x5EED);
+    Random rng(0xD1FF);
+
+    ScanScheduler scheduler(maxThreads);
+    SnapshotState state;
+    StringStore previous;
+    bool allMatch = true;
+    std::cout << "\nIncremental snapshots (" << maxThreads << " threads):" << std::endl;
+
+    for (int pass = 0; pass < 5; pass++) {
+        // Pass 1 is the baseline, 2 and 3 change pages in place, 4 also
+        // frees every 16th range and 5 changes nothing
+        size_t pageCount = memory.size() / 4096;
+        size_t changes = pass == 1 ? pageCount / 100 : pass == 2 || pass == 3 ? pageCount / 10 : 0;
+        for (size_t c = 0; c < changes; c++) {
+            size_t page = rng.Below(pageCount);
+            size_t length = 1 + rng.Below(rng.Below(8) == 0 ? 4096 : 256);
+            size_t at = page * 4096 + rng.Below(4096);
+            length = (std::min)(length, memory.size() - at);
+            std::memcpy(memory.data() + at, text.data() + rng.Below(text.size() - length), length);
+        }
+        std::vector<ScanRange> ranges;
+        for (size_t r = 0; r < allRanges.size(); r++) {
+            if (pass < 3 || r % 16 != 5) ranges.push_back(allRanges[r]);
+        }
+        std::vector<MemoryRegion> regions;
+        std::vector<uint64_t> offsets;
+        for (const auto& range : ranges) {
+            MemoryRegion region = {range.address, range.size, MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE};
+            regions.push_back(region);
+            offsets.push_back(range.address - base);
+        }
+        BufferMemorySource mapped(memory.data(), memory.size(), regions, offsets, "snapshot");
+
+        StringStore expected;
+        auto start = std::chrono::steady_clock::now();
+        scheduler.Scan(ranges, mapped, expected);
+        double fullSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        StringStore texts;
+        SnapshotDiff diff;
+        SnapshotScanner snapshots(scheduler);
+        start = std::chrono::steady_clock::now();
+        snapshots.Scan(ranges, mapped, state, texts, nullptr, diff);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<std::string> added;
+        for (uint32_t id : diff.added) added.push_back(std::string(texts[id]));
+        bool match = SameStrings(texts, expected) &&
+                     (pass == 0 || (added == MissingStrings(expected, previous) && diff.removed == MissingStrings(previous, expected)));
+        allMatch = allMatch && match;
+        std::cout << "  pass " << pass + 1 << ": " << std::right << std::setw(6) << diff.changedPages << " of " << diff.pages
+                  << " pages changed, " << std::fixed << std::setprecision(1) << std::setw(6)
+                  << diff.rescannedBytes / (1024.0 * 1024.0) << " MB rescanned in " << std::setw(7) << seconds * 1000.0
+                  << " ms (full scan " << fullSeconds * 1000.0 << " ms), +" << diff.added.size() << " -" << diff.removed.size()
+                  << " strings" << (match ? "" : "  MISMATCH against full scan") << std::endl;
+        previous = std::move(expected);
+    }
+    return allMatch;
+}
+
+// Random literal rules: three text tokens to one hex signature, plus two
+// regexes, so that rule sets differ only in size.
+static bool BuildPatternSet(size_t ruleCount, uint64_t seed, PatternSet& set, std::vector<std::string>& texts) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789_";
+    Random rng(seed);
+    std::string error;
+    bool ok = set.AddRule("aws-key", "regex", "AKIA[0-9A-Z]{16}", error) &&
+              set.AddRule("guid", "regex/ascii", "\\{[0-9a-f]{8}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{12}\\}", error);
+    for (size_t i = 2; ok && i < ruleCount; i++) {
+        std::string pattern;
+        if (i % 4 == 3) {
+            static const char digits[] = "0123456789ABCDEF";
+            for (size_t j = 0, length = 4 + rng.Below(5); j < length; j++) {
+                pattern += digits[rng.Below(16)];
+                pattern += digits[rng.Below(16)];
+            }
+            ok = set.AddRule("sig" + std::to_string(i), "hex", pattern, error);
+        } else {
+            for (size_t j = 0, length = 8 + rng.Below(9); j < length; j++) pattern += alphabet[rng.Below(sizeof(alphabet) - 1)];
+            ok = set.AddRule("token" + std::to_string(i), "text", pattern, error);
+            texts.push_back(pattern);
+        }
+    }
+    ok = ok && set.Compile(error);
+    if (!ok) std::cout << "  Failed to build rules: " << error << std::endl;
+    return ok;
+}
+
+// Checks the literal matches in a buffer against a plain search for every
+// text rule in both encodings.
+static bool VerifyPatternMatches(const PatternSet& set, const std::vector<std::string>& texts, const std::vector<char>& buffer) {
+    std::vector<PatternMatch> matches;
+    PatternMatcher matcher(set);
+    matcher.Scan(buffer.data(), buffer.size(), buffer.size(), matches);
+
+    size_t expected = 0, found = 0;
+    for (const auto& text : texts) {
+        std::string wide;
+        for (char c : text) {
+            wide += c;
+            wide += '\0';
+        }
+        for (const std::string* needle : {&text, static_cast<const std::string*>(&wide)}) {
+            for (auto it = buffer.begin(); (it = std::search(it, buffer.end(), needle->begin(), needle->end())) != buffer.end(); ++it) {
+                expected++;
+            }
+        }
+    }
+    for (const auto& match : matches) {
+        if (set.IsRegex(match.variant) || set.Encoding(match.variant) == PatternEncoding::Raw) continue;
+        std::string text = set.Preview(match.variant, buffer.data() + match.offset, match.length, PatternSet::kMaxMatchLength);
+        if (set.RuleId(match.variant).compare(0, 5, "token") == 0 &&
+            std::find(texts.begin(), texts.end(), text) != texts.end()) {
+            found++;
+        }
+    }
+    return found == expected;
+}
+
+static bool BenchmarkPatterns(const std::vector<char>& corpus) {
+    std::cout << "\nPattern search (one pass, ASCII + UTF-16LE + raw):" << std::endl;
+
+    // Plant every token of a small rule set into a copy of the corpus
+    bool match = true;
+    {
+        PatternSet set;
+        std::vector<std::string> texts;
+        if (!BuildPatternSet(100, 0xF00D, set, texts)) return false;
+        std::vector<char> buffer(corpus.begin(), corpus.begin() + (std::min)(corpus.size(), static_cast<size_t>(4 * 1024 * 1024)));
+        Random rng(0xBEEF);
+        for (size_t i = 0; i < 2000; i++) {
+            const std::string& text = texts[rng.Below(texts.size())];
+            size_t at = rng.Below(buffer.size() - 2 * text.size());
+            bool wide = rng.Below(2) == 0;
+            for (size_t j = 0; j < text.size(); j++) {
+                if (wide) {
+                    buffer[at + 2 * j] = text[j];
+                    buffer[at + 2 * j + 1] = 0;
+                } else {
+                    buffer[at + j] = text[j];
+                }
+            }
+        }
+        match = VerifyPatternMatches(set, texts, buffer);
+        std::cout << "  literal matches " << (match ? "agree" : "DISAGREE") << " with a plain search" << std::endl;
+    }
+
+    for (size_t ruleCount : {10, 100, 1000, 10000}) {
+        PatternSet set;
+        std::vector<std::string> texts;
+        auto start = std::chrono::steady_clock::now();
+        if (!BuildPatternSet(ruleCount, 0xF00D + ruleCount, set, texts)) return false;
+        double compileSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // Best of three passes, since the point is the curve across rule counts
+        PatternMatcher matcher(set);
+        std::vector<PatternMatch> matches;
+        size_t hits = 0;
+        const size_t sliceSize = 1024 * 1024;
+        double seconds = 0;
+        for (int pass = 0; pass < 3; pass++) {
+            hits = 0;
+            start = std::chrono::steady_clock::now();
+            for (size_t offset = 0; offset < corpus.size(); offset += sliceSize) {
+                matches.clear();
+                size_t size = (std::min)(sliceSize, corpus.size() - offset);
+                matcher.Scan(corpus.data() + offset, size, size, matches);
+                hits += matches.size();
+            }
+            double passSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            seconds = pass == 0 ? passSeconds : (std::min)(seconds, passSeconds);
+        }
+        std::cout << "  " << std::right << std::setw(6) << ruleCount << " rules: "
+                  << std::fixed << std::setprecision(1) << std::setw(9) << corpus.size() / (1024.0 * 1024.0) / seconds << " MB/s  "
+                  << std::setw(7) << set.LiteralStateCount() << " literal states, "
+                  << std::setprecision(2) << set.MemoryUsage() / (1024.0 * 1024.0) << " MB, compiled in "
+                  << std::setprecision(1) << compileSeconds * 1000.0 << " ms, " << hits << " hits" << std::endl;
+    }
+
+    // Broad regexes over long runs of text, one rule at a time over a slice
+    // of the corpus with 100 KB runs of one letter planted in it. The hits
+    // of [a-z]+ in ASCII must be the runs of lowercase letters, cut into
+    // pieces of kMaxMatchLength bytes.
+    std::vector<char> buffer(corpus.begin(), corpus.begin() + (std::min)(corpus.size(), static_cast<size_t>(8 * 1024 * 1024)));
+    Random rng(0xA11A);
+    for (size_t i = 0; i < 16 && buffer.size() > 200 * 1024; i++) {
+        size_t at = rng.Below(buffer.size() - 100 * 1024);
+        std::fill(buffer.begin() + at, buffer.begin() + at + 100 * 1024, 'a');
+    }
+    std::vector<std::pair<size_t, size_t>> expected;
+    for (size_t i = 0; i < buffer.size();) {
+        size_t end = i;
+        while (end < buffer.size() && buffer[end] >= 'a' && buffer[end] <= 'z') end++;
+        for (size_t start = i; start < end; start += PatternSet::kMaxMatchLength) {
+            expected.emplace_back(start, (std::min)(end - start, PatternSet::kMaxMatchLength));
+        }
+        i = end + 1;
+    }
+    for (const char* regex : {"a+", "[a-z]+", "\\w+", "[A-Za-z0-9]{8,}"}) {
+        PatternSet set;
+        std::string error;
+        if (!set.AddRule("broad", "regex", regex, error) || !set.Compile(error)) {
+            std::cout << "  Failed to build rules: " << error << std::endl;
+            return false;
+        }
+        PatternMatcher matcher(set);
+        std::vector<PatternMatch> matches;
+        auto start = std::chrono::steady_clock::now();
+        matcher.Scan(buffer.data(), buffer.size(), buffer.size(), matches);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::string agreement;
+        if (std::string(regex) == "[a-z]+") {
+            std::vector<std::pair<size_t, size_t>> found;
+            for (const auto& hit : matches) {
+                if (set.Encoding(hit.variant) == PatternEncoding::Ascii) found.emplace_back(hit.offset, hit.length);
+            }
+            std::sort(found.begin(), found.end());
+            bool agree = found == expected;
+            match = match && agree;
+            agreement = agree ? ", agree with a plain search" : ", DISAGREE with a plain search";
+        }
+        std::cout << "  " << std::left << std::setw(17) << regex << std::right << std::fixed << std::setprecision(1) << std::setw(9)
+                  << buffer.size() / (1024.0 * 1024.0) / seconds << " MB/s  " << matches.size() << " hits" << agreement << std::endl;
+    }
+    return match;
+}
+
+// Passes the strings of a scan straight on to an output sink, as
+// heap_extractor does with --format jsonl or binary.
+class SinkForwarder : public ScanListener {
+public:
+    explicit SinkForwarder(OutputSink& sink) : sink(sink) {}
+
+    void OnText(uint64_t address, uint32_t byteLength, std::string_view text, size_t range) override {
+        sink.OnText(address, byteLength, text, range);
+    }
+
+private:
+    OutputSink& sink;
+};
+
+// Runs the extractor's pipeline over a synthetic image, the way
+// heap_extractor does over a process: region filtering, the parallel scan,
+// the text report and the streamed formats. For the text report, bytes
+// are the bytes written.
+static void BenchmarkImage(const SyntheticImage& image, size_t maxThreads) {
+    BufferMemorySource mapped(image.bytes.data(), image.bytes.size(), image.regions, image.offsets, "synthetic");
+    CopyingMemorySource copied(mapped);
+    std::cout << "\nSynthetic image (" << image.regions.size() << " regions, " << FormatSize(image.bytes.size())
+              << " readable):" << std::endl;
+
+    // The image's layout over and over, to a million regions
+    std::vector<MemoryRegion> manyRegions;
+    while (manyRegions.size() < 1000000) manyRegions.insert(manyRegions.end(), image.regions.begin(), image.regions.end());
+    std::vector<MemoryRegion> selected;
+    Measurement filtering;
+    for (int it = 0; it < 10; it++) {
+        selected.clear();
+        for (const auto& region : manyRegions) {
+            if (IsUserDataRegion(region)) selected.push_back(region);
+        }
+    }
+    PrintResult(filtering.Finish("regions/filter", 0, manyRegions.size() * 10, "regions"));
+
+    std::vector<ScanRange> ranges;
+    uint64_t scanBytes = 0;
+    for (const auto& region : image.regions) {
+        if (!IsUserDataRegion(region) || region.RegionSize < 16) continue;
+        ScanRange range;
+        range.address = region.BaseAddress;
+        range.size = region.RegionSize;
+        ranges.push_back(range);
+        scanBytes += range.size;
+    }
+
+    StringStore texts;
+    std::vector<size_t> threadCounts = {1};
+    if (maxThreads > 1) threadCounts.push_back(maxThreads);
+    for (size_t threads : threadCounts) {
+        for (MemorySource* source : {static_cast<MemorySource*>(&copied), static_cast<MemorySource*>(&mapped)}) {
+            ScanScheduler scheduler(threads);
+            StringStore store;
+            Measurement extraction;
+            scheduler.Scan(ranges, *source, store);
+            uint64_t occurrences = 0;
+            for (size_t id = 0; id < store.size(); id++) occurrences += store.Count(id);
+            std::string name = std::string("extract/") + (source == &copied ? "read-" : "mapped-") + std::to_string(threads) + "t";
+            PrintResult(extraction.Finish(name, scanBytes, occurrences, "strings"));
+            texts = std::move(store);
+        }
+    }
+
+    // The read path again with the region map, so that reads also run
+    // through readable gaps of up to 16 KB, as on Windows. A second pass
+    // reuses the scheduler and store, so its allocations are the steady state.
+    {
+        ScanScheduler scheduler(maxThreads);
+        scheduler.SetRegionMap(image.regions, 16 * 1024);
+        StringStore store;
+        for (int pass = 0; pass < 2; pass++) {
+            TelemetrySnapshot before = Telemetry::Capture();
+            Measurement extraction;
+            scheduler.Scan(ranges, copied, store);
+            uint64_t occurrences = 0;
+            for (size_t id = 0; id < store.size(); id++) occurrences += store.Count(id);
+            if (pass) occurrences /= 2;
+            std::string name = std::string("extract/read-") + (pass ? "warm-" : "gap-") + std::to_string(maxThreads) + "t";
+            PrintResult(extraction.Finish(name, scanBytes, occurrences, "strings"));
+            if (pass) continue;
+
+            TelemetrySnapshot after = Telemetry::Capture();
+            uint64_t issued = after[Counter::ReadsIssued] - before[Counter::ReadsIssued];
+            uint64_t merged = after[Counter::ReadsMerged] - before[Counter::ReadsMerged];
+            std::cout << "    " << issued << " reads for " << issued + merged << " requests"
+                      << (SameStrings(store, texts) ? "" : " (STRINGS DIFFER)") << std::endl;
+        }
+    }
+
+    {
+        const char* path = "heap_bench_report.tmp";
+        Measurement report;
+        std::ofstream file(path);
+        WriteTextList(file, texts, "  ");
+        uint64_t written = static_cast<uint64_t>(file.tellp());
+        file.close();
+        PrintResult(report.Finish("report/text", written, texts.size(), "lines"));
+        std::remove(path);
+    }
+
+    for (const char* format : {"jsonl", "binary"}) {
+        std::string path = std::string("heap_bench_output.") + format;
+        std::string error;
+        ScanScheduler scheduler(maxThreads);
+        Measurement streaming;
+        std::unique_ptr<OutputSink> sink = OpenOutputSink(format, path, error);
+        if (!sink) {
+            std::cout << "  " << error << std::endl;
+            continue;
+        }
+        SinkForwarder forwarder(*sink);
+        scheduler.SetListener(&forwarder);
+        StringStore unused;
+        scheduler.Scan(ranges, mapped, unused);
+        if (!sink->Close(error)) std::cout << "  " << error << std::endl;
+        PrintResult(streaming.Finish(std::string("stream/") + format, scanBytes, sink->RecordCount(), "records"));
+        std::remove(path.c_str());
+    }
+}
+
+// A fragmented heap: thousands of 4 to 16 KB regions, some back to back and
+// some separated by a page the extractor skips. They are read out of this
+// very process through the live backend, so every read goes to the kernel
+// and merging them shows in wall time as well as in the read count.
+static void BenchmarkSmallRegions(uint64_t seed, size_t maxThreads) {
+    const size_t kPage = 4096;
+    std::vector<char> memory = BuildCorpus(16 * 1024 * 1024 + kPage, seed);
+    uint64_t base = (reinterpret_cast<uintptr_t>(memory.data()) + kPage - 1) / kPage * kPage;
+    uint64_t end = reinterpret_cast<uintptr_t>(memory.data()) + memory.size();
+
+    std::vector<MemoryRegion> regions;
+    std::vector<ScanRange> ranges;
+    Random rng(seed);
+    for (uint64_t address = base; address + 4 * kPage <= end;) {
+        MemoryRegion region = {address, kPage * (1 + rng.Below(4)), MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE};
+        regions.push_back(region);
+        ScanRange range = {region.BaseAddress, region.RegionSize};
+        ranges.push_back(range);
+        address += region.RegionSize;
+        if (rng.Below(2)) {
+            MemoryRegion gap = {address, kPage, MEM_COMMIT, MEM_IMAGE, PAGE_READONLY};
+            regions.push_back(gap);
+            address += kPage;
+        }
+    }
+
+#ifdef _WIN32
+    DWORD self = GetCurrentProcessId();
+#else
+    DWORD self = static_cast<DWORD>(getpid());
+#endif
+    std::string error;
+    std::unique_ptr<MemorySource> live = OpenProcessMemorySource(self, error);
+    if (!live) {
+        std::cout << "\nSmall regions: " << error << std::endl;
+        return;
+    }
+    std::cout << "\nSmall regions (" << ranges.size() << " of 4 to 16 KB, read from this process):" << std::endl;
+
+    // The Linux backend takes a whole batch in one process_vm_readv call;
+    // without its ReadBatch, every request is a call of its own, as each
+    // ReadProcessMemory is on Windows
+    CopyingMemorySource perCall(*live);
+    struct Variant {
+        const char* name;
+        MemorySource* source;
+        bool merge;
+        size_t maxGap;      // With the region map
+    };
+    const Variant variants[] = {
+        {"regions/read", live.get(), false, 0},
+        {"regions/read-merged", live.get(), true, 0},
+        {"regions/percall", &perCall, false, 0},
+        {"regions/percall-merged", &perCall, true, 16 * 1024},
+    };
+
+    uint64_t scanBytes = 0;
+    for (const auto& range : ranges) scanBytes += range.size;
+    for (const Variant& variant : variants) {
+        ScanScheduler scheduler(maxThreads);
+        scheduler.SetReadMerging(variant.merge);
+        if (variant.maxGap) scheduler.SetRegionMap(regions, variant.maxGap);
+
+        StringStore store;
+        TelemetrySnapshot before = Telemetry::Capture();
+        Measurement extraction;
+        scheduler.Scan(ranges, *variant.source, store);
+        uint64_t occurrences = 0;
+        for (size_t id = 0; id < store.size(); id++) occurrences += store.Count(id);
+        PrintResult(extraction.Finish(std::string(variant.name) + "-" + std::to_string(maxThreads) + "t", scanBytes, occurrences, "strings"));
+
+        TelemetrySnapshot after = Telemetry::Capture();
+        uint64_t issued = after[Counter::ReadsIssued] - before[Counter::ReadsIssued];
+        uint64_t merged = after[Counter::ReadsMerged] - before[Counter::ReadsMerged];
+        std::cout << "    " << std::fixed << std::setprecision(1)
+                  << (after.PhaseSeconds(Phase::Read) - before.PhaseSeconds(Phase::Read)) * 1000.0 << " ms reading, "
+                  << issued << " reads for " << issued + merged << " requests" << std::endl;
+    }
+}
+
+// A sparse heap in this process: of 64 MB allocated, one page in eight
+// holds corpus data and one in eight is written with zeros; the rest is
+// never touched. Scanned reading every page, with the zero-page check, and
+// with the residency of the pages too.
+static bool BenchmarkSparseHeap(uint64_t seed, size_t maxThreads) {
+    const size_t kPage = MemorySource::kPageSize;
+    const size_t kSize = 64 * 1024 * 1024;
+    std::vector<char> corpus = BuildCorpus(kSize / 8, seed);
+    // Not initialized, so that the allocator's fresh mapping stays untouched
+    std::unique_ptr<char, void (*)(void*)> block(static_cast<char*>(std::malloc(kSize + kPage)), std::free);
+    uint64_t base = (reinterpret_cast<uintptr_t>(block.get()) + kPage - 1) / kPage * kPage;
+    char* heap = reinterpret_cast<char*>(static_cast<uintptr_t>(base));
+    for (size_t page = 0; page < kSize / kPage; page += 8) {
+        std::memcpy(heap + page * kPage, corpus.data() + page / 8 * kPage, kPage);
+        std::memset(heap + (page + 4) * kPage, 0, kPage);
+    }
+
+#ifdef _WIN32
+    DWORD self = GetCurrentProcessId();
+#else
+    DWORD self = static_cast<DWORD>(getpid());
+#endif
+    std::string error;
+    std::unique_ptr<MemorySource> live = OpenProcessMemorySource(self, error);
+    if (!live) {
+        std::cout << "\nSparse heap: " << error << std::endl;
+        return true;
+    }
+    std::cout << "\nSparse heap (" << FormatSize(kSize) << ", 1 page in 8 with data, read from this process):" << std::endl;
+
+    const ScanRange whole = {base, kSize};
+    std::vector<ScanRange> resident;
+    std::vector<uint8_t> residency;
+    uint64_t notResident = 0;
+    // On Windows this is the working set, which leaves paged-out pages out
+    // too; the heap was just written, so none of it is paged out yet
+    if (!AppendResidentRuns(*live, base, kSize, residency, resident, notResident, true)) {
+        std::cout << "  Residency not available from this backend" << std::endl;
+    }
+
+    struct Variant {
+        const char* name;
+        bool zeroCheck;
+        bool residency;
+    };
+    const Variant variants[] = {
+        {"sparse/all-pages", false, false},
+        {"sparse/zero-check", true, false},
+        {"sparse/resident", true, true},
+    };
+
+    bool allMatch = true;
+    StringStore expected;
+    for (const Variant& variant : variants) {
+        if (variant.residency && resident.empty()) continue;
+        std::vector<ScanRange> ranges = variant.residency ? resident : std::vector<ScanRange>(1, whole);
+        ScanScheduler scheduler(maxThreads);
+        scheduler.SetZeroPageCheck(variant.zeroCheck);
+
+        StringStore store;
+        TelemetrySnapshot before = Telemetry::Capture();
+        Measurement extraction;
+        scheduler.Scan(ranges, *live, store);
+        uint64_t occurrences = 0;
+        for (size_t id = 0; id < store.size(); id++) occurrences += store.Count(id);
+        PrintResult(extraction.Finish(std::string(variant.name) + "-" + std::to_string(maxThreads) + "t", kSize, occurrences, "strings"));
+
+        TelemetrySnapshot after = Telemetry::Capture();
+        // Every variant must find what reading every page finds
+        bool match = variant.zeroCheck ? SameStrings(store, expected) : true;
+        if (!variant.zeroCheck) expected = std::move(store);
+        allMatch = allMatch && match;
+        std::cout << "    " << FormatSize(after[Counter::BytesRead] - before[Counter::BytesRead]) << " read, "
+                  << FormatSize(scheduler.ZeroBytesSkipped()) << " of zero pages skipped"
+                  << (variant.residency ? ", " + FormatSize(notResident) + " not resident" : std::string())
+                  << (match ? "" : "  MISMATCH against reading every page") << std::endl;
+    }
+    return allMatch;
+}
+
+// A glibc malloc heap laid out in a buffer: chunks of 32 bytes to 4 KB
+// filled from the corpus, one in three of them free, and a top chunk.
+// Scanned without a heap walk, with one, and with one that keeps only the
+// text of live chunks; the walk must count the chunks as they were built.
+static bool BenchmarkHeapWalk(const std::vector<char>& corpus, size_t maxThreads) {
+    const uint64_t base = 0x20000000;
+    std::vector<char> heap(corpus.begin(), corpus.begin() + (std::min)(corpus.size(), static_cast<size_t>(64 * 1024 * 1024)));
+    size_t size = heap.size() / 4096 * 4096;
+    heap.resize(size);
+
+    Random rng(0x4EA9);
+    HeapWalkStats expected;
+    uint64_t offset = 0;
+    bool previousLive = true;
+    while (true) {
+        uint64_t chunk = 32 + 16 * rng.Below(rng.Below(8) == 0 ? 255 : 16);
+        if (offset + chunk + 64 > size) chunk = size - offset;
+        bool top = offset + chunk == size;
+        bool live = !top && (!previousLive || rng.Below(3) != 0);   // Free chunks are never adjacent
+        uint64_t header = chunk | (previousLive ? 1 : 0);
+        std::memcpy(heap.data() + offset + 8, &header, sizeof(header));
+        if (live) {
+            expected.liveBlocks++;
+            expected.liveBytes += chunk;
+        } else {
+            expected.freeBlocks++;
+            expected.freeBytes += chunk;
+            if (!top) std::memcpy(heap.data() + offset + chunk, &chunk, sizeof(chunk));
+        }
+        previousLive = live;
+        offset += chunk;
+        if (top) break;
+    }
+
+    std::vector<MemoryRegion> regions = {{base, size, MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE}};
+    BufferMemorySource mapped(heap.data(), regions, "heap");
+    CopyingMemorySource copied(mapped);
+    std::vector<ScanRange> ranges = {{base, size}};
+    std::vector<HeapSegment> segments = {{base, size, HeapKind::GlibcMalloc}};
+    std::cout << "\nHeap walk (" << FormatSize(size) << ", " << expected.liveBlocks + expected.freeBlocks << " chunks, "
+              << FormatSize(expected.freeBytes) << " free):" << std::endl;
+
+    bool allMatch = true;
+    const char* variants[] = {"heapwalk/none", "heapwalk/walk", "heapwalk/in-use-only"};
+    for (size_t v = 0; v < 3; v++) {
+        ScanScheduler scheduler(maxThreads);
+        HeapWalk walk(segments);
+        if (v > 0) scheduler.SetHeapWalk(&walk, v == 2);
+        StringStore store;
+        Measurement extraction;
+        scheduler.Scan(ranges, copied, store);
+        uint64_t occurrences = 0;
+        for (size_t id = 0; id < store.size(); id++) occurrences += store.Count(id);
+        PrintResult(extraction.Finish(std::string(variants[v]) + "-" + std::to_string(maxThreads) + "t", size, occurrences, "strings"));
+        if (v == 0) continue;
+
+        HeapWalkStats stats = walk.Stats();
+        bool match = stats.segmentsFailed == 0 && stats.liveBlocks == expected.liveBlocks && stats.liveBytes == expected.liveBytes &&
+                     stats.freeBlocks == expected.freeBlocks && stats.freeBytes == expected.freeBytes;
+        allMatch = allMatch && match;
+        std::cout << "    " << stats.liveBlocks << " live, " << stats.freeBlocks << " free, " << stats.headerReads
+                  << " headers read separately" << (match ? "" : "  MISMATCH against the chunks built") << std::endl;
+    }
+    return allMatch;
+}
+
+// A heap of page-sized content: runs of 1 to 16 pages of the usual corpus,
+// of random bytes (compressed data), of pointer tables, of small counters
+// (binary) and of zeros. Every kernel must profile each page as the scalar
+// one does. The scan with classification must keep what the full scan
+// finds in the text pages, while skipping the rest.
+static bool BenchmarkClassifier(uint64_t seed, size_t maxThreads) {
+    const size_t kPage = MemorySource::kPageSize;
+    const size_t kSize = 64 * 1024 * 1024;
+    enum Kind { TextPages, RandomPages, PointerPages, CounterPages, ZeroPages };
+    const PageClass expectedClass[] = {PageClass::Text, PageClass::Compressed, PageClass::Pointers, PageClass::Binary, PageClass::Zero};
+    const size_t weights[] = {3, 2, 1, 1, 1};
+
+    std::vector<char> corpus = BuildCorpus(kSize, seed);
+    std::vector<char> heap(kSize);
+    std::vector<int> kinds(kSize / kPage);
+    Random rng(seed ^ 0xC1A5);
+    for (size_t page = 0; page < kinds.size();) {
+        size_t roll = rng.Below(8);
+        int kind = 0;
+        while (roll >= weights[kind]) roll -= weights[kind++];
+        for (size_t end = (std::min)(kinds.size(), page + 1 + rng.Below(16)); page < end; page++) {
+            kinds[page] = kind;
+            char* bytes = heap.data() + page * kPage;
+            for (size_t i = 0; i < kPage; i += 8) {
+                uint64_t word = 0;
+                if (kind == RandomPages) word = rng.Next();
+                else if (kind == PointerPages) word = 0x00007FF000000000ull + (rng.Next() & 0xFFFFFFF8ull);
+                else if (kind == CounterPages) word = (rng.Next() & 0x1F) | ((rng.Next() & 0x1F) << 32);
+                std::memcpy(bytes + i, &word, sizeof(word));
+            }
+            if (kind == TextPages) std::memcpy(bytes, corpus.data() + page * kPage, kPage);
+        }
+    }
+    std::cout << "\nContent classifier (" << FormatSize(kSize) << ", runs of text, random, pointer, counter and zero pages):" << std::endl;
+
+    bool allMatch = true;
+    PageClassifier reference(ClassifierThresholds(), ScanKernel::Scalar);
+    const ScanKernel kernels[] = {ScanKernel::Scalar, ScanKernel::SSE2, ScanKernel::AVX2, ScanKernel::AVX512};
+    for (ScanKernel kernel : kernels) {
+        if (!TextScanner::IsKernelSupported(kernel)) continue;
+        PageClassifier classifier(ClassifierThresholds(), kernel);
+        size_t pages = 0;
+        bool match = true;
+        for (size_t page = 0; match && page < kinds.size(); page += 3, pages++) {
+            const char* bytes = heap.data() + page * kPage;
+            PageProfile a = classifier.Profile(bytes, kPage);
+            PageProfile b = reference.Profile(bytes, kPage);
+            match = a.printable == b.printable && a.zeros == b.zeros && a.pointers == b.pointers &&
+                    classifier.Classify(bytes, kPage) == reference.Classify(bytes, kPage);
+        }
+        allMatch = allMatch && match;
+        std::cout << "  " << std::left << std::setw(8) << TextScanner::KernelName(kernel) << std::right
+                  << (match ? "profiles match scalar on " + std::to_string(pages) + " pages" : std::string("MISMATCH against scalar"))
+                  << std::endl;
+    }
+
+    // Classifying alone against the text scan it saves
+    PageClassifier classifier;
+    TextScanner scanner;
+    PageClassCounts counts;
+    size_t misclassified = 0;
+    Measurement classifying;
+    for (size_t page = 0; page < kinds.size(); page++) {
+        const char* bytes = heap.data() + page * kPage;
+        PageClass pageClass = scanner.IsZero(bytes, kPage) ? PageClass::Zero : classifier.Classify(bytes, kPage);
+        counts[pageClass]++;
+        misclassified += pageClass != expectedClass[kinds[page]];
+    }
+    PrintResult(classifying.Finish("classify/pages", kSize, kinds.size(), "pages"));
+    std::vector<TextSpan> spans;
+    Measurement scanning;
+    for (size_t offset = 0; offset < kSize; offset += 64 * 1024) {
+        spans.clear();
+        scanner.Scan(heap.data() + offset, 64 * 1024, spans);
+    }
+    PrintResult(scanning.Finish("classify/scan-only", kSize, kinds.size(), "pages"));
+    std::cout << "    " << FormatPageClasses(counts) << "; " << misclassified << " pages not of the kind they were built as" << std::endl;
+
+    std::vector<MemoryRegion> regions = {{0x30000000, kSize, MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE}};
+    BufferMemorySource mapped(heap.data(), regions, "classified");
+    std::vector<ScanRange> ranges = {{0x30000000, kSize}};
+    StringStore full;
+    for (int pass = 0; pass < 2; pass++) {
+        ScanScheduler scheduler(maxThreads);
+        if (pass) scheduler.SetPageClassifier(&classifier);
+        StringStore store;
+        std::vector<PageClassCounts> classes;
+        Measurement extraction;
+        scheduler.Scan(ranges, mapped, store, nullptr, nullptr, nullptr, &classes);
+        uint64_t occurrences = 0;
+        for (size_t id = 0; id < store.size(); id++) occurrences += store.Count(id);
+        PrintResult(extraction.Finish(std::string(pass ? "classify/on-" : "classify/off-") + std::to_string(maxThreads) + "t",
+                                      kSize, occurrences, "strings"));
+        if (!pass) {
+            full = std::move(store);
+            continue;
+        }
+        std::vector<std::string> missing = MissingStrings(full, store);
+        std::cout << "    " << FormatSize(scheduler.ClassifiedBytesSkipped()) << " not text skipped, " << missing.size() << " of " << full.size()
+                  << " strings missing; pages " << FormatPageClasses(classes[0])
+                  << std::endl;
+    }
+
+    // Mostly-zero pages that hold a short UTF-16 string or two among a few
+    // counters, between pages of counters alone: the counter pages are
+    // skipped, and every string must still be found
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789_";
+    const size_t kSparseSize = 4 * 1024 * 1024;
+    std::vector<char> sparse(kSparseSize);
+    for (size_t page = 0; page < kSparseSize / kPage; page++) {
+        char* bytes = sparse.data() + page * kPage;
+        for (size_t i = 0; i < 16; i++) {
+            uint64_t word = (rng.Next() & 0x1F) | ((rng.Next() & 0x1F) << 32);
+            std::memcpy(bytes + kPage / 2 + rng.Below(kPage / 16) * 8, &word, sizeof(word));
+        }
+        if (page % 4 == 3) continue;
+        for (size_t string = 0, strings = 1 + rng.Below(2); string < strings; string++) {
+            char* text = bytes + string * kPage / 4 + rng.Below(kPage / 16) * 2;
+            for (size_t i = 0, length = 4 + rng.Below(9); i < length; i++) text[2 * i] = alphabet[rng.Below(sizeof(alphabet) - 1)];
+        }
+    }
+    std::vector<MemoryRegion> sparseRegions = {{0x40000000, kSparseSize, MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE}};
+    BufferMemorySource sparseSource(sparse.data(), sparseRegions, "sparse");
+    std::vector<ScanRange> sparseRanges = {{0x40000000, kSparseSize}};
+    StringStore sparseFull, sparseClassified;
+    std::vector<PageClassCounts> sparseClasses;
+    ScanScheduler(maxThreads).Scan(sparseRanges, sparseSource, sparseFull);
+    ScanScheduler sparseScheduler(maxThreads);
+    sparseScheduler.SetPageClassifier(&classifier);
+    sparseScheduler.Scan(sparseRanges, sparseSource, sparseClassified, nullptr, nullptr, nullptr, &sparseClasses);
+    size_t sparseMissing = MissingStrings(sparseFull, sparseClassified).size();
+    allMatch = allMatch && sparseMissing == 0;
+    std::cout << "  mostly-zero pages: " << sparseMissing << " of " << sparseFull.size() << " strings missing with --classify; pages "
+              << FormatPageClasses(sparseClasses[0]) << (sparseMissing ? "  MISMATCH against unclassified scan" : "") << std::endl;
+    return allMatch;
+}
+
+// Sweeps the corpus for pointers into a process-like spread of regions:
+// one low, as an executable mapped at 4 MB is, and many where the corpus's
+// pointer tables point. Each kernel must find what a binary search of every
+// word finds; plain reads of the corpus give the speed to aim for.
+static bool BenchmarkReferences(const std::vector<char>& corpus, size_t maxThreads) {
+    std::vector<MemoryRegion> regions = {{0x400000, 1024 * 1024, MEM_COMMIT, MEM_IMAGE, PAGE_READONLY}};
+    for (uint64_t r = 0; r < 256; r++) {
+        regions.push_back({0x00007FF000000000ull + r * 16 * 1024 * 1024, 8 * 1024 * 1024, MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE});
+    }
+    RegionIndex index(regions);
+    const size_t kPiece = 1024 * 1024;
+    const uint64_t base = 0x20000000;
+    std::cout << "\nPointer sweep (" << FormatSize(corpus.size()) << ", " << regions.size() << " target regions):" << std::endl;
+
+    Measurement reading;
+    uint64_t sum = 0;
+    for (size_t offset = 0; offset + 8 <= corpus.size(); offset += 8) {
+        uint64_t word;
+        std::memcpy(&word, corpus.data() + offset, 8);
+        sum += word;
+    }
+    PrintResult(reading.Finish("references/read-only", corpus.size(), corpus.size() / 8, "words"));
+
+    std::vector<Reference> expected;
+    Measurement searching;
+    for (size_t offset = 0; offset + 8 <= corpus.size(); offset += 8) {
+        uint64_t word;
+        std::memcpy(&word, corpus.data() + offset, 8);
+        uint32_t region = index.Find(word);
+        if (region == RegionIndex::kNone) continue;
+        Reference reference = {base + offset, word, 0, region, StringStore::kInvalidId};
+        expected.push_back(reference);
+    }
+    PrintResult(searching.Finish("references/search-all", corpus.size(), corpus.size() / 8, "words"));
+
+    bool allMatch = true;
+    const ScanKernel kernels[] = {ScanKernel::Scalar, ScanKernel::SSE2, ScanKernel::AVX2, ScanKernel::AVX512};
+    for (ScanKernel kernel : kernels) {
+        if (!TextScanner::IsKernelSupported(kernel)) continue;
+        ReferenceScanner scanner(kernel);
+        std::vector<Reference> found;
+        found.reserve(expected.size());
+        size_t candidates = 0;
+        Measurement sweeping;
+        for (size_t offset = 0; offset < corpus.size(); offset += kPiece) {
+            candidates += scanner.Sweep(index, corpus.data() + offset, (std::min)(kPiece, corpus.size() - offset), base + offset, found);
+        }
+        PrintResult(sweeping.Finish(std::string("references/") + TextScanner::KernelName(kernel), corpus.size(), corpus.size() / 8, "words"));
+        bool match = found.size() == expected.size();
+        for (size_t i = 0; match && i < found.size(); i++) {
+            match = found[i].source == expected[i].source && found[i].target == expected[i].target &&
+                    found[i].targetRegion == expected[i].targetRegion;
+        }
+        allMatch = allMatch && match;
+        std::cout << "    " << candidates << " words in the span, " << found.size() << " pointers"
+                  << (match ? "" : " (MISMATCH against the binary search)") << std::endl;
+    }
+
+    // The sweep riding along a scan, against the scan alone
+    std::vector<MemoryRegion> source = {{base, corpus.size(), MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE}};
+    BufferMemorySource mapped(corpus.data(), source, "pointers");
+    std::vector<ScanRange> ranges = {{base, corpus.size()}};
+    for (int pass = 0; pass < 2; pass++) {
+        ScanScheduler scheduler(maxThreads);
+        if (pass) scheduler.SetReferenceIndex(&index);
+        StringStore store;
+        std::vector<Reference> references;
+        Measurement scanning;
+        scheduler.Scan(ranges, mapped, store, nullptr, nullptr, nullptr, nullptr, &references);
+        PrintResult(scanning.Finish(std::string(pass ? "references/scan-on-" : "references/scan-off-") + std::to_string(maxThreads) + "t",
+                                    corpus.size(), store.size(), "strings"));
+        if (pass && references.size() != expected.size()) {
+            std::cout << "    " << references.size() << " pointers from the scan, " << expected.size() << " expected" << std::endl;
+            allMatch = false;
+        }
+    }
+    // Keeps the plain read from being optimized away
+    if (sum == 0x5EED) std::cout << "    " << sum << std::endl;
+    return allMatch;
+}
+
+// Appends many scans' worth of segments to an index, then times opening it
+// and substring queries against a brute-force search of the same strings.
+static bool BenchmarkIndex(uint64_t seed) {
+    const size_t kSegments = 200;
+    const size_t kStringsEach = 2000;
+    const char* path = "heap_bench_index.tmp";
+    std::remove(path);
+    std::vector<std::string> pool = BuildStrings(kSegments * kStringsEach / 4, seed ^ 0x1D3);
+    std::vector<MemoryRegion> regions = {{0x40000000, 64 * 1024 * 1024, MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE}};
+    std::cout << "\nString index (" << kSegments << " segments of " << kStringsEach << " strings):" << std::endl;
+
+    // Consecutive scans share most of their strings, as passes of one process do
+    std::vector<StringStore> segments(kSegments);
+    std::vector<TextOccurrence> occurrences;
+    Random rng(seed ^ 0x1D4);
+    Measurement appending;
+    uint64_t strings = 0;
+    for (size_t s = 0; s < kSegments; s++) {
+        StringStore& store = segments[s];
+        occurrences.clear();
+        size_t first = s * pool.size() / (kSegments * 2);
+        for (size_t i = 0; i < kStringsEach; i++) {
+            uint64_t address = 0x40000000 + rng.Below(64 * 1024 * 1024);
+            const std::string& text = pool[first + rng.Below(pool.size() / 2)];
+            uint32_t id = store.Intern(text, address);
+            occurrences.push_back(TextOccurrence{address, static_cast<uint32_t>(text.size()), id});
+        }
+        strings += store.size();
+        StringIndexWriter writer;
+        std::string error;
+        if (!writer.Open(path, error) || !writer.Append("bench", static_cast<uint32_t>(s), regions, store, occurrences, error)) {
+            std::cout << "  " << error << std::endl;
+            std::remove(path);
+            return false;
+        }
+    }
+    PrintResult(appending.Finish("index/append", 0, strings, "strings"));
+
+    StringIndex index;
+    std::string error;
+    Measurement opening;
+    bool opened = index.Open(path, error);
+    PrintResult(opening.Finish("index/open", 0, index.Segments().size(), "segments"));
+    if (!opened || index.Segments().size() != kSegments) {
+        std::cout << "  " << (opened ? "Segments missing from the index" : error) << std::endl;
+        std::remove(path);
+        return false;
+    }
+
+    // Queries cut from pool strings, some too short for trigrams
+    std::vector<std::string> queries;
+    for (size_t q = 0; q < 200; q++) {
+        const std::string& text = pool[rng.Below(pool.size())];
+        size_t length = (std::min)(text.size(), static_cast<size_t>(q % 20 == 0 ? 2 : 4 + rng.Below(6)));
+        queries.push_back(text.substr(rng.Below(text.size() - length + 1), length));
+    }
+    std::vector<uint32_t> ids;
+    std::vector<uint32_t> scratch;
+    uint64_t found = 0;
+    Measurement querying;
+    for (const auto& query : queries) {
+        for (const auto& segment : index.Segments()) {
+            ids.clear();
+            segment.Find(query, ids, scratch);
+            found += ids.size();
+        }
+    }
+    double querySeconds = querying.Finish("index/query", 0, queries.size(), "queries").seconds;
+    PrintResult(results.back());
+
+    uint64_t expected = 0;
+    Measurement scanning;
+    for (const auto& query : queries) {
+        for (const auto& store : segments) {
+            for (size_t id = 0; id < store.size(); id++) expected += store[id].find(query) != std::string_view::npos;
+        }
+    }
+    double scanSeconds = scanning.Finish("index/brute-force", 0, queries.size(), "queries").seconds;
+    PrintResult(results.back());
+    std::cout << "    " << FormatSize(index.SizeBytes()) << " on disk, " << std::fixed << std::setprecision(3)
+              << querySeconds * 1000.0 / queries.size() << " ms per query (brute force: " << scanSeconds * 1000.0 / queries.size()
+              << " ms), " << found << " matches (brute force: " << expected << ")" << std::endl;
+    std::remove(path);
+    return found == expected;
+}
+
+// One object per run, one line per result, so runs of different commits
+// can be compared with any JSON tool (or diff).
+static bool WriteResultsJson(const std::string& path, size_t corpusMB, size_t maxThreads, uint64_t seed, const ContentMix& mix) {
+    std::ofstream file(path);
+    if (!file.is_open()) return false;
+
+    file << "{\n";
+    file << "  \"corpusMB\": " << corpusMB << ",\n";
+    file << "  \"threads\": " << maxThreads << ",\n";
+    file << "  \"seed\": " << seed << ",\n";
+    file << "  \"mix\": \"" << FormatContentMix(mix) << "\",\n";
+    file << "  \"kernel\": \"" << TextScanner::KernelName(TextScanner::DetectBestKernel()) << "\",\n";
+    file << "  \"results\": [\n";
+    file << std::fixed << std::setprecision(6);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+        file << "    {\"name\": \"" << result.name << "\", \"seconds\": " << result.seconds
+             << ", \"bytes\": " << result.bytes
+             << ", \"mbPerSecond\": " << result.bytes / (1024.0 * 1024.0) / result.seconds
+             << ", \"items\": " << result.items << ", \"unit\": \"" << result.unit << "\""
+             << ", \"itemsPerSecond\": " << result.items / result.seconds
+             << ", \"allocations\": " << result.allocations << ", \"allocatedBytes\": " << result.allocatedBytes
+             << ", \"peakMemoryBytes\": " << result.peakMemory << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n";
+    file << "}\n";
+    return file.good();
+}
+
+static void PrintUsage() {
+    std::cout << "Usage: heap_bench [options] [corpus size in MB] [threads]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --json FILE                    Also write every measurement to FILE as JSON" << std::endl;
+    std::cout << "  --mix KIND=WEIGHT,...          Content mix of the synthetic memory; kinds are utf16, ascii," << std::endl;
+    std::cout << "                                 zeros, random, pointers and zeropages (default: "
+              << FormatContentMix(ContentMix()) << ")" << std::endl;
+    std::cout << "  --seed N                       Seed of the synthetic memory (default: 24301)" << std::endl;
+    std::cout << "  --write-image IMAGE MANIFEST   Save the synthetic memory as a dump for heap_extractor --dump" << std::endl;
+}
+
+// Regions of text (corpus slices) shuffled among regions of random bytes,
+// and one large region of random bytes with a corpus page in sixteen. A
+// budgeted scan with no limit must find what the plain scan finds; with a
+// part of the bytes, it should find more of the strings than the same
+// bytes taken in address order.
+static bool BenchmarkBudget(uint64_t seed, size_t maxThreads) {
+    const size_t kPage = MemorySource::kPageSize;
+    const size_t kRegion = 1024 * 1024;
+    const size_t kLarge = 48 * 1024 * 1024;
+    std::vector<char> corpus = BuildCorpus(16 * kRegion, seed);
+    Random rng(seed ^ 0xB0D6);
+
+    std::vector<bool> textRegion(80, false);
+    for (size_t i = 0; i < 16; i++) textRegion[i] = true;
+    for (size_t i = textRegion.size(); i-- > 1;) {
+        size_t j = rng.Below(i + 1);
+        bool swapped = textRegion[i];
+        textRegion[i] = textRegion[j];
+        textRegion[j] = swapped;
+    }
+    std::vector<MemoryRegion> regions;
+    std::vector<ScanRange> ranges;
+    std::vector<char> memory;
+    uint64_t address = 0x40000000;
+    size_t textCopied = 0;
+    auto fillRandom = [&](size_t size) {
+        for (size_t i = 0; i < size; i += 8) {
+            uint64_t word = rng.Next();
+            memory.insert(memory.end(), reinterpret_cast<const char*>(&word), reinterpret_cast<const char*>(&word) + 8);
+        }
+    };
+    for (size_t i = 0; i <= textRegion.size(); i++) {
+        size_t size = i == textRegion.size() ? kLarge : kRegion;
+        if (i == textRegion.size()) {
+            for (size_t page = 0; page < kLarge / kPage; page++) {
+                if (page % 16 == 5) {
+                    memory.insert(memory.end(), corpus.begin() + page * kPage % corpus.size(),
+                                  corpus.begin() + page * kPage % corpus.size() + kPage);
+                } else {
+                    fillRandom(kPage);
+                }
+            }
+        } else if (textRegion[i]) {
+            memory.insert(memory.end(), corpus.begin() + textCopied, corpus.begin() + textCopied + kRegion);
+            textCopied += kRegion;
+        } else {
+            fillRandom(kRegion);
+        }
+        regions.push_back({address, size, MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE});
+        ranges.push_back({address, size});
+        address += size + 16 * kPage;
+    }
+    BufferMemorySource source(memory.data(), regions, "budget");
+    std::vector<const MemoryRegion*> rangeRegion;
+    for (const auto& region : regions) rangeRegion.push_back(&region);
+    std::cout << "\nBudgeted scan (" << FormatSize(memory.size()) << ": 16 text regions among 64 random ones, and "
+              << FormatSize(kLarge) << " of random bytes with one text page in 16):" << std::endl;
+
+    ScanScheduler scheduler(maxThreads);
+    StringStore full;
+    Measurement plain;
+    scheduler.Scan(ranges, source, full);
+    PrintResult(plain.Finish("budget/none-" + std::to_string(maxThreads) + "t", memory.size(), full.size(), "strings"));
+
+    std::ostringstream progress;
+    StringStore budgeted;
+    ScanBudget unlimited(0, 0);
+    Measurement prioritized;
+    ScanCoverage coverage = BudgetedScan(scheduler, unlimited).Scan(ranges, rangeRegion, source, budgeted, nullptr, nullptr,
+                                                                    nullptr, nullptr, progress);
+    PrintResult(prioritized.Finish("budget/unlimited-" + std::to_string(maxThreads) + "t", memory.size(), budgeted.size(), "strings"));
+    bool match = coverage.scannedBytes == memory.size() && MissingStrings(full, budgeted).empty() &&
+                 MissingStrings(budgeted, full).empty();
+    std::cout << "    " << (match ? "same strings as the plain scan" : "MISMATCH against the plain scan") << " in "
+              << coverage.batches << " batches" << std::endl;
+
+    for (uint64_t percent : {5, 10, 25, 50}) {
+        uint64_t bytes = memory.size() * percent / 100;
+        StringStore first;
+        ScanBudget budget(0, bytes);
+        BudgetedScan(scheduler, budget).Scan(ranges, rangeRegion, source, first, nullptr, nullptr, nullptr, nullptr, progress);
+
+        std::vector<ScanRange> leading;
+        for (uint64_t left = bytes; left && leading.size() < ranges.size(); left -= leading.back().size) {
+            leading.push_back(ranges[leading.size()]);
+            leading.back().size = (std::min)(leading.back().size, left);
+        }
+        StringStore inOrder;
+        scheduler.Scan(leading, source, inOrder);
+        std::cout << "    " << std::setw(2) << percent << "% of the bytes: " << std::setprecision(1)
+                  << first.size() * 100.0 / full.size() << "% of the strings by priority, "
+                  << inOrder.size() * 100.0 / full.size() << "% in address order" << std::endl;
+    }
+    return match;
+}
+
+int main(int argc, char* argv[]) {
+    size_t corpusMB = 64;
+    size_t maxThreads = std::thread::hardware_concurrency();
+    uint64_t seed = 0x5EED;
+    ContentMix mix;
+    std::string jsonPath;
+    std::string imagePath;
+    std::string manifestPath;
+    int positional = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--mix" && i + 1 < argc) {
+            std::string error;
+            if (!ParseContentMix(argv[++i], mix, error)) {
+                std::cout << error << std::endl;
+                return 1;
+            }
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], NULL, 0);
+        } else if (arg == "--write-image" && i + 2 < argc) {
+            imagePath = argv[++i];
+            manifestPath = argv[++i];
+        } else if (arg.compare(0, 2, "--") == 0 || arg == "-h") {
+            PrintUsage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        } else if (positional++ == 0) {
+            corpusMB = static_cast<size_t>(std::atoi(argv[i]));
+        } else {
+            maxThreads = static_cast<size_t>(std::atoi(argv[i]));
+        }
+    }
+    if (corpusMB == 0) corpusMB = 64;
+    if (maxThreads == 0) maxThreads = 1;
+
+    std::cout << "Heap Extractor Benchmark" << std::endl;
+    std::cout << "========================" << std::endl;
+    std::cout << "Building " << corpusMB << " MB corpus (seed " << seed << ", " << FormatContentMix(mix) << ")..." << std::endl;
+    // The corpus is the readable memory of the synthetic image
+    SyntheticImage image = BuildSyntheticImage(corpusMB * 1024 * 1024, seed, mix);
+    const std::vector<char>& corpus = image.bytes;
+
+    if (!imagePath.empty()) {
+        BufferMemorySource source(image.bytes.data(), image.bytes.size(), image.regions, image.offsets, "synthetic");
+        std::string error;
+        if (!WriteMemoryDump(source, imagePath, manifestPath, error)) {
+            std::cout << error << std::endl;
+            return 1;
+        }
+        std::cout << "Image written to: " << imagePath << " (manifest: " << manifestPath << ")" << std::endl;
+    }
+    const ScanKernel kernels[] = {ScanKernel::Scalar, ScanKernel::SSE2, ScanKernel::AVX2, ScanKernel::AVX512};
+
+    std::cout << "\nVerifying kernels against the reference heuristic..." << std::endl;
+    std::vector<char> verifyCorpus(corpus.begin(), corpus.begin() + (std::min)(corpus.size(), static_cast<size_t>(8 * 1024 * 1024)));
+    bool allMatch = true;
+    for (ScanKernel kernel : kernels) {
+        if (!TextScanner::IsKernelSupported(kernel)) {
+            std::cout << "  " << std::left << std::setw(8) << TextScanner::KernelName(kernel)
+                      << "not supported on this CPU" << std::endl;
+            continue;
+        }
+        allMatch = VerifyKernel(kernel, verifyCorpus) && allMatch;
+    }
+
+    std::cout << "\nUTF-16 scan throughput (64 KB slices):" << std::endl;
+    std::vector<std::string> texts;
+    double referenceRate = MeasureThroughput(corpus, 1, [&](const char* data, size_t size) {
+        texts.clear();
+        ScanTextReference(data, size, texts);
+    });
+    std::cout << "  " << std::left << std::setw(10) << "reference"
+              << std::right << std::fixed << std::setprecision(1) << std::setw(10) << referenceRate << " MB/s" << std::endl;
+
+    for (ScanKernel kernel : kernels) {
+        if (!TextScanner::IsKernelSupported(kernel)) continue;
+        TextScanner scanner(kernel);
+        std::vector<TextSpan> spans;
+        uint64_t strings = 0;
+        Measurement measurement;
+        double rate = MeasureThroughput(corpus, 5, [&](const char* data, size_t size) {
+            spans.clear();
+            scanner.Scan(data, size, spans);
+            strings += spans.size();
+        });
+        measurement.Finish(std::string("scan/") + TextScanner::KernelName(kernel), corpus.size() * 5, strings, "strings");
+        std::cout << "  " << std::left << std::setw(10) << TextScanner::KernelName(kernel)
+                  << std::right << std::fixed << std::setprecision(1) << std::setw(10) << rate << " MB/s"
+                  << "  (" << std::setprecision(1) << rate / referenceRate << "x)" << std::endl;
+    }
+
+    allMatch = BenchmarkScheduler(corpus, maxThreads) && allMatch;
+    allMatch = BenchmarkPatterns(corpus) && allMatch;
+    allMatch = BenchmarkSnapshots(corpus, maxThreads) && allMatch;
+    BenchmarkImage(image, maxThreads);
+    BenchmarkSmallRegions(seed, maxThreads);
+    allMatch = BenchmarkSparseHeap(seed, maxThreads) && allMatch;
+    allMatch = BenchmarkHeapWalk(corpus, maxThreads) && allMatch;
+    allMatch = BenchmarkClassifier(seed, maxThreads) && allMatch;
+    allMatch = BenchmarkReferences(corpus, maxThreads) && allMatch;
+    allMatch = BenchmarkIndex(seed) && allMatch;
+    allMatch = BenchmarkBudget(seed, maxThreads) && allMatch;
+    BenchmarkDedup();
+
+    if (!jsonPath.empty()) {
+        if (!WriteResultsJson(jsonPath, corpusMB, maxThreads, seed, mix)) {
+            std::cout << "Failed to write " << jsonPath << std::endl;
+            return 1;
+        }
+        std::cout << "\nResults written to: " << jsonPath << std::endl;
+    }
+    return allMatch ? 0 : 1;
+}
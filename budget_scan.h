@@ -0,0 +1,376 @@
+#pragma once
+
+// Budgeted, prioritized text extraction.
+//
+// With a time or byte budget, the ranges of a process are not scanned in
+// address order but by a cheap score of how likely they are to hold text:
+// their type and protection, their size, and the share of UTF-16 text in a
+// few 512-byte probes read from each. Ranges up to 4 MB are scanned whole
+// in score order; larger ones first get eight evenly spaced 256 KB samples,
+// and the rest of them is filled in once every range has been sampled.
+//
+// The plan is scanned in batches through the ScanScheduler. Each window of a
+// batch is read with 16 KB around it, as far as its memory runs on, so that
+// strings crossing its edges come out whole, and a string counts only for
+// the window it starts in. That way every string is found once no matter
+// the order, except for strings longer than the 16 KB of lookbehind, which
+// a window may cut. The budget is checked between batches, so a run stops
+// within one batch of it, with what it found so far and how much of the
+// memory that was.
+
+#include "heap_report.h"
+#include "memory_source.h"
+#include "scan_scheduler.h"
+#include "string_store.h"
+#include "telemetry.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Time and bytes a run may spend, shared by the processes of a batch
+class ScanBudget {
+public:
+    // 0 leaves either unlimited
+    ScanBudget(double seconds, uint64_t bytes)
+        : start(std::chrono::steady_clock::now()), seconds(seconds), bytesLeft(bytes), limitBytes(bytes != 0) {}
+
+    double Elapsed() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool TimeUp() const { return seconds > 0 && Elapsed() >= seconds; }
+    bool BytesUp() const { return limitBytes && bytesLeft.load() == 0; }
+    bool Expired() const { return TimeUp() || BytesUp(); }
+
+    // Takes up to wanted bytes out of the budget and returns how many
+    uint64_t Reserve(uint64_t wanted) {
+        if (!limitBytes) return wanted;
+        uint64_t left = bytesLeft.load();
+        uint64_t granted;
+        do {
+            granted = (std::min)(left, wanted);
+        } while (!bytesLeft.compare_exchange_weak(left, left - granted));
+        return granted;
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+    double seconds;
+    std::atomic<uint64_t> bytesLeft;
+    bool limitBytes;
+};
+
+// How much of the planned memory a budgeted scan got through
+struct ScanCoverage {
+    uint64_t plannedBytes = 0;
+    uint64_t scannedBytes = 0;
+    size_t ranges = 0;
+    size_t rangesComplete = 0;
+    size_t rangesSampled = 0;       // Scanned in part
+    size_t batches = 0;
+    double seconds = 0;
+    const char* stopReason = nullptr;   // "time budget" or "byte budget"; nullptr when finished
+
+    double Percent() const { return plannedBytes ? scannedBytes * 100.0 / plannedBytes : 100.0; }
+};
+
+// "210.0 MB of 512.0 MB (41.0%), 130 of 415 ranges complete, 12 sampled; stopped by the time budget"
+inline std::string FormatCoverage(const ScanCoverage& coverage) {
+    std::ostringstream out;
+    out << FormatSize(coverage.scannedBytes) << " of " << FormatSize(coverage.plannedBytes) << " (" << std::fixed
+        << std::setprecision(1) << coverage.Percent() << "%), " << coverage.rangesComplete << " of "
+        << coverage.ranges << " ranges complete, " << coverage.rangesSampled << " sampled";
+    if (coverage.stopReason) out << "; stopped by the " << coverage.stopReason;
+    return out.str();
+}
+
+// A part of a range in the scan plan
+struct ScanWindow {
+    uint64_t address;
+    uint64_t size;
+    size_t range;
+    double score;
+    int pass;       // 0: small ranges whole and samples of large ones; 1: the rest of the large ones
+};
+
+class BudgetedScan : private ScanListener {
+public:
+    static constexpr uint64_t kSampledAbove = 4 * 1024 * 1024;
+    static constexpr uint64_t kSampleBytes = 256 * 1024;
+    static constexpr size_t kSamplesPerRange = 8;
+    static constexpr size_t kProbesPerRange = 4;
+    static constexpr size_t kProbeBytes = 512;
+    static constexpr uint64_t kMinBatchBytes = 8 * 1024 * 1024;
+
+    BudgetedScan(ScanScheduler& scheduler, ScanBudget& budget) : scheduler(scheduler), budget(budget) {}
+
+    // Share of the bytes that are UTF-16 text: printable ASCII followed by
+    // a zero, counted on even offsets
+    static double TextDensity(const char* data, size_t size) {
+        size_t pairs = size / 2;
+        if (pairs == 0) return 0;
+        size_t text = 0;
+        for (size_t i = 0; i + 1 < size; i += 2) {
+            text += data[i] >= 0x20 && data[i] <= 0x7E && data[i + 1] == 0;
+        }
+        return static_cast<double>(text) / pairs;
+    }
+
+    // Heaps and stacks before mapped views, writable memory before
+    // read-only, and mid-sized regions before tiny or huge ones; the
+    // sampled text density counts most, with a floor so that no region
+    // scores zero
+    static double Score(const MemoryRegion& region, uint64_t size, double density) {
+        double score = 0.02 + density;
+        if (region.Type != MEM_PRIVATE) score *= 0.5;
+        bool writable = (region.Protect & PAGE_READWRITE) || (region.Protect & PAGE_WRITECOPY) ||
+                        (region.Protect & PAGE_EXECUTE_READWRITE);
+        if (!writable) score *= 0.5;
+        if (size < 64 * 1024 || size > 256ull * 1024 * 1024) score *= 0.5;
+        return score;
+    }
+
+    // Scores every range from probes spread over it, read in one batch.
+    // region[r] is the region range r lies in.
+    static std::vector<double> ScoreRanges(MemorySource& source, const std::vector<ScanRange>& ranges,
+                                           const std::vector<const MemoryRegion*>& region) {
+        std::vector<ReadRequest> requests;
+        std::vector<char> buffer(ranges.size() * kProbesPerRange * kProbeBytes);
+        std::vector<size_t> firstProbe(ranges.size() + 1, 0);
+        for (size_t r = 0; r < ranges.size(); r++) {
+            firstProbe[r] = requests.size();
+            uint64_t size = ranges[r].size;
+            size_t probes = size <= kProbeBytes ? 1 : kProbesPerRange;
+            for (size_t p = 0; p < probes; p++) {
+                ReadRequest request;
+                uint64_t offset = probes == 1 ? 0 : (size - kProbeBytes) * p / (probes - 1);
+                request.address = ranges[r].address + (offset & ~static_cast<uint64_t>(1));
+                request.buffer = buffer.data() + requests.size() * kProbeBytes;
+                request.size = static_cast<size_t>((std::min)(size, static_cast<uint64_t>(kProbeBytes)));
+                request.bytesRead = 0;
+                requests.push_back(request);
+            }
+        }
+        firstProbe[ranges.size()] = requests.size();
+
+        auto start = std::chrono::steady_clock::now();
+        source.ReadBatch(requests.data(), requests.size());
+        Telemetry::AddReadCall(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+        for (const auto& request : requests) Telemetry::AddReadRequest(request.size, request.bytesRead);
+
+        std::vector<double> scores(ranges.size());
+        for (size_t r = 0; r < ranges.size(); r++) {
+            double density = 0;
+            for (size_t p = firstProbe[r]; p < firstProbe[r + 1]; p++) {
+                density += TextDensity(requests[p].buffer, requests[p].bytesRead);
+            }
+            density /= (std::max)(firstProbe[r + 1] - firstProbe[r], static_cast<size_t>(1));
+            scores[r] = Score(*region[r], ranges[r].size, density);
+        }
+        return scores;
+    }
+
+    // The windows ranges are scanned in: the first pass by score, then the
+    // second by score. Samples are page-aligned.
+    static std::vector<ScanWindow> PlanWindows(const std::vector<ScanRange>& ranges, const std::vector<double>& scores) {
+        std::vector<ScanWindow> windows;
+        for (size_t r = 0; r < ranges.size(); r++) {
+            const ScanRange& range = ranges[r];
+            if (range.size <= kSampledAbove) {
+                windows.push_back(ScanWindow{range.address, range.size, r, scores[r], 0});
+                continue;
+            }
+            uint64_t end = range.address + range.size;
+            uint64_t filled = range.address;
+            for (size_t s = 0; s < kSamplesPerRange; s++) {
+                uint64_t at = range.address + (range.size - kSampleBytes) * s / (kSamplesPerRange - 1);
+                at = (std::max)(filled, at & ~(MemorySource::kPageSize - 1));
+                uint64_t sampleEnd = (std::min)(end, at + kSampleBytes);
+                if (at > filled) windows.push_back(ScanWindow{filled, at - filled, r, scores[r], 1});
+                if (sampleEnd > at) windows.push_back(ScanWindow{at, sampleEnd - at, r, scores[r], 0});
+                filled = (std::max)(filled, sampleEnd);
+            }
+            if (end > filled) windows.push_back(ScanWindow{filled, end - filled, r, scores[r], 1});
+        }
+        std::stable_sort(windows.begin(), windows.end(), [](const ScanWindow& a, const ScanWindow& b) {
+            return a.pass != b.pass ? a.pass < b.pass : a.score > b.score;
+        });
+        return windows;
+    }
+
+    // Scans ranges, sorted by address, in the order of PlanWindows until
+    // the budget runs out. region[r] is the region range r lies in. Like
+    // ScanScheduler::Scan, strings go to texts, or to the scheduler's
+    // listener if it has one, with range indices into ranges; but they come
+    // in plan order, and hits, occurrences and references are sorted by
+    // address only once the scan is over. Progress goes to log after every
+    // batch.
+    ScanCoverage Scan(const std::vector<ScanRange>& ranges, const std::vector<const MemoryRegion*>& region,
+                      MemorySource& source, StringStore& texts, std::vector<size_t>* newTextsPerRange,
+                      std::vector<PatternHit>* hits, std::vector<TextOccurrence>* occurrences,
+                      std::vector<Reference>* references, std::ostream& log) {
+        ScanCoverage coverage;
+        coverage.ranges = ranges.size();
+        for (const auto& range : ranges) coverage.plannedBytes += range.size;
+        if (newTextsPerRange) newTextsPerRange->assign(ranges.size(), 0);
+        std::vector<uint64_t> scanned(ranges.size(), 0);
+        double started = budget.Elapsed();
+
+        // Ranges that run on into each other are read as one stream
+        std::vector<uint64_t> streamStart(ranges.size()), streamEnd(ranges.size());
+        for (size_t r = 0; r < ranges.size(); r++) {
+            bool continues = r > 0 && ranges[r - 1].address + ranges[r - 1].size == ranges[r].address;
+            streamStart[r] = continues ? streamStart[r - 1] : ranges[r].address;
+        }
+        for (size_t r = ranges.size(); r-- > 0;) {
+            bool continues = r + 1 < ranges.size() && ranges[r].address + ranges[r].size == ranges[r + 1].address;
+            streamEnd[r] = continues ? streamEnd[r + 1] : ranges[r].address + ranges[r].size;
+        }
+
+        // A budget spent on earlier scans leaves nothing to plan
+        std::vector<ScanWindow> plan;
+        if (!budget.Expired()) plan = PlanWindows(ranges, ScoreRanges(source, ranges, region));
+        uint64_t batchBytes = (std::max)(kMinBatchBytes, static_cast<uint64_t>(scheduler.BufferBudget()));
+        ScanListener* listener = scheduler.Listener();
+        scheduler.SetListener(this);
+        target = listener;
+        store = &texts;
+        newTexts = newTextsPerRange;
+        textOccurrences = occurrences;
+
+        for (size_t next = 0; next < plan.size();) {
+            if (budget.TimeUp()) {
+                coverage.stopReason = "time budget";
+                break;
+            }
+
+            // Windows in plan order up to the batch size, the last cut down
+            // to what is left of the byte budget
+            owned.clear();
+            uint64_t wanted = 0;
+            for (; next < plan.size() && (owned.empty() || wanted + plan[next].size <= batchBytes); next++) {
+                uint64_t granted = budget.Reserve(plan[next].size);
+                if (granted == 0) break;
+                ScanWindow window = plan[next];
+                window.size = granted;
+                owned.push_back(window);
+                wanted += granted;
+                if (granted < plan[next].size) {
+                    next = plan.size();
+                    break;
+                }
+            }
+            if (owned.empty()) {
+                coverage.stopReason = "byte budget";
+                break;
+            }
+            std::sort(owned.begin(), owned.end(), [](const ScanWindow& a, const ScanWindow& b) { return a.address < b.address; });
+
+            batch.clear();
+            for (const auto& window : owned) {
+                ScanRange range;
+                range.address = (std::max)(streamStart[window.range], window.address - (std::min)(window.address, static_cast<uint64_t>(ScanScheduler::kTaskOverlap)));
+                uint64_t end = (std::min)(streamEnd[window.range], window.address + window.size + ScanScheduler::kTaskOverlap);
+                range.size = end - range.address;
+                if (!batch.empty() && batch.back().address + batch.back().size >= range.address) {
+                    batch.back().size = (std::max)(batch.back().address + batch.back().size, end) - batch.back().address;
+                } else {
+                    batch.push_back(range);
+                }
+                scanned[window.range] += window.size;
+                coverage.scannedBytes += window.size;
+            }
+
+            cursor = 0;
+            batchHits.clear();
+            batchReferences.clear();
+            scheduler.Scan(batch, source, unused, nullptr, hits ? &batchHits : nullptr, nullptr, nullptr,
+                           references ? &batchReferences : nullptr);
+            for (auto& hit : batchHits) {
+                const ScanWindow* window = Owner(hit.address);
+                if (!window || !hits) continue;
+                hit.range = window->range;
+                hits->push_back(hit);
+            }
+            for (const auto& reference : batchReferences) {
+                if (references && Owner(reference.source)) references->push_back(reference);
+            }
+            coverage.batches++;
+
+            log << "    [" << std::fixed << std::setprecision(1) << budget.Elapsed() - started << " s] "
+                << FormatSize(coverage.scannedBytes) << " of " << FormatSize(coverage.plannedBytes) << " ("
+                << coverage.Percent() << "%), " << found << " strings" << std::endl;
+        }
+        if (!coverage.stopReason && coverage.scannedBytes < coverage.plannedBytes) {
+            coverage.stopReason = budget.TimeUp() ? "time budget" : "byte budget";
+        }
+        scheduler.SetListener(listener);
+
+        for (size_t r = 0; r < ranges.size(); r++) {
+            coverage.rangesComplete += scanned[r] == ranges[r].size;
+            coverage.rangesSampled += scanned[r] && scanned[r] < ranges[r].size;
+        }
+        coverage.seconds = budget.Elapsed() - started;
+        Telemetry::Add(Counter::BytesSkippedBudget, coverage.plannedBytes - coverage.scannedBytes);
+
+        auto byAddress = [](const auto& a, const auto& b) { return a.address < b.address; };
+        if (hits) std::stable_sort(hits->begin(), hits->end(), byAddress);
+        if (occurrences) std::sort(occurrences->begin(), occurrences->end(), byAddress);
+        if (references) {
+            std::sort(references->begin(), references->end(),
+                      [](const Reference& a, const Reference& b) { return a.source < b.source; });
+        }
+        return coverage;
+    }
+
+private:
+    // The window of the current batch address starts in, or nullptr for
+    // the bytes read around the windows
+    const ScanWindow* Owner(uint64_t address) const {
+        auto window = std::upper_bound(owned.begin(), owned.end(), address,
+                                       [](uint64_t a, const ScanWindow& w) { return a < w.address; });
+        if (window == owned.begin() || address >= (window - 1)->address + (window - 1)->size) return nullptr;
+        return &*(window - 1);
+    }
+
+    // Strings come in address order within a batch
+    void OnText(uint64_t address, uint32_t byteLength, std::string_view text, size_t) override {
+        while (cursor < owned.size() && address >= owned[cursor].address + owned[cursor].size) cursor++;
+        if (cursor == owned.size() || address < owned[cursor].address) return;
+        size_t range = owned[cursor].range;
+        found++;
+        if (target) {
+            target->OnText(address, byteLength, text, range);
+            return;
+        }
+
+        bool inserted;
+        uint32_t id = store->Intern(text, address, &inserted);
+        if (inserted) Telemetry::Add(Counter::StringsUnique);
+        if (inserted && newTexts) (*newTexts)[range]++;
+        if (textOccurrences) textOccurrences->push_back(TextOccurrence{address, byteLength, id});
+    }
+
+    ScanScheduler& scheduler;
+    ScanBudget& budget;
+    std::vector<ScanWindow> owned;      // Windows of the current batch, by address
+    std::vector<ScanRange> batch;       // The same with the bytes around them, merged where they touch
+    size_t cursor = 0;
+    std::vector<PatternHit> batchHits;
+    std::vector<Reference> batchReferences;
+    StringStore unused;                 // The scheduler's store, which the listener stands in for
+    ScanListener* target = nullptr;
+    StringStore* store = nullptr;
+    std::vector<size_t>* newTexts = nullptr;
+    std::vector<TextOccurrence>* textOccurrences = nullptr;
+    size_t found = 0;
+};
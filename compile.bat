@@ -38,5 +38,15 @@ if %ERRORLEVEL% EQU 0 (
     echo Compilation failed!
 )
 
+echo.
+echo Compiling benchmark...
+cl.exe /EHsc /std:c++17 /O2 /MT bench.cpp /link psapi.lib /OUT:heap_bench.exe
+
+if %ERRORLEVEL% EQU 0 (
+    echo Benchmark build successful! Executable: heap_bench.exe
+) else (
+    echo Benchmark build failed!
+)
+
 pause
 
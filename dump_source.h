@@ -0,0 +1,298 @@
+#pragma once
+
+// Offline scanning of memory dumps.
+//
+// A dump is a raw memory image plus a text manifest with one region per
+// line, mirroring MEMORY_BASIC_INFORMATION:
+//
+//   # base size state type protect offset
+//   0x7ff6a0000000 0x10000 0x1000 0x20000 0x4 0x0
+//
+// Numbers are hex (0x prefix) or decimal. offset is where the region's bytes
+// start in the image, or "-" for regions without bytes (anything not
+// MEM_COMMIT). When the offset column is left out, committed regions are
+// taken to be stored back to back in manifest order.
+//
+// The image is memory-mapped read-only and scanned in place through
+// MemorySource::View, so a dump never has to fit in the heap.
+
+#include "memory_source.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A read-only mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        Close();
+    }
+
+    // sequential hints that the file is read front to back once; callers
+    // that jump around it, such as index queries, pass false
+    bool Open(const std::string& path, std::string& error, bool sequential = true) {
+#ifdef _WIN32
+        // Sequential-scan caching is the Windows counterpart of the madvise hints
+        hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | (sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0), NULL);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            error = "Failed to open " + path + ". Error: " + std::to_string(GetLastError());
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(hFile, &fileSize)) {
+            error = "Failed to get size of " + path + ". Error: " + std::to_string(GetLastError());
+            return false;
+        }
+        size = static_cast<uint64_t>(fileSize.QuadPart);
+        if (size == 0) return true;
+
+        hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hMapping == NULL) {
+            error = "Failed to map " + path + ". Error: " + std::to_string(GetLastError());
+            return false;
+        }
+        data = static_cast<const char*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+        if (data == NULL) {
+            error = "Failed to map " + path + ". Error: " + std::to_string(GetLastError());
+            return false;
+        }
+#else
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = "Failed to open " + path + ": " + strerror(errno);
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            error = "Failed to get size of " + path + ": " + strerror(errno);
+            return false;
+        }
+        size = static_cast<uint64_t>(info.st_size);
+        if (size == 0) return true;
+
+        void* mapping = mmap(NULL, static_cast<size_t>(size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            error = "Failed to map " + path + ": " + strerror(errno);
+            return false;
+        }
+        data = static_cast<const char*>(mapping);
+
+        // The scan reads each region front to back once. Both hints are
+        // best effort; huge pages only apply where the file system supports them.
+        if (sequential) {
+            madvise(mapping, static_cast<size_t>(size), MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+            madvise(mapping, static_cast<size_t>(size), MADV_HUGEPAGE);
+#endif
+        }
+#endif
+        return true;
+    }
+
+    void Close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (hMapping) CloseHandle(hMapping);
+        if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+        hMapping = NULL;
+        hFile = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap(const_cast<char*>(data), static_cast<size_t>(size));
+        if (fd >= 0) close(fd);
+        fd = -1;
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+    const char* Data() const { return data; }
+    uint64_t Size() const { return size; }
+
+private:
+    const char* data = NULL;
+    uint64_t size = 0;
+#ifdef _WIN32
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = NULL;
+#else
+    int fd = -1;
+#endif
+};
+
+inline bool ParseDumpNumber(const std::string& text, uint64_t& value) {
+    if (text.empty()) return false;
+    char* end = NULL;
+    value = std::strtoull(text.c_str(), &end, 0);
+    return end != NULL && *end == '\0';
+}
+
+// Reads a manifest into regions (sorted by address) and their image offsets.
+inline bool LoadDumpManifest(const std::string& path, std::vector<MemoryRegion>& regions,
+                             std::vector<uint64_t>& offsets, std::string& error) {
+    std::ifstream manifest(path);
+    if (!manifest.is_open()) {
+        error = "Failed to open manifest " + path;
+        return false;
+    }
+
+    struct Entry {
+        MemoryRegion region;
+        uint64_t offset;
+    };
+    std::vector<Entry> entries;
+    uint64_t nextOffset = 0;
+    std::string line;
+    int lineNumber = 0;
+
+    while (std::getline(manifest, line)) {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+
+        std::istringstream fields(line);
+        std::string base, size, state, type, protect, offset;
+        if (!(fields >> base)) continue;
+        fields >> size >> state >> type >> protect >> offset;
+
+        uint64_t values[5];
+        const std::string* texts[5] = {&base, &size, &state, &type, &protect};
+        for (int i = 0; i < 5; i++) {
+            if (!ParseDumpNumber(*texts[i], values[i])) {
+                error = path + ":" + std::to_string(lineNumber) + ": expected base size state type protect [offset]";
+                return false;
+            }
+        }
+
+        Entry entry;
+        entry.region.BaseAddress = values[0];
+        entry.region.RegionSize = values[1];
+        entry.region.State = static_cast<DWORD>(values[2]);
+        entry.region.Type = static_cast<DWORD>(values[3]);
+        entry.region.Protect = static_cast<DWORD>(values[4]);
+        entry.offset = BufferMemorySource::kNoData;
+
+        if (offset.empty()) {
+            if (entry.region.State == MEM_COMMIT) {
+                entry.offset = nextOffset;
+                nextOffset += entry.region.RegionSize;
+            }
+        } else if (offset != "-" && !ParseDumpNumber(offset, entry.offset)) {
+            error = path + ":" + std::to_string(lineNumber) + ": bad offset '" + offset + "'";
+            return false;
+        }
+        entries.push_back(entry);
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.region.BaseAddress < b.region.BaseAddress;
+    });
+    for (const auto& entry : entries) {
+        regions.push_back(entry.region);
+        offsets.push_back(entry.offset);
+    }
+    return true;
+}
+
+// A memory dump scanned straight from its mapping.
+class DumpMemorySource : public BufferMemorySource {
+public:
+    static std::unique_ptr<MemorySource> Open(const std::string& imagePath, const std::string& manifestPath,
+                                              std::string& error) {
+        std::unique_ptr<MappedFile> image(new MappedFile());
+        if (!image->Open(imagePath, error)) {
+            return nullptr;
+        }
+
+        std::vector<MemoryRegion> regions;
+        std::vector<uint64_t> offsets;
+        if (!LoadDumpManifest(manifestPath, regions, offsets, error)) {
+            return nullptr;
+        }
+
+        size_t slash = imagePath.find_last_of("/\\");
+        std::string name = slash == std::string::npos ? imagePath : imagePath.substr(slash + 1);
+        return std::unique_ptr<MemorySource>(new DumpMemorySource(std::move(image), regions, offsets, name));
+    }
+
+private:
+    DumpMemorySource(std::unique_ptr<MappedFile> file, const std::vector<MemoryRegion>& regions,
+                     const std::vector<uint64_t>& offsets, const std::string& name)
+        : BufferMemorySource(file->Data(), file->Size(), regions, offsets, name), image(std::move(file)) {}
+
+    std::unique_ptr<MappedFile> image;
+};
+
+// Writes the committed, readable regions of a source as a dump that
+// DumpMemorySource can open. Unreadable bytes are stored as zeros.
+inline bool WriteMemoryDump(MemorySource& source, const std::string& imagePath, const std::string& manifestPath,
+                            std::string& error) {
+    std::vector<MemoryRegion> regions;
+    if (!source.EnumerateRegions(regions)) {
+        error = "Failed to enumerate memory regions";
+        return false;
+    }
+
+    std::ofstream image(imagePath, std::ios::binary);
+    std::ofstream manifest(manifestPath);
+    if (!image.is_open() || !manifest.is_open()) {
+        error = "Failed to create " + (image.is_open() ? manifestPath : imagePath);
+        return false;
+    }
+
+    manifest << "# base size state type protect offset" << std::endl;
+    std::vector<char> buffer(1024 * 1024);
+    uint64_t offset = 0;
+
+    for (const auto& region : regions) {
+        bool readable = region.State == MEM_COMMIT && region.Protect != 0 &&
+                        !(region.Protect & PAGE_NOACCESS) && !(region.Protect & PAGE_GUARD);
+
+        char line[160];
+        snprintf(line, sizeof(line), "0x%llx 0x%llx 0x%lx 0x%lx 0x%lx ",
+                 static_cast<unsigned long long>(region.BaseAddress), static_cast<unsigned long long>(region.RegionSize),
+                 static_cast<unsigned long>(region.State), static_cast<unsigned long>(region.Type),
+                 static_cast<unsigned long>(region.Protect));
+        manifest << line;
+        if (!readable) {
+            // Still committed, but its bytes are not in the image
+            manifest << "-" << '\n';
+            continue;
+        }
+        snprintf(line, sizeof(line), "0x%llx", static_cast<unsigned long long>(offset));
+        manifest << line << '\n';
+
+        for (uint64_t done = 0; done < region.RegionSize;) {
+            size_t chunk = static_cast<size_t>((std::min)(static_cast<uint64_t>(buffer.size()), region.RegionSize - done));
+            size_t bytesRead = source.Read(region.BaseAddress + done, buffer.data(), chunk);
+            std::fill(buffer.begin() + bytesRead, buffer.begin() + chunk, 0);
+            image.write(buffer.data(), chunk);
+            done += chunk;
+        }
+        offset += region.RegionSize;
+    }
+
+    if (!image || !manifest) {
+        error = "Failed to write dump";
+        return false;
+    }
+    return true;
+}
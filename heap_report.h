@@ -0,0 +1,36 @@
+#pragma once
+
+// Formatting shared by the text report and heap_bench, which measures it.
+
+#include "string_store.h"
+
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+inline std::string FormatSize(uint64_t size) {
+    const char* units[] = {"B", "KB", "MB", "GB"};
+    int unitIndex = 0;
+    double sizeInUnits = static_cast<double>(size);
+
+    while (sizeInUnits >= 1024.0 && unitIndex < 3) {
+        sizeInUnits /= 1024.0;
+        unitIndex++;
+    }
+
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2) << sizeInUnits << " " << units[unitIndex];
+    return oss.str();
+}
+
+// One "Text N: ... (xCount, first at 0xAddress)" line per string. Lines end
+// in '\n' rather than std::endl, so a long list is not flushed line by line.
+inline void WriteTextList(std::ostream& out, const StringStore& texts, const char* indent) {
+    for (size_t j = 0; j < texts.size(); j++) {
+        out << indent << "Text " << j + 1 << ": " << texts[j]
+            << " (x" << texts.Count(j)
+            << ", first at 0x" << std::hex << texts.FirstAddress(j) << std::dec << ")\n";
+    }
+}
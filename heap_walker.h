@@ -0,0 +1,280 @@
+#pragma once
+
+// Allocator-aware heap walking.
+//
+// A HeapWalker follows the block headers of one heap segment through the
+// bytes the scan reads anyway: ScanScheduler hands it every chunk that
+// covers the segment, in address order, from its reader thread. Headers
+// that lie beyond the bytes at hand (the block that runs past the end of a
+// chunk) are read on their own, 16 bytes each, so there is never a second
+// pass over the memory. The walker counts live and free blocks, and reports
+// the spans that hold no live allocation (free blocks and allocator
+// metadata), so that text found there can be left out.
+//
+// GlibcHeapWalker parses glibc malloc chunks on 64-bit targets. A chunk
+// starts with the size of the previous chunk (only meaningful when that one
+// is free) and its own size, whose low bits are flags; bit 0 says whether
+// the previous chunk is in use. So a chunk's state is known once the header
+// after it has been read. The top chunk, which ends the heap, is free.
+// Chunks in tcache or fastbins are marked in use by malloc itself and are
+// counted as live.
+//
+// NT and segment heaps have no walker yet: CreateHeapWalker returns
+// nullptr for them and their segments are scanned as plain memory.
+
+#include "memory_source.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// [start, end) of the address space
+struct AddressSpan {
+    uint64_t start;
+    uint64_t end;
+};
+
+struct HeapWalkStats {
+    uint64_t segments = 0;          // Heap segments with a walker
+    uint64_t segmentsFailed = 0;    // Walks stopped by a header that made no sense
+    uint64_t liveBlocks = 0;
+    uint64_t liveBytes = 0;
+    uint64_t freeBlocks = 0;
+    uint64_t freeBytes = 0;
+    uint64_t headerReads = 0;       // Headers read on their own, beyond the chunks at hand
+
+    void Add(const HeapWalkStats& other) {
+        segments += other.segments;
+        segmentsFailed += other.segmentsFailed;
+        liveBlocks += other.liveBlocks;
+        liveBytes += other.liveBytes;
+        freeBlocks += other.freeBlocks;
+        freeBytes += other.freeBytes;
+        headerReads += other.headerReads;
+    }
+};
+
+class HeapWalker {
+public:
+    explicit HeapWalker(const HeapSegment& segment) : segment(segment) {
+        stats.segments = 1;
+    }
+    virtual ~HeapWalker() {}
+
+    const HeapSegment& Segment() const { return segment; }
+    const HeapWalkStats& Stats() const { return stats; }
+
+    // Takes the bytes [address, address + size) of the segment. Calls come
+    // in ascending address order and may overlap the previous one. Appends
+    // the spans of those bytes that hold no live allocation to unused, in
+    // address order.
+    virtual void Walk(uint64_t address, const char* data, size_t size, MemorySource& source,
+                      std::vector<AddressSpan>& unused) = 0;
+
+protected:
+    HeapSegment segment;
+    HeapWalkStats stats;
+};
+
+class GlibcHeapWalker : public HeapWalker {
+public:
+    static const uint64_t kHeaderSize = 16;     // prev_size and size
+    static const uint64_t kMinChunk = 32;
+    static const uint64_t kAlignment = 16;
+    // How far into a segment its first chunk is looked for: past the
+    // heap_info and malloc_state that start the first heap of an arena
+    static const uint64_t kFirstChunkSearch = 8192;
+
+    explicit GlibcHeapWalker(const HeapSegment& segment) : HeapWalker(segment), cursor(segment.address) {}
+
+    void Walk(uint64_t address, const char* data, size_t size, MemorySource& source,
+              std::vector<AddressSpan>& unused) override {
+        uint64_t end = address + size;
+        uint64_t segmentEnd = segment.address + segment.size;
+        Window window = {address, end, data};
+
+        // Free spans found earlier may reach into these bytes
+        size_t keep = 0;
+        for (const auto& span : spans) {
+            if (span.end > address) spans[keep++] = span;
+        }
+        spans.resize(keep);
+
+        if (state == Start) {
+            // The first chunk is looked for in the first bytes given
+            uint64_t first = 0;
+            if (address != segment.address || !FindFirstChunk(window, first)) {
+                state = Failed;
+                stats.segmentsFailed++;
+            } else {
+                if (first > segment.address) spans.push_back(AddressSpan{segment.address, first});
+                cursor = first;
+                state = Walking;
+            }
+        }
+
+        while (state == Walking && cursor < end) {
+            uint64_t sizeField = 0;
+            if (!ReadSize(window, source, cursor, sizeField)) {
+                Fail();
+                break;
+            }
+            uint64_t chunkSize = sizeField & ~static_cast<uint64_t>(7);
+            if (chunkSize == kHeaderSize) {
+                // A fencepost: the end of memory the arena has given up on
+                spans.push_back(AddressSpan{cursor + 8, segmentEnd});
+                state = Done;
+                break;
+            }
+            if (chunkSize < kMinChunk || chunkSize % kAlignment || (sizeField & 2) || chunkSize > segmentEnd - cursor) {
+                Fail();
+                break;
+            }
+
+            uint64_t next = cursor + chunkSize;
+            bool live = false;
+            if (next < segmentEnd) {
+                uint64_t nextSize = 0;
+                if (!ReadSize(window, source, next, nextSize)) {
+                    Fail();
+                    break;
+                }
+                live = (nextSize & 1) != 0;
+            }
+            if (live) {
+                stats.liveBlocks++;
+                stats.liveBytes += chunkSize;
+            } else {
+                // The top chunk too. Its user data runs from after its size
+                // field into the next chunk's prev_size, which holds its size.
+                stats.freeBlocks++;
+                stats.freeBytes += chunkSize;
+                uint64_t spanEnd = (std::min)(next + 8, segmentEnd);
+                if (!spans.empty() && spans.back().end >= cursor + 8) {
+                    spans.back().end = spanEnd;
+                } else {
+                    spans.push_back(AddressSpan{cursor + 8, spanEnd});
+                }
+            }
+            cursor = next;
+            if (cursor == segmentEnd) state = Done;
+        }
+
+        for (const auto& span : spans) {
+            uint64_t start = (std::max)(span.start, address);
+            uint64_t stop = (std::min)(span.end, end);
+            if (start < stop) unused.push_back(AddressSpan{start, stop});
+        }
+    }
+
+private:
+    enum State { Start, Walking, Done, Failed };
+
+    struct Window {
+        uint64_t start;
+        uint64_t end;
+        const char* data;
+    };
+
+    void Fail() {
+        state = Failed;
+        stats.segmentsFailed++;
+    }
+
+    // The size field of the chunk at address, from the bytes at hand when
+    // it lies in them and read on its own otherwise
+    bool ReadSize(const Window& window, MemorySource& source, uint64_t address, uint64_t& size) {
+        if (address >= window.start && address + kHeaderSize <= window.end) {
+            std::memcpy(&size, window.data + (address - window.start) + 8, sizeof(size));
+            return true;
+        }
+        stats.headerReads++;
+        return source.Read(address + 8, reinterpret_cast<char*>(&size), sizeof(size)) == sizeof(size);
+    }
+
+    // The first offset at which a chain of well-formed chunks starts and
+    // runs on to the end of the bytes or the segment. The first chunk of a
+    // heap always has its previous-in-use bit set.
+    bool FindFirstChunk(const Window& window, uint64_t& first) const {
+        uint64_t segmentEnd = segment.address + segment.size;
+        uint64_t limit = (std::min)(window.end, segment.address + kFirstChunkSearch);
+        for (uint64_t candidate = segment.address; candidate + kHeaderSize <= limit; candidate += kAlignment) {
+            uint64_t at = candidate;
+            int chunks = 0;
+            bool ok = true;
+            while (ok && at + kHeaderSize <= window.end && at < segmentEnd && chunks < 8) {
+                uint64_t sizeField;
+                std::memcpy(&sizeField, window.data + (at - window.start) + 8, sizeof(sizeField));
+                uint64_t chunkSize = sizeField & ~static_cast<uint64_t>(7);
+                ok = chunkSize >= kMinChunk && chunkSize % kAlignment == 0 && !(sizeField & 2) &&
+                     chunkSize <= segmentEnd - at && (chunks > 0 || (sizeField & 1));
+                at += chunkSize;
+                chunks++;
+            }
+            if (ok && (chunks >= 4 || at == segmentEnd || at + kHeaderSize > window.end)) {
+                first = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    State state = Start;
+    uint64_t cursor;
+    std::vector<AddressSpan> spans;     // Free spans that may reach into the next bytes
+};
+
+// The walker for a segment's allocator, or nullptr when there is none yet.
+inline std::unique_ptr<HeapWalker> CreateHeapWalker(const HeapSegment& segment) {
+    switch (segment.kind) {
+        case HeapKind::GlibcMalloc: return std::unique_ptr<HeapWalker>(new GlibcHeapWalker(segment));
+        default: return nullptr;
+    }
+}
+
+// The walkers of every heap segment of a source; routes the bytes a scan
+// reads to the walker of the segment they belong to.
+class HeapWalk {
+public:
+    explicit HeapWalk(const std::vector<HeapSegment>& segments) {
+        for (const auto& segment : segments) {
+            std::unique_ptr<HeapWalker> walker = CreateHeapWalker(segment);
+            if (walker) walkers.push_back(std::move(walker));
+            else unsupported++;
+        }
+        std::sort(walkers.begin(), walkers.end(), [](const std::unique_ptr<HeapWalker>& a, const std::unique_ptr<HeapWalker>& b) {
+            return a->Segment().address < b->Segment().address;
+        });
+    }
+
+    bool empty() const { return walkers.empty(); }
+
+    // Segments of allocators that have no walker
+    size_t Unsupported() const { return unsupported; }
+
+    // Bytes a scan read at address, in ascending address order per segment
+    void Walk(uint64_t address, const char* data, size_t size, MemorySource& source, std::vector<AddressSpan>& unused) {
+        uint64_t end = address + size;
+        auto walker = std::upper_bound(walkers.begin(), walkers.end(), address, [](uint64_t at, const std::unique_ptr<HeapWalker>& w) {
+            return at < w->Segment().address + w->Segment().size;
+        });
+        for (; walker != walkers.end() && (*walker)->Segment().address < end; ++walker) {
+            const HeapSegment& segment = (*walker)->Segment();
+            uint64_t start = (std::max)(address, segment.address);
+            uint64_t stop = (std::min)(end, segment.address + segment.size);
+            (*walker)->Walk(start, data + (start - address), static_cast<size_t>(stop - start), source, unused);
+        }
+    }
+
+    HeapWalkStats Stats() const {
+        HeapWalkStats total;
+        for (const auto& walker : walkers) total.Add(walker->Stats());
+        return total;
+    }
+
+private:
+    std::vector<std::unique_ptr<HeapWalker>> walkers;
+    size_t unsupported = 0;
+};
@@ -1,19 +1,35 @@
-#include <windows.h>
-#include <tlhelp32.h>
-#include <psapi.h>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <iomanip>
 #include <sstream>
 #include <fstream>
-#include <memoryapi.h>
 #include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <ctime>
+#include <atomic>
+#include <mutex>
 
-#pragma comment(lib, "psapi.lib")
+#include "budget_scan.h"
+#include "dump_source.h"
+#include "heap_report.h"
+#include "memory_source.h"
+#include "output_sink.h"
+#include "page_classifier.h"
+#include "pattern_engine.h"
+#include "process_selector.h"
+#include "reference_scanner.h"
+#include "scan_scheduler.h"
+#include "snapshot_diff.h"
+#include "string_index.h"
+#include "string_store.h"
+#include "telemetry.h"
 
 struct HeapInfo {
-    HANDLE heapHandle;
+    uint64_t heapHandle;
     DWORD processId;
     SIZE_T heapSize;
     SIZE_T committedSize;
@@ -21,8 +37,20 @@ struct HeapInfo {
     SIZE_T allocatedSize;
     SIZE_T freeSize;
     DWORD blockCount;
-    std::vector<MEMORY_BASIC_INFORMATION> regions;
-    std::vector<std::string> extractedTexts;
+    uint64_t notResidentSkipped;    // Bytes of private pages left unread as not resident
+    uint64_t zeroPagesSkipped;      // Bytes of all-zero pages read but not scanned
+    uint64_t notTextSkipped;        // Bytes of pages the classifier found not to be text
+    PageClassCounts pageClasses;    // Of the pages read, when they were classified
+    size_t heapSegments;            // Allocator heaps found, and how many of them were walked
+    size_t heapSegmentsWalked;
+    std::vector<MemoryRegion> regions;
+    StringStore extractedTexts;
+    std::vector<TextOccurrence> occurrences;    // Every place a string was found, kept when the run is indexed
+    std::vector<PatternHit> patternHits;
+    std::vector<MemoryRegion> targetRegions;    // Committed regions of the whole enumeration, which references point into
+    std::vector<Reference> references;          // Pointers into them, in address order
+    SnapshotDiff snapshotDiff;
+    ScanCoverage coverage;                      // Of the memory planned for a budgeted scan
 };
 
 struct ProcessInfo {
@@ -34,47 +62,45 @@ struct ProcessInfo {
     SIZE_T totalAllocatedSize;
     SIZE_T totalFreeSize;
     DWORD totalBlockCount;
+    std::string error;      // Why the process could not be scanned
 };
 
-class WindowsHeapExtractor {
+class HeapExtractor : public ScanListener {
 private:
     std::vector<ProcessInfo> processes;
+    ScanScheduler textScheduler;
+    PatternSet patterns;
+    std::unique_ptr<SnapshotState> snapshot;    // Set when passes are incremental
+    std::string snapshotPath;
+    std::unique_ptr<OutputSink> sink;           // Set when results are streamed to a file
+    std::string outputPath;
+    OutputSummary outputSummary = {};
+    const std::vector<size_t>* scanRegions = nullptr;   // Region of each scanned range
+    size_t threadCount;         // Scan threads, shared out between the processes of a batch
+    size_t taskSize;
+    bool pageFilters = true;    // Skip pages that are not resident or all zeros
+    bool workingSetOnly = false; // Count pages outside the working set as not resident
+    bool liveTextOnly = false;  // Extract text only from live heap allocations
+    std::unique_ptr<PageClassifier> classifier;     // Set when pages are classified before their text scan
+    std::string indexPath;      // Set when the strings of every pass are added to an index
+    bool referenceScan = false; // Sweep memory for pointers into the process's regions and strings
+    std::vector<TextOccurrence> streamedTexts;  // Strings streamed so far in this scan, when references link to them
+    std::unique_ptr<ScanBudget> budget;         // Set when scans go by priority and stop at a time or byte budget
 
-    DWORD FindProcessIdByName(const std::string& processName) {
-        HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-        if (hSnapshot == INVALID_HANDLE_VALUE) {
-            return 0;
-        }
-
-        PROCESSENTRY32 pe32;
-        pe32.dwSize = sizeof(PROCESSENTRY32);
+    // Block counts and sizes from the walk of the heap segments, in place
+    // of the process-wide estimates
+    bool GetHeapInformation(const HeapWalk& walk, const std::vector<HeapSegment>& segments, HeapInfo& heapInfo) {
+        HeapWalkStats stats = walk.Stats();
+        Telemetry::Add(Counter::HeapBlocks, stats.liveBlocks + stats.freeBlocks);
+        Telemetry::Add(Counter::HeapHeaderReads, stats.headerReads);
+        heapInfo.heapSegments = segments.size();
+        heapInfo.heapSegmentsWalked = stats.segments - stats.segmentsFailed;
+        if (stats.liveBlocks + stats.freeBlocks == 0) return false;
 
-        if (Process32First(hSnapshot, &pe32)) {
-            do {
-                // pe32.szExeFile is already a narrow string, no conversion needed
-                std::string currentProcessName(pe32.szExeFile);
-                
-                if (_stricmp(currentProcessName.c_str(), processName.c_str()) == 0) {
-                    CloseHandle(hSnapshot);
-                    std::cout << "Process found: " << pe32.th32ProcessID << std::endl;
-                    return pe32.th32ProcessID;
-                }
-            } while (Process32Next(hSnapshot, &pe32));
-        }
-
-        CloseHandle(hSnapshot);
-        return 0;
-    }
-
-    bool GetHeapInformation(HANDLE hProcess, HANDLE hHeap, HeapInfo& heapInfo) {
-        // This function is kept for compatibility but simplified
-        heapInfo.heapHandle = hHeap;
-        heapInfo.blockCount = 0;
-        heapInfo.allocatedSize = 0;
-        heapInfo.freeSize = 0;
-        heapInfo.heapSize = 0;
-        heapInfo.committedSize = 0;
-        heapInfo.uncommittedSize = 0;
+        heapInfo.heapHandle = segments.front().address;
+        heapInfo.blockCount = static_cast<DWORD>(stats.liveBlocks + stats.freeBlocks);
+        heapInfo.allocatedSize = stats.liveBytes;
+        heapInfo.freeSize = stats.freeBytes;
         return true;
     }
 
@@ -96,218 +122,571 @@ private:
         return hasPrintable && hasNulls;
     }
 
-    std::string ExtractUTF16Text(const char* data, size_t size) {
-        std::string result;
+    bool ExtractTextFromMemory(MemorySource& source, HeapInfo& heapInfo, ScanScheduler& scheduler, std::ostream& log) {
+        std::vector<ScanRange> ranges;
+        std::vector<size_t> rangeRegions;
+        // Snapshots fingerprint whole regions, so their passes read every page
+        bool residencyFilter = pageFilters && !snapshot;
+        std::vector<uint8_t> residency;
+        for (size_t i = 0; i < heapInfo.regions.size(); i++) {
+            const auto& region = heapInfo.regions[i];
+            if (region.RegionSize < 16) { // Too small to contain meaningful text
+                Telemetry::Add(Counter::RegionsSkippedSmall);
+                continue;
+            }
         
-        // Convert UTF-16 to UTF-8
-        int wideSize = MultiByteToWideChar(CP_UTF8, 0, data, size, NULL, 0);
-        if (wideSize > 0) {
-            std::wstring wideStr(wideSize, 0);
-            MultiByteToWideChar(CP_UTF8, 0, data, size, &wideStr[0], wideSize);
+            // A mapped page that is not resident still has its file behind
+            // it; a private one reads as zeros
+            if (residencyFilter && region.Type == MEM_PRIVATE &&
+                AppendResidentRuns(source, region.BaseAddress, region.RegionSize, residency, ranges, heapInfo.notResidentSkipped,
+                                   workingSetOnly)) {
+                rangeRegions.resize(ranges.size(), i);
+                continue;
+            }
             
-            int utf8Size = WideCharToMultiByte(CP_UTF8, 0, wideStr.c_str(), -1, NULL, 0, NULL, NULL);
-            if (utf8Size > 0) {
-                result.resize(utf8Size - 1);
-                WideCharToMultiByte(CP_UTF8, 0, wideStr.c_str(), -1, &result[0], utf8Size, NULL, NULL);
+            // Regions of any size are streamed through the scheduler in chunks
+            ScanRange range;
+            range.address = region.BaseAddress;
+            range.size = region.RegionSize;
+            ranges.push_back(range);
+            rangeRegions.push_back(i);
+        }
+        Telemetry::Add(Counter::BytesSkippedNotResident, heapInfo.notResidentSkipped);
+
+        size_t scannedRegions = 0;
+        for (size_t r = 0; r < ranges.size(); r++) scannedRegions += r == 0 || rangeRegions[r] != rangeRegions[r - 1];
+        log << "  Extracting text from " << scannedRegions << " regions";
+        if (ranges.size() != scannedRegions) log << " (" << ranges.size() << " resident runs)";
+        log << " on "
+            << scheduler.ThreadCount() << " threads (" << FormatSize(scheduler.BufferBudget())
+            << " of read buffers)..." << std::endl;
+
+        std::vector<size_t> newTexts;
+        std::vector<PageClassCounts> pageClasses;
+        if (sink) scanRegions = &rangeRegions;
+        uint64_t zeroBefore = scheduler.ZeroBytesSkipped();
+        uint64_t classifiedBefore = scheduler.ClassifiedBytesSkipped();
+        // Like the residency filter, classification would leave snapshots
+        // without the strings of whole pages
+        bool classify = classifier && pageFilters && !snapshot;
+        scheduler.SetPageClassifier(classify ? classifier.get() : nullptr);
+        if (snapshot) {
+            ExtractChangedText(source, ranges, heapInfo);
+        } else if (budget) {
+            // Most promising memory first, until the budget runs out
+            std::vector<const MemoryRegion*> rangeRegion(ranges.size());
+            for (size_t r = 0; r < ranges.size(); r++) rangeRegion[r] = &heapInfo.regions[rangeRegions[r]];
+            bool keepOccurrences = !indexPath.empty() || referenceScan;
+            BudgetedScan scan(scheduler, *budget);
+            heapInfo.coverage = scan.Scan(ranges, rangeRegion, source, heapInfo.extractedTexts, &newTexts, &heapInfo.patternHits,
+                                          keepOccurrences ? &heapInfo.occurrences : nullptr, &heapInfo.references, log);
+            log << "  Covered " << FormatCoverage(heapInfo.coverage) << " in " << std::fixed << std::setprecision(1)
+                << heapInfo.coverage.seconds << " s" << std::endl;
+        } else {
+            bool keepOccurrences = !indexPath.empty() || referenceScan;
+            scheduler.Scan(ranges, source, heapInfo.extractedTexts, &newTexts, &heapInfo.patternHits,
+                           keepOccurrences ? &heapInfo.occurrences : nullptr, &pageClasses, &heapInfo.references);
+        }
+        scheduler.SetPageClassifier(nullptr);
+        heapInfo.zeroPagesSkipped = scheduler.ZeroBytesSkipped() - zeroBefore;
+        heapInfo.notTextSkipped = scheduler.ClassifiedBytesSkipped() - classifiedBefore;
+        if (heapInfo.notResidentSkipped || heapInfo.zeroPagesSkipped || heapInfo.notTextSkipped) {
+            log << "  Skipped " << FormatSize(heapInfo.notResidentSkipped) << " not resident, "
+                << FormatSize(heapInfo.zeroPagesSkipped) << " of zero pages";
+            if (classify) log << ", " << FormatSize(heapInfo.notTextSkipped) << " not text";
+            log << std::endl;
+        }
+        if (!patterns.empty()) {
+            // Report hits against regions rather than scanned ranges
+            for (auto& hit : heapInfo.patternHits) hit.range = rangeRegions[hit.range];
+            log << "  Pattern hits" << (snapshot ? " in changed memory: " : ": ") << heapInfo.patternHits.size() << std::endl;
+        }
+        if (sink) {
+            for (const auto& hit : heapInfo.patternHits) {
+                sink->OnHit(hit, patterns.RuleId(hit.variant), patterns.Encoding(hit.variant));
             }
+            outputSummary.hits += heapInfo.patternHits.size();
         }
+        if (referenceScan) {
+            // Streamed strings arrive in the order their batches are merged,
+            // which for a budgeted scan is not address order
+            if (sink) {
+                std::sort(streamedTexts.begin(), streamedTexts.end(),
+                          [](const TextOccurrence& a, const TextOccurrence& b) { return a.address < b.address; });
+            }
+            LinkReferences(heapInfo, sink ? streamedTexts : heapInfo.occurrences, log);
+        }
+        if (sink) {
+            for (const auto& reference : heapInfo.references) {
+                sink->OnReference(reference, SourceRegion(heapInfo, reference.source),
+                                  heapInfo.targetRegions[reference.targetRegion].BaseAddress);
+            }
+            outputSummary.references += heapInfo.references.size();
+            streamedTexts.clear();
+            sink->Flush();
+            std::cout << "  Streamed " << outputSummary.texts << " strings" << std::endl;
+        }
+        
+        // A region split into resident runs is scanned as several ranges
+        std::vector<size_t> regionTexts(heapInfo.regions.size(), 0);
+        // Budgeted scans do not count page classes per range
+        bool regionClasses = classify && !budget;
+        std::vector<PageClassCounts> regionPages(regionClasses ? heapInfo.regions.size() : 0);
+        for (size_t r = 0; r < newTexts.size(); r++) regionTexts[rangeRegions[r]] += newTexts[r];
+        for (size_t r = 0; r < pageClasses.size() && regionClasses; r++) {
+            regionPages[rangeRegions[r]].Add(pageClasses[r]);
+            heapInfo.pageClasses.Add(pageClasses[r]);
+        }
+        for (size_t i = 0; i < regionTexts.size(); i++) {
+            bool skippedPages = regionClasses && regionPages[i].Total() > regionPages[i][PageClass::Text];
+            if (regionTexts[i] == 0 && !skippedPages) continue;
+            const auto& region = heapInfo.regions[i];
+            log << "    User data region " << i + 1
+                << " (size: " << FormatSize(region.RegionSize)
+                << ", type: " << (region.Type == MEM_PRIVATE ? "Private" : "Mapped")
+                << ", protection: 0x" << std::hex << region.Protect << std::dec << ")"
+                << ": found " << regionTexts[i] << " text strings";
+            if (regionClasses) log << " in pages " << FormatPageClasses(regionPages[i]);
+            log << std::endl;
+        }
+        return true;
+    }
+
+    // Points every reference at the string its target lies in; texts are in
+    // address order, with IDs into the string store or, streamed, their
+    // position in texts
+    void LinkReferences(HeapInfo& heapInfo, const std::vector<TextOccurrence>& texts, std::ostream& log) {
+        ScopedPhase timer(Phase::References);
+        size_t linked = 0;
+        for (auto& reference : heapInfo.references) {
+            auto text = std::upper_bound(texts.begin(), texts.end(), reference.target,
+                                         [](uint64_t address, const TextOccurrence& t) { return address < t.address; });
+            if (text == texts.begin() || reference.target >= (text - 1)->address + (text - 1)->byteLength) continue;
+            reference.textAddress = (text - 1)->address;
+            reference.text = (text - 1)->id;
+            linked++;
+        }
+        if (indexPath.empty()) std::vector<TextOccurrence>().swap(heapInfo.occurrences);
         
-        return result;
+        std::vector<bool> targeted(heapInfo.targetRegions.size(), false);
+        for (const auto& reference : heapInfo.references) targeted[reference.targetRegion] = true;
+        log << "  Found " << heapInfo.references.size() << " pointers into "
+            << std::count(targeted.begin(), targeted.end(), true) << " regions, " << linked << " of them into strings" << std::endl;
+    }
+
+    // Index of the user data region holding address, which a scan read
+    static size_t SourceRegion(const HeapInfo& heapInfo, uint64_t address) {
+        auto region = std::upper_bound(heapInfo.regions.begin(), heapInfo.regions.end(), address,
+                                       [](uint64_t a, const MemoryRegion& r) { return a < r.BaseAddress; });
+        return static_cast<size_t>(region - heapInfo.regions.begin()) - 1;
     }
 
-    bool ExtractTextFromMemory(HANDLE hProcess, LPVOID address, SIZE_T size, std::vector<std::string>& texts) {
-        if (size < 16) return false; // Too small to contain meaningful text
+    // Rescans only the pages that changed since the previous snapshot and
+    // moves the snapshot on to this pass
+    void ExtractChangedText(MemorySource& source, const std::vector<ScanRange>& ranges, HeapInfo& heapInfo) {
+        SnapshotScanner scanner(textScheduler);
+        SnapshotDiff& diff = heapInfo.snapshotDiff;
+        scanner.Scan(ranges, source, *snapshot, heapInfo.extractedTexts, &heapInfo.patternHits, diff);
+
+        std::cout << "  Fingerprinted " << diff.pages << " pages in " << std::fixed << std::setprecision(1)
+                  << diff.fingerprintSeconds * 1000.0 << " ms: " << diff.changedPages << " changed" << std::endl;
+        std::cout << "  Rescanned " << FormatSize(diff.rescannedBytes) << " in " << diff.scanSeconds * 1000.0 << " ms" << std::endl;
+        if (diff.hasPrevious) {
+            std::cout << "  Strings added: " << diff.added.size() << ", removed: " << diff.removed.size() << std::endl;
+        }
+        if (!indexPath.empty()) {
+            // The snapshot holds every string of the pass, not just the rescanned ones
+            heapInfo.occurrences.reserve(snapshot->strings.size());
+            for (const auto& text : snapshot->strings) {
+                uint32_t id = heapInfo.extractedTexts.Find(snapshot->texts[text.id]);
+                if (id != StringStore::kInvalidId) heapInfo.occurrences.push_back(TextOccurrence{text.address, text.byteLength, id});
+            }
+        }
         
-        // Limit the size to avoid long processing times
-        if (size > 64 * 1024) { // Max 64KB
-            size = 64 * 1024;
+        if (snapshotPath.empty()) return;
+        std::string error;
+        if (snapshot->Save(snapshotPath, error)) {
+            std::cout << "  Snapshot saved to: " << snapshotPath << std::endl;
+        } else {
+            std::cout << "  " << error << std::endl;
         }
+    }
+
+    // Keeps the user data regions in heapInfo; allRegions receives the
+    // whole enumeration
+    bool GetMemoryRegions(MemorySource& source, HeapInfo& heapInfo, std::vector<MemoryRegion>& allRegions, std::ostream& log) {
+        int regionCount = 0;
+        int userDataRegions = 0;
         
-        std::vector<char> buffer(size);
-        SIZE_T bytesRead;
+        log << "  Scanning memory regions for user data..." << std::endl;
         
-        if (!ReadProcessMemory(hProcess, address, buffer.data(), size, &bytesRead) || bytesRead == 0) {
+        bool enumerated;
+        {
+            ScopedPhase timer(Phase::Enumerate);
+            enumerated = source.EnumerateRegions(allRegions);
+        }
+        if (!enumerated || allRegions.empty()) {
+            // A process that has exited but not been reaped has no regions
+            log << "  Failed to enumerate memory regions." << std::endl;
             return false;
         }
+        Telemetry::Add(Counter::RegionsEnumerated, allRegions.size());
         
-        // Look for UTF-16 text patterns with smart skipping
-        int textFound = 0;
-        size_t i = 0;
+        for (const auto& mbi : allRegions) {
+            regionCount++;
         
-        while (i < bytesRead - 32) {
-            // Look for UTF-16 text patterns
-            if (i + 4 < bytesRead) {
-                // Check for alternating printable characters and nulls (UTF-16)
-                bool isUTF16 = false;
-                int printableCount = 0;
-                int nullCount = 0;
+            if (regionCount % 100 == 0) {
+                log << "    Scanned " << regionCount << " regions..." << std::endl;
+            }
                 
-                for (size_t j = 0; j < 20 && (i + j + 1) < bytesRead; j += 2) {
-                    if (buffer[i + j] >= 32 && buffer[i + j] <= 126) {
-                        printableCount++;
-                    }
-                    if (buffer[i + j + 1] == 0) {
-                        nullCount++;
-                    }
-                }
+            // Heaps, stacks and small mapped views (see ClassifyRegion)
+            switch (ClassifyRegion(mbi)) {
+                case RegionClass::UserData:
+                    if (sink) sink->OnRegion(heapInfo.regions.size(), mbi);
+                    heapInfo.regions.push_back(mbi);
+                    userDataRegions++;
+                    break;
+                case RegionClass::NotCommitted: Telemetry::Add(Counter::RegionsSkippedNotCommitted); break;
+                case RegionClass::Unreadable: Telemetry::Add(Counter::RegionsSkippedUnreadable); break;
+                case RegionClass::Image: Telemetry::Add(Counter::RegionsSkippedImage); break;
+                case RegionClass::LargeMapping: Telemetry::Add(Counter::RegionsSkippedLargeMapping); break;
+            }
+        }
                 
-                if (printableCount > 5 && nullCount > 2) {
-                    isUTF16 = true;
-                }
+        if (sink) {
+            outputSummary.regions += userDataRegions;
+            sink->Flush();
+        }
+        log << "  Total regions scanned: " << regionCount << std::endl;
+        log << "  User data regions found: " << userDataRegions << std::endl;
+        return true;
+    }
                 
-                if (isUTF16) {
-                    // Try to extract UTF-16 text
-                    std::string text;
-                    size_t textEnd = i;
-                    
-                    for (size_t j = 0; j < 200 && (i + j + 1) < bytesRead; j += 2) {
-                        if (buffer[i + j] >= 32 && buffer[i + j] <= 126 && buffer[i + j + 1] == 0) {
-                            text += buffer[i + j];
-                            textEnd = i + j + 2;
-                        } else if (buffer[i + j] == 0 && buffer[i + j + 1] == 0) {
-                            break; // End of string
-                        }
-                    }
                     
-                    if (text.length() > 3) {
-                        // Clean up the text
-                        text.erase(std::remove(text.begin(), text.end(), '\r'), text.end());
-                        text.erase(std::remove(text.begin(), text.end(), '\n'), text.end());
-                        text.erase(std::remove(text.begin(), text.end(), '\t'), text.end());
-                        
-                        if (text.length() > 3) {
-                            // Check if this text is already in our list
-                            bool found = false;
-                            for (const auto& existing : texts) {
-                                if (existing == text) {
-                                    found = true;
-                                    break;
-                                }
-                            }
-                            if (!found) {
-                                texts.push_back(text);
-                                textFound++;
-                            }
-                        }
-                    }
                     
-                    // Skip to the end of this text to avoid overlapping
-                    if (textEnd > i) {
-                        i = textEnd;
-                    } else {
-                        i += 2; // Move forward by 2 bytes (UTF-16)
-                    }
-                } else {
-                    i += 2; // Move forward by 2 bytes (UTF-16)
-                }
-            } else {
-                i++; // Move forward by 1 byte
-            }
+    // Hit line shared by the console and file reports
+    std::string FormatPatternHit(const HeapInfo& heap, const PatternHit& hit) {
+        std::ostringstream line;
+        line << "rule " << patterns.RuleId(hit.variant) << " (" << PatternEncodingName(patterns.Encoding(hit.variant))
+             << ") at 0x" << std::hex << hit.address << std::dec;
+        if (hit.range < heap.regions.size()) line << ", region " << hit.range + 1;
+        line << ": " << hit.preview;
+        return line.str();
+    }
+        
+    // Snapshot section shared by the console and file reports
+    void WriteSnapshotChanges(std::ostream& out, const HeapInfo& heap, const std::string& indent) {
+        const SnapshotDiff& diff = heap.snapshotDiff;
+        out << indent << "SNAPSHOT CHANGES:" << std::endl;
+        out << indent << "  Pages changed: " << diff.changedPages << " of " << diff.pages
+            << " (" << FormatSize(diff.rescannedBytes) << " rescanned)" << std::endl;
+        if (!diff.hasPrevious) {
+            out << indent << "  No previous snapshot; this pass is the baseline" << std::endl;
+            return;
         }
+        out << indent << "  Strings added: " << diff.added.size() << std::endl;
+        out << indent << "  Strings removed: " << diff.removed.size() << std::endl;
+        for (size_t j = 0; j < diff.added.size(); j++) {
+            uint32_t id = diff.added[j];
+            out << indent << "  Added " << j + 1 << ": " << heap.extractedTexts[id]
+                << " (x" << heap.extractedTexts.Count(id)
+                << ", first at 0x" << std::hex << heap.extractedTexts.FirstAddress(id) << std::dec << ")" << std::endl;
+        }
+        for (size_t j = 0; j < diff.removed.size(); j++) {
+            out << indent << "  Removed " << j + 1 << ": " << diff.removed[j] << std::endl;
+        }
+    }
         
-        if (textFound > 0) {
-            std::cout << "      Found " << textFound << " text strings" << std::endl;
+    // Reference section shared by the console and file reports: the regions
+    // and strings pointed to most
+    void WriteReferences(std::ostream& out, const HeapInfo& heap, const std::string& indent) {
+        const size_t kMaxRegions = 20;
+        const size_t kMaxTexts = 100;
+        std::vector<std::pair<uint64_t, uint32_t>> regions(heap.targetRegions.size());
+        for (size_t r = 0; r < regions.size(); r++) regions[r] = std::make_pair(0, static_cast<uint32_t>(r));
+        std::vector<std::pair<uint64_t, uint32_t>> texts(heap.extractedTexts.size());
+        for (size_t t = 0; t < texts.size(); t++) texts[t] = std::make_pair(0, static_cast<uint32_t>(t));
+        std::vector<uint64_t> firstSource(texts.size(), 0);
+        size_t linked = 0;
+        for (const auto& reference : heap.references) {
+            regions[reference.targetRegion].first++;
+            if (reference.text == StringStore::kInvalidId) continue;
+            if (texts[reference.text].first++ == 0) firstSource[reference.text] = reference.source;
+            linked++;
+        }
+        auto mostFirst = [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        };
+        std::sort(regions.begin(), regions.end(), mostFirst);
+        std::sort(texts.begin(), texts.end(), mostFirst);
+        size_t targetRegions = regions.size() - std::count_if(regions.begin(), regions.end(),
+                                                              [](const std::pair<uint64_t, uint32_t>& r) { return r.first == 0; });
+        size_t targetTexts = texts.size() - std::count_if(texts.begin(), texts.end(),
+                                                          [](const std::pair<uint64_t, uint32_t>& t) { return t.first == 0; });
+
+        out << indent << "REFERENCES:" << std::endl;
+        out << indent << "  Pointers: " << heap.references.size() << " into " << targetRegions << " regions, " << linked
+            << " into " << targetTexts << " strings" << std::endl;
+        for (size_t j = 0; j < targetRegions && j < kMaxRegions; j++) {
+            const MemoryRegion& region = heap.targetRegions[regions[j].second];
+            out << indent << "  Region 0x" << std::hex << region.BaseAddress << std::dec << " ("
+                << (region.Type == MEM_PRIVATE ? "Private" : region.Type == MEM_IMAGE ? "Image" : "Mapped") << ", "
+                << FormatSize(region.RegionSize) << "): " << regions[j].first << (regions[j].first == 1 ? " pointer" : " pointers")
+                << std::endl;
+        }
+        for (size_t j = 0; j < targetTexts && j < kMaxTexts; j++) {
+            uint32_t id = texts[j].second;
+            out << indent << "  Text " << id + 1 << ": " << heap.extractedTexts[id] << " <- " << texts[j].first
+                << (texts[j].first == 1 ? " pointer" : " pointers") << ", first from 0x" << std::hex << firstSource[id] << std::dec << std::endl;
+        }
+        if (targetTexts > kMaxTexts) {
+            out << indent << "  ... and " << targetTexts - kMaxTexts << " more strings (all pointers with --format jsonl)" << std::endl;
         }
+    }
         
-        return true;
+public:
+    explicit HeapExtractor(size_t threads, size_t taskSize = ScanScheduler::kDefaultTaskSize)
+        : textScheduler(threads, taskSize), threadCount(threads), taskSize(taskSize) {}
+
+    // Strings of a streamed scan, straight from the scheduler's merge
+    void OnText(uint64_t address, uint32_t byteLength, std::string_view text, size_t range) override {
+        sink->OnText(address, byteLength, text, (*scanRegions)[range]);
+        if (referenceScan) streamedTexts.push_back(TextOccurrence{address, byteLength, static_cast<uint32_t>(streamedTexts.size())});
+        outputSummary.texts++;
     }
 
-    bool GetMemoryRegions(HANDLE hProcess, HeapInfo& heapInfo) {
-        MEMORY_BASIC_INFORMATION mbi;
-        LPVOID address = 0;
-        int regionCount = 0;
-        int userDataRegions = 0;
+    // Skips pages that are not text before they are scanned; null scans
+    // every page again
+    void SetPageClassifier(const ClassifierThresholds* thresholds) {
+        classifier.reset(thresholds ? new PageClassifier(*thresholds) : nullptr);
+    }
         
-        std::cout << "  Scanning memory regions for user data..." << std::endl;
+    // Drops strings that start in free heap blocks or allocator metadata,
+    // where the process's heaps can be walked
+    void SetLiveTextOnly(bool on) {
+        liveTextOnly = on;
+    }
         
-        while (VirtualQueryEx(hProcess, address, &mbi, sizeof(mbi))) {
-            regionCount++;
-            
-            if (regionCount % 100 == 0) {
-                std::cout << "    Scanned " << regionCount << " regions..." << std::endl;
-            }
+    // On by default: pages that are not resident are left unread and
+    // all-zero pages unscanned. Off, every page of a region is scanned.
+    void SetPageFilters(bool on) {
+        pageFilters = on;
+        textScheduler.SetZeroPageCheck(on);
+    }
+
+    // Off by default: pages outside the working set are read too, since on
+    // Windows they include pages trimmed to the page file. On, they are left
+    // unread, which is faster and misses the strings paged out.
+    void SetWorkingSetOnly(bool on) {
+        workingSetOnly = on;
+    }
             
-            // Focus on memory regions that typically contain user data
-            bool isUserDataRegion = false;
+    // Compiles a rule file; its patterns are then searched for alongside
+    // the text extraction
+    bool LoadPatterns(const std::string& path) {
+        std::string error;
+        if (!patterns.LoadRules(path, error)) {
+            std::cout << error << std::endl;
+            return false;
+        }
+        textScheduler.SetPatterns(&patterns);
+        std::cout << "Loaded " << patterns.RuleCount() << " rules (" << patterns.LiteralStateCount() << " literal states, "
+                  << patterns.RegexStateCount() << " regex states, " << FormatSize(patterns.MemoryUsage()) << ")" << std::endl;
+        return true;
+    }
             
-            if (mbi.State == MEM_COMMIT) {
-                // MEM_PRIVATE - Process heap, stack, and dynamically allocated memory
-                if (mbi.Type == MEM_PRIVATE) {
-                    // Check if it's readable and writable (typical for user data)
-                    if ((mbi.Protect & PAGE_READWRITE) || 
-                        (mbi.Protect & PAGE_READONLY) ||
-                        (mbi.Protect & PAGE_EXECUTE_READ) ||
-                        (mbi.Protect & PAGE_EXECUTE_READWRITE)) {
-                        isUserDataRegion = true;
-                    }
-                }
-                // MEM_MAPPED - Memory-mapped files (could contain user data)
-                else if (mbi.Type == MEM_MAPPED) {
-                    // Focus on smaller mapped regions that might contain user data
-                    if (mbi.RegionSize < 10 * 1024 * 1024) { // Less than 10MB
-                        isUserDataRegion = true;
-                    }
-                }
-            }
+    // Keeps page fingerprints and strings from pass to pass, so that a pass
+    // only rescans the memory that changed. With a path, the snapshot is
+    // loaded from that file if it exists and saved back after every pass.
+    bool EnableSnapshots(const std::string& path) {
+        snapshot.reset(new SnapshotState());
+        snapshotPath = path;
+        if (path.empty() || !std::ifstream(path).good()) return true;
+
+        std::string error;
+        if (!snapshot->Load(path, error)) {
+            std::cout << error << std::endl;
+            return false;
+        }
+        std::cout << "Loaded snapshot " << path << " (" << snapshot->regions.size() << " regions, "
+                  << snapshot->strings.size() << " strings)" << std::endl;
+        return true;
+    }
             
-            if (isUserDataRegion) {
-                heapInfo.regions.push_back(mbi);
-                userDataRegions++;
-                
-                // Extract text from user data regions
-                if (mbi.RegionSize < 1024 * 1024) { // Less than 1MB for performance
-                    std::cout << "    Extracting text from user data region " << userDataRegions 
-                              << " (size: " << FormatSize(mbi.RegionSize) 
-                              << ", type: " << (mbi.Type == MEM_PRIVATE ? "Private" : "Mapped")
-                              << ", protection: 0x" << std::hex << mbi.Protect << std::dec << ")" << std::endl;
-                    ExtractTextFromMemory(hProcess, mbi.BaseAddress, mbi.RegionSize, heapInfo.extractedTexts);
-                }
-            }
+    // Sweeps the memory of every following scan for pointers into the
+    // process's committed regions and the strings found in them
+    void SetReferenceScan(bool on) {
+        referenceScan = on;
+    }
             
-            address = (LPVOID)((DWORD_PTR)mbi.BaseAddress + mbi.RegionSize);
+    // Scans the most promising memory first and stops once seconds have
+    // passed since this call or bytes have been scanned, counted across
+    // all the following scans; 0 leaves either unlimited
+    void SetBudget(double seconds, uint64_t bytes) {
+        budget.reset(new ScanBudget(seconds, bytes));
+    }
+
+    // Adds the strings of every following pass to the index at path, which
+    // is created if it does not exist
+    void EnableIndex(const std::string& path) {
+        indexPath = path;
+    }
             
-            if (address < mbi.BaseAddress) {
-                break; // Overflow occurred
+    // Appends one segment per scanned process to the index, all of them
+    // under a new snapshot ID
+    bool IndexResults() {
+        std::string error;
+        StringIndexWriter writer;
+        if (!writer.Open(indexPath, error)) {
+            std::cout << error << std::endl;
+            return false;
+        }
+        size_t strings = 0;
+        size_t segments = 0;
+        for (const auto& process : processes) {
+            for (const auto& heap : process.heaps) {
+                if (!writer.Append(process.processName, process.processId, heap.regions, heap.extractedTexts,
+                                   heap.occurrences, error)) {
+                    std::cout << error << std::endl;
+                    return false;
+                }
+                strings += heap.extractedTexts.size();
+                segments++;
             }
         }
-        
-        std::cout << "  Total regions scanned: " << regionCount << std::endl;
-        std::cout << "  User data regions found: " << userDataRegions << std::endl;
+        std::cout << "Indexed " << strings << " strings of " << segments << (segments == 1 ? " process" : " processes")
+                  << " as snapshot " << writer.Snapshot() << " in: " << indexPath << std::endl;
         return true;
     }
 
+    // Streams every following result to path in format ("jsonl" or
+    // "binary") as it is found, instead of collecting it for the report
+    bool EnableOutput(const std::string& format, const std::string& path) {
+        std::string error;
+        sink = OpenOutputSink(format, path, error);
+        if (!sink) {
+            std::cout << error << std::endl;
+            return false;
+        }
+        outputPath = path;
+        textScheduler.SetListener(this);
+        return true;
+    }
 
+    // Writes the summary record and closes the streamed output
+    bool FinishOutput() {
+        sink->OnSummary(outputSummary);
+        std::string error;
+        bool ok = sink->Close(error);
+        if (ok) {
+            std::cout << "Results streamed to: " << outputPath << " (" << sink->RecordCount() << " records, "
+                      << FormatSize(sink->BytesWritten()) << ")" << std::endl;
+        } else {
+            std::cout << error << ": " << outputPath << std::endl;
+        }
+        sink.reset();
+        textScheduler.SetListener(nullptr);
+        return ok;
+    }
 
-    std::string FormatSize(SIZE_T size) {
-        const char* units[] = {"B", "KB", "MB", "GB"};
-        int unitIndex = 0;
-        double sizeInUnits = static_cast<double>(size);
+    void ClearResults() {
+        processes.clear();
+    }
         
-        while (sizeInUnits >= 1024.0 && unitIndex < 3) {
-            sizeInUnits /= 1024.0;
-            unitIndex++;
+    bool ExtractHeapData(const ProcessEntry& process) {
+        std::string error;
+        std::unique_ptr<MemorySource> source = OpenProcessMemorySource(process.processId, error);
+        if (!source) {
+            std::cout << error << std::endl;
+            return false;
         }
+        return ExtractFromSource(*source, process.processId, process.name);
+    }
+
+    // Scans every target, up to concurrency of them at a time, with the scan
+    // threads shared out between them. A process's progress is printed when
+    // it is done. A process that cannot be opened or read is recorded with
+    // its error and the batch goes on. Returns how many were scanned.
+    size_t ExtractBatch(const std::vector<ProcessEntry>& targets, size_t concurrency) {
+        concurrency = (std::max)(size_t(1), (std::min)(concurrency, targets.size()));
+        size_t threadsEach = (std::max)(size_t(1), threadCount / concurrency);
+        std::cout << "Scanning " << targets.size() << " processes, " << concurrency << " at a time on "
+                  << threadsEach << " threads each" << std::endl;
+
+        std::vector<ProcessInfo> results(targets.size());
+        std::atomic<size_t> next(0);
+        std::atomic<size_t> scanned(0);
+        std::mutex printMutex;
+        auto runner = [&]() {
+            ScanScheduler scheduler(threadsEach, taskSize);
+            scheduler.SetPatterns(&patterns);
+            scheduler.SetZeroPageCheck(pageFilters);
+            for (size_t t = next++; t < targets.size(); t = next++) {
+                const ProcessEntry& target = targets[t];
+                std::ostringstream log;
+                std::string error;
+                std::unique_ptr<MemorySource> source = OpenProcessMemorySource(target.processId, error);
+                if (!source) {
+                    InitProcessInfo(results[t], target.processId, target.name);
+                    results[t].error = error;
+                } else if (ScanProcess(*source, target.processId, target.name, scheduler, log, results[t])) {
+                    scanned++;
+                }
         
-        std::ostringstream oss;
-        oss << std::fixed << std::setprecision(2) << sizeInUnits << " " << units[unitIndex];
-        return oss.str();
+                std::lock_guard<std::mutex> lock(printMutex);
+                std::cout << "\n[" << t + 1 << "/" << targets.size() << "] " << (target.name.empty() ? "?" : target.name)
+                          << " (PID " << target.processId << ")" << std::endl;
+                std::cout << log.str();
+                if (!results[t].error.empty()) std::cout << "  Skipped: " << results[t].error << std::endl;
+            }
+        };
+
+        std::vector<std::thread> runners;
+        for (size_t r = 1; r < concurrency; r++) runners.emplace_back(runner);
+        runner();
+        for (auto& thread : runners) thread.join();
+
+        for (auto& result : results) processes.push_back(std::move(result));
+        std::cout << "\nScanned " << scanned << " of " << targets.size() << " processes";
+        if (scanned < targets.size()) std::cout << " (" << targets.size() - scanned << " failed)";
+        std::cout << std::endl;
+        return scanned;
     }
 
-public:
-    bool ExtractHeapData(const std::string& processName) {
-        DWORD processId = FindProcessIdByName(processName);
-        if (processId == 0) {
-            std::cout << "Process '" << processName << "' not found!" << std::endl;
+    // Scans a dump written with --write-dump (or any image plus manifest)
+    // instead of a live process.
+    bool ExtractDumpData(const std::string& imagePath, const std::string& manifestPath) {
+        std::string error;
+        std::unique_ptr<MemorySource> source = DumpMemorySource::Open(imagePath, manifestPath, error);
+        if (!source) {
+            std::cout << error << std::endl;
             return false;
         }
 
-        HANDLE hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, processId);
-        if (hProcess == NULL) {
-            std::cout << "Failed to open process. Error: " << GetLastError() << std::endl;
+        ProcessDescription description;
+        source->Describe(description);
+        return ExtractFromSource(*source, 0, description.name);
+    }
+
+    bool WriteDump(DWORD processId, const std::string& imagePath, const std::string& manifestPath) {
+        std::string error;
+        std::unique_ptr<MemorySource> source = OpenProcessMemorySource(processId, error);
+        if (!source || !WriteMemoryDump(*source, imagePath, manifestPath, error)) {
+            std::cout << error << std::endl;
             return false;
         }
+        std::cout << "Dump written to: " << imagePath << " (manifest: " << manifestPath << ")" << std::endl;
+        return true;
+    }
 
+    bool ExtractFromSource(MemorySource& source, DWORD processId, const std::string& processName) {
         ProcessInfo processInfo;
+        bool scanned = ScanProcess(source, processId, processName, textScheduler, std::cout, processInfo);
+        processes.push_back(std::move(processInfo));
+        return scanned;
+    }
+
+    static void InitProcessInfo(ProcessInfo& processInfo, DWORD processId, const std::string& processName) {
         processInfo.processId = processId;
         processInfo.processName = processName;
         processInfo.totalHeapSize = 0;
@@ -315,45 +694,105 @@ public:
         processInfo.totalAllocatedSize = 0;
         processInfo.totalFreeSize = 0;
         processInfo.totalBlockCount = 0;
+    }
+
+    // Fills processInfo from one source with the given scheduler, writing
+    // progress to log. On failure, processInfo.error says why.
+    bool ScanProcess(MemorySource& source, DWORD processId, const std::string& processName,
+                     ScanScheduler& scheduler, std::ostream& log, ProcessInfo& processInfo) {
+        InitProcessInfo(processInfo, processId, processName);
 
-        std::cout << "Getting process memory information..." << std::endl;
+        log << "Getting process memory information..." << std::endl;
         
         // Get process memory information
-        PROCESS_MEMORY_COUNTERS_EX pmc;
-        if (GetProcessMemoryInfo(hProcess, (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc))) {
-            HeapInfo heapInfo;
-            heapInfo.heapHandle = NULL;
-            heapInfo.heapSize = pmc.WorkingSetSize;
-            heapInfo.committedSize = pmc.PagefileUsage;
-            heapInfo.uncommittedSize = pmc.WorkingSetSize - pmc.PagefileUsage;
-            heapInfo.allocatedSize = pmc.PrivateUsage;
-            heapInfo.freeSize = pmc.PagefileUsage - pmc.PrivateUsage;
-            heapInfo.blockCount = 0;
-            
-            std::cout << "Extracting memory regions and text..." << std::endl;
-            GetMemoryRegions(hProcess, heapInfo);
-            std::cout << "Memory extraction completed." << std::endl;
-            processInfo.heaps.push_back(heapInfo);
-            
-            processInfo.totalHeapSize = heapInfo.heapSize;
-            processInfo.totalCommittedSize = heapInfo.committedSize;
-            processInfo.totalAllocatedSize = heapInfo.allocatedSize;
-            processInfo.totalFreeSize = heapInfo.freeSize;
-            processInfo.totalBlockCount = heapInfo.blockCount;
+        ProcessDescription pmc;
+        if (!source.Describe(pmc)) {
+            log << "  Failed to read process information." << std::endl;
+            processInfo.error = "Failed to read process information";
+            return false;
         }
 
-        processes.push_back(processInfo);
-        CloseHandle(hProcess);
+        if (sink) sink->OnProcess(pmc);
+        HeapInfo heapInfo;
+        heapInfo.heapHandle = 0;
+        heapInfo.heapSize = pmc.workingSetSize;
+        heapInfo.committedSize = pmc.pagefileUsage;
+        // The counters come from different accounts (on Linux, the commit
+        // charge stands in for virtual data size, often above the resident
+        // set), so their differences stop at zero rather than wrap
+        heapInfo.uncommittedSize = pmc.workingSetSize > pmc.pagefileUsage ? pmc.workingSetSize - pmc.pagefileUsage : 0;
+        heapInfo.allocatedSize = pmc.privateUsage;
+        heapInfo.freeSize = pmc.pagefileUsage > pmc.privateUsage ? pmc.pagefileUsage - pmc.privateUsage : 0;
+        heapInfo.blockCount = 0;
+        heapInfo.notResidentSkipped = 0;
+        heapInfo.zeroPagesSkipped = 0;
+        heapInfo.notTextSkipped = 0;
+        heapInfo.heapSegments = 0;
+        heapInfo.heapSegmentsWalked = 0;
+        
+        log << "Extracting memory regions and text..." << std::endl;
+        std::vector<MemoryRegion> allRegions;
+        if (!GetMemoryRegions(source, heapInfo, allRegions, log)) {
+            processInfo.error = "Failed to enumerate memory regions";
+            return false;
+        }
+        // Heaps are walked as the scan reads them; snapshot passes only
+        // read what changed and budgeted scans may not read it all, so
+        // they are not
+        std::vector<HeapSegment> segments;
+        std::unique_ptr<HeapWalk> walk;
+        if (!snapshot && !budget && source.EnumerateHeaps(segments) && !segments.empty()) walk.reset(new HeapWalk(segments));
+        if (liveTextOnly && !walk) log << "  No heaps to walk; extracting text from all memory" << std::endl;
+
+        RegionIndex regionIndex;
+        if (referenceScan) {
+            for (const auto& region : allRegions) {
+                if (region.State == MEM_COMMIT) heapInfo.targetRegions.push_back(region);
+            }
+            regionIndex.Build(heapInfo.targetRegions);
+        }
+
+        // Reads may run through small gaps between the regions (see read_planner.h)
+        scheduler.SetRegionMap(allRegions);
+        scheduler.SetHeapWalk(walk.get(), liveTextOnly);
+        scheduler.SetReferenceIndex(&regionIndex);
+        ExtractTextFromMemory(source, heapInfo, scheduler, log);
+        scheduler.SetReferenceIndex(nullptr);
+        scheduler.SetHeapWalk(nullptr);
+        scheduler.ClearRegionMap();
+        if (walk && GetHeapInformation(*walk, segments, heapInfo)) {
+            log << "  Walked " << heapInfo.heapSegmentsWalked << " of " << heapInfo.heapSegments << " heap segments: "
+                << heapInfo.blockCount << " blocks, " << FormatSize(heapInfo.allocatedSize) << " allocated, "
+                << FormatSize(heapInfo.freeSize) << " free" << std::endl;
+        }
+        log << "Memory extraction completed." << std::endl;
+        processInfo.totalHeapSize = heapInfo.heapSize;
+        processInfo.totalCommittedSize = heapInfo.committedSize;
+        processInfo.totalAllocatedSize = heapInfo.allocatedSize;
+        processInfo.totalFreeSize = heapInfo.freeSize;
+        processInfo.totalBlockCount = heapInfo.blockCount;
+
+        processInfo.heaps.push_back(std::move(heapInfo));
         return true;
     }
 
+    const std::string& ProcessName() const {
+        static const std::string none;
+        return processes.empty() ? none : processes.back().processName;
+    }
+
     void PrintHeapReport() {
+        ScopedPhase timer(Phase::Report);
         for (const auto& process : processes) {
             std::cout << "\n" << std::string(80, '=') << std::endl;
             std::cout << "HEAP EXTRACTION REPORT" << std::endl;
             std::cout << std::string(80, '=') << std::endl;
             std::cout << "Process Name: " << process.processName << std::endl;
             std::cout << "Process ID: " << process.processId << std::endl;
+            if (!process.error.empty()) {
+                std::cout << "Error: " << process.error << std::endl;
+                continue;
+            }
             std::cout << "Number of Heaps: " << process.heaps.size() << std::endl;
             std::cout << std::endl;
 
@@ -376,8 +815,16 @@ public:
                 std::cout << "  Allocated: " << FormatSize(heap.allocatedSize) << std::endl;
                 std::cout << "  Free: " << FormatSize(heap.freeSize) << std::endl;
                 std::cout << "  Blocks: " << heap.blockCount << std::endl;
+                std::cout << "  Skipped (not resident): " << FormatSize(heap.notResidentSkipped) << std::endl;
+                std::cout << "  Skipped (zero pages): " << FormatSize(heap.zeroPagesSkipped) << std::endl;
+                std::cout << "  Skipped (not text): " << FormatSize(heap.notTextSkipped) << std::endl;
+                if (heap.pageClasses.Total()) std::cout << "  Page Classes: " << FormatPageClasses(heap.pageClasses) << std::endl;
+                std::cout << "  Heap Segments Walked: " << heap.heapSegmentsWalked << " of " << heap.heapSegments << std::endl;
                 std::cout << "  Memory Regions: " << heap.regions.size() << std::endl;
                 std::cout << "  Extracted Texts: " << heap.extractedTexts.size() << std::endl;
+                if (!patterns.empty()) std::cout << "  Pattern Hits: " << heap.patternHits.size() << std::endl;
+                if (referenceScan) std::cout << "  References: " << heap.references.size() << std::endl;
+                if (budget) std::cout << "  Coverage: " << FormatCoverage(heap.coverage) << std::endl;
                 std::cout << std::endl;
 
                 // Memory regions
@@ -405,16 +852,42 @@ public:
                 // Display extracted texts for this heap
                 if (!heap.extractedTexts.empty()) {
                     std::cout << "  EXTRACTED TEXTS:" << std::endl;
-                    for (size_t j = 0; j < heap.extractedTexts.size(); j++) {
-                        std::cout << "    Text " << j + 1 << ": " << heap.extractedTexts[j] << std::endl;
+                    WriteTextList(std::cout, heap.extractedTexts, "    ");
+                    std::cout << std::endl;
+                }
+
+                if (!heap.patternHits.empty()) {
+                    std::cout << "  PATTERN HITS:" << std::endl;
+                    for (size_t j = 0; j < heap.patternHits.size(); j++) {
+                        std::cout << "    Hit " << j + 1 << ": " << FormatPatternHit(heap, heap.patternHits[j]) << '\n';
                     }
                     std::cout << std::endl;
                 }
+
+                if (referenceScan) {
+                    WriteReferences(std::cout, heap, "  ");
+                    std::cout << std::endl;
+                }
+
+                if (snapshot) {
+                    WriteSnapshotChanges(std::cout, heap, "  ");
+                    std::cout << std::endl;
+                }
+            }
+        }
+    }
+
+    // Just the snapshot sections, for the passes of --watch
+    void PrintSnapshotChanges() {
+        for (const auto& process : processes) {
+            for (const auto& heap : process.heaps) {
+                WriteSnapshotChanges(std::cout, heap, "  ");
             }
         }
     }
 
     void SaveReportToFile(const std::string& filename) {
+        ScopedPhase timer(Phase::Report);
         std::ofstream file(filename);
         if (!file.is_open()) {
             std::cout << "Failed to create report file: " << filename << std::endl;
@@ -425,6 +898,10 @@ public:
             file << "HEAP EXTRACTION REPORT" << std::endl;
             file << "Process Name: " << process.processName << std::endl;
             file << "Process ID: " << process.processId << std::endl;
+            if (!process.error.empty()) {
+                file << "Error: " << process.error << std::endl << std::endl;
+                continue;
+            }
             file << "Number of Heaps: " << process.heaps.size() << std::endl;
             file << std::endl;
 
@@ -444,14 +921,28 @@ public:
                  file << "Allocated: " << FormatSize(heap.allocatedSize) << std::endl;
                  file << "Free: " << FormatSize(heap.freeSize) << std::endl;
                  file << "Blocks: " << heap.blockCount << std::endl;
+                 file << "Skipped (not resident): " << FormatSize(heap.notResidentSkipped) << std::endl;
+                 file << "Skipped (zero pages): " << FormatSize(heap.zeroPagesSkipped) << std::endl;
+                 file << "Skipped (not text): " << FormatSize(heap.notTextSkipped) << std::endl;
+                 if (heap.pageClasses.Total()) file << "Page Classes: " << FormatPageClasses(heap.pageClasses) << std::endl;
+                 file << "Heap Segments Walked: " << heap.heapSegmentsWalked << " of " << heap.heapSegments << std::endl;
                  file << "Extracted Texts: " << heap.extractedTexts.size() << std::endl;
+                 if (!patterns.empty()) file << "Pattern Hits: " << heap.patternHits.size() << std::endl;
+                 if (referenceScan) file << "References: " << heap.references.size() << std::endl;
+                 if (budget) file << "Coverage: " << FormatCoverage(heap.coverage) << std::endl;
                  
                  if (!heap.extractedTexts.empty()) {
                      file << "TEXTS:" << std::endl;
-                     for (size_t j = 0; j < heap.extractedTexts.size(); j++) {
-                         file << "  Text " << j + 1 << ": " << heap.extractedTexts[j] << std::endl;
+                     WriteTextList(file, heap.extractedTexts, "  ");
+                 }
+                 if (!heap.patternHits.empty()) {
+                     file << "PATTERN HITS:" << std::endl;
+                     for (size_t j = 0; j < heap.patternHits.size(); j++) {
+                         file << "  Hit " << j + 1 << ": " << FormatPatternHit(heap, heap.patternHits[j]) << '\n';
                      }
                  }
+                 if (referenceScan) WriteReferences(file, heap, "");
+                 if (snapshot) WriteSnapshotChanges(file, heap, "");
                  file << std::endl;
              }
         }
@@ -461,35 +952,490 @@ public:
     }
 };
 
-int main() {
-    std::cout << "Windows Heap Extractor" << std::endl;
-    std::cout << "======================" << std::endl;
+struct Options {
+    size_t threads;
+    ProcessSelector processes;      // Process name or glob, --pid or --all
+    size_t parallel;                // --parallel: processes of a batch scanned at once (0: as many as threads)
+    size_t memoryBudget;            // --memory-budget: read buffers of all scan threads, in bytes (0: default)
+    std::string dumpImage;          // --dump: scan this image instead of a process
+    std::string dumpManifest;
+    std::string writeDumpImage;     // --write-dump: save the process instead of scanning it
+    std::string writeDumpManifest;
+    std::string rulesPath;          // --rules: search for these patterns too
+    std::string snapshotPath;       // --snapshot: rescan only what changed since the snapshot in this file
+    unsigned long watchSeconds;     // --watch: take a snapshot every this many seconds
+    std::string format;             // --format: text report, or results streamed as jsonl or binary
+    std::string outputPath;         // --output: report or stream file instead of the default
+    bool stats;                     // --stats: print the scan statistics at the end
+    std::string statsJsonPath;      // --stats-json: write them to this file as JSON
+    unsigned long statsInterval;    // --stats-interval: print progress every this many seconds
+    bool allPages;                  // --all-pages: scan pages that are not resident or all zeros too
+    bool workingSetOnly;            // --working-set-only: leave pages outside the working set unread
+    bool inUseOnly;                 // --in-use-only: extract text only from live heap allocations
+    bool classify;                  // --classify: skip pages that are not text
+    ClassifierThresholds thresholds; // --classify-thresholds
+    bool references;                // --references: find the pointers into the process's regions and strings
+    std::string indexPath;          // --index: add the strings of every pass to this index
+    std::string queryIndex;         // --query: search this index for queryText instead of scanning
+    std::string queryText;
+    double timeBudget;              // --time-budget: stop scanning after this many seconds (0: no limit)
+    uint64_t byteBudget;            // --byte-budget: stop scanning after this many bytes (0: no limit)
+};
 
-    WindowsHeapExtractor extractor;
-    std::string processName;
+static void PrintUsage() {
+    std::cout << "Usage: heap_extractor.exe [options] [process name or glob]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --threads N                    Number of scan threads (default: one per CPU)" << std::endl;
+    std::cout << "  --pid PID[,PID...]             Scan the processes with these IDs" << std::endl;
+    std::cout << "  --all                          Scan every process that can be opened" << std::endl;
+    std::cout << "  --parallel N                   Scan up to N processes at a time (default: one per thread)" << std::endl;
+    std::cout << "  --memory-budget MB             Limit the read buffers of all scan threads to MB megabytes" << std::endl;
+    std::cout << "  --dump IMAGE MANIFEST          Scan a memory dump instead of a live process" << std::endl;
+    std::cout << "  --write-dump IMAGE MANIFEST    Save the process memory as a dump and exit" << std::endl;
+    std::cout << "  --rules FILE                   Also report hits of the patterns in FILE (see pattern_engine.h)" << std::endl;
+    std::cout << "  --snapshot FILE                Rescan only pages changed since the snapshot in FILE, report" << std::endl;
+    std::cout << "                                 the strings added and removed, and update FILE" << std::endl;
+    std::cout << "  --watch SECONDS                Take a snapshot every SECONDS until the process exits" << std::endl;
+    std::cout << "  --format text|jsonl|binary     Write a text report (default), or stream the results as JSON" << std::endl;
+    std::cout << "                                 lines or binary records while scanning (see output_sink.h)" << std::endl;
+    std::cout << "  --output FILE                  Write the report or results to FILE" << std::endl;
+    std::cout << "  --all-pages                    Also read pages that are not resident and scan all-zero pages" << std::endl;
+    std::cout << "  --working-set-only             Leave pages outside the working set unread, paged-out ones too" << std::endl;
+    std::cout << "  --in-use-only                  Leave out text in free heap blocks (glibc malloc heaps)" << std::endl;
+    std::cout << "  --classify                     Skip pages of pointers, compressed or binary data" << std::endl;
+    std::cout << "  --classify-thresholds K=V,...  Classify with these thresholds: pointers (fraction of words, default 0.5)," << std::endl;
+    std::cout << "                                 entropy (bits per byte, default 7) and printable (fraction of non-zero bytes, default 0.02)" << std::endl;
+    std::cout << "  --references                   Find pointers into the process's memory regions and strings" << std::endl;
+    std::cout << "  --index FILE                   Add the strings found to the index in FILE, creating it" << std::endl;
+    std::cout << "  --query FILE TEXT              Find the strings that contain TEXT in the index in FILE and exit" << std::endl;
+    std::cout << "  --time-budget SECONDS          Scan the likeliest memory first and stop after SECONDS" << std::endl;
+    std::cout << "  --byte-budget MB               Scan the likeliest memory first and stop after MB megabytes" << std::endl;
+    std::cout << "  --stats                        Print time per phase, counters and read latencies at the end" << std::endl;
+    std::cout << "  --stats-json FILE              Write the same statistics to FILE as JSON" << std::endl;
+    std::cout << "  --stats-interval SECONDS       Print progress every SECONDS while scanning" << std::endl;
+    std::cout << "  --help                         Show this message" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Every process whose name matches is scanned; a name with * or ? is a glob. A process" << std::endl;
+    std::cout << "that cannot be read is reported and skipped. --snapshot, --watch, --write-dump and" << std::endl;
+    std::cout << "--format jsonl|binary take a single process: the first match, or the one given by --pid." << std::endl;
+    std::cout << "Without a process name, --pid, --all or --dump, the name is read from the console." << std::endl;
+}
 
-    std::cout << "Enter process name (e.g., notepad.exe): ";
-    std::getline(std::cin, processName);
+static bool ParseArguments(int argc, char* argv[], Options& options) {
+    options.threads = std::thread::hardware_concurrency();
+    if (options.threads == 0) options.threads = 1;
+    options.watchSeconds = 0;
+    options.format = "text";
+    options.stats = false;
+    options.statsInterval = 0;
+    options.parallel = 0;
+    options.memoryBudget = 0;
+    options.allPages = false;
+    options.workingSetOnly = false;
+    options.inUseOnly = false;
+    options.classify = false;
+    options.references = false;
+    options.timeBudget = 0;
+    options.byteBudget = 0;
+    bool selected = false;
 
-    if (processName.empty()) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::strtoul(argv[++i], NULL, 10);
+            if (options.threads == 0) {
+                std::cout << "Invalid thread count: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--pid" && i + 1 < argc) {
+            std::string error;
+            options.processes.kind = ProcessSelector::PidList;
+            if (!ParsePidList(argv[++i], options.processes.pids, error)) {
+                std::cout << error << std::endl;
+                return false;
+            }
+            if (selected) {
+                std::cout << "Give only one of a process name, --pid and --all" << std::endl;
+                return false;
+            }
+            selected = true;
+        } else if (arg == "--all") {
+            if (selected) {
+                std::cout << "Give only one of a process name, --pid and --all" << std::endl;
+                return false;
+            }
+            options.processes.kind = ProcessSelector::All;
+            selected = true;
+        } else if (arg == "--parallel" && i + 1 < argc) {
+            options.parallel = std::strtoul(argv[++i], NULL, 10);
+            if (options.parallel == 0) {
+                std::cout << "Invalid process count: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--memory-budget" && i + 1 < argc) {
+            options.memoryBudget = std::strtoul(argv[++i], NULL, 10) * 1024 * 1024;
+            if (options.memoryBudget == 0) {
+                std::cout << "Invalid memory budget: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--dump" && i + 2 < argc) {
+            options.dumpImage = argv[++i];
+            options.dumpManifest = argv[++i];
+        } else if (arg == "--write-dump" && i + 2 < argc) {
+            options.writeDumpImage = argv[++i];
+            options.writeDumpManifest = argv[++i];
+        } else if (arg == "--rules" && i + 1 < argc) {
+            options.rulesPath = argv[++i];
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            options.snapshotPath = argv[++i];
+        } else if (arg == "--watch" && i + 1 < argc) {
+            options.watchSeconds = std::strtoul(argv[++i], NULL, 10);
+            if (options.watchSeconds == 0) {
+                std::cout << "Invalid watch interval: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--format" && i + 1 < argc) {
+            options.format = argv[++i];
+            if (options.format != "text" && options.format != "jsonl" && options.format != "binary") {
+                std::cout << "Unknown output format: " << options.format << std::endl;
+                return false;
+            }
+        } else if (arg == "--output" && i + 1 < argc) {
+            options.outputPath = argv[++i];
+        } else if (arg == "--all-pages") {
+            options.allPages = true;
+        } else if (arg == "--working-set-only") {
+            options.workingSetOnly = true;
+        } else if (arg == "--in-use-only") {
+            options.inUseOnly = true;
+        } else if (arg == "--classify") {
+            options.classify = true;
+        } else if (arg == "--classify-thresholds" && i + 1 < argc) {
+            std::string error;
+            if (!PageClassifier::ParseThresholds(argv[++i], options.thresholds, error)) {
+                std::cout << error << std::endl;
+                return false;
+            }
+            options.classify = true;
+        } else if (arg == "--references") {
+            options.references = true;
+        } else if (arg == "--index" && i + 1 < argc) {
+            options.indexPath = argv[++i];
+        } else if (arg == "--query" && i + 2 < argc) {
+            options.queryIndex = argv[++i];
+            options.queryText = argv[++i];
+            if (options.queryText.empty()) {
+                std::cout << "Query text cannot be empty!" << std::endl;
+                return false;
+            }
+        } else if (arg == "--time-budget" && i + 1 < argc) {
+            options.timeBudget = std::strtod(argv[++i], NULL);
+            if (!(options.timeBudget > 0)) {
+                std::cout << "Invalid time budget: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--byte-budget" && i + 1 < argc) {
+            options.byteBudget = std::strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+            if (options.byteBudget == 0) {
+                std::cout << "Invalid byte budget: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else if (arg == "--stats-json" && i + 1 < argc) {
+            options.statsJsonPath = argv[++i];
+        } else if (arg == "--stats-interval" && i + 1 < argc) {
+            options.statsInterval = std::strtoul(argv[++i], NULL, 10);
+            if (options.statsInterval == 0) {
+                std::cout << "Invalid statistics interval: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--help" || arg == "-h") {
+            PrintUsage();
+            return false;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            std::cout << "Unknown option: " << arg << std::endl;
+            PrintUsage();
+            return false;
+        } else {
+            if (selected) {
+                std::cout << "Give only one of a process name, --pid and --all" << std::endl;
+                return false;
+            }
+            options.processes.kind = IsGlob(arg) ? ProcessSelector::Glob : ProcessSelector::Name;
+            options.processes.name = arg;
+            selected = true;
+        }
+    }
+
+    if (!options.queryIndex.empty() && (selected || !options.dumpImage.empty() || !options.writeDumpImage.empty() ||
+                                        !options.indexPath.empty())) {
+        std::cout << "--query does not scan; it cannot be combined with a process selection, --dump, --write-dump or --index" << std::endl;
+        return false;
+    }
+    if (!options.indexPath.empty() && (options.format != "text" || !options.writeDumpImage.empty())) {
+        std::cout << "--index needs --format text and cannot be combined with --write-dump" << std::endl;
+        return false;
+    }
+    if (!options.dumpImage.empty() && (selected || !options.writeDumpImage.empty())) {
+        std::cout << "--dump cannot be combined with a process selection or --write-dump" << std::endl;
+        return false;
+    }
+    if (options.processes.IsBatch() && (options.watchSeconds || !options.snapshotPath.empty() ||
+                                        !options.writeDumpImage.empty() || options.format != "text")) {
+        std::cout << "--snapshot, --watch, --write-dump and --format jsonl|binary take a single process" << std::endl;
+        return false;
+    }
+    if (options.watchSeconds && !options.dumpImage.empty()) {
+        std::cout << "--watch needs a live process, not --dump" << std::endl;
+        return false;
+    }
+    if ((options.watchSeconds || !options.snapshotPath.empty()) && !options.writeDumpImage.empty()) {
+        std::cout << "--snapshot and --watch cannot be combined with --write-dump" << std::endl;
+        return false;
+    }
+    if (options.references && (options.watchSeconds || !options.snapshotPath.empty())) {
+        std::cout << "--references cannot be combined with --snapshot or --watch" << std::endl;
+        return false;
+    }
+    if ((options.timeBudget > 0 || options.byteBudget) &&
+        (options.watchSeconds || !options.snapshotPath.empty() || !options.writeDumpImage.empty() || options.inUseOnly)) {
+        std::cout << "--time-budget and --byte-budget cannot be combined with --snapshot, --watch, --write-dump or --in-use-only" << std::endl;
+        return false;
+    }
+    if (options.format != "text" && (options.watchSeconds || !options.snapshotPath.empty())) {
+        std::cout << "--snapshot and --watch need --format text" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Chunk size that keeps the read buffers of threads scan threads within
+// budget, from 64 KB up to the default 1 MB
+static size_t TaskSizeForBudget(size_t budget, size_t threads) {
+    if (budget == 0) return ScanScheduler::kDefaultTaskSize;
+    size_t perTask = budget / (ScanScheduler::kDefaultPipelineDepth * threads);
+    perTask = perTask > ScanScheduler::kTaskOverlap ? perTask - ScanScheduler::kTaskOverlap : 0;
+    return (std::min)(ScanScheduler::kDefaultTaskSize, (std::max)(static_cast<size_t>(64 * 1024), perTask));
+}
+
+// Prints every string in the index that contains text, oldest snapshot first
+static int QueryIndex(const std::string& path, const std::string& text) {
+    auto start = std::chrono::steady_clock::now();
+    StringIndex index;
+    std::string error;
+    if (!index.Open(path, error)) {
+        std::cout << error << std::endl;
+        return 1;
+    }
+
+    size_t matches = 0;
+    size_t matchingSegments = 0;
+    std::vector<uint32_t> ids;
+    std::vector<uint32_t> scratch;
+    std::ostringstream results;
+    for (const auto& segment : index.Segments()) {
+        ids.clear();
+        segment.Find(text, ids, scratch);
+        if (ids.empty()) continue;
+        matchingSegments++;
+        matches += ids.size();
+
+        std::time_t time = static_cast<std::time_t>(segment.Time());
+        results << "\nSnapshot " << segment.Snapshot() << " (" << std::put_time(std::localtime(&time), "%Y-%m-%d %H:%M:%S")
+                << "), " << segment.ProcessName() << " (PID " << segment.ProcessId() << "): " << ids.size()
+                << (ids.size() == 1 ? " string" : " strings") << std::endl;
+        for (uint32_t id : ids) {
+            const IndexOccurrence* first = segment.OccurrencesBegin(id);
+            size_t count = static_cast<size_t>(segment.OccurrencesEnd(id) - first);
+            results << "  " << segment.String(id) << std::endl;
+            if (count == 0) continue;
+            results << "    " << count << (count == 1 ? " occurrence" : " occurrences") << ", first at 0x" << std::hex
+                    << first->address;
+            if (const IndexRegion* region = segment.Region(*first)) {
+                results << " in region 0x" << region->base << std::dec << " ("
+                        << (region->type == MEM_PRIVATE ? "Private" : "Mapped") << ", " << FormatSize(region->size) << ")";
+            }
+            results << std::dec << std::endl;
+        }
+    }
+    double ms = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000.0;
+
+    std::cout << results.str();
+    std::cout << "\nFound " << matches << (matches == 1 ? " string" : " strings") << " containing \"" << text << "\" in "
+              << matchingSegments << " of " << index.Segments().size() << " segments (" << FormatSize(index.SizeBytes())
+              << " index) in " << std::fixed << std::setprecision(1) << ms << " ms" << std::endl;
+    return 0;
+}
+
+static int Run(const Options& options) {
+    if (!options.queryIndex.empty()) {
+        return QueryIndex(options.queryIndex, options.queryText);
+    }
+
+    // A batch can run more scan threads than --threads when it scans more
+    // processes at once, since every process gets one at least
+    size_t totalThreads = (std::max)(options.threads, options.parallel);
+    HeapExtractor extractor(options.threads, TaskSizeForBudget(options.memoryBudget, totalThreads));
+    extractor.SetPageFilters(!options.allPages);
+    extractor.SetWorkingSetOnly(options.workingSetOnly);
+    extractor.SetLiveTextOnly(options.inUseOnly);
+    extractor.SetPageClassifier(options.classify ? &options.thresholds : nullptr);
+    extractor.SetReferenceScan(options.references);
+    if (options.timeBudget > 0 || options.byteBudget) extractor.SetBudget(options.timeBudget, options.byteBudget);
+    if (!options.rulesPath.empty() && !extractor.LoadPatterns(options.rulesPath)) {
+        return 1;
+    }
+    if ((options.watchSeconds || !options.snapshotPath.empty()) && !extractor.EnableSnapshots(options.snapshotPath)) {
+        return 1;
+    }
+    bool indexed = !options.indexPath.empty();
+    if (indexed) extractor.EnableIndex(options.indexPath);
+
+    bool streaming = options.format != "text";
+    const char* extension = options.format == "jsonl" ? ".jsonl" : options.format == "binary" ? ".bin" : ".txt";
+
+    if (!options.dumpImage.empty()) {
+        std::cout << "\nScanning dump: " << options.dumpImage << std::endl;
+        // Named like the report of a dump: after the image file
+        std::string filename = options.outputPath;
+        if (filename.empty()) {
+            size_t slash = options.dumpImage.find_last_of("/\\");
+            filename = options.dumpImage.substr(slash == std::string::npos ? 0 : slash + 1) + "_heap_report" + extension;
+        }
+        if (streaming && !extractor.EnableOutput(options.format, filename)) {
+            return 1;
+        }
+        if (!extractor.ExtractDumpData(options.dumpImage, options.dumpManifest)) {
+            std::cout << "Failed to extract heap data!" << std::endl;
+            if (streaming) extractor.FinishOutput();
+            return 1;
+        }
+        if (streaming) return extractor.FinishOutput() ? 0 : 1;
+        extractor.PrintHeapReport();
+        extractor.SaveReportToFile(filename);
+        return indexed && !extractor.IndexResults() ? 1 : 0;
+    }
+
+    ProcessSelector selector = options.processes;
+    bool interactive = selector.kind == ProcessSelector::Name && selector.name.empty();
+
+    if (interactive) {
+        std::cout << "Enter process name (e.g., notepad.exe): ";
+        std::getline(std::cin, selector.name);
+        if (IsGlob(selector.name)) selector.kind = ProcessSelector::Glob;
+    }
+
+    if (selector.kind == ProcessSelector::Name && selector.name.empty()) {
         std::cout << "Process name cannot be empty!" << std::endl;
         return 1;
     }
 
-    std::cout << "\nSearching for process: " << processName << std::endl;
-    std::cout << "Extracting heap data..." << std::endl;
+    // The process list is taken once; every lookup of this run uses it
+    std::cout << "\nSearching for " << (selector.kind == ProcessSelector::Name ? "process: " : "") << selector.Describe() << std::endl;
+    std::vector<ProcessEntry> targets = selector.Select(EnumerateProcesses());
+    if (targets.empty()) {
+        std::cout << "No process matches '" << selector.Describe() << "'!" << std::endl;
+        return 1;
+    }
 
-    if (extractor.ExtractHeapData(processName)) {
+    // Named after the process, or "batch" when a run is meant to cover several
+    std::string reportName = selector.kind == ProcessSelector::Name ? selector.name
+                           : selector.IsBatch() ? std::string("batch")
+                           : targets[0].name.empty() ? "pid" + std::to_string(targets[0].processId) : targets[0].name;
+    std::string filename = options.outputPath.empty() ? reportName + "_heap_report" + extension : options.outputPath;
+
+    bool singleProcess = options.watchSeconds || !options.snapshotPath.empty() || !options.writeDumpImage.empty() || streaming;
+    if (!singleProcess && (selector.IsBatch() || targets.size() > 1)) {
+        size_t concurrency = options.parallel ? options.parallel : options.threads;
+        size_t scanned = extractor.ExtractBatch(targets, concurrency);
         extractor.PrintHeapReport();
+        extractor.SaveReportToFile(filename);
+        if (indexed && scanned && !extractor.IndexResults()) return 1;
+        return scanned ? 0 : 1;
+    }
+
+    const ProcessEntry& target = targets[0];
+    std::cout << "Process found: " << target.processId << std::endl;
+    if (targets.size() > 1) {
+        std::cout << targets.size() << " processes match; scanning the first (choose another with --pid)" << std::endl;
+    }
+
+    if (!options.writeDumpImage.empty()) {
+        return extractor.WriteDump(target.processId, options.writeDumpImage, options.writeDumpManifest) ? 0 : 1;
+    }
+
+    std::cout << "Extracting heap data..." << std::endl;
+
+    if (options.watchSeconds) {
+        // Every pass after the first rescans only what changed; the report
+        // file always holds the latest one
+        for (int pass = 1;; pass++) {
+            std::cout << "\nSnapshot " << pass << ":" << std::endl;
+            extractor.ClearResults();
+            if (!extractor.ExtractHeapData(target)) {
+                std::cout << (pass == 1 ? "Failed to extract heap data!" : "Process is gone; watch ended.") << std::endl;
+                return pass == 1 ? 1 : 0;
+            }
+            extractor.PrintSnapshotChanges();
+            extractor.SaveReportToFile(filename);
+            if (indexed) extractor.IndexResults();
+            std::this_thread::sleep_for(std::chrono::seconds(options.watchSeconds));
+        }
+    }
         
-        std::string filename = processName + "_heap_report.txt";
+    if (streaming) {
+        // Records reach the file while the scan runs; there is no report
+        if (!extractor.EnableOutput(options.format, filename)) {
+            return 1;
+        }
+        bool extracted = extractor.ExtractHeapData(target);
+        if (!extracted) std::cout << "Failed to extract heap data!" << std::endl;
+        if (!extractor.FinishOutput() || !extracted) return 1;
+    } else if (extractor.ExtractHeapData(target)) {
+        extractor.PrintHeapReport();
         extractor.SaveReportToFile(filename);
+        if (indexed && !extractor.IndexResults()) return 1;
     } else {
         std::cout << "Failed to extract heap data!" << std::endl;
         return 1;
     }
 
-    std::cout << "\nPress Enter to exit...";
-    std::cin.get();
+    if (interactive) {
+        std::cout << "\nPress Enter to exit...";
+        std::cin.get();
+    }
     return 0;
 }
+
+int main(int argc, char* argv[]) {
+    std::cout << "Windows Heap Extractor" << std::endl;
+    std::cout << "======================" << std::endl;
+
+    Options options;
+    if (!ParseArguments(argc, argv, options)) {
+        return 1;
+    }
+
+    TelemetryReporter reporter;
+    if (options.statsInterval) reporter.Start(options.statsInterval);
+    int result = Run(options);
+    reporter.Stop();
+
+    TelemetrySnapshot stats = Telemetry::Capture();
+    if (options.stats) {
+        std::cout << std::endl;
+        WriteTelemetryTable(std::cout, stats);
+    }
+    if (!options.statsJsonPath.empty()) {
+        std::ofstream file(options.statsJsonPath);
+        WriteTelemetryJson(file, stats);
+        if (file.good()) {
+            std::cout << "Statistics saved to: " << options.statsJsonPath << std::endl;
+        } else {
+            std::cout << "Failed to write statistics to: " << options.statsJsonPath << std::endl;
+        }
+    }
+    return result;
+}
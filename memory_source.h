@@ -0,0 +1,281 @@
+#pragma once
+
+// Where process memory comes from.
+//
+// A MemorySource enumerates the regions of an address space, reads ranges
+// of it and describes the process it belongs to. The scanning code only
+// talks to this interface; memory_source_win32.h and memory_source_linux.h
+// implement it for live processes on each platform.
+//
+// Regions use the Win32 vocabulary (MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE,
+// ...) on every platform; other backends translate into it.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+typedef uint32_t DWORD;
+typedef size_t SIZE_T;
+
+#define MEM_COMMIT 0x1000
+#define MEM_RESERVE 0x2000
+#define MEM_FREE 0x10000
+#define MEM_PRIVATE 0x20000
+#define MEM_MAPPED 0x40000
+#define MEM_IMAGE 0x1000000
+
+#define PAGE_NOACCESS 0x01
+#define PAGE_READONLY 0x02
+#define PAGE_READWRITE 0x04
+#define PAGE_WRITECOPY 0x08
+#define PAGE_EXECUTE 0x10
+#define PAGE_EXECUTE_READ 0x20
+#define PAGE_EXECUTE_READWRITE 0x40
+#define PAGE_EXECUTE_WRITECOPY 0x80
+#define PAGE_GUARD 0x100
+#endif
+
+// Mirrors the MEMORY_BASIC_INFORMATION fields the scanner uses.
+struct MemoryRegion {
+    uint64_t BaseAddress;
+    uint64_t RegionSize;
+    DWORD State;
+    DWORD Type;
+    DWORD Protect;
+};
+
+// Why the extractor does or does not scan a region for user data.
+enum class RegionClass {
+    UserData,           // Committed private memory that is readable, or a mapped view under 10 MB
+    NotCommitted,
+    Unreadable,         // Private memory without read access
+    Image,              // Executable images, and anything else neither private nor mapped
+    LargeMapping,       // Mapped views of 10 MB and more
+};
+
+inline RegionClass ClassifyRegion(const MemoryRegion& region) {
+    if (region.State != MEM_COMMIT) return RegionClass::NotCommitted;
+    if (region.Type == MEM_PRIVATE) {
+        bool readable = (region.Protect & PAGE_READWRITE) || (region.Protect & PAGE_READONLY) ||
+                        (region.Protect & PAGE_EXECUTE_READ) || (region.Protect & PAGE_EXECUTE_READWRITE);
+        return readable ? RegionClass::UserData : RegionClass::Unreadable;
+    }
+    if (region.Type != MEM_MAPPED) return RegionClass::Image;
+    return region.RegionSize < 10 * 1024 * 1024 ? RegionClass::UserData : RegionClass::LargeMapping;
+}
+
+// Whether the extractor scans a region: heaps, stacks and other dynamic
+// allocations, and small mapped views.
+inline bool IsUserDataRegion(const MemoryRegion& region) {
+    return ClassifyRegion(region) == RegionClass::UserData;
+}
+
+// Mirrors the PROCESS_MEMORY_COUNTERS_EX fields the report uses.
+struct ProcessDescription {
+    DWORD processId;
+    std::string name;
+    uint64_t workingSetSize;
+    uint64_t pagefileUsage;
+    uint64_t privateUsage;
+};
+
+struct ProcessEntry {
+    DWORD processId;
+    std::string name;
+};
+
+// Allocators whose heaps heap_walker.h knows about
+enum class HeapKind {
+    GlibcMalloc,        // An arena heap of glibc malloc: [heap], or an mmapped heap of another arena
+    NtHeap,             // Windows NT heap segments
+    SegmentHeap,        // Windows segment heap
+};
+
+// Memory one allocator carves its blocks out of
+struct HeapSegment {
+    uint64_t address;
+    uint64_t size;
+    HeapKind kind;
+};
+
+struct ReadRequest {
+    uint64_t address;
+    char* buffer;
+    size_t size;
+    size_t bytesRead;   // Set by the source; less than size on a partial read
+};
+
+class MemorySource {
+public:
+    // The page size residency is reported in
+    static const uint64_t kPageSize = 4096;
+
+    virtual ~MemorySource() {}
+
+    // Fills regions with the whole address space in ascending address order.
+    virtual bool EnumerateRegions(std::vector<MemoryRegion>& regions) = 0;
+
+    // Reads up to size bytes at address and returns the bytes read (0 on
+    // failure). Must be safe to call from several threads at once.
+    virtual size_t Read(uint64_t address, char* buffer, size_t size) = 0;
+
+    virtual bool Describe(ProcessDescription& description) = 0;
+
+    // Reads several ranges. Backends that can, override this to fetch the
+    // whole batch in as few system calls as possible.
+    virtual void ReadBatch(ReadRequest* requests, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            requests[i].bytesRead = Read(requests[i].address, requests[i].buffer, requests[i].size);
+        }
+    }
+
+    // Fills heaps with the allocator heaps of the address space, in
+    // ascending address order, so that their blocks can be walked. Returns
+    // false when the source cannot tell.
+    virtual bool EnumerateHeaps(std::vector<HeapSegment>& heaps) {
+        (void)heaps;
+        return false;
+    }
+
+    // Sets resident[i] to whether page i of the page-aligned range at
+    // address may hold data, so that private pages known to read as zeros
+    // can be skipped without reading them. Returns false when the source
+    // cannot tell; then every page has to be read.
+    virtual bool QueryResidency(uint64_t address, uint64_t size, std::vector<uint8_t>& resident) {
+        (void)address;
+        (void)size;
+        (void)resident;
+        return false;
+    }
+
+    // Like QueryResidency, but may also count pages that hold data
+    // elsewhere, such as pages trimmed to the page file, as not resident.
+    // Sources that only know which pages are in memory (the working set on
+    // Windows) implement this alone.
+    virtual bool QueryWorkingSet(uint64_t address, uint64_t size, std::vector<uint8_t>& resident) {
+        return QueryResidency(address, size, resident);
+    }
+
+    // Sources whose memory is already addressable here (a mapped dump)
+    // return a pointer to it, so callers can scan it without a copy. size is
+    // clipped to the bytes available at address. Returns NULL otherwise.
+    virtual const char* View(uint64_t address, size_t& size) {
+        (void)address;
+        (void)size;
+        return NULL;
+    }
+};
+
+// Memory that is already in this process: a snapshot laid out as regions
+// back to back in one buffer, or at the given offsets into it. Regions that
+// are not committed hold no bytes.
+class BufferMemorySource : public MemorySource {
+public:
+    static constexpr uint64_t kNoData = ~static_cast<uint64_t>(0);
+
+    BufferMemorySource(const char* data, const std::vector<MemoryRegion>& regions, const std::string& name)
+        : data(data), regions(regions), name(name) {
+        uint64_t offset = 0;
+        for (const auto& region : regions) {
+            offsets.push_back(offset);
+            offset += region.RegionSize;
+        }
+        dataSize = offset;
+    }
+
+    BufferMemorySource(const char* data, uint64_t dataSize, const std::vector<MemoryRegion>& regions,
+                       const std::vector<uint64_t>& offsets, const std::string& name)
+        : data(data), dataSize(dataSize), regions(regions), offsets(offsets), name(name) {}
+
+    bool EnumerateRegions(std::vector<MemoryRegion>& out) override {
+        out = regions;
+        return true;
+    }
+
+    // Like a process read, a range may run on through adjacent regions
+    size_t Read(uint64_t address, char* buffer, size_t size) override {
+        size_t total = 0;
+        while (total < size) {
+            size_t chunk = size - total;
+            const char* source = ViewRegion(address + total, chunk);
+            if (source == NULL) break;
+            std::memcpy(buffer + total, source, chunk);
+            total += chunk;
+        }
+        return total;
+    }
+
+    // Adjacent regions stored back to back in the buffer are one view
+    const char* View(uint64_t address, size_t& size) override {
+        size_t available = size;
+        const char* view = ViewRegion(address, available);
+        if (view == NULL) return NULL;
+        while (available < size) {
+            size_t more = size - available;
+            if (ViewRegion(address + available, more) != view + available) break;
+            available += more;
+        }
+        size = available;
+        return view;
+    }
+
+    bool Describe(ProcessDescription& description) override {
+        description.processId = 0;
+        description.name = name;
+        description.workingSetSize = 0;
+        description.pagefileUsage = 0;
+        description.privateUsage = 0;
+        for (const auto& region : regions) {
+            if (region.State != MEM_COMMIT) continue;
+            description.workingSetSize += region.RegionSize;
+            description.pagefileUsage += region.RegionSize;
+            if (region.Type == MEM_PRIVATE) description.privateUsage += region.RegionSize;
+        }
+        return true;
+    }
+
+private:
+    // The bytes at address up to the end of its region
+    const char* ViewRegion(uint64_t address, size_t& size) const {
+        size_t index = FindRegion(address);
+        if (index == regions.size() || offsets[index] == kNoData || regions[index].State != MEM_COMMIT) return NULL;
+        uint64_t offset = offsets[index] + (address - regions[index].BaseAddress);
+        uint64_t regionEnd = offsets[index] + regions[index].RegionSize;
+        uint64_t end = regionEnd < dataSize ? regionEnd : dataSize;
+        if (offset >= end) return NULL;
+        if (size > end - offset) size = static_cast<size_t>(end - offset);
+        return data + offset;
+    }
+
+    size_t FindRegion(uint64_t address) const {
+        size_t lo = 0, hi = regions.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (regions[mid].BaseAddress + regions[mid].RegionSize <= address) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo < regions.size() && regions[lo].BaseAddress <= address) return lo;
+        return regions.size();
+    }
+
+    const char* data;
+    uint64_t dataSize;
+    std::vector<MemoryRegion> regions;
+    std::vector<uint64_t> offsets;
+    std::string name;
+};
+
+// Each platform backend provides:
+//   std::vector<ProcessEntry> EnumerateProcesses();
+//   std::unique_ptr<MemorySource> OpenProcessMemorySource(DWORD processId, std::string& error);
+#ifdef _WIN32
+#include "memory_source_win32.h"
+#else
+#include "memory_source_linux.h"
+#endif
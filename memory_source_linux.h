@@ -0,0 +1,386 @@
+#pragma once
+
+// Live-process backend for Linux: regions come from /proc/<pid>/maps and
+// memory is read with batched process_vm_readv calls, falling back to
+// pread on /proc/<pid>/mem where that system call is unavailable. Page
+// residency comes from /proc/<pid>/pagemap.
+
+#include "memory_source.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// The name a process was started as: argv[0] without its directory, which
+// is what users type (a "python3" symlink rather than "python3.11").
+inline std::string ProcessNameFromProc(const std::string& procDir) {
+    std::ifstream cmdline(procDir + "/cmdline");
+    std::string argv0;
+    std::getline(cmdline, argv0, '\0');
+    if (argv0.empty()) {
+        char path[PATH_MAX];
+        ssize_t length = readlink((procDir + "/exe").c_str(), path, sizeof(path) - 1);
+        if (length > 0) argv0.assign(path, static_cast<size_t>(length));
+    }
+    if (!argv0.empty()) {
+        size_t slash = argv0.rfind('/');
+        return slash == std::string::npos ? argv0 : argv0.substr(slash + 1);
+    }
+
+    // Kernel threads only expose comm
+    std::ifstream comm(procDir + "/comm");
+    std::string name;
+    std::getline(comm, name);
+    return name;
+}
+
+inline std::vector<ProcessEntry> EnumerateProcesses() {
+    std::vector<ProcessEntry> processes;
+    DIR* proc = opendir("/proc");
+    if (proc == NULL) {
+        return processes;
+    }
+
+    while (struct dirent* entry = readdir(proc)) {
+        const char* name = entry->d_name;
+        if (*name == '\0' || strspn(name, "0123456789") != strlen(name)) continue;
+
+        ProcessEntry process;
+        process.processId = static_cast<DWORD>(strtoul(name, NULL, 10));
+        process.name = ProcessNameFromProc(std::string("/proc/") + name);
+        processes.push_back(process);
+    }
+
+    closedir(proc);
+    return processes;
+}
+
+inline bool ProcessNameMatches(const std::string& processName, const std::string& pattern) {
+    return strcasecmp(processName.c_str(), pattern.c_str()) == 0;
+}
+
+// Page frame number of the shared zero page, which private pages that were
+// read but never written map to; 0 when pagemap hides frame numbers (they
+// are shown only to privileged readers) or the lookup fails. Found by
+// reading an anonymous page of our own and looking it up.
+inline uint64_t ZeroPageFrame() {
+    static const uint64_t frame = [] {
+        uint64_t found = 0;
+        void* page = mmap(NULL, MemorySource::kPageSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED) return found;
+        volatile const char* touch = static_cast<const char*>(page);
+        (void)*touch;
+        int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            uint64_t entry = 0;
+            off_t offset = static_cast<off_t>(reinterpret_cast<uintptr_t>(page) / MemorySource::kPageSize * 8);
+            if (pread(fd, &entry, sizeof(entry), offset) == sizeof(entry) && (entry >> 63)) {
+                found = entry & ((1ull << 55) - 1);
+            }
+            close(fd);
+        }
+        munmap(page, MemorySource::kPageSize);
+        return found;
+    }();
+    return frame;
+}
+
+class LinuxProcessMemorySource : public MemorySource {
+public:
+    static constexpr size_t kMaxIovecs = 1024;
+
+    explicit LinuxProcessMemorySource(pid_t pid)
+        : pid(pid), procDir("/proc/" + std::to_string(pid)), useProcMem(false) {
+        memFd = open((procDir + "/mem").c_str(), O_RDONLY | O_CLOEXEC);
+        pagemapFd = open((procDir + "/pagemap").c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    ~LinuxProcessMemorySource() override {
+        if (memFd >= 0) close(memFd);
+        if (pagemapFd >= 0) close(pagemapFd);
+    }
+
+    // Anonymous and [heap]/[stack] mappings are reported as MEM_PRIVATE,
+    // shared and file mappings as MEM_MAPPED, and mappings of files that
+    // are also mapped executable (binaries and libraries) as MEM_IMAGE.
+    // Inaccessible (---p) mappings are reported as MEM_RESERVE. Unmapped
+    // gaps are not listed.
+    bool EnumerateRegions(std::vector<MemoryRegion>& regions) override {
+        std::ifstream maps(procDir + "/maps");
+        if (!maps.is_open()) {
+            return false;
+        }
+
+        struct Mapping {
+            MemoryRegion region;
+            std::string perms;
+            std::string path;
+            unsigned long long inode;
+        };
+        std::vector<Mapping> mappings;
+        std::set<std::string> executableFiles;
+
+        std::string line;
+        while (std::getline(maps, line)) {
+            unsigned long long start, end, offset, inode;
+            unsigned int major, minor;
+            char perms[5] = {0};
+            int pathStart = 0;
+            if (sscanf(line.c_str(), "%llx-%llx %4s %llx %x:%x %llu %n",
+                       &start, &end, perms, &offset, &major, &minor, &inode, &pathStart) < 7) {
+                continue;
+            }
+
+            Mapping mapping;
+            mapping.region.BaseAddress = start;
+            mapping.region.RegionSize = end - start;
+            mapping.perms = perms;
+            mapping.path = pathStart > 0 ? line.substr(static_cast<size_t>(pathStart)) : std::string();
+            mapping.inode = inode;
+            if (perms[2] == 'x' && inode != 0) executableFiles.insert(mapping.path);
+            mappings.push_back(mapping);
+        }
+
+        for (auto& mapping : mappings) {
+            MemoryRegion& region = mapping.region;
+            bool readable = mapping.perms[0] == 'r';
+            bool writable = mapping.perms[1] == 'w';
+            bool executable = mapping.perms[2] == 'x';
+            bool shared = mapping.perms[3] == 's';
+
+            if (!readable && !writable && !executable) {
+                region.State = MEM_RESERVE;
+                region.Protect = 0;
+            } else {
+                region.State = MEM_COMMIT;
+                if (executable) {
+                    region.Protect = writable ? PAGE_EXECUTE_READWRITE : (readable ? PAGE_EXECUTE_READ : PAGE_EXECUTE);
+                } else {
+                    region.Protect = writable ? PAGE_READWRITE : PAGE_READONLY;
+                }
+            }
+
+            if (mapping.path.empty()) {
+                region.Type = shared ? MEM_MAPPED : MEM_PRIVATE;
+            } else if (mapping.path[0] == '[') {
+                bool special = mapping.path == "[vvar]" || mapping.path == "[vdso]" ||
+                               mapping.path == "[vsyscall]" || mapping.path.compare(0, 6, "[vvar_") == 0;
+                region.Type = special ? MEM_IMAGE : MEM_PRIVATE;
+            } else if (executableFiles.count(mapping.path)) {
+                region.Type = MEM_IMAGE;
+            } else {
+                region.Type = MEM_MAPPED;
+            }
+            regions.push_back(region);
+        }
+        return !regions.empty();
+    }
+
+    size_t Read(uint64_t address, char* buffer, size_t size) override {
+        ReadRequest request;
+        request.address = address;
+        request.buffer = buffer;
+        request.size = size;
+        request.bytesRead = 0;
+        ReadBatch(&request, 1);
+        return request.bytesRead;
+    }
+
+    // One process_vm_readv call covers up to kMaxIovecs requests. The call
+    // stops at the first unreadable byte, so the batch is resumed after the
+    // request it stopped in.
+    void ReadBatch(ReadRequest* requests, size_t count) override {
+        struct iovec local[kMaxIovecs];
+        struct iovec remote[kMaxIovecs];
+
+        size_t i = 0;
+        while (i < count) {
+            if (useProcMem.load(std::memory_order_relaxed)) {
+                requests[i].bytesRead = ReadProcMem(requests[i].address, requests[i].buffer, requests[i].size);
+                i++;
+                continue;
+            }
+
+            size_t batch = (std::min)(count - i, kMaxIovecs);
+            for (size_t j = 0; j < batch; j++) {
+                local[j].iov_base = requests[i + j].buffer;
+                local[j].iov_len = requests[i + j].size;
+                remote[j].iov_base = reinterpret_cast<void*>(static_cast<uintptr_t>(requests[i + j].address));
+                remote[j].iov_len = requests[i + j].size;
+            }
+
+            ssize_t got = process_vm_readv(pid, local, batch, remote, batch, 0);
+            if (got < 0) {
+                if ((errno == ENOSYS || errno == EPERM) && memFd >= 0) {
+                    useProcMem.store(true, std::memory_order_relaxed);
+                    continue;
+                }
+                if (errno == ESRCH) {
+                    for (; i < count; i++) requests[i].bytesRead = 0;
+                    return;
+                }
+                requests[i].bytesRead = 0;
+                i++;
+                continue;
+            }
+
+            size_t remaining = static_cast<size_t>(got);
+            size_t j = 0;
+            for (; j < batch; j++) {
+                ReadRequest& request = requests[i + j];
+                if (remaining < request.size) {
+                    request.bytesRead = remaining;
+                    j++;
+                    break;
+                }
+                request.bytesRead = request.size;
+                remaining -= request.size;
+            }
+            i += j;
+        }
+    }
+
+    // glibc malloc's main arena grows the [heap] mapping with brk. Other
+    // arenas use heaps mmapped at multiples of their 64 MB maximum size,
+    // each starting with a heap_info: its arena, the previous heap, and the
+    // bytes in use, which is where the heap's top chunk ends. Only 64-bit
+    // targets are recognized.
+    bool EnumerateHeaps(std::vector<HeapSegment>& heaps) override {
+        const uint64_t kHeapMaxSize = 64 * 1024 * 1024;
+        std::ifstream maps(procDir + "/maps");
+        if (!maps.is_open()) {
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(maps, line)) {
+            unsigned long long start, end, offset, inode;
+            unsigned int major, minor;
+            char perms[5] = {0};
+            int pathStart = 0;
+            if (sscanf(line.c_str(), "%llx-%llx %4s %llx %x:%x %llu %n",
+                       &start, &end, perms, &offset, &major, &minor, &inode, &pathStart) < 7) {
+                continue;
+            }
+            std::string path = pathStart > 0 ? line.substr(static_cast<size_t>(pathStart)) : std::string();
+
+            HeapSegment heap = {start, end - start, HeapKind::GlibcMalloc};
+            if (path == "[heap]") {
+                heaps.push_back(heap);
+                continue;
+            }
+            if (!path.empty() || std::string(perms) != "rw-p" || start % kHeapMaxSize != 0) continue;
+
+            uint64_t info[4];   // ar_ptr, prev, size, mprotect_size
+            if (Read(start, reinterpret_cast<char*>(info), sizeof(info)) != sizeof(info)) continue;
+            bool plausible = info[0] != 0 && info[0] % 16 == 0 && info[2] >= kPageSize && info[2] % kPageSize == 0 &&
+                             info[2] <= end - start && info[3] >= info[2];
+            if (!plausible) continue;
+            heap.size = info[2];
+            heaps.push_back(heap);
+        }
+        return true;
+    }
+
+    // A pagemap entry per page: bit 63 set when the page is present, bit 62
+    // when it is swapped out, and the frame number below bit 55. A private
+    // page that is neither was never touched, and one present at the zero
+    // page's frame was never written; both read as zeros.
+    bool QueryResidency(uint64_t address, uint64_t size, std::vector<uint8_t>& resident) override {
+        if (pagemapFd < 0) return false;
+        uint64_t zeroFrame = ZeroPageFrame();
+        size_t pages = static_cast<size_t>((size + kPageSize - 1) / kPageSize);
+        resident.resize(pages);
+
+        uint64_t entries[512];
+        for (size_t done = 0; done < pages;) {
+            size_t batch = (std::min)(pages - done, sizeof(entries) / sizeof(entries[0]));
+            off_t offset = static_cast<off_t>((address / kPageSize + done) * sizeof(uint64_t));
+            ssize_t got = pread(pagemapFd, entries, batch * sizeof(uint64_t), offset);
+            if (got != static_cast<ssize_t>(batch * sizeof(uint64_t))) {
+                if (got < 0 && errno == EINTR) continue;
+                return false;
+            }
+            for (size_t i = 0; i < batch; i++) {
+                bool present = (entries[i] >> 63) & 1;
+                bool swapped = (entries[i] >> 62) & 1;
+                uint64_t frame = entries[i] & ((1ull << 55) - 1);
+                resident[done + i] = swapped || (present && !(zeroFrame && frame == zeroFrame));
+            }
+            done += batch;
+        }
+        return true;
+    }
+
+    bool Describe(ProcessDescription& description) override {
+        std::ifstream status(procDir + "/status");
+        if (!status.is_open()) {
+            return false;
+        }
+
+        uint64_t rss = 0, data = 0, stack = 0, anon = 0;
+        std::string line;
+        while (std::getline(status, line)) {
+            unsigned long long value = 0;
+            if (sscanf(line.c_str(), "VmRSS: %llu", &value) == 1) rss = value * 1024;
+            else if (sscanf(line.c_str(), "VmData: %llu", &value) == 1) data = value * 1024;
+            else if (sscanf(line.c_str(), "VmStk: %llu", &value) == 1) stack = value * 1024;
+            else if (sscanf(line.c_str(), "RssAnon: %llu", &value) == 1) anon = value * 1024;
+        }
+
+        // Closest equivalents: resident set for the working set, private
+        // writable mappings for the commit charge, resident anonymous
+        // memory for private usage
+        description.processId = static_cast<DWORD>(pid);
+        description.name = ProcessNameFromProc(procDir);
+        description.workingSetSize = rss;
+        description.pagefileUsage = data + stack;
+        description.privateUsage = anon;
+        return true;
+    }
+
+private:
+    size_t ReadProcMem(uint64_t address, char* buffer, size_t size) {
+        if (memFd < 0) return 0;
+        size_t total = 0;
+        while (total < size) {
+            ssize_t got = pread(memFd, buffer + total, size - total, static_cast<off_t>(address + total));
+            if (got <= 0) {
+                if (got < 0 && errno == EINTR) continue;
+                break;
+            }
+            total += static_cast<size_t>(got);
+        }
+        return total;
+    }
+
+    pid_t pid;
+    std::string procDir;
+    int memFd;
+    int pagemapFd;
+    std::atomic<bool> useProcMem;
+};
+
+inline std::unique_ptr<MemorySource> OpenProcessMemorySource(DWORD processId, std::string& error) {
+    std::string procDir = "/proc/" + std::to_string(processId);
+    if (access((procDir + "/maps").c_str(), R_OK) != 0) {
+        error = "Failed to open process. Error: " + std::string(strerror(errno));
+        return nullptr;
+    }
+    return std::unique_ptr<MemorySource>(new LinuxProcessMemorySource(static_cast<pid_t>(processId)));
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+// Live-process backend for Windows: VirtualQueryEx, ReadProcessMemory,
+// QueryWorkingSetEx and the Toolhelp process snapshot.
+
+#include "memory_source.h"
+
+#include <algorithm>
+
+#include <windows.h>
+#include <tlhelp32.h>
+#include <psapi.h>
+#include <memoryapi.h>
+
+#pragma comment(lib, "psapi.lib")
+
+inline std::vector<ProcessEntry> EnumerateProcesses() {
+    std::vector<ProcessEntry> processes;
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (hSnapshot == INVALID_HANDLE_VALUE) {
+        return processes;
+    }
+
+    PROCESSENTRY32 pe32;
+    pe32.dwSize = sizeof(PROCESSENTRY32);
+
+    if (Process32First(hSnapshot, &pe32)) {
+        do {
+            // pe32.szExeFile is already a narrow string, no conversion needed
+            ProcessEntry entry;
+            entry.processId = pe32.th32ProcessID;
+            entry.name = pe32.szExeFile;
+            processes.push_back(entry);
+        } while (Process32Next(hSnapshot, &pe32));
+    }
+
+    CloseHandle(hSnapshot);
+    return processes;
+}
+
+inline bool ProcessNameMatches(const std::string& processName, const std::string& pattern) {
+    return _stricmp(processName.c_str(), pattern.c_str()) == 0;
+}
+
+class Win32ProcessMemorySource : public MemorySource {
+public:
+    Win32ProcessMemorySource(HANDLE hProcess, DWORD processId) : hProcess(hProcess), processId(processId) {}
+
+    ~Win32ProcessMemorySource() override {
+        CloseHandle(hProcess);
+    }
+
+    bool EnumerateRegions(std::vector<MemoryRegion>& regions) override {
+        MEMORY_BASIC_INFORMATION mbi;
+        LPVOID address = 0;
+
+        while (VirtualQueryEx(hProcess, address, &mbi, sizeof(mbi))) {
+            MemoryRegion region;
+            region.BaseAddress = (DWORD_PTR)mbi.BaseAddress;
+            region.RegionSize = mbi.RegionSize;
+            region.State = mbi.State;
+            region.Type = mbi.Type;
+            region.Protect = mbi.Protect;
+            regions.push_back(region);
+
+            address = (LPVOID)((DWORD_PTR)mbi.BaseAddress + mbi.RegionSize);
+
+            if (address < mbi.BaseAddress) {
+                break; // Overflow occurred
+            }
+        }
+        return !regions.empty();
+    }
+
+    size_t Read(uint64_t address, char* buffer, size_t size) override {
+        SIZE_T bytesRead = 0;
+        if (!ReadProcessMemory(hProcess, (LPCVOID)(DWORD_PTR)address, buffer, size, &bytesRead)) {
+            // A partial copy still reports how much was read
+            if (GetLastError() != ERROR_PARTIAL_COPY) return 0;
+        }
+        return bytesRead;
+    }
+
+    // The NT heaps of a process are listed in its PEB (ProcessHeaps), and
+    // heap_walker.h has no walker for NT or segment heaps yet, so heaps are
+    // not enumerated here; MemorySource::EnumerateHeaps is where they would
+    // be reported.
+
+    // The working set cannot tell committed pages never touched, which
+    // read as zeros, from pages trimmed to the page file, which do not. So
+    // QueryResidency is left to the default (every page is read), and the
+    // working set is only used when asked for (--working-set-only).
+    bool QueryWorkingSet(uint64_t address, uint64_t size, std::vector<uint8_t>& resident) override {
+        size_t pages = static_cast<size_t>((size + kPageSize - 1) / kPageSize);
+        resident.resize(pages);
+
+        PSAPI_WORKING_SET_EX_INFORMATION info[512];
+        for (size_t done = 0; done < pages;) {
+            size_t batch = (std::min)(pages - done, sizeof(info) / sizeof(info[0]));
+            for (size_t i = 0; i < batch; i++) {
+                info[i].VirtualAddress = (PVOID)(DWORD_PTR)(address + (done + i) * kPageSize);
+            }
+            if (!QueryWorkingSetEx(hProcess, info, static_cast<DWORD>(batch * sizeof(info[0])))) {
+                return false;
+            }
+            for (size_t i = 0; i < batch; i++) {
+                resident[done + i] = info[i].VirtualAttributes.Valid ? 1 : 0;
+            }
+            done += batch;
+        }
+        return true;
+    }
+
+    bool Describe(ProcessDescription& description) override {
+        PROCESS_MEMORY_COUNTERS_EX pmc;
+        if (!GetProcessMemoryInfo(hProcess, (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc))) {
+            return false;
+        }
+        description.processId = processId;
+        description.workingSetSize = pmc.WorkingSetSize;
+        description.pagefileUsage = pmc.PagefileUsage;
+        description.privateUsage = pmc.PrivateUsage;
+
+        char path[MAX_PATH];
+        DWORD length = GetModuleBaseNameA(hProcess, NULL, path, MAX_PATH);
+        description.name = length ? std::string(path, length) : std::string();
+        return true;
+    }
+
+private:
+    HANDLE hProcess;
+    DWORD processId;
+};
+
+inline std::unique_ptr<MemorySource> OpenProcessMemorySource(DWORD processId, std::string& error) {
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, processId);
+    if (hProcess == NULL) {
+        error = "Failed to open process. Error: " + std::to_string(GetLastError());
+        return nullptr;
+    }
+    return std::unique_ptr<MemorySource>(new Win32ProcessMemorySource(hProcess, processId));
+}
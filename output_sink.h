@@ -0,0 +1,432 @@
+#pragma once
+
+// Streaming output of scan results.
+//
+// An OutputSink turns results into records as the scan produces them and
+// hands the bytes to an AsyncWriter, whose thread writes them to disk. The
+// writer takes fixed-size blocks through a bounded single-producer ring, so
+// memory use does not depend on how much a scan finds, and a full ring
+// makes the producer wait instead of growing. Records are produced by one
+// thread at a time: the main thread for process, region and reference
+// records, the scheduler's merging thread for strings.
+//
+// Formats:
+//
+//   jsonl   One JSON object per line, with a "record" field: "process",
+//           "region", "text", "hit", "reference" or "summary". Addresses
+//           are numbers.
+//
+//   binary  "HXREC1\0\0", then records of
+//             u32 payload length, u8 type, payload
+//           in host byte order. Payloads by type:
+//             1 process  u32 pid, u64 working set, u64 pagefile, u64 private, name
+//             2 region   u32 index, u64 base, u64 size, u32 state, u32 type, u32 protect
+//             3 text     u64 address, u32 bytes, u32 region, text
+//             4 hit      u64 address, u32 length, u32 region, u8 encoding (PatternEncoding),
+//                        u32 rule length, rule, preview
+//             5 summary  u64 regions, u64 texts, u64 hits, u64 references
+//             6 reference u64 source, u32 region, u64 target, u64 target region base,
+//                        u64 text (address of the string target points into, or 0)
+//           where a trailing string runs to the end of the payload.
+//
+// Region numbers start at 1, as in the text report. The target of a
+// reference can lie in any enumerated region, scanned or not, so it is
+// named by its base address. References follow all strings of a process,
+// since a pointer can point to a string found after it.
+
+#include "memory_source.h"
+#include "pattern_engine.h"
+#include "reference_scanner.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Writes bytes to a file on a thread of its own.
+class AsyncWriter {
+public:
+    static constexpr size_t kBlockSize = 256 * 1024;
+    static constexpr size_t kQueueBlocks = 16;
+    // A block is handed over at the latest this long after its first record
+    static constexpr int kFlushMilliseconds = 5;
+
+    AsyncWriter() = default;
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    ~AsyncWriter() {
+        std::string error;
+        Close(error);
+    }
+
+    bool Open(const std::string& path, std::string& error) {
+        file = std::fopen(path.c_str(), "wb");
+        if (file == NULL) {
+            error = "Failed to create " + path;
+            return false;
+        }
+        for (auto& block : ring) {
+            block.reserve(kBlockSize);
+        }
+        current.reserve(kBlockSize);
+        head.store(0);
+        tail.store(0);
+        closing.store(false);
+        writer = std::thread([this] { WriterLoop(); });
+        return true;
+    }
+
+    void Write(const void* data, size_t size) {
+        if (current.empty()) blockStarted = std::chrono::steady_clock::now();
+        const char* bytes = static_cast<const char*>(data);
+        current.insert(current.end(), bytes, bytes + size);
+        bytesWritten += size;
+        if (current.size() >= kBlockSize ||
+            (++writesSinceCheck % 64 == 0 && std::chrono::steady_clock::now() - blockStarted > std::chrono::milliseconds(kFlushMilliseconds))) {
+            Flush();
+        }
+    }
+
+    void Write(std::string_view text) {
+        Write(text.data(), text.size());
+    }
+
+    // Hands the current block to the writer thread, waiting for room in the ring
+    void Flush() {
+        if (current.empty()) return;
+        size_t position = head.load(std::memory_order_relaxed);
+        for (int spins = 0; position - tail.load(std::memory_order_acquire) == kQueueBlocks; spins++) {
+            Backoff(spins);
+        }
+        ring[position % kQueueBlocks].swap(current);
+        current.clear();
+        head.store(position + 1, std::memory_order_release);
+    }
+
+    // Writes out everything and closes the file. Returns false on a write error.
+    bool Close(std::string& error) {
+        if (file == NULL) return true;
+        Flush();
+        closing.store(true, std::memory_order_release);
+        writer.join();
+        bool ok = !failed.load() && std::fclose(file) == 0;
+        file = NULL;
+        if (!ok) error = "Failed to write output";
+        return ok;
+    }
+
+    uint64_t BytesWritten() const { return bytesWritten; }
+
+private:
+    static void Backoff(int spins) {
+        if (spins < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+    void WriterLoop() {
+        for (int spins = 0;; spins++) {
+            size_t position = tail.load(std::memory_order_relaxed);
+            if (position == head.load(std::memory_order_acquire)) {
+                if (closing.load(std::memory_order_acquire) && position == head.load(std::memory_order_acquire)) break;
+                Backoff(spins);
+                continue;
+            }
+            spins = 0;
+
+            std::vector<char>& block = ring[position % kQueueBlocks];
+            if (std::fwrite(block.data(), 1, block.size(), file) != block.size()) failed.store(true);
+            block.clear();
+            tail.store(position + 1, std::memory_order_release);
+            // Nothing else queued: let the bytes reach the file now
+            if (position + 1 == head.load(std::memory_order_acquire)) std::fflush(file);
+        }
+    }
+
+    FILE* file = NULL;
+    std::thread writer;
+    std::vector<char> ring[kQueueBlocks];
+    std::atomic<size_t> head{0};        // Blocks handed over by the producer
+    std::atomic<size_t> tail{0};        // Blocks written by the writer thread
+    std::atomic<bool> closing{false};
+    std::atomic<bool> failed{false};
+
+    // Producer side
+    std::vector<char> current;
+    std::chrono::steady_clock::time_point blockStarted;
+    uint64_t writesSinceCheck = 0;
+    uint64_t bytesWritten = 0;
+};
+
+struct OutputSummary {
+    uint64_t regions;
+    uint64_t texts;
+    uint64_t hits;
+    uint64_t references;
+};
+
+class OutputSink {
+public:
+    virtual ~OutputSink() {}
+
+    virtual void OnProcess(const ProcessDescription& description) = 0;
+    virtual void OnRegion(size_t index, const MemoryRegion& region) = 0;
+    virtual void OnText(uint64_t address, uint32_t byteLength, std::string_view text, size_t region) = 0;
+    // hit.range is the index of the hit's region
+    virtual void OnHit(const PatternHit& hit, std::string_view rule, PatternEncoding encoding) = 0;
+    // region is the index of the source's region
+    virtual void OnReference(const Reference& reference, size_t region, uint64_t targetBase) = 0;
+    virtual void OnSummary(const OutputSummary& summary) = 0;
+
+    // Makes everything so far visible in the file
+    void Flush() { writer.Flush(); }
+
+    bool Close(std::string& error) { return writer.Close(error); }
+
+    uint64_t BytesWritten() const { return writer.BytesWritten(); }
+    uint64_t RecordCount() const { return records; }
+
+protected:
+    AsyncWriter writer;
+    uint64_t records = 0;
+};
+
+class JsonLinesSink : public OutputSink {
+public:
+    static std::unique_ptr<OutputSink> Open(const std::string& path, std::string& error) {
+        std::unique_ptr<JsonLinesSink> sink(new JsonLinesSink());
+        if (!sink->writer.Open(path, error)) return nullptr;
+        return std::unique_ptr<OutputSink>(sink.release());
+    }
+
+    void OnProcess(const ProcessDescription& description) override {
+        line = "{\"record\":\"process\",\"pid\":";
+        AppendNumber(description.processId);
+        line += ",\"name\":";
+        AppendString(description.name);
+        line += ",\"workingSet\":";
+        AppendNumber(description.workingSetSize);
+        line += ",\"pagefile\":";
+        AppendNumber(description.pagefileUsage);
+        line += ",\"private\":";
+        AppendNumber(description.privateUsage);
+        Emit();
+    }
+
+    void OnRegion(size_t index, const MemoryRegion& region) override {
+        line = "{\"record\":\"region\",\"index\":";
+        AppendNumber(index + 1);
+        line += ",\"base\":";
+        AppendNumber(region.BaseAddress);
+        line += ",\"size\":";
+        AppendNumber(region.RegionSize);
+        line += ",\"state\":";
+        AppendNumber(region.State);
+        line += ",\"type\":";
+        AppendNumber(region.Type);
+        line += ",\"protect\":";
+        AppendNumber(region.Protect);
+        Emit();
+    }
+
+    void OnText(uint64_t address, uint32_t byteLength, std::string_view text, size_t region) override {
+        line = "{\"record\":\"text\",\"address\":";
+        AppendNumber(address);
+        line += ",\"bytes\":";
+        AppendNumber(byteLength);
+        line += ",\"region\":";
+        AppendNumber(region + 1);
+        line += ",\"text\":";
+        AppendString(text);
+        Emit();
+    }
+
+    void OnHit(const PatternHit& hit, std::string_view rule, PatternEncoding encoding) override {
+        line = "{\"record\":\"hit\",\"address\":";
+        AppendNumber(hit.address);
+        line += ",\"length\":";
+        AppendNumber(hit.length);
+        line += ",\"region\":";
+        AppendNumber(hit.range + 1);
+        line += ",\"rule\":";
+        AppendString(rule);
+        line += ",\"encoding\":";
+        AppendString(PatternEncodingName(encoding));
+        line += ",\"preview\":";
+        AppendString(hit.preview);
+        Emit();
+    }
+
+    void OnReference(const Reference& reference, size_t region, uint64_t targetBase) override {
+        line = "{\"record\":\"reference\",\"source\":";
+        AppendNumber(reference.source);
+        line += ",\"region\":";
+        AppendNumber(region + 1);
+        line += ",\"target\":";
+        AppendNumber(reference.target);
+        line += ",\"targetRegion\":";
+        AppendNumber(targetBase);
+        if (reference.textAddress) {
+            line += ",\"text\":";
+            AppendNumber(reference.textAddress);
+        }
+        Emit();
+    }
+
+    void OnSummary(const OutputSummary& summary) override {
+        line = "{\"record\":\"summary\",\"regions\":";
+        AppendNumber(summary.regions);
+        line += ",\"texts\":";
+        AppendNumber(summary.texts);
+        line += ",\"hits\":";
+        AppendNumber(summary.hits);
+        line += ",\"references\":";
+        AppendNumber(summary.references);
+        Emit();
+    }
+
+private:
+    void AppendNumber(uint64_t value) {
+        char digits[24];
+        int length = std::snprintf(digits, sizeof(digits), "%llu", static_cast<unsigned long long>(value));
+        line.append(digits, static_cast<size_t>(length));
+    }
+
+    void AppendString(std::string_view text) {
+        static const char hex[] = "0123456789abcdef";
+        line += '"';
+        for (char c : text) {
+            unsigned char u = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') {
+                line += '\\';
+                line += c;
+            } else if (u < 32 || u >= 127) {
+                line += "\\u00";
+                line += hex[u >> 4];
+                line += hex[u & 15];
+            } else {
+                line += c;
+            }
+        }
+        line += '"';
+    }
+
+    void Emit() {
+        line += "}\n";
+        writer.Write(line);
+        records++;
+    }
+
+    std::string line;
+};
+
+class BinarySink : public OutputSink {
+public:
+    enum RecordType : uint8_t { Process = 1, Region = 2, Text = 3, Hit = 4, Summary = 5, ReferenceRecord = 6 };
+
+    static std::unique_ptr<OutputSink> Open(const std::string& path, std::string& error) {
+        std::unique_ptr<BinarySink> sink(new BinarySink());
+        if (!sink->writer.Open(path, error)) return nullptr;
+        sink->writer.Write("HXREC1\0\0", 8);
+        return std::unique_ptr<OutputSink>(sink.release());
+    }
+
+    void OnProcess(const ProcessDescription& description) override {
+        Begin(Process);
+        Put<uint32_t>(description.processId);
+        Put<uint64_t>(description.workingSetSize);
+        Put<uint64_t>(description.pagefileUsage);
+        Put<uint64_t>(description.privateUsage);
+        record.append(description.name);
+        Emit();
+    }
+
+    void OnRegion(size_t index, const MemoryRegion& region) override {
+        Begin(Region);
+        Put<uint32_t>(static_cast<uint32_t>(index + 1));
+        Put<uint64_t>(region.BaseAddress);
+        Put<uint64_t>(region.RegionSize);
+        Put<uint32_t>(region.State);
+        Put<uint32_t>(region.Type);
+        Put<uint32_t>(region.Protect);
+        Emit();
+    }
+
+    void OnText(uint64_t address, uint32_t byteLength, std::string_view text, size_t region) override {
+        Begin(Text);
+        Put<uint64_t>(address);
+        Put<uint32_t>(byteLength);
+        Put<uint32_t>(static_cast<uint32_t>(region + 1));
+        record.append(text.data(), text.size());
+        Emit();
+    }
+
+    void OnHit(const PatternHit& hit, std::string_view rule, PatternEncoding encoding) override {
+        Begin(Hit);
+        Put<uint64_t>(hit.address);
+        Put<uint32_t>(hit.length);
+        Put<uint32_t>(static_cast<uint32_t>(hit.range + 1));
+        Put<uint8_t>(static_cast<uint8_t>(encoding));
+        Put<uint32_t>(static_cast<uint32_t>(rule.size()));
+        record.append(rule.data(), rule.size());
+        record.append(hit.preview);
+        Emit();
+    }
+
+    void OnReference(const Reference& reference, size_t region, uint64_t targetBase) override {
+        Begin(ReferenceRecord);
+        Put<uint64_t>(reference.source);
+        Put<uint32_t>(static_cast<uint32_t>(region + 1));
+        Put<uint64_t>(reference.target);
+        Put<uint64_t>(targetBase);
+        Put<uint64_t>(reference.textAddress);
+        Emit();
+    }
+
+    void OnSummary(const OutputSummary& summary) override {
+        Begin(Summary);
+        Put<uint64_t>(summary.regions);
+        Put<uint64_t>(summary.texts);
+        Put<uint64_t>(summary.hits);
+        Put<uint64_t>(summary.references);
+        Emit();
+    }
+
+private:
+    void Begin(RecordType type) {
+        record.assign(4, '\0');
+        record += static_cast<char>(type);
+    }
+
+    template <typename T>
+    void Put(T value) {
+        record.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void Emit() {
+        uint32_t length = static_cast<uint32_t>(record.size() - 5);
+        std::memcpy(&record[0], &length, sizeof(length));
+        writer.Write(record);
+        records++;
+    }
+
+    std::string record;
+};
+
+// Format names as accepted by --format; "text" is the classic report and
+// has no sink.
+inline std::unique_ptr<OutputSink> OpenOutputSink(const std::string& format, const std::string& path, std::string& error) {
+    if (format == "jsonl") return JsonLinesSink::Open(path, error);
+    if (format == "binary") return BinarySink::Open(path, error);
+    error = "Unknown output format: " + format;
+    return nullptr;
+}
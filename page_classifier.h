@@ -0,0 +1,381 @@
+#pragma once
+
+// Per-page content classification ahead of text extraction.
+//
+// Every 4 KB page the scan reads is profiled before its text scan: the
+// fraction of its bytes that are zero, the fraction of the others that are
+// printable ASCII, the fraction of its 8-byte words that look like
+// user-space pointers, and, where it can matter, the Shannon entropy of its
+// byte histogram. The profile puts the page in a class; only text pages go
+// on to the UTF-16 scanner, the others are skipped. Thresholds are set with
+// ClassifierThresholds.
+//
+// The counts come from one SIMD pass over the page, much cheaper than the
+// text scan's. The histogram is only built when the entropy could reach
+// the threshold at all: a page whose bytes are a quarter zeros cannot have
+// more than 6.8 bits per byte, so text, pointer tables and sparse
+// structures never need one. Otherwise it is built from an eighth of the
+// page, which tells random bytes from the rest as well.
+
+#include "text_scanner.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+enum class PageClass {
+    Text,           // Scanned for text
+    Zero,           // All zeros (found by TextScanner::IsZero before profiling)
+    Pointers,       // Mostly pointer-sized words that point into user space
+    Compressed,     // Entropy of compressed, encrypted or random data
+    Binary,         // Too few printable bytes to hold text
+    Count
+};
+
+static const size_t kPageClassCount = static_cast<size_t>(PageClass::Count);
+
+inline const char* PageClassName(PageClass pageClass) {
+    static const char* names[] = {"text", "zero", "pointers", "compressed", "binary"};
+    return names[static_cast<size_t>(pageClass)];
+}
+
+// Pages of each class
+struct PageClassCounts {
+    uint64_t pages[kPageClassCount] = {};
+
+    uint64_t& operator[](PageClass pageClass) { return pages[static_cast<size_t>(pageClass)]; }
+    uint64_t operator[](PageClass pageClass) const { return pages[static_cast<size_t>(pageClass)]; }
+
+    uint64_t Total() const {
+        uint64_t total = 0;
+        for (uint64_t count : pages) total += count;
+        return total;
+    }
+
+    void Add(const PageClassCounts& other) {
+        for (size_t i = 0; i < kPageClassCount; i++) pages[i] += other.pages[i];
+    }
+};
+
+// "120 text, 3 pointers, 1 compressed": the classes with any pages
+inline std::string FormatPageClasses(const PageClassCounts& counts) {
+    std::string text;
+    for (size_t i = 0; i < kPageClassCount; i++) {
+        if (!counts.pages[i]) continue;
+        if (!text.empty()) text += ", ";
+        text += std::to_string(counts.pages[i]) + " " + PageClassName(static_cast<PageClass>(i));
+    }
+    return text.empty() ? "none" : text;
+}
+
+struct ClassifierThresholds {
+    double maxPointerRatio = 0.5;       // Pointers at or above this fraction of words
+    double maxEntropy = 7.0;            // Compressed at or above this many bits per byte
+    double minPrintableRatio = 0.02;    // Binary below this fraction of non-zero bytes being printable
+};
+
+struct PageProfile {
+    double printable;   // Fraction of bytes in 0x20-0x7E
+    double zeros;
+    double pointers;    // Fraction of 8-byte words in [1 TB, 128 TB)
+    double entropy;     // Bits per byte; only computed by PageClassifier::Profile
+};
+
+namespace page_classify_detail {
+
+struct ByteCounts {
+    size_t printable;
+    size_t zeros;
+    size_t pointers;
+};
+
+// Pointer-like: from 1 TB, above where small integers and pairs of them
+// fall, to the end of the 47-bit user address space
+inline bool IsPointerLike(uint64_t word) {
+    return (word >> 47) == 0 && (word >> 40) != 0;
+}
+
+// Kernels take a size that is a multiple of 64 bytes.
+
+inline ByteCounts CountBytesScalar(const unsigned char* data, size_t size) {
+    ByteCounts counts = {0, 0, 0};
+    for (size_t i = 0; i < size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        counts.pointers += IsPointerLike(word);
+        for (size_t j = 0; j < 8; j++) {
+            unsigned char c = data[i + j];
+            counts.printable += c >= 32 && c <= 126;
+            counts.zeros += c == 0;
+        }
+    }
+    return counts;
+}
+
+#if defined(HEAP_SCAN_X86)
+
+// The vector kernels count in per-lane byte counters, subtracting each
+// compare mask (-1 where it holds), and add the counters up with a sum of
+// absolute differences every 255 vectors, before they can overflow. Bytes
+// in 0x20-0x7E are found by shifting them down by 0x20 and comparing as
+// signed bytes after flipping the sign bit, since SSE2 and AVX2 have no
+// unsigned comparison. A word is pointer-like when its upper half is in
+// [0x100, 0x8000), which 32-bit compares can tell.
+
+HEAP_SCAN_TARGET_SSE2
+inline ByteCounts CountBytesSSE2(const unsigned char* data, size_t size) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i shift = _mm_set1_epi8(static_cast<char>(0x80 - 0x20));
+    const __m128i limit = _mm_set1_epi8(static_cast<char>(0x80 + 0x5F));
+    const __m128i upperHalves = _mm_set_epi32(-1, 0, -1, 0);
+    const __m128i pointerLow = _mm_set1_epi32(0xFF);
+    const __m128i pointerHigh = _mm_set1_epi32(0x8000);
+    __m128i printable = zero, zeros = zero, pointers = zero;
+    for (size_t block = 0; block < size; block += 255 * 16) {
+        __m128i printableBytes = zero, zeroBytes = zero;
+        for (size_t i = block; i < size && i < block + 255 * 16; i += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            printableBytes = _mm_sub_epi8(printableBytes, _mm_cmplt_epi8(_mm_add_epi8(bytes, shift), limit));
+            zeroBytes = _mm_sub_epi8(zeroBytes, _mm_cmpeq_epi8(bytes, zero));
+            __m128i pointer = _mm_and_si128(_mm_cmpgt_epi32(bytes, pointerLow), _mm_cmplt_epi32(bytes, pointerHigh));
+            pointers = _mm_sub_epi32(pointers, _mm_and_si128(pointer, upperHalves));
+        }
+        printable = _mm_add_epi64(printable, _mm_sad_epu8(printableBytes, zero));
+        zeros = _mm_add_epi64(zeros, _mm_sad_epu8(zeroBytes, zero));
+    }
+    uint64_t sums[2][2];
+    uint32_t pointerCounts[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sums[0]), printable);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sums[1]), zeros);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pointerCounts), pointers);
+    ByteCounts counts = {static_cast<size_t>(sums[0][0] + sums[0][1]), static_cast<size_t>(sums[1][0] + sums[1][1]),
+                         static_cast<size_t>(pointerCounts[1]) + pointerCounts[3]};
+    return counts;
+}
+
+HEAP_SCAN_TARGET_AVX2
+inline ByteCounts CountBytesAVX2(const unsigned char* data, size_t size) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i shift = _mm256_set1_epi8(static_cast<char>(0x80 - 0x20));
+    const __m256i limit = _mm256_set1_epi8(static_cast<char>(0x80 + 0x5F));
+    const __m256i upperHalves = _mm256_set_epi32(-1, 0, -1, 0, -1, 0, -1, 0);
+    const __m256i pointerLow = _mm256_set1_epi32(0xFF);
+    const __m256i pointerHigh = _mm256_set1_epi32(0x8000);
+    __m256i printable = zero, zeros = zero, pointers = zero;
+    for (size_t block = 0; block < size; block += 255 * 32) {
+        __m256i printableBytes = zero, zeroBytes = zero;
+        for (size_t i = block; i < size && i < block + 255 * 32; i += 32) {
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            printableBytes = _mm256_sub_epi8(printableBytes, _mm256_cmpgt_epi8(limit, _mm256_add_epi8(bytes, shift)));
+            zeroBytes = _mm256_sub_epi8(zeroBytes, _mm256_cmpeq_epi8(bytes, zero));
+            __m256i pointer = _mm256_and_si256(_mm256_cmpgt_epi32(bytes, pointerLow), _mm256_cmpgt_epi32(pointerHigh, bytes));
+            pointers = _mm256_sub_epi32(pointers, _mm256_and_si256(pointer, upperHalves));
+        }
+        printable = _mm256_add_epi64(printable, _mm256_sad_epu8(printableBytes, zero));
+        zeros = _mm256_add_epi64(zeros, _mm256_sad_epu8(zeroBytes, zero));
+    }
+    uint64_t sums[2][4];
+    uint32_t pointerCounts[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums[0]), printable);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums[1]), zeros);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pointerCounts), pointers);
+    ByteCounts counts = {0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+        counts.printable += sums[0][i];
+        counts.zeros += sums[1][i];
+        counts.pointers += pointerCounts[2 * i + 1];
+    }
+    return counts;
+}
+
+HEAP_SCAN_TARGET_AVX512
+inline ByteCounts CountBytesAVX512(const unsigned char* data, size_t size) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi8(1);
+    const __m512i shift = _mm512_set1_epi8(static_cast<char>(0xE0));
+    const __m512i span = _mm512_set1_epi8(0x5F);
+    const __m512i low = _mm512_set1_epi64(static_cast<long long>(1ull << 40));
+    const __m512i high = _mm512_set1_epi64(static_cast<long long>(1ull << 47));
+    const __m512i oneWord = _mm512_set1_epi64(1);
+    __m512i printable = zero, zeros = zero, pointers = zero;
+    for (size_t block = 0; block < size; block += 255 * 64) {
+        __m512i printableBytes = zero, zeroBytes = zero;
+        for (size_t i = block; i < size && i < block + 255 * 64; i += 64) {
+            __m512i bytes = _mm512_loadu_si512(reinterpret_cast<const void*>(data + i));
+            printableBytes = _mm512_mask_add_epi8(printableBytes, _mm512_cmplt_epu8_mask(_mm512_add_epi8(bytes, shift), span),
+                                                  printableBytes, one);
+            zeroBytes = _mm512_mask_add_epi8(zeroBytes, _mm512_testn_epi8_mask(bytes, bytes), zeroBytes, one);
+            __mmask8 pointer = _mm512_mask_cmplt_epu64_mask(_mm512_cmpge_epu64_mask(bytes, low), bytes, high);
+            pointers = _mm512_mask_add_epi64(pointers, pointer, pointers, oneWord);
+        }
+        printable = _mm512_add_epi64(printable, _mm512_sad_epu8(printableBytes, zero));
+        zeros = _mm512_add_epi64(zeros, _mm512_sad_epu8(zeroBytes, zero));
+    }
+    uint64_t sums[3][8];
+    _mm512_storeu_si512(reinterpret_cast<void*>(sums[0]), printable);
+    _mm512_storeu_si512(reinterpret_cast<void*>(sums[1]), zeros);
+    _mm512_storeu_si512(reinterpret_cast<void*>(sums[2]), pointers);
+    ByteCounts counts = {0, 0, 0};
+    for (int i = 0; i < 8; i++) {
+        counts.printable += sums[0][i];
+        counts.zeros += sums[1][i];
+        counts.pointers += sums[2][i];
+    }
+    return counts;
+}
+
+#endif
+
+// count * log2(count), for the counts a histogram of up to 4 KB can hold
+inline const double* CountLog2Table() {
+    static const std::vector<double> table = [] {
+        std::vector<double> values(4097, 0.0);
+        for (size_t count = 1; count < values.size(); count++) values[count] = count * std::log2(static_cast<double>(count));
+        return values;
+    }();
+    return table.data();
+}
+
+// Entropy of the 64-byte lines at every stride bytes of size bytes (at
+// most 4 KB), from four interleaved histograms so that neighbouring equal
+// bytes do not wait on each other's increment
+inline double ByteEntropy(const unsigned char* data, size_t size, size_t stride = 64) {
+    uint16_t histogram[4][256] = {};
+    size_t sampled = 0;
+    for (size_t line = 0; line + 64 <= size; line += stride, sampled += 64) {
+        for (size_t i = line; i < line + 64; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            histogram[0][word & 0xFF]++;
+            histogram[1][(word >> 8) & 0xFF]++;
+            histogram[2][(word >> 16) & 0xFF]++;
+            histogram[3][(word >> 24) & 0xFF]++;
+            histogram[0][(word >> 32) & 0xFF]++;
+            histogram[1][(word >> 40) & 0xFF]++;
+            histogram[2][(word >> 48) & 0xFF]++;
+            histogram[3][word >> 56]++;
+        }
+    }
+    const double* countLog2 = CountLog2Table();
+    double sum = 0;
+    for (size_t b = 0; b < 256; b++) {
+        sum += countLog2[histogram[0][b] + histogram[1][b] + histogram[2][b] + histogram[3][b]];
+    }
+    return std::log2(static_cast<double>(sampled)) - sum / sampled;
+}
+
+// Highest entropy a page whose fraction zeros of bytes are zero can have:
+// the zeros and the rest, spread evenly over the 255 other values
+inline double EntropyBound(double zeros) {
+    if (zeros <= 0) return 8.0;
+    if (zeros >= 1) return 0.0;
+    return -zeros * std::log2(zeros) - (1 - zeros) * std::log2(1 - zeros) + (1 - zeros) * std::log2(255.0);
+}
+
+}  // namespace page_classify_detail
+
+class PageClassifier {
+public:
+    explicit PageClassifier(const ClassifierThresholds& thresholds = ClassifierThresholds(),
+                            ScanKernel requested = TextScanner::DetectBestKernel())
+        : thresholds(thresholds), kernel(TextScanner::IsKernelSupported(requested) ? requested : TextScanner::DetectBestKernel()),
+          zeroLimit(ZeroLimit(thresholds.maxEntropy)) {}
+
+    const ClassifierThresholds& Thresholds() const { return thresholds; }
+
+    // Parses "KEY=VALUE,..." with the keys pointers, entropy and printable
+    // into thresholds, leaving the keys not given as they are
+    static bool ParseThresholds(const std::string& text, ClassifierThresholds& thresholds, std::string& error) {
+        size_t start = 0;
+        while (start <= text.size()) {
+            size_t end = text.find(',', start);
+            if (end == std::string::npos) end = text.size();
+            std::string item = text.substr(start, end - start);
+            size_t equals = item.find('=');
+            char* parsed = nullptr;
+            double value = equals == std::string::npos ? 0 : std::strtod(item.c_str() + equals + 1, &parsed);
+            std::string key = item.substr(0, equals);
+            if (equals == std::string::npos || parsed == item.c_str() + equals + 1 || *parsed || value < 0) {
+                error = "Invalid classifier threshold: " + item;
+                return false;
+            }
+            if (key == "pointers" && value <= 1) thresholds.maxPointerRatio = value;
+            else if (key == "entropy" && value <= 8) thresholds.maxEntropy = value;
+            else if (key == "printable" && value <= 1) thresholds.minPrintableRatio = value;
+            else {
+                error = "Invalid classifier threshold: " + item;
+                return false;
+            }
+            start = end + 1;
+        }
+        return true;
+    }
+
+    // Bytes of a page the entropy is estimated from when classifying: one
+    // 64-byte line in eight. Random data still comes out above 7.6 bits.
+    static const size_t kEntropyStride = 512;
+
+    // The class of size bytes (a multiple of 64, at most 4 KB) that are not
+    // all zeros. The entropy is only estimated when it could reach the
+    // threshold.
+    //
+    // The printable bytes are measured against the non-zero ones: a page of
+    // zeros holding one short UTF-16 string and a few counters is still text.
+    PageClass Classify(const char* data, size_t size) const {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        page_classify_detail::ByteCounts counts = CountBytes(bytes, size);
+        if (counts.pointers >= thresholds.maxPointerRatio * (size / 8)) return PageClass::Pointers;
+        if (counts.printable < thresholds.minPrintableRatio * (size - counts.zeros)) return PageClass::Binary;
+        if (counts.zeros <= zeroLimit * size && page_classify_detail::ByteEntropy(bytes, size, kEntropyStride) >= thresholds.maxEntropy) {
+            return PageClass::Compressed;
+        }
+        return PageClass::Text;
+    }
+
+    // Every measure of size bytes (a multiple of 64, at most 4 KB), with the
+    // entropy of all of them
+    PageProfile Profile(const char* data, size_t size) const {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        page_classify_detail::ByteCounts counts = CountBytes(bytes, size);
+        PageProfile profile;
+        profile.printable = static_cast<double>(counts.printable) / size;
+        profile.zeros = static_cast<double>(counts.zeros) / size;
+        profile.pointers = static_cast<double>(counts.pointers) / (size / 8);
+        profile.entropy = page_classify_detail::ByteEntropy(bytes, size);
+        return profile;
+    }
+
+private:
+    page_classify_detail::ByteCounts CountBytes(const unsigned char* bytes, size_t size) const {
+        using namespace page_classify_detail;
+
+        switch (kernel) {
+#if defined(HEAP_SCAN_X86)
+            case ScanKernel::AVX512: return CountBytesAVX512(bytes, size);
+            case ScanKernel::AVX2: return CountBytesAVX2(bytes, size);
+            case ScanKernel::SSE2: return CountBytesSSE2(bytes, size);
+#endif
+            default: return CountBytesScalar(bytes, size);
+        }
+    }
+
+    // Largest fraction of zeros at which the entropy can still reach
+    // maxEntropy; EntropyBound falls as the zeros grow
+    static double ZeroLimit(double maxEntropy) {
+        double low = 0, high = 1;
+        for (int i = 0; i < 40; i++) {
+            double middle = (low + high) / 2;
+            if (page_classify_detail::EntropyBound(middle) >= maxEntropy) low = middle;
+            else high = middle;
+        }
+        return low;
+    }
+
+    ClassifierThresholds thresholds;
+    ScanKernel kernel;
+    double zeroLimit;
+};
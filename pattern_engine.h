@@ -0,0 +1,1071 @@
+#pragma once
+
+// Multi-pattern search over raw memory.
+//
+// A rule file is compiled into tables that are applied together over a
+// buffer in a single pass:
+//
+//   - every literal (text and hex rules) goes into one trie, fronted by two
+//     filters on where a literal may start: its first two bytes, looked up
+//     directly, and a hash of its first eight. Only starts that pass both
+//     walk the trie, so the work per byte is a few independent loads from
+//     small tables whatever the rule count. More rules do let more starts
+//     through the first filter (with 10,000 rules, most text does), so the
+//     cost per byte still varies with the rule set; the bench reports it
+//     for 10 to 10,000 rules;
+//   - every regex goes into one DFA, built by subset construction from a
+//     Thompson NFA. It stays at its start state for nearly all bytes, which
+//     are skipped without a table lookup.
+//
+// Text and regex rules are matched both as ASCII and as UTF-16LE; hex rules
+// match raw bytes. Bytes are first mapped to equivalence classes (bytes no
+// rule tells apart share one), which keeps the transition tables small.
+// The trie is dense for the shallowest states and sparse below them, so
+// memory stays bounded for large rule sets.
+//
+// Rule file syntax, one rule per line, '#' starts a comment:
+//
+//   # id        kind    pattern
+//   aws-key     regex   AKIA[0-9A-Z]{16}
+//   mz-header   hex     4D 5A 90 00
+//   password    text    password=
+//
+// kind may be narrowed to one encoding: text/ascii, text/utf16,
+// regex/ascii, regex/utf16. The regex subset is literals, '.', classes
+// ([a-z], [^0-9]), escapes (\d \w \s \D \W \S \xHH and escaped
+// metacharacters), grouping, '|' and the quantifiers * + ? {n} {n,} {n,m}.
+//
+// Limits: text is at most 2048 characters and hex at most 4096 bytes
+// (kMaxMatchLength). A regex match is cut at kMaxMatchLength bytes too: a
+// longer run, say 100 KB that `a+` matches, is reported as consecutive hits
+// of 4096 bytes, each starting where the previous one ends.
+//
+// Regexes are not anchored. Where the DFA first accepts, a regex hit takes
+// the leftmost start of a match ending there and grows to the longest match
+// from that start; hits of one rule do not overlap. Each is found with one
+// backward and one forward run of the rule's NFA, so the work per byte does
+// not grow with the length of the matches.
+
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+enum class PatternEncoding : uint8_t { Raw, Ascii, Utf16 };
+
+inline const char* PatternEncodingName(PatternEncoding encoding) {
+    switch (encoding) {
+        case PatternEncoding::Ascii: return "ascii";
+        case PatternEncoding::Utf16: return "utf16";
+        default: return "raw";
+    }
+}
+
+// A match inside one buffer. variant identifies the rule and encoding.
+struct PatternMatch {
+    size_t offset;
+    size_t length;
+    uint32_t variant;
+};
+
+// A match in the scanned memory
+struct PatternHit {
+    uint64_t address;
+    uint32_t length;
+    uint32_t variant;
+    size_t range;           // Index of the scanned range the hit starts in
+    std::string preview;
+};
+
+class PatternMatcher;
+
+class PatternSet {
+public:
+    // Longest match reported, and how far back a regex hit looks for its start
+    static constexpr size_t kMaxMatchLength = 4096;
+    static constexpr size_t kMaxRegexStates = 65536;
+    static constexpr size_t kMaxNfaStates = 1000000;
+    // Bytes of dense trie rows at most
+    static constexpr size_t kDenseBudget = 4 * 1024 * 1024;
+    // Bytes of a literal's head the prefix filter keys on at most, and
+    // log2 of the bits in the filter
+    static constexpr size_t kPrefixLength = 8;
+    static constexpr unsigned kPrefixBits = 20;
+
+    bool AddRule(const std::string& id, const std::string& kind, const std::string& pattern, std::string& error) {
+        std::string base = kind;
+        bool ascii = true, utf16 = true;
+        size_t slash = kind.find('/');
+        if (slash != std::string::npos) {
+            base = kind.substr(0, slash);
+            std::string encoding = kind.substr(slash + 1);
+            ascii = encoding == "ascii";
+            utf16 = encoding == "utf16";
+            if (!ascii && !utf16) {
+                error = "unknown encoding '" + encoding + "'";
+                return false;
+            }
+        }
+
+        uint32_t rule = static_cast<uint32_t>(ruleIds.size());
+        if (base == "text") {
+            if (pattern.empty() || pattern.size() * 2 > kMaxMatchLength) {
+                error = "text must be 1 to " + std::to_string(kMaxMatchLength / 2) + " characters";
+                return false;
+            }
+            if (ascii) AddLiteral(rule, PatternEncoding::Ascii, pattern);
+            if (utf16) {
+                std::string wide;
+                for (char c : pattern) {
+                    wide += c;
+                    wide += '\0';
+                }
+                AddLiteral(rule, PatternEncoding::Utf16, wide);
+            }
+        } else if (base == "hex") {
+            if (slash != std::string::npos) {
+                error = "hex rules match raw bytes only";
+                return false;
+            }
+            std::string bytes;
+            if (!ParseHex(pattern, bytes, error)) return false;
+            AddLiteral(rule, PatternEncoding::Raw, bytes);
+        } else if (base == "regex") {
+            RegexParser parser(*this, pattern);
+            int root = parser.Parse(error);
+            if (root < 0) return false;
+            if (ascii) AddRegex(rule, PatternEncoding::Ascii, root);
+            if (utf16) AddRegex(rule, PatternEncoding::Utf16, root);
+        } else {
+            error = "unknown rule kind '" + kind + "'";
+            return false;
+        }
+
+        ruleIds.push_back(id);
+        return true;
+    }
+
+    bool LoadRules(const std::string& path, std::string& error) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            error = "Failed to open rule file " + path;
+            return false;
+        }
+
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line)) {
+            lineNumber++;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+
+            // Comments start at a '#' that begins a line or follows blanks
+            size_t start = line.find_first_not_of(" \t");
+            if (start == std::string::npos || line[start] == '#') continue;
+
+            std::string fields[2];
+            size_t position = start;
+            for (auto& field : fields) {
+                size_t end = line.find_first_of(" \t", position);
+                field = line.substr(position, end == std::string::npos ? std::string::npos : end - position);
+                position = end == std::string::npos ? line.size() : line.find_first_not_of(" \t", end);
+                if (position == std::string::npos) position = line.size();
+            }
+            std::string pattern = line.substr(position);
+            size_t last = pattern.find_last_not_of(" \t");
+            pattern.erase(last == std::string::npos ? 0 : last + 1);
+
+            std::string ruleError;
+            if (fields[1].empty() || pattern.empty()) {
+                ruleError = "expected: id kind pattern";
+            } else {
+                AddRule(fields[0], fields[1], pattern, ruleError);
+            }
+            if (!ruleError.empty()) {
+                error = path + ":" + std::to_string(lineNumber) + ": " + ruleError;
+                return false;
+            }
+        }
+        return Compile(error);
+    }
+
+    bool Compile(std::string& error) {
+        BuildByteClasses();
+        BuildLiteralAutomaton();
+        return BuildRegexAutomaton(error);
+    }
+
+    bool empty() const { return variants.empty(); }
+    size_t RuleCount() const { return ruleIds.size(); }
+    size_t VariantCount() const { return variants.size(); }
+    const std::string& RuleId(uint32_t variant) const { return ruleIds[variants[variant].rule]; }
+    PatternEncoding Encoding(uint32_t variant) const { return variants[variant].encoding; }
+    bool IsRegex(uint32_t variant) const { return variants[variant].regexRoot >= 0; }
+
+    size_t LiteralStateCount() const { return trieOutputBegin.empty() ? 0 : trieOutputBegin.size() - 1; }
+    size_t RegexStateCount() const { return regexAccept.empty() ? 0 : regexAccept.size() - 1; }
+    size_t ClassCount() const { return classCount; }
+
+    // Bytes held by the compiled tables
+    size_t MemoryUsage() const {
+        return trieDense.size() * sizeof(uint32_t) + trieSparse.size() * sizeof(SparseEdge) +
+               (trieSparseBegin.size() + trieOutputBegin.size() + trieOutputs.size()) * sizeof(uint32_t) +
+               prefixFilter.size() * sizeof(uint64_t) +
+               regexNext.size() * sizeof(uint32_t) + (regexAccept.size() + regexAccepts.size()) * sizeof(uint32_t) +
+               nfa.size() * sizeof(NfaState);
+    }
+
+    // Printable form of a match: the text for ASCII and UTF-16 matches, hex
+    // for raw ones, cut to maxChars characters
+    std::string Preview(uint32_t variant, const char* data, size_t length, size_t maxChars = 64) const {
+        static const char digits[] = "0123456789ABCDEF";
+        std::string preview;
+        PatternEncoding encoding = variants[variant].encoding;
+        size_t step = encoding == PatternEncoding::Utf16 ? 2 : 1;
+        for (size_t i = 0; i < length && preview.size() < maxChars * (encoding == PatternEncoding::Raw ? 3 : 1); i += step) {
+            unsigned char c = static_cast<unsigned char>(data[i]);
+            if (encoding == PatternEncoding::Raw) {
+                if (!preview.empty()) preview += ' ';
+                preview += digits[c >> 4];
+                preview += digits[c & 15];
+            } else {
+                preview += (c >= 32 && c <= 126) ? static_cast<char>(c) : '.';
+            }
+        }
+        return preview;
+    }
+
+private:
+    friend class PatternMatcher;
+
+    static constexpr uint32_t kOutputFlag = 0x80000000u;
+    static constexpr uint32_t kStateMask = 0x7FFFFFFFu;
+    static constexpr uint32_t kNone = 0xFFFFFFFFu;
+
+    struct Variant {
+        uint32_t rule;
+        PatternEncoding encoding;
+        int regexRoot;          // Regexes: AST root, or -1 for literals
+        int forwardStart;       // Regexes: start of the NFA
+        int reverseStart;       // Regexes: start of the reversed NFA
+    };
+
+    struct RegexNode {
+        enum Kind { Set, Concat, Alt, Repeat } kind;
+        int set;
+        std::vector<int> children;
+        int min;
+        int max;                // -1: unbounded
+    };
+
+    struct NfaState {
+        enum Kind { Set, Split, Match } kind;
+        int set;
+        int out;
+        int out1;
+        uint32_t variant;
+    };
+
+    struct SparseEdge {
+        uint16_t byteClass;
+        uint32_t next;
+    };
+
+    // Recursive-descent parser for the regex subset; builds RegexNodes
+    class RegexParser {
+    public:
+        RegexParser(PatternSet& owner, const std::string& text) : owner(owner), text(text), position(0) {}
+
+        int Parse(std::string& error) {
+            int root = ParseAlternation();
+            if (root >= 0 && position < text.size()) Fail("unexpected ')'");
+            if (root >= 0 && this->error.empty() && MatchesEmpty(root)) Fail("regex matches the empty string");
+            if (!this->error.empty()) {
+                error = "regex: " + this->error;
+                return -1;
+            }
+            return root;
+        }
+
+    private:
+        int Fail(const std::string& message) {
+            if (error.empty()) error = message + " at offset " + std::to_string(position);
+            return -1;
+        }
+
+        int ParseAlternation() {
+            std::vector<int> choices;
+            while (true) {
+                int choice = ParseConcatenation();
+                if (choice < 0) return -1;
+                choices.push_back(choice);
+                if (position >= text.size() || text[position] != '|') break;
+                position++;
+            }
+            return choices.size() == 1 ? choices[0] : owner.AddNode(RegexNode::Alt, -1, choices);
+        }
+
+        int ParseConcatenation() {
+            std::vector<int> items;
+            while (position < text.size() && text[position] != '|' && text[position] != ')') {
+                int item = ParseRepeat();
+                if (item < 0) return -1;
+                items.push_back(item);
+            }
+            if (items.empty()) return Fail("empty expression");
+            return items.size() == 1 ? items[0] : owner.AddNode(RegexNode::Concat, -1, items);
+        }
+
+        int ParseRepeat() {
+            int atom = ParseAtom();
+            while (atom >= 0 && position < text.size()) {
+                int min = 0, max = -1;
+                char c = text[position];
+                if (c == '*') { min = 0; max = -1; }
+                else if (c == '+') { min = 1; max = -1; }
+                else if (c == '?') { min = 0; max = 1; }
+                else if (c == '{') {
+                    if (!ParseBounds(min, max)) return -1;
+                }
+                else break;
+                position++;
+                int node = owner.AddNode(RegexNode::Repeat, -1, std::vector<int>(1, atom));
+                owner.regexNodes[node].min = min;
+                owner.regexNodes[node].max = max;
+                atom = node;
+            }
+            return atom;
+        }
+
+        // {n}, {n,} or {n,m}; leaves position on the closing brace
+        bool ParseBounds(int& min, int& max) {
+            size_t close = text.find('}', position);
+            if (close == std::string::npos) return Fail("unterminated '{'") >= 0;
+            std::string inside = text.substr(position + 1, close - position - 1);
+            size_t comma = inside.find(',');
+            std::string low = inside.substr(0, comma);
+            std::string high = comma == std::string::npos ? low : inside.substr(comma + 1);
+            if (low.empty() || low.find_first_not_of("0123456789") != std::string::npos ||
+                high.find_first_not_of("0123456789") != std::string::npos || low.size() > 4 || high.size() > 4) {
+                return Fail("bad repeat count") >= 0;
+            }
+            min = std::atoi(low.c_str());
+            max = high.empty() ? -1 : std::atoi(high.c_str());
+            if ((max >= 0 && max < min) || min > 1000 || max > 1000) return Fail("bad repeat count") >= 0;
+            position = close;
+            return true;
+        }
+
+        int ParseAtom() {
+            char c = text[position];
+            if (c == '(') {
+                position++;
+                int inner = ParseAlternation();
+                if (inner < 0) return -1;
+                if (position >= text.size() || text[position] != ')') return Fail("missing ')'");
+                position++;
+                return inner;
+            }
+            if (c == '*' || c == '+' || c == '?' || c == '{') return Fail("nothing to repeat");
+
+            std::bitset<256> set;
+            if (c == '[') {
+                if (!ParseClass(set)) return -1;
+            } else if (c == '.') {
+                set.set();
+                set.reset('\n');
+                position++;
+            } else if (c == '\\') {
+                if (!ParseEscape(set)) return -1;
+            } else {
+                set.set(static_cast<unsigned char>(c));
+                position++;
+            }
+            return owner.AddNode(RegexNode::Set, owner.AddSet(set), std::vector<int>());
+        }
+
+        bool ParseEscape(std::bitset<256>& set) {
+            if (++position >= text.size()) return Fail("trailing '\\'") >= 0;
+            char c = text[position++];
+            bool negate = c == 'D' || c == 'W' || c == 'S';
+            switch (c) {
+                case 'd': case 'D':
+                    for (int b = '0'; b <= '9'; b++) set.set(b);
+                    break;
+                case 'w': case 'W':
+                    for (int b = 0; b < 256; b++) if (isalnum(b) || b == '_') set.set(b);
+                    break;
+                case 's': case 'S':
+                    for (char b : std::string(" \t\r\n\f\v")) set.set(static_cast<unsigned char>(b));
+                    break;
+                case 'x': {
+                    std::string bytes;
+                    std::string dummy;
+                    if (position + 2 > text.size() || !ParseHex(text.substr(position, 2), bytes, dummy)) {
+                        return Fail("bad \\x escape") >= 0;
+                    }
+                    set.set(static_cast<unsigned char>(bytes[0]));
+                    position += 2;
+                    break;
+                }
+                case 'n': set.set('\n'); break;
+                case 'r': set.set('\r'); break;
+                case 't': set.set('\t'); break;
+                case '0': set.set(0); break;
+                default:
+                    if (isalnum(static_cast<unsigned char>(c))) return Fail("unknown escape") >= 0;
+                    set.set(static_cast<unsigned char>(c));
+                    break;
+            }
+            if (negate) set.flip();
+            return true;
+        }
+
+        bool ParseClass(std::bitset<256>& set) {
+            position++;
+            bool negate = position < text.size() && text[position] == '^';
+            if (negate) position++;
+
+            bool first = true;
+            while (position < text.size() && (text[position] != ']' || first)) {
+                first = false;
+                std::bitset<256> item;
+                int low = static_cast<unsigned char>(text[position]);
+                if (text[position] == '\\') {
+                    if (!ParseEscape(item)) return false;
+                    // A single-byte escape can start a range
+                    low = item.count() == 1 ? static_cast<int>(FirstBit(item)) : -1;
+                } else {
+                    item.set(low);
+                    position++;
+                }
+
+                if (low >= 0 && position + 1 < text.size() && text[position] == '-' && text[position + 1] != ']') {
+                    position++;
+                    int high = static_cast<unsigned char>(text[position]);
+                    if (text[position] == '\\') {
+                        std::bitset<256> end;
+                        if (!ParseEscape(end)) return false;
+                        if (end.count() != 1) return Fail("bad class range") >= 0;
+                        high = static_cast<int>(FirstBit(end));
+                    } else {
+                        position++;
+                    }
+                    if (high < low) return Fail("bad class range") >= 0;
+                    for (int b = low; b <= high; b++) item.set(b);
+                }
+                set |= item;
+            }
+            if (position >= text.size()) return Fail("unterminated '['") >= 0;
+            position++;
+            if (negate) set.flip();
+            return true;
+        }
+
+        static size_t FirstBit(const std::bitset<256>& set) {
+            for (size_t b = 0; b < 256; b++) {
+                if (set[b]) return b;
+            }
+            return 256;
+        }
+
+        bool MatchesEmpty(int node) const {
+            const RegexNode& n = owner.regexNodes[node];
+            switch (n.kind) {
+                case RegexNode::Set: return false;
+                case RegexNode::Repeat: return n.min == 0 || MatchesEmpty(n.children[0]);
+                case RegexNode::Concat:
+                    for (int child : n.children) if (!MatchesEmpty(child)) return false;
+                    return true;
+                default:
+                    for (int child : n.children) if (MatchesEmpty(child)) return true;
+                    return false;
+            }
+        }
+
+        PatternSet& owner;
+        const std::string& text;
+        size_t position;
+        std::string error;
+    };
+
+    static bool ParseHex(const std::string& text, std::string& bytes, std::string& error) {
+        int high = -1;
+        for (char c : text) {
+            if (c == ' ' || c == '\t') continue;
+            int value;
+            if (c >= '0' && c <= '9') value = c - '0';
+            else if (c >= 'a' && c <= 'f') value = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value = c - 'A' + 10;
+            else {
+                error = std::string("bad hex digit '") + c + "'";
+                return false;
+            }
+            if (high < 0) {
+                high = value;
+            } else {
+                bytes += static_cast<char>(high << 4 | value);
+                high = -1;
+            }
+        }
+        if (high >= 0 || bytes.empty() || bytes.size() > kMaxMatchLength) {
+            error = "hex signature needs 1 to " + std::to_string(kMaxMatchLength) + " whole bytes";
+            return false;
+        }
+        return true;
+    }
+
+    int AddNode(RegexNode::Kind kind, int set, const std::vector<int>& children) {
+        RegexNode node;
+        node.kind = kind;
+        node.set = set;
+        node.children = children;
+        node.min = node.max = 1;
+        regexNodes.push_back(node);
+        return static_cast<int>(regexNodes.size()) - 1;
+    }
+
+    int AddSet(const std::bitset<256>& set) {
+        byteSets.push_back(set);
+        return static_cast<int>(byteSets.size()) - 1;
+    }
+
+    void AddLiteral(uint32_t rule, PatternEncoding encoding, const std::string& bytes) {
+        Variant variant = {rule, encoding, -1, -1, -1};
+        variants.push_back(variant);
+        literals.push_back(bytes);
+    }
+
+    void AddRegex(uint32_t rule, PatternEncoding encoding, int root) {
+        Variant variant = {rule, encoding, root, -1, -1};
+        variants.push_back(variant);
+        literals.push_back(std::string());
+    }
+
+    // Splits the 256 byte values into classes no rule distinguishes within
+    void BuildByteClasses() {
+        std::vector<std::bitset<256>> sets;
+        std::bitset<256> literalBytes;
+        for (size_t v = 0; v < variants.size(); v++) {
+            for (char c : literals[v]) literalBytes.set(static_cast<unsigned char>(c));
+        }
+        for (size_t b = 0; b < 256; b++) {
+            if (!literalBytes[b]) continue;
+            std::bitset<256> single;
+            single.set(b);
+            sets.push_back(single);
+        }
+        // The zero byte is what UTF-16 regex characters are followed by
+        if (zeroSet < 0) {
+            std::bitset<256> zero;
+            zero.set(0);
+            zeroSet = AddSet(zero);
+        }
+        sets.insert(sets.end(), byteSets.begin(), byteSets.end());
+
+        std::vector<uint16_t> current(256, 0);
+        classCount = 1;
+        for (const auto& set : sets) {
+            std::vector<int> remap(classCount * 2, -1);
+            size_t next = 0;
+            for (size_t b = 0; b < 256; b++) {
+                int& target = remap[current[b] * 2 + (set[b] ? 1 : 0)];
+                if (target < 0) target = static_cast<int>(next++);
+                current[b] = static_cast<uint16_t>(target);
+            }
+            classCount = next;
+        }
+        for (size_t b = 0; b < 256; b++) byteClass[b] = current[b];
+        for (size_t b = 256; b-- > 0;) classByte[byteClass[b]] = static_cast<uint8_t>(b);
+    }
+
+    void BuildLiteralAutomaton() {
+        struct TrieNode {
+            std::vector<std::pair<uint16_t, uint32_t>> children;
+            std::vector<uint32_t> outputs;
+        };
+        std::vector<TrieNode> trie(1);
+        for (size_t v = 0; v < variants.size(); v++) {
+            if (variants[v].regexRoot >= 0) continue;
+            uint32_t node = 0;
+            for (char c : literals[v]) {
+                uint16_t cls = byteClass[static_cast<unsigned char>(c)];
+                uint32_t next = kNone;
+                for (const auto& child : trie[node].children) {
+                    if (child.first == cls) next = child.second;
+                }
+                if (next == kNone) {
+                    next = static_cast<uint32_t>(trie.size());
+                    trie[node].children.push_back(std::make_pair(cls, next));
+                    trie.emplace_back();
+                }
+                node = next;
+            }
+            trie[node].outputs.push_back(static_cast<uint32_t>(v));
+        }
+
+        // Number the states breadth first, so the shallow ones, which
+        // every verification passes through, get the dense rows
+        std::vector<uint32_t> order(1, 0), id(trie.size(), 0);
+        for (size_t i = 0; i < order.size(); i++) {
+            auto& children = trie[order[i]].children;
+            std::sort(children.begin(), children.end());
+            for (const auto& child : children) {
+                id[child.second] = static_cast<uint32_t>(order.size());
+                order.push_back(child.second);
+            }
+        }
+
+        size_t states = trie.size();
+        trieOutputBegin.assign(states + 1, 0);
+        trieOutputs.clear();
+        for (size_t i = 0; i < states; i++) {
+            trieOutputBegin[i] = static_cast<uint32_t>(trieOutputs.size());
+            const auto& outputs = trie[order[i]].outputs;
+            trieOutputs.insert(trieOutputs.end(), outputs.begin(), outputs.end());
+        }
+        trieOutputBegin[states] = static_cast<uint32_t>(trieOutputs.size());
+
+        trieDenseStates = (std::min)(states, (std::max)(static_cast<size_t>(1), kDenseBudget / (classCount * sizeof(uint32_t))));
+        trieDense.assign(trieDenseStates * classCount, 0);
+        trieSparseBegin.assign(states - trieDenseStates + 1, 0);
+        trieSparse.clear();
+
+        for (size_t i = 0; i < states; i++) {
+            const TrieNode& node = trie[order[i]];
+            if (i < trieDenseStates) {
+                uint32_t* row = &trieDense[i * classCount];
+                for (const auto& child : node.children) {
+                    row[child.first] = id[child.second];
+                }
+            } else {
+                trieSparseBegin[i - trieDenseStates] = static_cast<uint32_t>(trieSparse.size());
+                for (const auto& child : node.children) {
+                    SparseEdge edge = {child.first, id[child.second]};
+                    trieSparse.push_back(edge);
+                }
+                trieSparseBegin[i - trieDenseStates + 1] = static_cast<uint32_t>(trieSparse.size());
+            }
+        }
+
+        // Start filters. The first passes a start if any literal begins
+        // with its two bytes. The second hashes the head of every literal:
+        // its first kPrefixLength bytes (four characters of UTF-16, so plain
+        // text rarely passes), or all of it when shorter, in which case it
+        // is keyed by as many bytes as the shortest literal has.
+        std::memset(startPairs, 0, sizeof(startPairs));
+        size_t shortest = kPrefixLength;
+        for (size_t v = 0; v < variants.size(); v++) {
+            if (variants[v].regexRoot >= 0) continue;
+            const std::string& literal = literals[v];
+            for (size_t second = 0; second < 256; second++) {
+                if (literal.size() > 1 && static_cast<unsigned char>(literal[1]) != second) continue;
+                size_t pair = static_cast<unsigned char>(literal[0]) | second << 8;
+                startPairs[pair / 64] |= static_cast<uint64_t>(1) << (pair % 64);
+            }
+            shortest = (std::min)(shortest, literal.size());
+        }
+        prefixMasks[0] = PrefixOf(std::string(kPrefixLength, '\xFF'));
+        prefixMasks[1] = PrefixOf(std::string(shortest, '\xFF'));
+        prefixFilter.assign((static_cast<size_t>(1) << kPrefixBits) / 64, 0);
+        for (size_t v = 0; v < variants.size(); v++) {
+            if (variants[v].regexRoot >= 0) continue;
+            uint64_t mask = prefixMasks[literals[v].size() >= kPrefixLength ? 0 : 1];
+            uint64_t hash = PrefixHash(PrefixOf(literals[v]) & mask);
+            prefixFilter[PrefixWord(hash)] |= PrefixBits(hash);
+        }
+    }
+
+    // The first kPrefixLength bytes of data, padded with zeros
+    static uint64_t PrefixOf(const std::string& data) {
+        unsigned char head[kPrefixLength] = {};
+        std::memcpy(head, data.data(), (std::min)(data.size(), kPrefixLength));
+        uint64_t prefix;
+        std::memcpy(&prefix, head, sizeof(prefix));
+        return prefix;
+    }
+
+    // Each key sets two bits of one filter word, picked by its hash
+    static uint64_t PrefixHash(uint64_t prefix) { return prefix * 0x9E3779B97F4A7C15ull; }
+    static size_t PrefixWord(uint64_t hash) { return static_cast<size_t>(hash >> (64 - kPrefixBits + 6)); }
+    static uint64_t PrefixBits(uint64_t hash) {
+        return (static_cast<uint64_t>(1) << ((hash >> 20) & 63)) | (static_cast<uint64_t>(1) << ((hash >> 26) & 63));
+    }
+
+    // The trie child of state on a byte class, or kNone
+    uint32_t Child(uint32_t state, uint16_t cls) const {
+        if (state < trieDenseStates) {
+            uint32_t next = trieDense[state * classCount + cls];
+            return next == 0 ? kNone : next;
+        }
+        uint32_t sparse = state - static_cast<uint32_t>(trieDenseStates);
+        for (uint32_t e = trieSparseBegin[sparse]; e < trieSparseBegin[sparse + 1]; e++) {
+            if (trieSparse[e].byteClass == cls) return trieSparse[e].next;
+        }
+        return kNone;
+    }
+
+    // Builds the NFA for node so that it continues to next. reversed builds
+    // the NFA of the reversed language, used to find where a match starts.
+    int CompileNode(int node, PatternEncoding encoding, bool reversed, int next) {
+        RegexNode n = regexNodes[node];
+        switch (n.kind) {
+            case RegexNode::Set: {
+                if (encoding != PatternEncoding::Utf16) return AddState(NfaState::Set, n.set, next);
+                // One character is the byte followed by a zero high byte
+                if (reversed) return AddState(NfaState::Set, zeroSet, AddState(NfaState::Set, n.set, next));
+                return AddState(NfaState::Set, n.set, AddState(NfaState::Set, zeroSet, next));
+            }
+            case RegexNode::Concat:
+                if (reversed) {
+                    for (size_t i = 0; i < n.children.size(); i++) next = CompileNode(n.children[i], encoding, reversed, next);
+                } else {
+                    for (size_t i = n.children.size(); i-- > 0;) next = CompileNode(n.children[i], encoding, reversed, next);
+                }
+                return next;
+            case RegexNode::Alt: {
+                int start = CompileNode(n.children.back(), encoding, reversed, next);
+                for (size_t i = n.children.size() - 1; i-- > 0;) {
+                    int choice = CompileNode(n.children[i], encoding, reversed, next);
+                    int split = AddState(NfaState::Split, -1, choice);
+                    nfa[split].out1 = start;
+                    start = split;
+                }
+                return start;
+            }
+            default: {
+                int tail = next;
+                if (n.max < 0) {
+                    int loop = AddState(NfaState::Split, -1, -1);
+                    nfa[loop].out1 = tail;
+                    int body = CompileNode(n.children[0], encoding, reversed, loop);
+                    nfa[loop].out = body;
+                    tail = loop;
+                } else {
+                    for (int i = n.min; i < n.max; i++) {
+                        int body = CompileNode(n.children[0], encoding, reversed, tail);
+                        int split = AddState(NfaState::Split, -1, body);
+                        nfa[split].out1 = tail;
+                        tail = split;
+                    }
+                }
+                for (int i = 0; i < n.min; i++) tail = CompileNode(n.children[0], encoding, reversed, tail);
+                return tail;
+            }
+        }
+    }
+
+    int AddState(NfaState::Kind kind, int set, int out) {
+        NfaState state = {kind, set, out, -1, 0};
+        nfa.push_back(state);
+        return static_cast<int>(nfa.size()) - 1;
+    }
+
+    // Adds state and everything reachable from it without input to set;
+    // stack is scratch space
+    void Closure(int state, std::vector<int>& set, std::vector<uint32_t>& marks, uint32_t mark, std::vector<int>& stack) const {
+        stack.assign(1, state);
+        while (!stack.empty()) {
+            int s = stack.back();
+            stack.pop_back();
+            if (s < 0 || marks[s] == mark) continue;
+            marks[s] = mark;
+            if (nfa[s].kind == NfaState::Split) {
+                stack.push_back(nfa[s].out1);
+                stack.push_back(nfa[s].out);
+            } else {
+                set.push_back(s);
+            }
+        }
+    }
+
+    bool BuildRegexAutomaton(std::string& error) {
+        nfa.clear();
+        regexNext.clear();
+        regexAccept.clear();
+        regexAccepts.clear();
+        regexVariants.clear();
+        std::fill(regexStartStays, regexStartStays + 256, true);
+        for (size_t v = 0; v < variants.size(); v++) {
+            if (variants[v].regexRoot >= 0) regexVariants.push_back(static_cast<uint32_t>(v));
+        }
+        if (regexVariants.empty()) return true;
+
+        std::vector<int> starts;
+        for (uint32_t v : regexVariants) {
+            Variant& variant = variants[v];
+            int match = AddState(NfaState::Match, -1, -1);
+            nfa[match].variant = v;
+            variant.forwardStart = CompileNode(variant.regexRoot, variant.encoding, false, match);
+            starts.push_back(variant.forwardStart);
+
+            int reverseMatch = AddState(NfaState::Match, -1, -1);
+            nfa[reverseMatch].variant = v;
+            variant.reverseStart = CompileNode(variant.regexRoot, variant.encoding, true, reverseMatch);
+            if (nfa.size() > kMaxNfaStates) {
+                error = "regex for rule '" + ruleIds[variant.rule] + "' is too large; lower its repeat counts";
+                return false;
+            }
+        }
+
+        // Subset construction. Every state also holds all the start states,
+        // since a match may begin at any byte.
+        std::vector<uint32_t> marks(nfa.size(), 0);
+        uint32_t mark = 0;
+        std::vector<int> stack;
+        std::vector<int> startSet;
+        mark++;
+        for (int start : starts) Closure(start, startSet, marks, mark, stack);
+        std::sort(startSet.begin(), startSet.end());
+
+        std::map<std::vector<int>, uint32_t> ids;
+        std::vector<std::vector<int>> states;
+        ids[startSet] = 0;
+        states.push_back(startSet);
+
+        for (size_t i = 0; i < states.size(); i++) {
+            regexNext.resize((i + 1) * classCount);
+            for (size_t c = 0; c < classCount; c++) {
+                unsigned char byte = classByte[c];
+                std::vector<int> next;
+                mark++;
+                for (int s : states[i]) {
+                    if (nfa[s].kind == NfaState::Set && byteSets[nfa[s].set][byte]) Closure(nfa[s].out, next, marks, mark, stack);
+                }
+                for (int start : starts) Closure(start, next, marks, mark, stack);
+                std::sort(next.begin(), next.end());
+
+                auto found = ids.find(next);
+                uint32_t nextId;
+                if (found != ids.end()) {
+                    nextId = found->second;
+                } else {
+                    if (states.size() == kMaxRegexStates) {
+                        error = "regexes need more than " + std::to_string(kMaxRegexStates) + " DFA states; simplify them";
+                        return false;
+                    }
+                    nextId = static_cast<uint32_t>(states.size());
+                    ids[next] = nextId;
+                    states.push_back(next);
+                }
+                regexNext[i * classCount + c] = nextId;
+            }
+        }
+
+        regexAccept.assign(states.size() + 1, 0);
+        for (size_t i = 0; i < states.size(); i++) {
+            regexAccept[i] = static_cast<uint32_t>(regexAccepts.size());
+            for (int s : states[i]) {
+                if (nfa[s].kind == NfaState::Match) regexAccepts.push_back(nfa[s].variant);
+            }
+        }
+        regexAccept[states.size()] = static_cast<uint32_t>(regexAccepts.size());
+
+        // Flag transitions into accepting states
+        for (auto& next : regexNext) {
+            if (regexAccept[next] != regexAccept[next + 1]) next |= kOutputFlag;
+        }
+        for (size_t b = 0; b < 256; b++) regexStartStays[b] = regexNext[byteClass[b]] == 0;
+        return true;
+    }
+
+    std::vector<std::string> ruleIds;
+    std::vector<Variant> variants;
+    std::vector<std::string> literals;
+    std::vector<RegexNode> regexNodes;
+    std::vector<std::bitset<256>> byteSets;
+
+    uint16_t byteClass[256] = {};
+    uint8_t classByte[256] = {};
+    size_t classCount = 1;
+
+    // Literal trie: states < trieDenseStates have a row in trieDense (0: no
+    // child, as the root is nobody's child), the rest list their edges in
+    // trieSparse
+    size_t trieDenseStates = 0;
+    std::vector<uint32_t> trieDense;
+    std::vector<uint32_t> trieSparseBegin;
+    std::vector<SparseEdge> trieSparse;
+    std::vector<uint32_t> trieOutputBegin;
+    std::vector<uint32_t> trieOutputs;
+    uint64_t startPairs[65536 / 64] = {};   // First two bytes of some literal
+    uint64_t prefixMasks[2] = {};           // Bytes of a start hashed: long literals, short ones
+    std::vector<uint64_t> prefixFilter;
+
+    // Regex DFA, and the NFA it was built from (kept to find match starts)
+    std::vector<NfaState> nfa;
+    int zeroSet = -1;
+    std::vector<uint32_t> regexVariants;
+    std::vector<uint32_t> regexNext;
+    std::vector<uint32_t> regexAccept;      // Per state: first entry in regexAccepts
+    std::vector<uint32_t> regexAccepts;
+    bool regexStartStays[256] = {};         // Bytes that keep the DFA at its start state
+};
+
+// Per-thread scanning state for a compiled PatternSet.
+class PatternMatcher {
+public:
+    explicit PatternMatcher(const PatternSet& set)
+        : set(set), marks(set.nfa.size(), 0), matchEnd(set.variants.size(), 0) {}
+
+    // Appends the matches in data[0, size) that start before startLimit.
+    // Literal matches may overlap; regex matches of one rule do not.
+    void Scan(const char* data, size_t size, size_t startLimit, std::vector<PatternMatch>& matches) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        const uint16_t* byteClass = set.byteClass;
+
+        const uint32_t* regexNext = set.regexNext.data();
+        size_t classCount = set.classCount;
+        const bool* stays = set.regexStartStays;
+        uint32_t regex = 0;
+
+        // Literals are found by where they start: a start that fails either
+        // filter cannot begin one, and the few that pass walk the trie. The
+        // filters are applied a block at a time, each over the starts the
+        // previous one kept, so the loads do not wait on each other and
+        // there is no branch to mispredict. Starts too close to the end to
+        // read a whole prefix go straight to the trie.
+        size_t literalLimit = set.trieOutputs.empty() ? 0 : (std::min)(startLimit, size);
+        size_t filtered = size >= PatternSet::kPrefixLength ? (std::min)(literalLimit, size - PatternSet::kPrefixLength + 1) : 0;
+        const uint64_t* pairs = set.startPairs;
+        const uint64_t* filter = set.prefixFilter.data();
+        uint64_t longMask = set.prefixMasks[0], shortMask = set.prefixMasks[1];
+        uint16_t starts[kBlockSize];        // Offsets in the block of the starts still in
+
+        for (size_t block = 0; block < size; block += kBlockSize) {
+            size_t blockEnd = (std::min)(size, block + kBlockSize);
+            size_t filterEnd = (std::min)(blockEnd, filtered);
+            // The DFA sits at its start state for nearly all bytes, which
+            // are skipped without touching the table
+            for (size_t i = block; i < blockEnd; i++) {
+                if (regex == 0) {
+                    while (i < blockEnd && stays[bytes[i]]) i++;
+                    if (i == blockEnd) break;
+                }
+                regex = regexNext[(regex & PatternSet::kStateMask) * classCount + byteClass[bytes[i]]];
+                if (regex & PatternSet::kOutputFlag) {
+                    ReportRegexes(regex & PatternSet::kStateMask, bytes, i + 1, size, startLimit, matches);
+                }
+            }
+
+            size_t count = 0;
+            for (size_t i = block; i < filterEnd; i++) {
+                uint16_t pair;
+                std::memcpy(&pair, bytes + i, sizeof(pair));
+                starts[count] = static_cast<uint16_t>(i - block);
+                count += (pairs[pair / 64] >> (pair % 64)) & 1;
+            }
+            size_t kept = 0;
+            for (size_t s = 0; s < count; s++) {
+                uint64_t prefix;
+                std::memcpy(&prefix, bytes + block + starts[s], sizeof(prefix));
+                uint64_t longHash = PatternSet::PrefixHash(prefix & longMask), longBits = PatternSet::PrefixBits(longHash);
+                uint64_t shortHash = PatternSet::PrefixHash(prefix & shortMask), shortBits = PatternSet::PrefixBits(shortHash);
+                starts[kept] = starts[s];
+                kept += ((filter[PatternSet::PrefixWord(longHash)] & longBits) == longBits) |
+                        ((filter[PatternSet::PrefixWord(shortHash)] & shortBits) == shortBits);
+            }
+            for (size_t s = 0; s < kept; s++) ReportLiterals(bytes, block + starts[s], size, matches);
+        }
+        for (size_t i = filtered; i < literalLimit; i++) ReportLiterals(bytes, i, size, matches);
+
+        for (uint32_t v : touched) matchEnd[v] = 0;
+        touched.clear();
+    }
+
+private:
+    static constexpr size_t kNoMatch = ~static_cast<size_t>(0);
+    static constexpr size_t kBlockSize = 4096;
+
+    // Reports every literal that starts at start
+    void ReportLiterals(const unsigned char* bytes, size_t start, size_t size, std::vector<PatternMatch>& matches) {
+        uint32_t state = 0;
+        for (size_t i = start; i < size; i++) {
+            state = set.Child(state, set.byteClass[bytes[i]]);
+            if (state == PatternSet::kNone) return;
+            for (uint32_t o = set.trieOutputBegin[state]; o < set.trieOutputBegin[state + 1]; o++) {
+                PatternMatch match = {start, i + 1 - start, set.trieOutputs[o]};
+                matches.push_back(match);
+            }
+        }
+    }
+
+    // The DFA accepts at end for each variant of state. The first time it
+    // does past a variant's last match, the match is resolved whole: the
+    // leftmost start of a match ending at end that does not overlap the last
+    // one, then the longest match from that start. The accepting bytes that
+    // match covers are passed over, so every byte is walked by the NFA about
+    // twice however long the matches grow.
+    void ReportRegexes(uint32_t state, const unsigned char* bytes, size_t end, size_t size, size_t startLimit,
+                       std::vector<PatternMatch>& matches) {
+        for (uint32_t a = set.regexAccept[state]; a < set.regexAccept[state + 1]; a++) {
+            uint32_t variant = set.regexAccepts[a];
+            size_t& last = matchEnd[variant];
+            if (end <= last) continue;
+            size_t start = FindStart(variant, bytes, end, last);
+            if (start == kNoMatch) continue;
+            if (last == 0) touched.push_back(variant);
+            last = FindEnd(variant, bytes, start, size);
+            if (start >= startLimit) continue;
+            PatternMatch match = {start, last - start, variant};
+            matches.push_back(match);
+        }
+    }
+
+    // Runs the reversed NFA backwards from end and returns the leftmost
+    // start of a match, not before floor and looking back at most
+    // kMaxMatchLength bytes
+    size_t FindStart(uint32_t variant, const unsigned char* bytes, size_t end, size_t floor) {
+        size_t lower = (std::max)(floor, end > PatternSet::kMaxMatchLength ? end - PatternSet::kMaxMatchLength : 0);
+        size_t best = kNoMatch;
+        current.clear();
+        set.Closure(set.variants[variant].reverseStart, current, marks, ++mark, stack);
+        for (size_t p = end; p > lower && !current.empty(); p--) {
+            if (Step(bytes[p - 1])) best = p - 1;
+        }
+        return best;
+    }
+
+    // Runs the NFA forwards from start and returns the end of the longest
+    // match, at most kMaxMatchLength bytes long and within size
+    size_t FindEnd(uint32_t variant, const unsigned char* bytes, size_t start, size_t size) {
+        size_t upper = (std::min)(size, start + PatternSet::kMaxMatchLength);
+        size_t best = start;
+        current.clear();
+        set.Closure(set.variants[variant].forwardStart, current, marks, ++mark, stack);
+        for (size_t p = start; p < upper && !current.empty(); p++) {
+            if (Step(bytes[p])) best = p + 1;
+        }
+        return best;
+    }
+
+    // Moves the NFA states in current over byte; true if one now matches
+    bool Step(unsigned char byte) {
+        next.clear();
+        ++mark;
+        for (int s : current) {
+            const PatternSet::NfaState& state = set.nfa[s];
+            if (state.kind == PatternSet::NfaState::Set && set.byteSets[state.set][byte]) set.Closure(state.out, next, marks, mark, stack);
+        }
+        current.swap(next);
+        for (int s : current) {
+            if (set.nfa[s].kind == PatternSet::NfaState::Match) return true;
+        }
+        return false;
+    }
+
+    const PatternSet& set;
+    std::vector<uint32_t> marks;
+    uint32_t mark = 0;
+    std::vector<int> current;
+    std::vector<int> next;
+    std::vector<int> stack;
+    std::vector<size_t> matchEnd;       // Per variant: end of its last match in this scan, or 0
+    std::vector<uint32_t> touched;
+};
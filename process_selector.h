@@ -0,0 +1,114 @@
+#pragma once
+
+// Which processes a run scans: those with a given name, those whose name
+// matches a glob (* and ?, case-insensitive), those in a list of PIDs, or
+// every process. The process list is enumerated once per run and the
+// selector is matched against it.
+
+#include "memory_source.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Case-insensitive match of text against a pattern of literal characters,
+// '*' (any run) and '?' (any one character).
+inline bool GlobMatches(const std::string& text, const std::string& pattern) {
+    size_t t = 0, p = 0;
+    size_t starPattern = std::string::npos, starText = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            starPattern = p++;
+            starText = t;
+        } else if (p < pattern.size() && (pattern[p] == '?' ||
+                   std::tolower(static_cast<unsigned char>(pattern[p])) == std::tolower(static_cast<unsigned char>(text[t])))) {
+            p++;
+            t++;
+        } else if (starPattern != std::string::npos) {
+            // Let the last star take one more character
+            p = starPattern + 1;
+            t = ++starText;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') p++;
+    return p == pattern.size();
+}
+
+inline bool IsGlob(const std::string& pattern) {
+    return pattern.find_first_of("*?") != std::string::npos;
+}
+
+// Parses "1200,1304,88"
+inline bool ParsePidList(const std::string& text, std::vector<DWORD>& pids, std::string& error) {
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) end = text.size();
+        std::string item = text.substr(start, end - start);
+        start = end + 1;
+
+        char* last = NULL;
+        unsigned long pid = std::strtoul(item.c_str(), &last, 10);
+        if (item.empty() || *last != '\0' || pid == 0) {
+            error = "Invalid process ID: " + item;
+            return false;
+        }
+        pids.push_back(static_cast<DWORD>(pid));
+    }
+    return true;
+}
+
+struct ProcessSelector {
+    enum Kind { Name, Glob, PidList, All };
+
+    Kind kind = Name;
+    std::string name;           // Name or Glob
+    std::vector<DWORD> pids;    // PidList
+
+    // Whether the selection is meant to cover several processes. A plain
+    // name can match several too, but is also how a single process is
+    // picked, as is a list of one PID.
+    bool IsBatch() const { return kind == Glob || kind == All || (kind == PidList && pids.size() > 1); }
+
+    std::string Describe() const {
+        switch (kind) {
+            case Name: return name;
+            case Glob: return "processes matching " + name;
+            case PidList: {
+                std::string list = pids.size() == 1 ? "PID " : "PIDs ";
+                for (size_t i = 0; i < pids.size(); i++) list += (i ? "," : "") + std::to_string(pids[i]);
+                return list;
+            }
+            default: return "all processes";
+        }
+    }
+
+    // The processes selected, in the order listed, each once. PIDs that no
+    // longer exist are kept, with no name, so that their failure is reported.
+    std::vector<ProcessEntry> Select(const std::vector<ProcessEntry>& processes) const {
+        std::vector<ProcessEntry> selected;
+        if (kind == PidList) {
+            for (DWORD pid : pids) {
+                bool seen = false;
+                for (const auto& entry : selected) seen = seen || entry.processId == pid;
+                if (seen) continue;
+                ProcessEntry entry = {pid, std::string()};
+                for (const auto& process : processes) {
+                    if (process.processId == pid) entry.name = process.name;
+                }
+                selected.push_back(entry);
+            }
+            return selected;
+        }
+        for (const auto& process : processes) {
+            if (kind == All || (kind == Glob && GlobMatches(process.name, name)) ||
+                (kind == Name && ProcessNameMatches(process.name, name))) {
+                selected.push_back(process);
+            }
+        }
+        return selected;
+    }
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+// Fewer, larger reads into reused buffers.
+//
+// BufferPool hands out page-aligned buffers and takes them back when they
+// are released, so once a scan has warmed up its reads allocate nothing.
+//
+// ReadPlanner merges the requests of a batch into as few reads as it can:
+// requests laid out in their buffers the way they are in memory become one
+// read, also across a gap of up to maxGap bytes between them when the
+// region map shows the gap readable (ScanScheduler leaves room for such
+// gaps in its chunk buffers). A merged read that comes back short is redone
+// request by request, so memory that became unreadable since it was
+// enumerated costs only its own requests.
+
+#include "memory_source.h"
+#include "telemetry.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+class BufferPool;
+
+// A buffer on loan from a BufferPool; it goes back to the pool when
+// destroyed or replaced.
+class PooledBuffer {
+public:
+    PooledBuffer() : pool(nullptr), bytes(nullptr), capacity(0) {}
+    PooledBuffer(PooledBuffer&& other) noexcept : pool(other.pool), bytes(other.bytes), capacity(other.capacity) {
+        other.bytes = nullptr;
+        other.capacity = 0;
+    }
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+    ~PooledBuffer();
+
+    char* data() const { return bytes; }
+    size_t size() const { return capacity; }
+
+private:
+    friend class BufferPool;
+    PooledBuffer(BufferPool* pool, char* bytes, size_t capacity) : pool(pool), bytes(bytes), capacity(capacity) {}
+
+    BufferPool* pool;
+    char* bytes;
+    size_t capacity;
+};
+
+class BufferPool {
+public:
+    static const size_t kAlignment = 4096;
+    // Sizes are rounded up to this, so that buffers of similar size can be
+    // reused for each other
+    static const size_t kGranularity = 64 * 1024;
+
+    BufferPool() {}
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ~BufferPool() {
+        for (const auto& block : idle) Free(block);
+    }
+
+    // The smallest idle buffer of at least size bytes, or a new one. Safe
+    // to call from several threads at once.
+    PooledBuffer Acquire(size_t size) {
+        size = (size + kGranularity - 1) / kGranularity * kGranularity;
+        if (size == 0) size = kGranularity;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t best = idle.size();
+            for (size_t i = 0; i < idle.size(); i++) {
+                if (idle[i].size >= size && (best == idle.size() || idle[i].size < idle[best].size)) best = i;
+            }
+            if (best < idle.size()) {
+                Block block = idle[best];
+                idle[best] = idle.back();
+                idle.pop_back();
+                return PooledBuffer(this, block.data, block.size);
+            }
+            allocations++;
+        }
+        char* data = static_cast<char*>(::operator new(size, std::align_val_t(kAlignment)));
+        return PooledBuffer(this, data, size);
+    }
+
+    // Buffers allocated so far; stops growing once the pool is warm
+    size_t Allocations() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return allocations;
+    }
+
+private:
+    friend class PooledBuffer;
+
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    void Release(char* data, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(Block{data, size});
+    }
+
+    static void Free(const Block& block) {
+        ::operator delete(block.data, std::align_val_t(kAlignment));
+    }
+
+    mutable std::mutex mutex;
+    std::vector<Block> idle;
+    size_t allocations = 0;
+};
+
+inline PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if (this != &other) {
+        if (bytes) pool->Release(bytes, capacity);
+        pool = other.pool;
+        bytes = other.bytes;
+        capacity = other.capacity;
+        other.bytes = nullptr;
+        other.capacity = 0;
+    }
+    return *this;
+}
+
+inline PooledBuffer::~PooledBuffer() {
+    if (bytes) pool->Release(bytes, capacity);
+}
+
+class ReadPlanner {
+public:
+    // Each ReadProcessMemory is a system call, so reading a small gap costs
+    // less than a second call. process_vm_readv already takes a whole batch
+    // in one call, so there only reads that are adjacent are merged.
+#ifdef _WIN32
+    static const size_t kDefaultMaxGap = 16 * 1024;
+#else
+    static const size_t kDefaultMaxGap = 0;
+#endif
+    static const size_t kMaxMergedRead = 4 * 1024 * 1024;
+
+    // Takes the readable committed memory from regions, the enumeration of
+    // the source about to be read, in ascending address order. Without a
+    // map, only adjacent requests are merged.
+    void SetRegions(const std::vector<MemoryRegion>& regions, size_t gap = kDefaultMaxGap) {
+        readable.clear();
+        maxGap = gap;
+        for (const auto& region : regions) {
+            if (!IsReadable(region)) continue;
+            uint64_t end = region.BaseAddress + region.RegionSize;
+            if (!readable.empty() && readable.back().end == region.BaseAddress) {
+                readable.back().end = end;
+            } else {
+                readable.push_back(Span{region.BaseAddress, end});
+            }
+        }
+    }
+
+    void ClearRegions() {
+        readable.clear();
+        maxGap = 0;
+    }
+
+    // On by default; off, every request is read on its own
+    void SetMerging(bool on) {
+        merging = on;
+    }
+
+    // Whether a read may run on from end through to next, so that the two
+    // reads on either side can be merged. next must not be below end.
+    bool CanBridge(uint64_t end, uint64_t next) const {
+        if (!merging) return false;
+        if (next == end) return true;
+        if (next - end > maxGap) return false;
+        auto span = std::upper_bound(readable.begin(), readable.end(), end,
+                                     [](uint64_t address, const Span& s) { return address < s.end; });
+        return span != readable.end() && span->start <= end && next <= span->end;
+    }
+
+    // Reads every request, merged where their buffers allow. Uses scratch
+    // space of its own, so one thread at a time.
+    void ReadBatch(MemorySource& source, ReadRequest* requests, size_t count) {
+        merged.clear();
+        firsts.clear();
+        for (size_t i = 0; i < count;) {
+            ReadRequest read = requests[i];
+            size_t next = i + 1;
+            for (; next < count; next++) {
+                const ReadRequest& request = requests[next];
+                uint64_t end = read.address + read.size;
+                // Gap bytes land in the buffer between the two requests
+                if (request.address < end || request.buffer != read.buffer + (request.address - read.address) ||
+                    request.address + request.size - read.address > kMaxMergedRead || !CanBridge(end, request.address)) {
+                    break;
+                }
+                read.size = static_cast<size_t>(request.address + request.size - read.address);
+            }
+            read.bytesRead = 0;
+            merged.push_back(read);
+            firsts.push_back(i);
+            i = next;
+        }
+        firsts.push_back(count);
+
+        source.ReadBatch(merged.data(), merged.size());
+        Telemetry::Add(Counter::ReadsIssued, merged.size());
+        Telemetry::Add(Counter::ReadsMerged, count - merged.size());
+
+        retries.clear();
+        for (size_t m = 0; m < merged.size(); m++) {
+            size_t first = firsts[m], last = firsts[m + 1];
+            if (last - first == 1) {
+                requests[first].bytesRead = merged[m].bytesRead;
+                continue;
+            }
+            bool complete = merged[m].bytesRead == merged[m].size;
+            if (!complete) Telemetry::Add(Counter::MergedReadRetries);
+            for (size_t r = first; r < last; r++) {
+                requests[r].bytesRead = complete ? requests[r].size : 0;
+                if (!complete) retries.push_back(r);
+            }
+        }
+        if (retries.empty()) return;
+
+        // Per request, as if they had never been merged
+        for (size_t r : retries) retried.push_back(requests[r]);
+        source.ReadBatch(retried.data(), retried.size());
+        Telemetry::Add(Counter::ReadsIssued, retried.size());
+        for (size_t i = 0; i < retries.size(); i++) requests[retries[i]].bytesRead = retried[i].bytesRead;
+        retried.clear();
+    }
+
+private:
+    struct Span {
+        uint64_t start;
+        uint64_t end;
+    };
+
+    static bool IsReadable(const MemoryRegion& region) {
+        const DWORD readAccess = PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY |
+                                 PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+        return region.State == MEM_COMMIT && (region.Protect & readAccess) && !(region.Protect & PAGE_GUARD);
+    }
+
+    std::vector<Span> readable;     // Readable committed memory, adjacent regions joined
+    size_t maxGap = 0;
+    bool merging = true;
+    // Scratch space of ReadBatch
+    std::vector<ReadRequest> merged;
+    std::vector<size_t> firsts;     // Per merged read: its first request, then count
+    std::vector<size_t> retries;
+    std::vector<ReadRequest> retried;
+};
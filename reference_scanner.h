@@ -0,0 +1,244 @@
+#pragma once
+
+// Pointer sweep for the reference graph: which memory points where.
+//
+// A RegionIndex holds the enumerated regions as two sorted arrays of start
+// and end addresses, 16 bytes a region. The sweep reads every 8-byte
+// aligned word of a buffer and first checks it against the span from the
+// lowest region start to the highest region end with a vector compare,
+// which rejects text, small integers and zeros 8 words at a time. The few
+// words inside the span are confirmed with a binary search of the starts,
+// after a check of the region the previous pointer fell in, since pointers
+// tend to come in runs into the same region.
+//
+// SSE2 has no 64-bit compare, so its kernel compares the upper halves of
+// the words with 32-bit compares, a superset the confirmation narrows
+// down; the AVX2 and AVX-512 kernels compare whole words.
+
+#include "memory_source.h"
+#include "string_store.h"
+#include "text_scanner.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// One pointer found in memory
+struct Reference {
+    uint64_t source;        // Address of the pointer
+    uint64_t target;        // Address it holds
+    uint64_t textAddress;   // Start of the string target points into, or 0
+    uint32_t targetRegion;  // Index of the region target lies in, as given to RegionIndex
+    uint32_t text;          // ID of that string, or StringStore::kInvalidId
+};
+
+// Sorted interval index over a list of regions
+class RegionIndex {
+public:
+    static const uint32_t kNone = 0xFFFFFFFFu;
+
+    RegionIndex() = default;
+
+    explicit RegionIndex(const std::vector<MemoryRegion>& regions) {
+        Build(regions);
+    }
+
+    // Regions may come in any order; empty ones are left out. Regions are
+    // not expected to overlap.
+    void Build(const std::vector<MemoryRegion>& regions) {
+        std::vector<uint32_t> order;
+        for (size_t i = 0; i < regions.size(); i++) {
+            if (regions[i].RegionSize) order.push_back(static_cast<uint32_t>(i));
+        }
+        std::sort(order.begin(), order.end(),
+                  [&](uint32_t a, uint32_t b) { return regions[a].BaseAddress < regions[b].BaseAddress; });
+        starts.resize(order.size());
+        ends.resize(order.size());
+        indices.swap(order);
+        for (size_t i = 0; i < indices.size(); i++) {
+            starts[i] = regions[indices[i]].BaseAddress;
+            ends[i] = starts[i] + regions[indices[i]].RegionSize;
+        }
+        low = starts.empty() ? 0 : starts.front();
+        high = 0;
+        for (uint64_t end : ends) high = (std::max)(high, end);
+    }
+
+    bool empty() const { return starts.empty(); }
+    size_t size() const { return starts.size(); }
+
+    // Lowest start and highest end of all regions
+    uint64_t Low() const { return low; }
+    uint64_t High() const { return high; }
+
+    // Position in the sorted arrays of the region holding address, or kNone.
+    // The search halves without branching on the comparisons, which random
+    // words would mispredict half the time.
+    uint32_t Position(uint64_t address) const {
+        const uint64_t* first = starts.data();
+        for (size_t count = starts.size(); count > 1;) {
+            size_t half = count / 2;
+            first = first[half] <= address ? first + half : first;
+            count -= half;
+        }
+        size_t i = static_cast<size_t>(first - starts.data());
+        return address >= starts[i] && address < ends[i] ? static_cast<uint32_t>(i) : kNone;
+    }
+
+    bool Contains(uint32_t position, uint64_t address) const {
+        return address >= starts[position] && address < ends[position];
+    }
+
+    // The region's index in the list the index was built from
+    uint32_t RegionAt(uint32_t position) const { return indices[position]; }
+
+    // Index of the region holding address, in the list the index was built
+    // from, or kNone
+    uint32_t Find(uint64_t address) const {
+        uint32_t position = Position(address);
+        return position == kNone ? kNone : indices[position];
+    }
+
+private:
+    std::vector<uint64_t> starts;
+    std::vector<uint64_t> ends;
+    std::vector<uint32_t> indices;
+    uint64_t low = 0;
+    uint64_t high = 0;
+};
+
+namespace reference_scan_detail {
+
+// Kernels take 512 bytes and return one bit per word, set for the words
+// that may lie in [low, high).
+
+inline uint64_t CandidateMaskScalar(const unsigned char* data, uint64_t low, uint64_t high) {
+    uint64_t mask = 0;
+    for (size_t w = 0; w < 64; w++) {
+        uint64_t word;
+        std::memcpy(&word, data + w * 8, 8);
+        mask |= static_cast<uint64_t>(word - low < high - low) << w;
+    }
+    return mask;
+}
+
+#if defined(HEAP_SCAN_X86)
+
+HEAP_SCAN_TARGET_SSE2
+inline uint64_t CandidateMaskSSE2(const unsigned char* data, uint64_t low, uint64_t high) {
+    const __m128i flip = _mm_set1_epi32(static_cast<int>(0x80000000u));
+    const __m128i lowHalf = _mm_set1_epi32(static_cast<int>(static_cast<uint32_t>(low >> 32) ^ 0x80000000u));
+    const __m128i highHalf = _mm_set1_epi32(static_cast<int>(static_cast<uint32_t>((high - 1) >> 32) ^ 0x80000000u));
+    uint64_t mask = 0;
+    for (size_t i = 0; i < 512; i += 16) {
+        __m128i words = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), flip);
+        __m128i outside = _mm_or_si128(_mm_cmpgt_epi32(lowHalf, words), _mm_cmpgt_epi32(words, highHalf));
+        // The upper halves are dwords 1 and 3
+        int halves = ~_mm_movemask_ps(_mm_castsi128_ps(outside));
+        mask |= static_cast<uint64_t>(((halves >> 1) & 1) | ((halves >> 2) & 2)) << (i / 8);
+    }
+    return mask;
+}
+
+HEAP_SCAN_TARGET_AVX2
+inline uint64_t CandidateMaskAVX2(const unsigned char* data, uint64_t low, uint64_t high) {
+    const __m256i flip = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+    const __m256i lowWord = _mm256_set1_epi64x(static_cast<long long>(low ^ 0x8000000000000000ull));
+    const __m256i lastWord = _mm256_set1_epi64x(static_cast<long long>((high - 1) ^ 0x8000000000000000ull));
+    uint64_t mask = 0;
+    for (size_t i = 0; i < 512; i += 32) {
+        __m256i words = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), flip);
+        __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi64(lowWord, words), _mm256_cmpgt_epi64(words, lastWord));
+        int inside = ~_mm256_movemask_pd(_mm256_castsi256_pd(outside)) & 0xF;
+        mask |= static_cast<uint64_t>(inside) << (i / 8);
+    }
+    return mask;
+}
+
+HEAP_SCAN_TARGET_AVX512
+inline uint64_t CandidateMaskAVX512(const unsigned char* data, uint64_t low, uint64_t high) {
+    const __m512i lowWord = _mm512_set1_epi64(static_cast<long long>(low));
+    const __m512i highWord = _mm512_set1_epi64(static_cast<long long>(high));
+    uint64_t mask = 0;
+    for (size_t i = 0; i < 512; i += 64) {
+        __m512i words = _mm512_loadu_si512(reinterpret_cast<const void*>(data + i));
+        __mmask8 inside = _mm512_mask_cmplt_epu64_mask(_mm512_cmpge_epu64_mask(words, lowWord), words, highWord);
+        mask |= static_cast<uint64_t>(inside) << (i / 8);
+    }
+    return mask;
+}
+
+#endif
+
+}  // namespace reference_scan_detail
+
+class ReferenceScanner {
+public:
+    static const size_t kBlockBytes = 512;
+
+    explicit ReferenceScanner(ScanKernel requested = TextScanner::DetectBestKernel())
+        : kernel(TextScanner::IsKernelSupported(requested) ? requested : TextScanner::DetectBestKernel()) {}
+
+    ScanKernel Kernel() const { return kernel; }
+
+    // Appends a Reference for every 8-byte aligned word of the size bytes at
+    // data, which lie at address, that points into a region of index, in
+    // address order. Their text fields are left unset. Returns how many
+    // words passed the span check.
+    size_t Sweep(const RegionIndex& index, const char* data, size_t size, uint64_t address, std::vector<Reference>& out) const {
+        if (index.empty()) return 0;
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        size_t offset = static_cast<size_t>((8 - address % 8) % 8);
+        uint64_t low = index.Low();
+        uint64_t high = index.High();
+        uint32_t last = 0;
+        size_t candidates = 0;
+
+        auto confirm = [&](size_t at) {
+            uint64_t word;
+            std::memcpy(&word, bytes + at, 8);
+            if (word - low >= high - low) return;
+            candidates++;
+            if (!index.Contains(last, word)) {
+                uint32_t position = index.Position(word);
+                if (position == RegionIndex::kNone) return;
+                last = position;
+            }
+            Reference reference;
+            reference.source = address + at;
+            reference.target = word;
+            reference.textAddress = 0;
+            reference.targetRegion = index.RegionAt(last);
+            reference.text = StringStore::kInvalidId;
+            out.push_back(reference);
+        };
+
+        for (; offset + kBlockBytes <= size; offset += kBlockBytes) {
+            uint64_t mask = CandidateMask(bytes + offset, low, high);
+            while (mask) {
+                confirm(offset + CountTrailingZeros64(mask) * 8);
+                mask &= mask - 1;
+            }
+        }
+        for (; offset + 8 <= size; offset += 8) confirm(offset);
+        return candidates;
+    }
+
+private:
+    uint64_t CandidateMask(const unsigned char* bytes, uint64_t low, uint64_t high) const {
+        using namespace reference_scan_detail;
+
+        switch (kernel) {
+#if defined(HEAP_SCAN_X86)
+            case ScanKernel::AVX512: return CandidateMaskAVX512(bytes, low, high);
+            case ScanKernel::AVX2: return CandidateMaskAVX2(bytes, low, high);
+            case ScanKernel::SSE2: return CandidateMaskSSE2(bytes, low, high);
+#endif
+            default: return CandidateMaskScalar(bytes, low, high);
+        }
+    }
+
+    ScanKernel kernel;
+};
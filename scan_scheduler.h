@@ -0,0 +1,782 @@
+#pragma once
+
+// Parallel, streaming text extraction over a list of memory ranges.
+//
+// Ranges that follow each other without a gap form one stream, so strings
+// crossing a region boundary are found whole. Streams are cut into pieces
+// of at most the chunk (task) size, never crossing a range boundary, and
+// runs of small pieces are packed into one task so they are fetched with a
+// single MemorySource::ReadBatch call. Within a task, a ReadPlanner merges
+// the reads of neighbouring pieces; given the region map, it also reads
+// through small readable gaps between them, for which the task's buffer
+// leaves room.
+//
+// Tasks flow through a pipeline with a bounded number of slots, each
+// holding one chunk: a reader thread fetches the next chunks while the scan
+// workers are busy with the current ones, and a slot is reused once its
+// results are merged. Memory use is therefore bounded by the chunk size
+// times the pipeline depth, however large the target, and slot buffers come
+// from a BufferPool that outlives the scans. Sources that expose
+// their memory through MemorySource::View are scanned in place.
+//
+// A piece whose stream goes on reads a little past its end. It follows its
+// scan across the boundary until it meets the scan the next piece starts
+// fresh at the boundary, and records that meeting point; the next piece's
+// strings before it are dropped at merge time. Merging happens in piece
+// order, so a stream yields the same strings, in the same order and with
+// the same first-seen addresses, as one sequential scan over all of it,
+// whatever the number of threads. All-zero pages of a piece are found with
+// a vectorized check and left out of its text scan, which changes nothing
+// about the strings found. With a PageClassifier attached, the other pages
+// are profiled first too, and only those classed as text are scanned.
+//
+// With a HeapWalk attached, the reader thread hands it every chunk it has
+// fetched, in address order, before the chunk is scanned, and gets back the
+// spans of heap segments that hold no live allocation. Strings that start
+// in them can then be left out.
+//
+// With a PatternSet attached, every piece is also searched for the rules'
+// patterns in the same pass; a piece reports the matches that start in it,
+// using its overlap to finish the ones that cross its end.
+//
+// With a RegionIndex attached, every piece is also swept for pointers into
+// the indexed regions (see reference_scanner.h), whatever its pages were
+// classed as; a piece reports the pointers that start in it.
+
+#include "heap_walker.h"
+#include "memory_source.h"
+#include "page_classifier.h"
+#include "pattern_engine.h"
+#include "read_planner.h"
+#include "reference_scanner.h"
+#include "string_store.h"
+#include "telemetry.h"
+#include "text_scanner.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct ScanRange {
+    uint64_t address;
+    uint64_t size;
+};
+
+// Appends the runs of pages of [address, address + size) that the source
+// reports resident to runs, and adds the bytes of the others to skipped.
+// Pages that are not resident read as zeros, so a run followed by one takes
+// the first bytes of it along: the scan of the run then sees the zeros it
+// would have seen scanning the whole range. workingSet asks for
+// MemorySource::QueryWorkingSet instead of QueryResidency. Returns false,
+// having appended nothing, when the source cannot tell or address is not
+// page-aligned.
+inline bool AppendResidentRuns(MemorySource& source, uint64_t address, uint64_t size, std::vector<uint8_t>& residency,
+                               std::vector<ScanRange>& runs, uint64_t& skipped, bool workingSet = false) {
+    const uint64_t page = MemorySource::kPageSize;
+    const uint64_t tail = TextScanner::kLookaheadBytes;
+    if (address % page) return false;
+    if (!(workingSet ? source.QueryWorkingSet(address, size, residency) : source.QueryResidency(address, size, residency))) return false;
+
+    for (size_t p = 0; p < residency.size();) {
+        size_t first = p;
+        bool resident = residency[p] != 0;
+        while (p < residency.size() && (residency[p] != 0) == resident) p++;
+        uint64_t start = address + first * page;
+        uint64_t end = (std::min)(address + size, address + p * page);
+        if (resident) {
+            if (p < residency.size()) end = (std::min)(address + size, end + tail);
+            ScanRange run = {start, end - start};
+            runs.push_back(run);
+        } else {
+            if (first > 0) start = (std::min)(end, start + tail);
+            skipped += end - start;
+        }
+    }
+    return true;
+}
+
+// Receives the strings of a scan instead of the string store, as they are
+// merged: in address order and from one thread at a time. range is an
+// index into the scanned ranges.
+class ScanListener {
+public:
+    virtual ~ScanListener() {}
+    virtual void OnText(uint64_t address, uint32_t byteLength, std::string_view text, size_t range) = 0;
+};
+
+// One string a scan found: where it starts, the bytes it covers and its ID
+// in the string store
+struct TextOccurrence {
+    uint64_t address;
+    uint32_t byteLength;
+    uint32_t id;
+};
+
+class ScanScheduler {
+public:
+    static constexpr size_t kDefaultTaskSize = 1024 * 1024;
+    static const size_t kTaskOverlap = 16 * 1024;
+    // Ranges packed into one batched task at most
+    static const size_t kMaxBatchPieces = 256;
+    // Chunks in flight per scan thread: one being scanned, one being read
+    static const size_t kDefaultPipelineDepth = 2;
+
+    explicit ScanScheduler(size_t threads, size_t taskSize = kDefaultTaskSize, size_t depth = kDefaultPipelineDepth)
+        : pool(threads), taskSize(taskSize & ~static_cast<size_t>(1)), depth(depth ? depth : 1), workers(pool.ThreadCount()) {
+        if (this->taskSize < 2 * kTaskOverlap) this->taskSize = 2 * kTaskOverlap;
+    }
+
+    size_t ThreadCount() const { return pool.ThreadCount(); }
+
+    // The scan threads, for other per-chunk work between scans
+    WorkStealingPool& Pool() { return pool; }
+
+    // Read buffers, for that work and for sources that stage their reads
+    BufferPool& Buffers() { return buffers; }
+
+    // Searches for patterns during every following scan; nullptr stops.
+    // The set must be compiled and outlive the scans.
+    void SetPatterns(const PatternSet* set) {
+        patterns = set && !set->empty() ? set : nullptr;
+        for (auto& worker : workers) {
+            worker.matcher.reset(patterns ? new PatternMatcher(*patterns) : nullptr);
+        }
+    }
+
+    // The enumeration of the source the following scans read, so that
+    // their reads can run through small readable gaps (see read_planner.h)
+    void SetRegionMap(const std::vector<MemoryRegion>& regions, size_t maxGap = ReadPlanner::kDefaultMaxGap) {
+        planner.SetRegions(regions, maxGap);
+    }
+
+    void ClearRegionMap() {
+        planner.ClearRegions();
+    }
+
+    // Read merging is on by default; heap_bench turns it off to compare
+    void SetReadMerging(bool on) {
+        planner.SetMerging(on);
+    }
+
+    // Drops all-zero pages before they are scanned for text; on by default.
+    // Results do not change, since such a page starts no string and ends
+    // any before it.
+    void SetZeroPageCheck(bool on) {
+        zeroPageCheck = on;
+    }
+
+    // Bytes of all-zero pages the scans so far did not scan for text
+    uint64_t ZeroBytesSkipped() const {
+        uint64_t total = 0;
+        for (const auto& worker : workers) total += worker.zeroBytes;
+        return total;
+    }
+
+    // Bytes of pages the classifier found not to be text, left unscanned
+    uint64_t ClassifiedBytesSkipped() const {
+        uint64_t total = 0;
+        for (const auto& worker : workers) total += worker.classifiedBytes;
+        return total;
+    }
+
+    // Profiles every page before its text scan and skips those that are not
+    // text (see page_classifier.h); nullptr scans every page that is not
+    // all zeros. Unlike the zero check, this can drop strings: the ones
+    // that start in a skipped page.
+    void SetPageClassifier(const PageClassifier* pageClassifier) {
+        classifier = pageClassifier;
+    }
+
+    // Sweeps every following scan for pointers into the regions of index;
+    // nullptr stops. The index must outlive the scans.
+    void SetReferenceIndex(const RegionIndex* index) {
+        referenceIndex = index && !index->empty() ? index : nullptr;
+    }
+
+    // Walks the heap segments of every following scan as their memory is
+    // read (see heap_walker.h); with inUseOnly, strings that start outside
+    // live allocations are dropped. nullptr stops.
+    void SetHeapWalk(HeapWalk* walk, bool inUseOnly = false) {
+        heapWalk = walk && !walk->empty() ? walk : nullptr;
+        liveTextOnly = heapWalk && inUseOnly;
+    }
+
+    // Streams the strings of every following scan to listener instead of
+    // interning them; nullptr goes back to the store
+    void SetListener(ScanListener* listener) {
+        textListener = listener;
+    }
+
+    ScanListener* Listener() const { return textListener; }
+
+    // Most bytes of chunk buffers a scan holds at once
+    size_t BufferBudget() const { return depth * workers.size() * (taskSize + kTaskOverlap); }
+
+    // Extracts text from every range and interns it into texts (or passes
+    // it to the listener) in address order. ranges must be sorted by
+    // address. newTextsPerRange, if given, receives how many previously
+    // unseen strings start in each range. Pattern hits, if patterns are set,
+    // are appended to hits in address order, and so is every string found
+    // to occurrences, if given. pageClassesPerRange, if given, receives the
+    // classes of the whole pages of each range that were read. Pointers, if
+    // a region index is set, are appended to references in address order.
+    void Scan(const std::vector<ScanRange>& ranges, MemorySource& source, StringStore& texts,
+              std::vector<size_t>* newTextsPerRange = nullptr, std::vector<PatternHit>* hits = nullptr,
+              std::vector<TextOccurrence>* occurrences = nullptr, std::vector<PageClassCounts>* pageClassesPerRange = nullptr,
+              std::vector<Reference>* references = nullptr) {
+        if (pageClassesPerRange) pageClassesPerRange->assign(ranges.size(), PageClassCounts());
+        if (newTextsPerRange) newTextsPerRange->assign(ranges.size(), 0);
+        textOccurrences = occurrences;
+        PlanTasks(ranges);
+        if (tasks.empty()) return;
+        patternHits = patterns ? hits : nullptr;
+        referenceOutput = referenceIndex ? references : nullptr;
+        if (patternHits) lastRegexHit.assign(patterns->VariantCount(), kNoHit);
+
+        size_t slotCount = (std::min)(tasks.size(), depth * workers.size());
+        if (slots.size() < slotCount) slots.resize(slotCount);
+        for (auto& slot : slots) {
+            slot.state = Slot::Free;
+        }
+        nextScan = 0;
+        nextMerge = 0;
+        merging = false;
+
+        std::thread reader([&] {
+            for (size_t t = 0; t < tasks.size(); t++) {
+                Slot& slot = slots[t % slotCount];
+                {
+                    std::unique_lock<std::mutex> lock(pipelineMutex);
+                    slotFreed.wait(lock, [&] { return slot.state == Slot::Free; });
+                }
+                Fetch(source, tasks[t], slot);
+                if (heapWalk) WalkHeaps(source, tasks[t], slot);
+                {
+                    std::lock_guard<std::mutex> lock(pipelineMutex);
+                    slot.task = t;
+                    slot.state = Slot::Ready;
+                }
+                slotReady.notify_all();
+            }
+        });
+
+        // Chunks are taken in read order from the ring, not stolen (see thread_pool.h)
+        pool.RunOnEach([&](size_t, size_t worker) {
+            ScanLoop(ranges, texts, newTextsPerRange, slotCount, workers[worker]);
+        });
+        reader.join();
+        if (pageClassesPerRange) {
+            for (const auto& piece : pieces) (*pageClassesPerRange)[piece.range].Add(piece.pageClasses);
+        }
+    }
+
+private:
+    struct Piece {
+        size_t range;
+        bool continuesStream;   // Starts where the previous piece ends
+        uint64_t address;
+        uint64_t length;
+        uint64_t overlap;       // Bytes read past the piece to finish its last strings
+        uint64_t streamEnd;
+        size_t bufferOffset;    // Where the piece lands in its slot's read buffer
+        // Filled in by the scan
+        uint64_t resume;        // Address from which the next piece's strings count
+        size_t foundBegin;
+        size_t foundEnd;
+        size_t hitsBegin;
+        size_t hitsEnd;
+        size_t referencesBegin;
+        size_t referencesEnd;
+        PageClassCounts pageClasses;
+    };
+
+    struct Task {
+        size_t firstPiece;
+        size_t pieceCount;
+        size_t bufferSize;
+    };
+
+    struct FoundText {
+        uint64_t address;
+        uint64_t hash;
+        size_t arenaOffset;
+        size_t length;
+        size_t byteLength;
+    };
+
+    // One chunk in the pipeline: the bytes of a task and the strings found
+    // in them, kept until they are merged
+    struct Slot {
+        enum State { Free, Ready, Scanned };
+
+        State state = Free;
+        size_t task = 0;
+        PooledBuffer buffer;
+        std::vector<ReadRequest> requests;
+        std::vector<const char*> data;      // Per piece
+        std::vector<size_t> available;      // Per piece, overlap included
+        std::vector<AddressSpan> unused;    // Heap spans without live allocations
+        std::vector<size_t> unusedBegin;    // Per piece, then the end, into unused
+        std::string arena;
+        std::vector<FoundText> found;
+        std::vector<PatternHit> hits;
+        std::vector<Reference> references;
+    };
+
+    struct Worker {
+        TextScanner scanner;
+        std::vector<TextSpan> spans;
+        std::string text;
+        std::unique_ptr<PatternMatcher> matcher;
+        std::vector<PatternMatch> matches;
+        ReferenceScanner pointers;
+        std::vector<PageClass> pageClasses;     // Of the whole pages of the current piece
+        size_t firstPage = 0;                   // Offset of the first of them
+        uint64_t zeroBytes = 0;
+        uint64_t classifiedBytes = 0;
+    };
+
+    static constexpr size_t kNoHit = ~static_cast<size_t>(0);
+
+    void PlanTasks(const std::vector<ScanRange>& ranges) {
+        pieces.clear();
+        tasks.clear();
+
+        Task batch = {0, 0, 0};
+        uint64_t streamEnd = 0;
+        for (size_t r = 0; r < ranges.size(); r++) {
+            const ScanRange& range = ranges[r];
+            bool continues = r > 0 && ranges[r - 1].address + ranges[r - 1].size == range.address;
+            if (!continues) {
+                streamEnd = range.address + range.size;
+                for (size_t next = r + 1; next < ranges.size() && ranges[next].address == streamEnd; next++) {
+                    streamEnd += ranges[next].size;
+                }
+            }
+
+            for (uint64_t offset = 0; offset < range.size; offset += taskSize) {
+                Piece piece = Piece();
+                piece.range = r;
+                piece.continuesStream = continues || offset > 0;
+                piece.address = range.address + offset;
+                piece.length = (std::min)(static_cast<uint64_t>(taskSize), range.size - offset);
+                piece.overlap = (std::min)(static_cast<uint64_t>(kTaskOverlap), streamEnd - piece.address - piece.length);
+                piece.streamEnd = streamEnd;
+
+                // Room for a gap the planner can read through, so that the
+                // pieces on either side of it are read together
+                size_t gap = 0;
+                if (batch.pieceCount && !piece.continuesStream) {
+                    uint64_t previousEnd = pieces.back().address + pieces.back().length + pieces.back().overlap;
+                    if (planner.CanBridge(previousEnd, piece.address)) gap = static_cast<size_t>(piece.address - previousEnd);
+                }
+
+                if (batch.pieceCount &&
+                    (batch.bufferSize + gap + piece.length + piece.overlap > taskSize + kTaskOverlap || batch.pieceCount == kMaxBatchPieces)) {
+                    tasks.push_back(batch);
+                    batch.pieceCount = 0;
+                }
+                if (batch.pieceCount == 0) {
+                    batch.firstPiece = pieces.size();
+                    batch.bufferSize = 0;
+                } else if (piece.continuesStream) {
+                    // The previous piece's overlap is this piece's start
+                    batch.bufferSize -= static_cast<size_t>(pieces.back().overlap);
+                } else {
+                    batch.bufferSize += gap;
+                }
+
+                piece.bufferOffset = batch.bufferSize;
+                pieces.push_back(piece);
+                batch.pieceCount++;
+                batch.bufferSize += static_cast<size_t>(piece.length + piece.overlap);
+            }
+        }
+        if (batch.pieceCount) tasks.push_back(batch);
+    }
+
+    // Runs on the reader thread. A task the source can expose in place is
+    // used there; otherwise it is copied into the slot buffer with one
+    // batched read, merged by the planner. Each piece reads its own bytes,
+    // and the last piece of a run also reads its overlap; the other pieces'
+    // overlap is the next piece's bytes.
+    void Fetch(MemorySource& source, const Task& task, Slot& slot) {
+        slot.data.resize(task.pieceCount);
+        slot.available.resize(task.pieceCount);
+
+        bool viewed = true;
+        for (size_t i = 0; i < task.pieceCount && viewed; i++) {
+            const Piece& piece = pieces[task.firstPiece + i];
+            size_t size = static_cast<size_t>(piece.length + piece.overlap);
+            slot.data[i] = source.View(piece.address, size);
+            slot.available[i] = size;
+            viewed = slot.data[i] != NULL && size == piece.length + piece.overlap;
+        }
+        if (viewed) {
+            for (size_t i = 0; i < task.pieceCount; i++) Telemetry::Add(Counter::BytesMapped, pieces[task.firstPiece + i].length);
+            return;
+        }
+
+        if (slot.buffer.size() < task.bufferSize) slot.buffer = buffers.Acquire(task.bufferSize);
+        slot.requests.clear();
+        for (size_t i = 0; i < task.pieceCount; i++) {
+            const Piece& piece = pieces[task.firstPiece + i];
+            ReadRequest request;
+            request.address = piece.address;
+            request.buffer = slot.buffer.data() + piece.bufferOffset;
+            request.size = static_cast<size_t>(piece.length);
+            request.bytesRead = 0;
+            slot.requests.push_back(request);
+
+            bool nextReadsOverlap = i + 1 < task.pieceCount && pieces[task.firstPiece + i + 1].continuesStream;
+            if (piece.overlap && !nextReadsOverlap) {
+                request.address += piece.length;
+                request.buffer += piece.length;
+                request.size = static_cast<size_t>(piece.overlap);
+                slot.requests.push_back(request);
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        planner.ReadBatch(source, slot.requests.data(), slot.requests.size());
+        Telemetry::AddReadCall(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+        for (const auto& request : slot.requests) {
+            Telemetry::AddReadRequest(request.size, request.bytesRead);
+        }
+
+        // A piece's bytes run on through the requests after its own until
+        // one comes back short
+        size_t first = 0;
+        for (size_t i = 0; i < task.pieceCount; i++) {
+            const Piece& piece = pieces[task.firstPiece + i];
+            char* start = slot.buffer.data() + piece.bufferOffset;
+            while (slot.requests[first].buffer != start) first++;
+
+            size_t wanted = static_cast<size_t>(piece.length + piece.overlap);
+            size_t available = 0;
+            for (size_t r = first; r < slot.requests.size() && available < wanted; r++) {
+                const ReadRequest& read = slot.requests[r];
+                if (read.buffer != start + available) break;
+                available += (std::min)(read.bytesRead, wanted - available);
+                if (read.bytesRead < read.size) break;
+            }
+            slot.data[i] = start;
+            slot.available[i] = available;
+        }
+    }
+
+    // Runs on each pool thread: takes tasks in order as the reader delivers
+    // them, scans them, and merges every scanned task that is next in line.
+    void ScanLoop(const std::vector<ScanRange>& ranges, StringStore& texts, std::vector<size_t>* newTextsPerRange,
+                  size_t slotCount, Worker& worker) {
+        while (true) {
+            size_t t;
+            Slot* slot;
+            {
+                std::unique_lock<std::mutex> lock(pipelineMutex);
+                if (nextScan == tasks.size()) return;
+                t = nextScan++;
+                slot = &slots[t % slotCount];
+                slotReady.wait(lock, [&] { return slot->state == Slot::Ready && slot->task == t; });
+            }
+
+            slot->arena.clear();
+            slot->found.clear();
+            slot->hits.clear();
+            slot->references.clear();
+            for (size_t i = 0; i < tasks[t].pieceCount; i++) {
+                ScanPiece(pieces[tasks[t].firstPiece + i], i, *slot, worker);
+            }
+
+            // Whoever finds the merge idle merges as far as tasks are done
+            std::unique_lock<std::mutex> lock(pipelineMutex);
+            slot->state = Slot::Scanned;
+            if (merging) continue;
+            merging = true;
+            while (nextMerge < tasks.size()) {
+                Slot& next = slots[nextMerge % slotCount];
+                if (next.state != Slot::Scanned || next.task != nextMerge) break;
+                lock.unlock();
+                Merge(ranges, tasks[nextMerge], next, texts, newTextsPerRange);
+                lock.lock();
+                next.state = Slot::Free;
+                nextMerge++;
+                slotFreed.notify_all();
+            }
+            merging = false;
+        }
+    }
+
+    // Runs on the reader thread, which sees every task in address order
+    void WalkHeaps(MemorySource& source, const Task& task, Slot& slot) {
+        ScopedPhase timer(Phase::HeapWalk);
+        slot.unused.clear();
+        slot.unusedBegin.resize(task.pieceCount + 1);
+        for (size_t i = 0; i < task.pieceCount; i++) {
+            slot.unusedBegin[i] = slot.unused.size();
+            if (slot.available[i]) heapWalk->Walk(pieces[task.firstPiece + i].address, slot.data[i], slot.available[i], source, slot.unused);
+        }
+        slot.unusedBegin[task.pieceCount] = slot.unused.size();
+    }
+
+    void ScanPiece(Piece& piece, size_t index, Slot& slot, Worker& worker) {
+        const char* data = slot.data[index];
+        size_t bytesRead = slot.available[index];
+        piece.foundBegin = piece.foundEnd = slot.found.size();
+        piece.hitsBegin = piece.hitsEnd = slot.hits.size();
+        piece.referencesBegin = piece.referencesEnd = slot.references.size();
+        piece.resume = piece.address + piece.length;
+        if (bytesRead == 0) return;
+
+        if (patternHits) {
+            ScopedPhase timer(Phase::Patterns);
+            worker.matches.clear();
+            worker.matcher->Scan(data, bytesRead, static_cast<size_t>(piece.length), worker.matches);
+            std::sort(worker.matches.begin(), worker.matches.end(), [](const PatternMatch& a, const PatternMatch& b) {
+                return a.offset != b.offset ? a.offset < b.offset : a.variant < b.variant;
+            });
+            for (const auto& match : worker.matches) {
+                PatternHit hit;
+                hit.address = piece.address + match.offset;
+                hit.length = static_cast<uint32_t>(match.length);
+                hit.variant = match.variant;
+                hit.range = piece.range;
+                hit.preview = patterns->Preview(match.variant, data + match.offset, match.length);
+                slot.hits.push_back(hit);
+            }
+            piece.hitsEnd = slot.hits.size();
+        }
+
+        if (referenceOutput) {
+            // Words that start in the piece, the last of them finished in its overlap
+            ScopedPhase timer(Phase::References);
+            size_t size = (std::min)(bytesRead, static_cast<size_t>(piece.length) + 7);
+            worker.pointers.Sweep(*referenceIndex, data, size, piece.address, slot.references);
+            piece.referencesEnd = slot.references.size();
+        }
+
+        ClassifyPages(piece, data, bytesRead, worker);
+        ScopedPhase timer(Phase::Scan);
+        worker.spans.clear();
+        size_t start = ScanAroundSkippedPages(data, worker);
+        size_t firstSpan = worker.spans.size();
+        size_t rest = bytesRead - start;
+        worker.scanner.Prepare(data + start, rest);
+        if (bytesRead > piece.length) {
+            // Cut short of the stream only if the overlap read fully and more data follows
+            bool truncated = bytesRead == piece.length + piece.overlap && piece.address + bytesRead < piece.streamEnd;
+            size_t limit = truncated ? TextScanner::SafeLimit(rest) : ~static_cast<size_t>(0);
+            size_t boundary = static_cast<size_t>((piece.length - start) / 2);
+            size_t position = worker.scanner.Walk(0, boundary, &worker.spans);
+            size_t meet = worker.scanner.Converge(position, boundary, limit, &worker.spans);
+            piece.resume = piece.address + start + meet * 2;
+        } else {
+            worker.scanner.Walk(0, rest / 2, &worker.spans);
+        }
+        for (size_t i = firstSpan; i < worker.spans.size(); i++) worker.spans[i].offset += start;
+
+        const AddressSpan* unused = liveTextOnly ? slot.unused.data() + slot.unusedBegin[index] : nullptr;
+        const AddressSpan* unusedEnd = liveTextOnly ? slot.unused.data() + slot.unusedBegin[index + 1] : nullptr;
+        uint64_t dropped = 0;
+        for (const auto& span : worker.spans) {
+            if (unused != unusedEnd) {
+                uint64_t address = piece.address + span.offset;
+                while (unused != unusedEnd && unused->end <= address) unused++;
+                if (unused != unusedEnd && unused->start <= address) {
+                    dropped++;
+                    continue;
+                }
+            }
+            TextScanner::Materialize(data, span, worker.text);
+            FoundText found;
+            found.address = piece.address + span.offset;
+            found.hash = HashBytes(worker.text.data(), worker.text.size());
+            found.arenaOffset = slot.arena.size();
+            found.length = worker.text.size();
+            found.byteLength = span.byteLength;
+            slot.arena += worker.text;
+            slot.found.push_back(found);
+        }
+        piece.foundEnd = slot.found.size();
+        if (dropped) Telemetry::Add(Counter::StringsOutsideAllocations, dropped);
+    }
+
+    // Sorts the whole pages of a piece into classes before its text scan.
+    // Without a classifier, pages are either zero or scanned as text.
+    void ClassifyPages(Piece& piece, const char* data, size_t bytesRead, Worker& worker) {
+        worker.pageClasses.clear();
+        if (!zeroPageCheck && !classifier) return;
+
+        ScopedPhase timer(Phase::Classify);
+        const size_t page = static_cast<size_t>(MemorySource::kPageSize);
+        size_t offset = static_cast<size_t>((page - piece.address % page) % page);
+        // Stretches between skipped pages have to keep the piece's character alignment
+        if (offset % 2) return;
+
+        worker.firstPage = offset;
+        size_t end = (std::min)(bytesRead, static_cast<size_t>(piece.length));
+        uint64_t zeroBytes = 0;
+        uint64_t otherBytes = 0;
+        for (; offset + page <= end; offset += page) {
+            PageClass pageClass = PageClass::Text;
+            if (zeroPageCheck && worker.scanner.IsZero(data + offset, page)) pageClass = PageClass::Zero;
+            else if (classifier) pageClass = classifier->Classify(data + offset, page);
+            worker.pageClasses.push_back(pageClass);
+            piece.pageClasses[pageClass]++;
+            if (pageClass == PageClass::Zero) zeroBytes += page;
+            else if (pageClass != PageClass::Text) otherBytes += page;
+        }
+        if (zeroBytes) {
+            worker.zeroBytes += zeroBytes;
+            Telemetry::Add(Counter::BytesSkippedZero, zeroBytes);
+        }
+        if (otherBytes) {
+            worker.classifiedBytes += otherBytes;
+            Telemetry::Add(Counter::BytesSkippedNotText, otherBytes);
+        }
+        if (classifier) Telemetry::Add(Counter::PagesClassified, worker.pageClasses.size());
+    }
+
+    // A zero page starts no string and ends any string before it, so the
+    // piece up to its last skipped page is scanned in stretches that stop
+    // at one, and a scan that starts after it sees what a scan of the whole
+    // piece would. Each stretch is classified with the lookahead it needs
+    // from the page that follows, so a string that runs into a skipped page
+    // is found whole; only strings that start in one are lost, and for a
+    // zero page there are none. Returns the offset after the last skipped
+    // page, from which the caller scans the rest of the piece.
+    size_t ScanAroundSkippedPages(const char* data, Worker& worker) {
+        const size_t page = static_cast<size_t>(MemorySource::kPageSize);
+        size_t stretch = 0;
+        for (size_t i = 0; i < worker.pageClasses.size(); i++) {
+            if (worker.pageClasses[i] == PageClass::Text) continue;
+            size_t offset = worker.firstPage + i * page;
+            if (offset > stretch) {
+                size_t firstSpan = worker.spans.size();
+                worker.scanner.Prepare(data + stretch, offset - stretch + TextScanner::kLookaheadBytes);
+                worker.scanner.Walk(0, (offset - stretch) / 2, &worker.spans);
+                for (size_t j = firstSpan; j < worker.spans.size(); j++) worker.spans[j].offset += stretch;
+            }
+            stretch = offset + page;
+        }
+        return stretch;
+    }
+
+    void Merge(const std::vector<ScanRange>& ranges, const Task& task, const Slot& slot, StringStore& texts,
+               std::vector<size_t>* newTextsPerRange) {
+        ScopedPhase timer(Phase::Merge);
+        uint64_t foundCount = 0;
+        uint64_t uniqueCount = 0;
+        for (size_t p = task.firstPiece; p < task.firstPiece + task.pieceCount; p++) {
+            const Piece& piece = pieces[p];
+            size_t range = piece.range;
+            for (size_t i = piece.foundBegin; i < piece.foundEnd; i++) {
+                const FoundText& found = slot.found[i];
+                if (piece.continuesStream && found.address < pieces[p - 1].resume) continue;
+                foundCount++;
+
+                if (textListener) {
+                    while (found.address >= ranges[range].address + ranges[range].size) range++;
+                    textListener->OnText(found.address, static_cast<uint32_t>(found.byteLength),
+                                         std::string_view(slot.arena.data() + found.arenaOffset, found.length), range);
+                    continue;
+                }
+
+                bool inserted = false;
+                uint32_t id = texts.Intern(slot.arena.data() + found.arenaOffset, found.length, found.hash, found.address, &inserted);
+                if (textOccurrences) {
+                    TextOccurrence occurrence;
+                    occurrence.address = found.address;
+                    occurrence.byteLength = static_cast<uint32_t>(found.byteLength);
+                    occurrence.id = id;
+                    textOccurrences->push_back(occurrence);
+                }
+                if (inserted) uniqueCount++;
+                if (!inserted || !newTextsPerRange) continue;
+
+                // Strings finished across the piece's end start in a later range
+                while (found.address >= ranges[range].address + ranges[range].size) range++;
+                (*newTextsPerRange)[range]++;
+            }
+
+            if (patternHits) MergeHits(ranges, p, slot);
+            if (referenceOutput) {
+                referenceOutput->insert(referenceOutput->end(), slot.references.begin() + piece.referencesBegin,
+                                        slot.references.begin() + piece.referencesEnd);
+                Telemetry::Add(Counter::ReferencesFound, piece.referencesEnd - piece.referencesBegin);
+            }
+        }
+        Telemetry::Add(Counter::StringsFound, foundCount);
+        Telemetry::Add(Counter::StringsUnique, uniqueCount);
+    }
+
+    void MergeHits(const std::vector<ScanRange>& ranges, size_t p, const Slot& slot) {
+        const Piece& piece = pieces[p];
+        if (!piece.continuesStream) {
+            for (auto& last : lastRegexHit) last = kNoHit;
+        }
+
+        for (size_t i = piece.hitsBegin; i < piece.hitsEnd; i++) {
+            PatternHit hit = slot.hits[i];
+            while (hit.address >= ranges[hit.range].address + ranges[hit.range].size) hit.range++;
+            if (!patterns->IsRegex(hit.variant)) {
+                Telemetry::Add(Counter::PatternHits);
+                patternHits->push_back(hit);
+                continue;
+            }
+
+            // The piece could not look back past its start, so a regex match
+            // it reports there may continue one from the previous piece
+            size_t& last = lastRegexHit[hit.variant];
+            if (last != kNoHit) {
+                PatternHit& previous = (*patternHits)[last];
+                uint64_t previousEnd = previous.address + previous.length;
+                if (hit.address == piece.address && hit.address < previousEnd) {
+                    previous.length = static_cast<uint32_t>((std::max)(previousEnd, hit.address + hit.length) - previous.address);
+                    continue;
+                }
+            }
+            last = patternHits->size();
+            Telemetry::Add(Counter::PatternHits);
+            patternHits->push_back(hit);
+        }
+    }
+
+    WorkStealingPool pool;
+    BufferPool buffers;         // Before slots, which return their buffers to it
+    size_t taskSize;
+    size_t depth;
+    std::vector<Worker> workers;
+    std::vector<Piece> pieces;
+    std::vector<Task> tasks;
+    std::vector<Slot> slots;
+    ReadPlanner planner;        // Used by PlanTasks, then by the reader thread
+
+    std::mutex pipelineMutex;
+    std::condition_variable slotFreed;
+    std::condition_variable slotReady;
+    size_t nextScan = 0;
+    size_t nextMerge = 0;
+    bool merging = false;
+
+    const PatternSet* patterns = nullptr;
+    std::vector<PatternHit>* patternHits = nullptr;
+    std::vector<size_t> lastRegexHit;       // Per variant: its last hit in the current stream
+    std::vector<TextOccurrence>* textOccurrences = nullptr;
+    const RegionIndex* referenceIndex = nullptr;
+    std::vector<Reference>* referenceOutput = nullptr;
+    ScanListener* textListener = nullptr;
+    bool zeroPageCheck = true;
+    const PageClassifier* classifier = nullptr;
+    HeapWalk* heapWalk = nullptr;
+    bool liveTextOnly = false;
+};
@@ -0,0 +1,581 @@
+#pragma once
+
+// Incremental snapshots: rescan only the memory that changed since the
+// previous pass.
+//
+// A SnapshotState keeps a 64-bit fingerprint of every 4 KB page of the
+// scanned regions, keyed by region base address, and every string the last
+// pass found. The next pass fingerprints the pages again, which costs one
+// read and one hash per page, and runs the text scan only over windows
+// around the pages whose fingerprint changed or that are new. Strings from
+// unchanged memory are carried over from the state, so a pass reports the
+// same strings as a full scan, plus the strings added and removed since the
+// previous one.
+//
+// A window starts and ends a page beyond its changed pages, so the fresh
+// scan at the window's start has fallen into step with the walk a full scan
+// takes long before it reaches them. The window's results replace the
+// state's only inside its core: the changed pages, widened to the whole
+// strings that overlap them. A core that grows to within kSyncBytes of a
+// window edge (a string running on for pages) has its whole stream
+// rescanned instead.
+//
+// The state can be saved to and loaded from a file, so that passes can be
+// separate runs of the tool.
+
+#include "memory_source.h"
+#include "pattern_engine.h"
+#include "scan_scheduler.h"
+#include "string_store.h"
+#include "telemetry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Page fingerprint: four lanes accumulate each word plus the product of
+// its halves, keyed by its offset so that moved words count as changes.
+// There is no dependency chain through the multiplies, so hashing keeps up
+// with memory reads. Never 0, which marks a page that could not be read.
+inline uint64_t PageFingerprint(const char* data, size_t size) {
+    const uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+    uint64_t lanes[4] = {size, 0x2545F4914F6CDD1Dull, 0x27BB2EE687B0B0FDull, 0xD6E8FEB86659FD93ull};
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        uint64_t key = (i + 1) * multiplier;
+        for (int lane = 0; lane < 4; lane++) {
+            uint64_t word;
+            std::memcpy(&word, data + i + lane * 8, 8);
+            uint64_t keyed = word ^ (key + lane);
+            lanes[lane] += word + (keyed & 0xFFFFFFFFu) * (keyed >> 32);
+        }
+    }
+
+    uint64_t hash = HashBytes(data + i, size - i);
+    for (int lane = 0; lane < 4; lane++) {
+        hash = HashMix64(hash ^ lanes[lane]);
+    }
+    return hash ? hash : 1;
+}
+
+struct SnapshotRegion {
+    uint64_t size;
+    std::vector<uint64_t> pages;    // Fingerprint per page, the last one possibly partial
+};
+
+// What one pass found against the previous one.
+struct SnapshotDiff {
+    bool hasPrevious = false;
+    uint64_t pages = 0;
+    uint64_t changedPages = 0;      // New pages included
+    uint64_t rescannedBytes = 0;
+    double fingerprintSeconds = 0;
+    double scanSeconds = 0;
+    std::vector<uint32_t> added;        // IDs of strings not in the previous pass
+    std::vector<std::string> removed;   // Strings of the previous pass that are gone
+};
+
+struct SnapshotState {
+    static constexpr uint64_t kPageSize = 4096;
+
+    std::map<uint64_t, SnapshotRegion> regions;
+    StringStore texts;
+    std::vector<TextOccurrence> strings;    // In address order, IDs into texts
+
+    bool empty() const { return regions.empty(); }
+
+    // File layout, all integers in host byte order:
+    //   "HXSNAP1\0"
+    //   u64 region count, then per region: u64 base, u64 size, u64 page count, u64 fingerprints[]
+    //   u64 text count, then per text: u32 length, bytes
+    //   u64 string count, then per string: u64 address, u32 byte length, u32 text index
+    bool Save(const std::string& path, std::string& error) const {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            error = "Failed to create snapshot " + path;
+            return false;
+        }
+        auto put = [&](const void* data, size_t size) { file.write(static_cast<const char*>(data), size); };
+        auto putU64 = [&](uint64_t value) { put(&value, sizeof(value)); };
+
+        put(kMagic, sizeof(kMagic));
+        putU64(regions.size());
+        for (const auto& entry : regions) {
+            putU64(entry.first);
+            putU64(entry.second.size);
+            putU64(entry.second.pages.size());
+            put(entry.second.pages.data(), entry.second.pages.size() * sizeof(uint64_t));
+        }
+        putU64(texts.size());
+        for (size_t id = 0; id < texts.size(); id++) {
+            uint32_t length = static_cast<uint32_t>(texts[id].size());
+            put(&length, sizeof(length));
+            put(texts[id].data(), length);
+        }
+        putU64(strings.size());
+        put(strings.data(), strings.size() * sizeof(TextOccurrence));
+
+        if (!file) {
+            error = "Failed to write snapshot " + path;
+            return false;
+        }
+        return true;
+    }
+
+    bool Load(const std::string& path, std::string& error) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            error = "Failed to open snapshot " + path;
+            return false;
+        }
+        file.seekg(0, std::ios::end);
+        uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+        file.seekg(0);
+
+        // Sizes are checked against what is left of the file before anything is allocated
+        auto get = [&](void* data, size_t size) { return static_cast<bool>(file.read(static_cast<char*>(data), size)); };
+        auto fits = [&](uint64_t count, size_t itemSize) { return count <= (fileSize - static_cast<uint64_t>(file.tellg())) / itemSize; };
+        uint64_t count = 0;
+        auto getCount = [&](size_t itemSize) { return get(&count, sizeof(count)) && fits(count, itemSize); };
+
+        char magic[sizeof(kMagic)];
+        bool ok = get(magic, sizeof(magic)) && std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+        std::map<uint64_t, SnapshotRegion> loadedRegions;
+        ok = ok && getCount(3 * sizeof(uint64_t));
+        for (uint64_t r = 0, regionCount = count; ok && r < regionCount; r++) {
+            uint64_t base = 0;
+            SnapshotRegion region;
+            ok = get(&base, sizeof(base)) && get(&region.size, sizeof(region.size)) && getCount(sizeof(uint64_t));
+            if (!ok) break;
+            region.pages.resize(static_cast<size_t>(count));
+            ok = get(region.pages.data(), region.pages.size() * sizeof(uint64_t));
+            loadedRegions[base] = std::move(region);
+        }
+
+        StringStore loadedTexts;
+        std::string text;
+        ok = ok && getCount(sizeof(uint32_t));
+        for (uint64_t t = 0, textCount = count; ok && t < textCount; t++) {
+            uint32_t length = 0;
+            ok = get(&length, sizeof(length)) && fits(length, 1);
+            if (!ok) break;
+            text.resize(length);
+            ok = get(&text[0], length);
+            loadedTexts.Intern(text, 0);
+        }
+
+        std::vector<TextOccurrence> loadedStrings;
+        ok = ok && getCount(sizeof(TextOccurrence));
+        if (ok) {
+            loadedStrings.resize(static_cast<size_t>(count));
+            ok = get(loadedStrings.data(), loadedStrings.size() * sizeof(TextOccurrence));
+        }
+        for (size_t i = 0; ok && i < loadedStrings.size(); i++) {
+            ok = loadedStrings[i].id < loadedTexts.size() && (i == 0 || loadedStrings[i - 1].address < loadedStrings[i].address);
+        }
+
+        if (!ok) {
+            error = "Snapshot " + path + " is damaged or not a snapshot";
+            return false;
+        }
+        regions.swap(loadedRegions);
+        texts = std::move(loadedTexts);
+        strings.swap(loadedStrings);
+        return true;
+    }
+
+private:
+    static constexpr char kMagic[8] = {'H', 'X', 'S', 'N', 'A', 'P', '1', '\0'};
+};
+
+// Runs passes over a process against a SnapshotState, on the threads of a
+// ScanScheduler.
+class SnapshotScanner {
+public:
+    static constexpr uint64_t kPageSize = SnapshotState::kPageSize;
+    // Closest a window's core may come to a window edge inside a stream
+    static constexpr uint64_t kSyncBytes = 1024;
+    // Bytes fingerprinted per pool task
+    static constexpr uint64_t kChunkSize = 1024 * 1024;
+
+    explicit SnapshotScanner(ScanScheduler& scheduler) : scheduler(scheduler) {}
+
+    // Extracts the text of ranges (sorted by address) into texts, which
+    // must be empty, like ScanScheduler::Scan; then moves state on to this
+    // pass. Pattern hits are only searched for in the rescanned memory;
+    // their range is an index into ranges.
+    void Scan(const std::vector<ScanRange>& ranges, MemorySource& source, SnapshotState& state, StringStore& texts,
+              std::vector<PatternHit>* hits, SnapshotDiff& diff) {
+        diff = SnapshotDiff();
+        diff.hasPrevious = !state.empty();
+
+        streams.clear();
+        for (size_t r = 0; r < ranges.size(); r++) {
+            if (r == 0 || ranges[r - 1].address + ranges[r - 1].size != ranges[r].address) streams.push_back(ranges[r]);
+            else streams.back().size += ranges[r].size;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<uint64_t>> pages(ranges.size());
+        Fingerprint(ranges, source, pages);
+        diff.fingerprintSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        FindChanges(ranges, pages, state, diff);
+        PlanWindows();
+
+        // Windows that cannot settle take their whole stream along on the
+        // second round, which always settles
+        StringStore found;
+        std::vector<Window> settled;
+        std::vector<TextOccurrence> fresh;
+        for (int round = 0; round < 2 && !windows.empty(); round++) {
+            std::vector<TextOccurrence> occurrences;
+            std::vector<PatternHit> windowHits;
+            ScanWindows(ranges, source, found, hits ? &windowHits : nullptr, occurrences, diff);
+
+            std::vector<size_t> firstFound(windows.size() + 1);
+            std::vector<size_t> failedStreams;
+            size_t next = 0;
+            for (size_t w = 0; w < windows.size(); w++) {
+                while (next < occurrences.size() && occurrences[next].address < windows[w].start) next++;
+                firstFound[w] = next;
+                while (next < occurrences.size() && occurrences[next].address < windows[w].end) next++;
+                if (!Settle(windows[w], state.strings, occurrences.data() + firstFound[w], occurrences.data() + next) &&
+                    (failedStreams.empty() || failedStreams.back() != windows[w].stream)) {
+                    failedStreams.push_back(windows[w].stream);
+                }
+            }
+            firstFound[windows.size()] = next;
+
+            std::vector<Window> retry;
+            size_t firstSettled = settled.size();
+            for (size_t w = 0; w < windows.size(); w++) {
+                const Window& window = windows[w];
+                if (std::binary_search(failedStreams.begin(), failedStreams.end(), window.stream)) {
+                    if (retry.empty() || retry.back().stream != window.stream) {
+                        const ScanRange& stream = streams[window.stream];
+                        uint64_t end = stream.address + stream.size;
+                        Window whole = {stream.address, end, stream.address, end, window.stream};
+                        retry.push_back(whole);
+                    }
+                    continue;
+                }
+                settled.push_back(window);
+                for (size_t i = firstFound[w]; i < firstFound[w + 1]; i++) {
+                    if (occurrences[i].address >= window.coreStart && occurrences[i].address < window.coreEnd) {
+                        fresh.push_back(occurrences[i]);
+                    }
+                }
+            }
+            for (const auto& hit : windowHits) {
+                if (InsideCore(settled.data() + firstSettled, settled.data() + settled.size(), hit.address)) hits->push_back(hit);
+            }
+            windows.swap(retry);
+        }
+        diff.scanSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::sort(settled.begin(), settled.end(), [](const Window& a, const Window& b) { return a.start < b.start; });
+        std::sort(fresh.begin(), fresh.end(), [](const TextOccurrence& a, const TextOccurrence& b) { return a.address < b.address; });
+        if (hits) {
+            std::stable_sort(hits->begin(), hits->end(), [](const PatternHit& a, const PatternHit& b) { return a.address < b.address; });
+        }
+        Combine(state, settled, found, fresh, texts, diff);
+
+        std::map<uint64_t, SnapshotRegion> regions;
+        for (size_t r = 0; r < ranges.size(); r++) {
+            SnapshotRegion& region = regions[ranges[r].address];
+            region.size = ranges[r].size;
+            region.pages.swap(pages[r]);
+        }
+        state.regions.swap(regions);
+    }
+
+private:
+    // A stretch of a stream that is scanned again. The core is the part
+    // whose strings are taken from the new scan.
+    struct Window {
+        uint64_t start;
+        uint64_t end;
+        uint64_t coreStart;
+        uint64_t coreEnd;
+        size_t stream;
+    };
+
+    void Fingerprint(const std::vector<ScanRange>& ranges, MemorySource& source, std::vector<std::vector<uint64_t>>& pages) {
+        struct Chunk {
+            size_t range;
+            uint64_t offset;
+            uint64_t size;
+        };
+        std::vector<Chunk> chunks;
+        for (size_t r = 0; r < ranges.size(); r++) {
+            pages[r].assign(static_cast<size_t>((ranges[r].size + kPageSize - 1) / kPageSize), 0);
+            for (uint64_t offset = 0; offset < ranges[r].size; offset += kChunkSize) {
+                Chunk chunk = {r, offset, (std::min)(kChunkSize, ranges[r].size - offset)};
+                chunks.push_back(chunk);
+            }
+        }
+
+        WorkStealingPool& pool = scheduler.Pool();
+        buffers.resize(pool.ThreadCount());
+        pool.Run(chunks.size(), [&](size_t c, size_t worker) {
+            const Chunk& chunk = chunks[c];
+            uint64_t address = ranges[chunk.range].address + chunk.offset;
+            size_t size = static_cast<size_t>(chunk.size);
+            const char* data = source.View(address, size);
+            if (data == NULL) {
+                PooledBuffer& buffer = buffers[worker];
+                if (buffer.size() < kChunkSize) buffer = scheduler.Buffers().Acquire(static_cast<size_t>(kChunkSize));
+                auto start = std::chrono::steady_clock::now();
+                size = source.Read(address, buffer.data(), static_cast<size_t>(chunk.size));
+                Telemetry::AddReadCall(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+                Telemetry::AddReadRequest(chunk.size, size);
+                data = buffer.data();
+            } else {
+                Telemetry::Add(Counter::BytesMapped, size);
+            }
+            ScopedPhase timer(Phase::Fingerprint);
+            Telemetry::Add(Counter::PagesFingerprinted, (size + kPageSize - 1) / kPageSize);
+            uint64_t* fingerprints = pages[chunk.range].data() + chunk.offset / kPageSize;
+            for (size_t offset = 0; offset < size; offset += kPageSize) {
+                *fingerprints++ = PageFingerprint(data + offset, (std::min)(static_cast<size_t>(kPageSize), size - offset));
+            }
+        });
+    }
+
+    // Collects the changed stretches of memory into changes: pages with a
+    // new fingerprint, the edges of streams that grew or shrank, and the
+    // previous strings that are no longer inside a stream
+    void FindChanges(const std::vector<ScanRange>& ranges, const std::vector<std::vector<uint64_t>>& pages,
+                     const SnapshotState& state, SnapshotDiff& diff) {
+        changes.clear();
+        auto mark = [&](uint64_t start, uint64_t end) {
+            if (!changes.empty() && changes.back().address + changes.back().size == start) {
+                changes.back().size += end - start;
+            } else {
+                ScanRange change = {start, end - start};
+                changes.push_back(change);
+            }
+        };
+
+        for (size_t r = 0; r < ranges.size(); r++) {
+            auto previous = state.regions.find(ranges[r].address);
+            for (size_t i = 0; i < pages[r].size(); i++) {
+                diff.pages++;
+                if (previous != state.regions.end() && i < previous->second.pages.size() &&
+                    previous->second.pages[i] == pages[r][i]) {
+                    continue;
+                }
+                diff.changedPages++;
+                uint64_t start = ranges[r].address + i * kPageSize;
+                mark(start, (std::min)(start + kPageSize, ranges[r].address + ranges[r].size));
+            }
+        }
+
+        // A stream that now starts or ends elsewhere changes how the scan
+        // enters or leaves its first or last page
+        std::vector<uint64_t> previousStarts, previousEnds;
+        uint64_t previousEnd = 0;
+        for (const auto& entry : state.regions) {
+            if (entry.first != previousEnd) {
+                if (previousEnd) previousEnds.push_back(previousEnd);
+                previousStarts.push_back(entry.first);
+            }
+            previousEnd = entry.first + entry.second.size;
+        }
+        if (previousEnd) previousEnds.push_back(previousEnd);
+        for (const auto& stream : streams) {
+            uint64_t end = stream.address + stream.size;
+            if (!std::binary_search(previousStarts.begin(), previousStarts.end(), stream.address)) {
+                mark(stream.address, (std::min)(stream.address + kPageSize, end));
+            }
+            if (!std::binary_search(previousEnds.begin(), previousEnds.end(), end)) {
+                mark(end - (std::min)(kPageSize, stream.size), end);
+            }
+        }
+
+        for (const auto& text : state.strings) {
+            uint64_t end = text.address + text.byteLength;
+            size_t s = FindStream(text.address);
+            if (s == streams.size()) s = FindStream(end - 1);
+            if (s == streams.size()) continue;
+            const ScanRange& stream = streams[s];
+            if (text.address >= stream.address && end <= stream.address + stream.size) continue;
+            mark((std::max)(text.address, stream.address), (std::min)(end, stream.address + stream.size));
+        }
+
+        std::sort(changes.begin(), changes.end(), [](const ScanRange& a, const ScanRange& b) { return a.address < b.address; });
+    }
+
+    // Stream containing address, or streams.size()
+    size_t FindStream(uint64_t address) const {
+        auto next = std::upper_bound(streams.begin(), streams.end(), address,
+                                     [](uint64_t value, const ScanRange& stream) { return value < stream.address; });
+        if (next == streams.begin()) return streams.size();
+        --next;
+        return address < next->address + next->size ? static_cast<size_t>(next - streams.begin()) : streams.size();
+    }
+
+    // One window per change, a page wider on both sides within its
+    // stream; windows that meet are joined
+    void PlanWindows() {
+        windows.clear();
+        for (const auto& change : changes) {
+            size_t s = FindStream(change.address);
+            const ScanRange& stream = streams[s];
+            uint64_t start = change.address - (std::min)(kPageSize, change.address - stream.address);
+            start -= (start - stream.address) & 1;  // The scan walks the stream in UTF-16 steps
+            uint64_t end = (std::min)(change.address + change.size + kPageSize, stream.address + stream.size);
+
+            if (!windows.empty() && windows.back().stream == s && windows.back().end >= start) {
+                Window& last = windows.back();
+                last.end = (std::max)(last.end, end);
+                last.coreStart = (std::min)(last.coreStart, change.address);
+                last.coreEnd = (std::max)(last.coreEnd, change.address + change.size);
+                continue;
+            }
+            Window window = {start, end, change.address, change.address + change.size, s};
+            windows.push_back(window);
+        }
+    }
+
+    void ScanWindows(const std::vector<ScanRange>& ranges, MemorySource& source, StringStore& found,
+                     std::vector<PatternHit>* hits, std::vector<TextOccurrence>& occurrences, SnapshotDiff& diff) {
+        // Windows are cut at range boundaries, so hits can be mapped back to ranges
+        std::vector<ScanRange> pieces;
+        std::vector<size_t> pieceRanges;
+        size_t r = 0;
+        for (const auto& window : windows) {
+            diff.rescannedBytes += window.end - window.start;
+            while (ranges[r].address + ranges[r].size <= window.start) r++;
+            for (uint64_t address = window.start; address < window.end; r++) {
+                uint64_t end = (std::min)(window.end, ranges[r].address + ranges[r].size);
+                ScanRange piece = {address, end - address};
+                pieces.push_back(piece);
+                pieceRanges.push_back(r);
+                address = end;
+            }
+            r--;
+        }
+        scheduler.Scan(pieces, source, found, nullptr, hits, &occurrences);
+        if (hits) {
+            for (auto& hit : *hits) hit.range = pieceRanges[hit.range];
+        }
+    }
+
+    // Widens the window's core over every previous and new string that
+    // overlaps it, until none does partly. Returns false if the core came
+    // too close to a window edge inside the stream for the new strings
+    // there to be trusted.
+    bool Settle(Window& window, const std::vector<TextOccurrence>& previous, const TextOccurrence* begin,
+                const TextOccurrence* end) const {
+        auto firstEndingAfter = [](const TextOccurrence* from, const TextOccurrence* to, uint64_t address) {
+            return std::partition_point(from, to, [&](const TextOccurrence& text) { return text.address + text.byteLength <= address; });
+        };
+
+        bool grown = true;
+        while (grown) {
+            grown = false;
+            for (int set = 0; set < 2; set++) {
+                const TextOccurrence* from = set ? begin : previous.data();
+                const TextOccurrence* to = set ? end : previous.data() + previous.size();
+                for (const TextOccurrence* text = firstEndingAfter(from, to, window.coreStart);
+                     text != to && text->address < window.coreEnd; ++text) {
+                    if (text->address < window.coreStart) {
+                        window.coreStart = text->address;
+                        grown = true;
+                    }
+                    if (text->address + text->byteLength > window.coreEnd) {
+                        window.coreEnd = text->address + text->byteLength;
+                        grown = true;
+                    }
+                }
+            }
+        }
+
+        const ScanRange& stream = streams[window.stream];
+        bool startSynced = window.start == stream.address || window.coreStart >= window.start + kSyncBytes;
+        bool endSynced = window.end == stream.address + stream.size || window.coreEnd + kSyncBytes <= window.end;
+        return startSynced && endSynced;
+    }
+
+    // Whether address is in the core of one of the windows, which are in
+    // address order
+    static bool InsideCore(const Window* begin, const Window* end, uint64_t address) {
+        const Window* window = std::partition_point(begin, end, [&](const Window& w) { return w.coreEnd <= address; });
+        return window != end && window->coreStart <= address;
+    }
+
+    // Joins the previous strings outside every core with the new strings
+    // inside one, in address order, into texts and the state. Only strings
+    // the rescan found have to be looked up to tell what was added, and only
+    // previous strings no longer seen to tell what was removed.
+    void Combine(SnapshotState& state, const std::vector<Window>& settled, const StringStore& found,
+                 const std::vector<TextOccurrence>& fresh, StringStore& texts, SnapshotDiff& diff) {
+        std::vector<TextOccurrence> strings;
+        strings.reserve(state.strings.size() + fresh.size());
+        std::vector<bool> seen(state.texts.size(), false);
+        std::vector<uint32_t> freshIds;
+        size_t core = 0, next = 0;
+        auto takeFresh = [&](uint64_t before) {
+            for (; next < fresh.size() && fresh[next].address < before; next++) {
+                TextOccurrence text = fresh[next];
+                std::string_view view = found[text.id];
+                bool inserted = false;
+                text.id = texts.Intern(view.data(), view.size(), found.Hash(text.id), text.address, &inserted);
+                if (inserted) freshIds.push_back(text.id);
+                strings.push_back(text);
+            }
+        };
+
+        for (const auto& previous : state.strings) {
+            while (core < settled.size() && settled[core].coreEnd <= previous.address) core++;
+            if (core < settled.size() && settled[core].coreStart < previous.address + previous.byteLength) continue;
+            size_t s = FindStream(previous.address);
+            if (s == streams.size() || previous.address + previous.byteLength > streams[s].address + streams[s].size) continue;
+
+            takeFresh(previous.address);
+            TextOccurrence text = previous;
+            std::string_view view = state.texts[previous.id];
+            text.id = texts.Intern(view.data(), view.size(), state.texts.Hash(previous.id), previous.address, nullptr);
+            seen[previous.id] = true;
+            strings.push_back(text);
+        }
+        takeFresh(~static_cast<uint64_t>(0));
+
+        if (diff.hasPrevious) {
+            for (uint32_t id : freshIds) {
+                if (state.texts.Find(texts[id], texts.Hash(id)) == StringStore::kInvalidId) diff.added.push_back(id);
+            }
+            std::sort(diff.added.begin(), diff.added.end());
+            for (size_t id = 0; id < state.texts.size(); id++) {
+                if (!seen[id] && texts.Find(state.texts[id], state.texts.Hash(id)) == StringStore::kInvalidId) {
+                    diff.removed.push_back(std::string(state.texts[id]));
+                }
+            }
+        }
+
+        StringStore kept;
+        for (size_t id = 0; id < texts.size(); id++) {
+            std::string_view view = texts[id];
+            kept.Intern(view.data(), view.size(), texts.Hash(id), texts.FirstAddress(id), nullptr);
+        }
+        state.texts = std::move(kept);
+        state.strings.swap(strings);
+    }
+
+    ScanScheduler& scheduler;
+    std::vector<ScanRange> streams;
+    std::vector<ScanRange> changes;
+    std::vector<Window> windows;
+    std::vector<PooledBuffer> buffers;         // Per pool worker, from the scheduler's pool
+};
@@ -0,0 +1,418 @@
+#pragma once
+
+// Persistent, searchable index of extracted strings across snapshots.
+//
+// Every scan a run adds (one per process, one per --watch pass) becomes a
+// segment appended to the index file: the strings found, every address
+// they were found at with its region, the process, a snapshot ID shared by
+// the segments of one run or pass, and a trigram table. The trigram table
+// maps each 3-byte sequence to the sorted IDs of the strings that contain
+// it, so a substring lookup intersects a few posting lists per segment and
+// only compares the candidates left over.
+//
+// The file is laid out to be mapped and read in place. Opening it reads the
+// header and follows the chain of segment trailers back from the last one;
+// nothing else is parsed or copied. Appending writes the new segment after
+// the last one and then moves the header's end past it, so earlier segments
+// are never rewritten, and a torn append is ignored by readers and
+// overwritten by the next writer. There is no locking: one writer at a
+// time.
+//
+// File layout, integers in host byte order, sections aligned to 8 bytes:
+//   IndexHeader
+//   segments, each:
+//     process name
+//     IndexRegion[region count]
+//     u64 string offsets[string count + 1] into the string bytes, string bytes
+//     u64 occurrence offsets[string count + 1] into the occurrences,
+//     IndexOccurrence[occurrence count], in address order per string
+//     u32 trigrams[trigram count], ascending: byte 0 << 16 | byte 1 << 8 | byte 2
+//     u32 posting offsets[trigram count + 1] into the postings
+//     u32 postings[], string IDs ascending per trigram
+//     IndexSegmentTrailer
+
+#include "dump_source.h"
+#include "memory_source.h"
+#include "scan_scheduler.h"
+#include "string_store.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct IndexHeader {
+    char magic[8];
+    uint64_t end;               // Bytes in use; anything past them is a torn append
+    uint64_t segments;
+    uint64_t last;              // Offset of the last segment's trailer, 0 when there is none
+    uint64_t snapshots;         // Snapshot IDs handed out so far
+    uint64_t reserved[3];
+};
+
+struct IndexRegion {
+    uint64_t base;
+    uint64_t size;
+    uint32_t type;
+    uint32_t protect;
+};
+
+struct IndexOccurrence {
+    uint64_t address;
+    uint32_t region;            // Index into the segment's regions
+    uint32_t byteLength;
+};
+
+struct IndexSegmentTrailer {
+    char magic[8];
+    uint64_t start;             // Offset of the segment's first byte
+    uint64_t previous;          // Offset of the previous segment's trailer, 0 for the first
+    uint64_t snapshot;
+    int64_t time;               // Seconds since the epoch
+    uint32_t processId;
+    uint32_t nameLength;
+    uint64_t regionCount;
+    uint64_t stringCount;
+    uint64_t occurrenceCount;
+    uint64_t trigramCount;
+    uint64_t postingCount;
+    uint64_t stringBytes;
+    // Offsets of the sections from the segment's start
+    uint64_t name;
+    uint64_t regions;
+    uint64_t stringOffsets;
+    uint64_t strings;
+    uint64_t occurrenceOffsets;
+    uint64_t occurrences;
+    uint64_t trigrams;
+    uint64_t postingOffsets;
+    uint64_t postings;
+};
+
+static const char kIndexMagic[8] = {'H', 'X', 'I', 'D', 'X', '1', '\0', '\0'};
+static const char kIndexSegmentMagic[8] = {'H', 'X', 'S', 'E', 'G', '1', '\0', '\0'};
+
+inline uint32_t TrigramKey(const char* text) {
+    return static_cast<uint32_t>(static_cast<unsigned char>(text[0])) << 16 |
+           static_cast<uint32_t>(static_cast<unsigned char>(text[1])) << 8 | static_cast<unsigned char>(text[2]);
+}
+
+// One segment of a mapped index, read in place
+class IndexSegment {
+public:
+    IndexSegment(const char* base, const IndexSegmentTrailer* trailer) : data(base + trailer->start), trailer(trailer) {}
+
+    uint64_t Snapshot() const { return trailer->snapshot; }
+    int64_t Time() const { return trailer->time; }
+    uint32_t ProcessId() const { return trailer->processId; }
+    std::string_view ProcessName() const { return std::string_view(data + trailer->name, trailer->nameLength); }
+    size_t StringCount() const { return static_cast<size_t>(trailer->stringCount); }
+    size_t TrigramCount() const { return static_cast<size_t>(trailer->trigramCount); }
+
+    std::string_view String(size_t id) const {
+        const uint64_t* offsets = Section<uint64_t>(trailer->stringOffsets);
+        return std::string_view(data + trailer->strings + offsets[id], static_cast<size_t>(offsets[id + 1] - offsets[id]));
+    }
+
+    // The occurrences of a string, in address order
+    const IndexOccurrence* OccurrencesBegin(size_t id) const {
+        return Section<IndexOccurrence>(trailer->occurrences) + Section<uint64_t>(trailer->occurrenceOffsets)[id];
+    }
+    const IndexOccurrence* OccurrencesEnd(size_t id) const {
+        return Section<IndexOccurrence>(trailer->occurrences) + Section<uint64_t>(trailer->occurrenceOffsets)[id + 1];
+    }
+
+    // The region an occurrence lies in, or nullptr
+    const IndexRegion* Region(const IndexOccurrence& occurrence) const {
+        return occurrence.region < trailer->regionCount ? Section<IndexRegion>(trailer->regions) + occurrence.region : nullptr;
+    }
+
+    // IDs of the strings that contain the trigram, ascending
+    const uint32_t* PostingsBegin(uint32_t trigram, const uint32_t** end) const {
+        const uint32_t* keys = Section<uint32_t>(trailer->trigrams);
+        const uint32_t* key = std::lower_bound(keys, keys + trailer->trigramCount, trigram);
+        const uint32_t* postings = Section<uint32_t>(trailer->postings);
+        if (key == keys + trailer->trigramCount || *key != trigram) {
+            *end = postings;
+            return postings;
+        }
+        const uint32_t* offsets = Section<uint32_t>(trailer->postingOffsets);
+        size_t k = static_cast<size_t>(key - keys);
+        *end = postings + offsets[k + 1];
+        return postings + offsets[k];
+    }
+
+    // Appends the IDs of the strings that contain text, ascending
+    void Find(std::string_view text, std::vector<uint32_t>& ids, std::vector<uint32_t>& scratch) const {
+        if (text.size() < 3) {
+            for (size_t id = 0; id < StringCount(); id++) {
+                if (String(id).find(text) != std::string_view::npos) ids.push_back(static_cast<uint32_t>(id));
+            }
+            return;
+        }
+
+        // Candidates from the shortest posting list, narrowed by the others
+        std::vector<std::pair<const uint32_t*, const uint32_t*>> lists;
+        for (size_t i = 0; i + 3 <= text.size(); i++) {
+            const uint32_t* end;
+            const uint32_t* begin = PostingsBegin(TrigramKey(text.data() + i), &end);
+            if (begin == end) return;
+            lists.push_back(std::make_pair(begin, end));
+        }
+        std::sort(lists.begin(), lists.end(), [](const std::pair<const uint32_t*, const uint32_t*>& a,
+                                                 const std::pair<const uint32_t*, const uint32_t*>& b) {
+            return a.second - a.first < b.second - b.first;
+        });
+        scratch.assign(lists[0].first, lists[0].second);
+        for (size_t l = 1; l < lists.size() && !scratch.empty(); l++) {
+            if (lists[l] == lists[l - 1]) continue;     // A trigram that repeats in text
+            size_t kept = 0;
+            const uint32_t* at = lists[l].first;
+            for (uint32_t id : scratch) {
+                at = std::lower_bound(at, lists[l].second, id);
+                if (at == lists[l].second) break;
+                if (*at == id) scratch[kept++] = id;
+            }
+            scratch.resize(kept);
+        }
+        for (uint32_t id : scratch) {
+            if (String(id).find(text) != std::string_view::npos) ids.push_back(id);
+        }
+    }
+
+private:
+    template <typename T>
+    const T* Section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(data + offset);
+    }
+
+    const char* data;
+    const IndexSegmentTrailer* trailer;
+};
+
+// An index file mapped for queries
+class StringIndex {
+public:
+    bool Open(const std::string& path, std::string& error) {
+        segments.clear();
+        if (!file.Open(path, error, false)) return false;
+        const char* base = file.Data();
+        IndexHeader header;
+        if (file.Size() < sizeof(header)) {
+            error = path + " is not a string index";
+            return false;
+        }
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, kIndexMagic, sizeof(kIndexMagic)) != 0 || header.end > file.Size()) {
+            error = path + " is not a string index";
+            return false;
+        }
+
+        // Only the trailers are checked; the sections they point to are
+        // trusted to lie within their segment
+        segments.reserve(static_cast<size_t>((std::min)(header.segments, header.end / sizeof(IndexSegmentTrailer))));
+        for (uint64_t at = header.last, previousStart = header.end; at != 0;) {
+            const IndexSegmentTrailer* trailer = reinterpret_cast<const IndexSegmentTrailer*>(base + at);
+            bool valid = at % 8 == 0 && at >= sizeof(IndexHeader) && at + sizeof(IndexSegmentTrailer) <= previousStart &&
+                         std::memcmp(trailer->magic, kIndexSegmentMagic, sizeof(kIndexSegmentMagic)) == 0 &&
+                         trailer->start >= sizeof(IndexHeader) && trailer->start <= at && trailer->previous < trailer->start;
+            if (!valid) {
+                error = path + " is damaged";
+                segments.clear();
+                return false;
+            }
+            segments.push_back(IndexSegment(base, trailer));
+            previousStart = trailer->start;
+            at = trailer->previous;
+        }
+        std::reverse(segments.begin(), segments.end());
+        return true;
+    }
+
+    // Oldest first
+    const std::vector<IndexSegment>& Segments() const { return segments; }
+
+    uint64_t SizeBytes() const { return file.Size(); }
+
+private:
+    MappedFile file;
+    std::vector<IndexSegment> segments;
+};
+
+// Appends segments to an index file, creating it if needed
+class StringIndexWriter {
+public:
+    // Opens the index and takes the next snapshot ID for the segments
+    // appended until Close
+    bool Open(const std::string& path, std::string& error) {
+        Close();
+        filePath = path;
+        file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        if (!file.is_open()) {
+            std::ofstream create(path, std::ios::binary);
+            IndexHeader empty = IndexHeader();
+            std::memcpy(empty.magic, kIndexMagic, sizeof(kIndexMagic));
+            empty.end = sizeof(IndexHeader);
+            create.write(reinterpret_cast<const char*>(&empty), sizeof(empty));
+            create.close();
+            file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+            if (!file.is_open()) {
+                error = "Failed to create index " + path;
+                return false;
+            }
+        }
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, kIndexMagic, sizeof(kIndexMagic)) != 0) {
+            error = path + " is not a string index";
+            file.close();
+            return false;
+        }
+        header.snapshots++;
+        snapshot = header.snapshots;
+        return true;
+    }
+
+    uint64_t Snapshot() const { return snapshot; }
+
+    // Appends the strings of one scan: texts with every occurrence of them
+    // (IDs into texts), regions sorted by base address
+    bool Append(const std::string& processName, uint32_t processId, const std::vector<MemoryRegion>& regions,
+                const StringStore& texts, const std::vector<TextOccurrence>& occurrences, std::string& error) {
+        if (!file.is_open()) {
+            error = "Index is not open";
+            return false;
+        }
+        buffer.clear();
+        IndexSegmentTrailer trailer = IndexSegmentTrailer();
+        std::memcpy(trailer.magic, kIndexSegmentMagic, sizeof(kIndexSegmentMagic));
+        trailer.start = header.end;
+        trailer.previous = header.last;
+        trailer.snapshot = snapshot;
+        trailer.time = static_cast<int64_t>(std::time(nullptr));
+        trailer.processId = processId;
+
+        trailer.name = Put(processName.data(), processName.size());
+        trailer.nameLength = static_cast<uint32_t>(processName.size());
+
+        std::vector<IndexRegion> indexRegions(regions.size());
+        for (size_t r = 0; r < regions.size(); r++) {
+            indexRegions[r] = IndexRegion{regions[r].BaseAddress, regions[r].RegionSize, static_cast<uint32_t>(regions[r].Type),
+                                          static_cast<uint32_t>(regions[r].Protect)};
+        }
+        trailer.regionCount = indexRegions.size();
+        trailer.regions = Put(indexRegions.data(), indexRegions.size() * sizeof(IndexRegion));
+
+        std::vector<uint64_t> offsets(texts.size() + 1, 0);
+        for (size_t id = 0; id < texts.size(); id++) offsets[id + 1] = offsets[id] + texts[id].size();
+        trailer.stringCount = texts.size();
+        trailer.stringBytes = offsets.back();
+        trailer.stringOffsets = Put(offsets.data(), offsets.size() * sizeof(uint64_t));
+        trailer.strings = buffer.size();
+        for (size_t id = 0; id < texts.size(); id++) buffer.append(texts[id].data(), texts[id].size());
+        Align();
+
+        // Occurrences grouped by string, in address order within each
+        std::vector<uint64_t> counts(texts.size() + 1, 0);
+        for (const auto& occurrence : occurrences) counts[occurrence.id + 1]++;
+        for (size_t id = 0; id < texts.size(); id++) counts[id + 1] += counts[id];
+        std::vector<IndexOccurrence> grouped(occurrences.size());
+        std::vector<uint64_t> next(counts.begin(), counts.end() - 1);
+        for (const auto& occurrence : occurrences) {
+            auto region = std::upper_bound(regions.begin(), regions.end(), occurrence.address,
+                                           [](uint64_t address, const MemoryRegion& r) { return address < r.BaseAddress; });
+            uint32_t index = 0xFFFFFFFF;
+            if (region != regions.begin() && occurrence.address < (region - 1)->BaseAddress + (region - 1)->RegionSize) {
+                index = static_cast<uint32_t>(region - 1 - regions.begin());
+            }
+            grouped[next[occurrence.id]++] = IndexOccurrence{occurrence.address, index, occurrence.byteLength};
+        }
+        for (size_t id = 0; id < texts.size(); id++) {
+            std::sort(grouped.begin() + counts[id], grouped.begin() + counts[id + 1],
+                      [](const IndexOccurrence& a, const IndexOccurrence& b) { return a.address < b.address; });
+        }
+        trailer.occurrenceCount = grouped.size();
+        trailer.occurrenceOffsets = Put(counts.data(), counts.size() * sizeof(uint64_t));
+        trailer.occurrences = Put(grouped.data(), grouped.size() * sizeof(IndexOccurrence));
+
+        // Every distinct (trigram, string) pair, sorted, becomes the
+        // trigram table and its posting lists
+        pairs.clear();
+        for (size_t id = 0; id < texts.size(); id++) {
+            std::string_view text = texts[id];
+            for (size_t i = 0; i + 3 <= text.size(); i++) {
+                pairs.push_back(static_cast<uint64_t>(TrigramKey(text.data() + i)) << 32 | id);
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+        std::vector<uint32_t> trigrams;
+        std::vector<uint32_t> postingOffsets;
+        std::vector<uint32_t> postings(pairs.size());
+        for (size_t i = 0; i < pairs.size(); i++) {
+            uint32_t key = static_cast<uint32_t>(pairs[i] >> 32);
+            if (trigrams.empty() || trigrams.back() != key) {
+                trigrams.push_back(key);
+                postingOffsets.push_back(static_cast<uint32_t>(i));
+            }
+            postings[i] = static_cast<uint32_t>(pairs[i]);
+        }
+        postingOffsets.push_back(static_cast<uint32_t>(pairs.size()));
+        trailer.trigramCount = trigrams.size();
+        trailer.postingCount = postings.size();
+        trailer.trigrams = Put(trigrams.data(), trigrams.size() * sizeof(uint32_t));
+        trailer.postingOffsets = Put(postingOffsets.data(), postingOffsets.size() * sizeof(uint32_t));
+        trailer.postings = Put(postings.data(), postings.size() * sizeof(uint32_t));
+
+        uint64_t trailerOffset = header.end + buffer.size();
+        buffer.append(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+
+        // The segment first, then the header that makes it visible
+        file.seekp(static_cast<std::streamoff>(header.end));
+        file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        file.flush();
+        IndexHeader updated = header;
+        updated.end = trailerOffset + sizeof(trailer);
+        updated.segments++;
+        updated.last = trailerOffset;
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&updated), sizeof(updated));
+        file.flush();
+        if (!file) {
+            error = "Failed to write index " + filePath;
+            file.close();
+            return false;
+        }
+        header = updated;
+        return true;
+    }
+
+    void Close() {
+        if (file.is_open()) file.close();
+    }
+
+private:
+    // Appends bytes at an 8-byte boundary and returns their offset
+    uint64_t Put(const void* data, size_t size) {
+        Align();
+        uint64_t offset = buffer.size();
+        buffer.append(static_cast<const char*>(data), size);
+        Align();
+        return offset;
+    }
+
+    void Align() {
+        buffer.resize((buffer.size() + 7) / 8 * 8, '\0');
+    }
+
+    std::fstream file;
+    std::string filePath;
+    IndexHeader header = IndexHeader();
+    uint64_t snapshot = 0;
+    std::string buffer;
+    std::vector<uint64_t> pairs;
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+// Interning store for extracted strings.
+//
+// Unique strings are packed back to back into a bump-allocated arena and
+// looked up through an open-addressing hash table, so deduplication costs one
+// hash and (almost always) one probe per string instead of a scan over every
+// string seen so far. Strings are identified by a dense ID in first-seen order.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Fast non-cryptographic 64-bit hash: 8 bytes per multiply, strong finalizer.
+inline uint64_t HashMix64(uint64_t x) {
+    x ^= x >> 32;
+    x *= 0xD6E8FEB86659FD93ull;
+    x ^= x >> 32;
+    x *= 0xD6E8FEB86659FD93ull;
+    x ^= x >> 32;
+    return x;
+}
+
+inline uint64_t HashBytes(const char* data, size_t length) {
+    const uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+    uint64_t hash = (length + 1) * multiplier;
+
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        hash = (hash ^ HashMix64(word)) * multiplier;
+        data += 8;
+        length -= 8;
+    }
+    if (length > 0) {
+        uint64_t word = 0;
+        std::memcpy(&word, data, length);
+        hash = (hash ^ HashMix64(word ^ length)) * multiplier;
+    }
+    return HashMix64(hash);
+}
+
+class StringStore {
+public:
+    static const uint32_t kInvalidId = 0xFFFFFFFFu;
+
+    StringStore() = default;
+    StringStore(StringStore&&) = default;
+    StringStore& operator=(StringStore&&) = default;
+    StringStore(const StringStore&) = delete;
+    StringStore& operator=(const StringStore&) = delete;
+
+    // Returns the ID of the string, adding it if it is new. Repeated strings
+    // only bump the occurrence count; the first address seen is kept.
+    uint32_t Intern(const char* data, size_t length, uint64_t address, bool* inserted = nullptr) {
+        return Intern(data, length, HashBytes(data, length), address, inserted);
+    }
+
+    uint32_t Intern(std::string_view text, uint64_t address, bool* inserted = nullptr) {
+        return Intern(text.data(), text.size(), address, inserted);
+    }
+
+    uint32_t Intern(const char* data, size_t length, uint64_t hash, uint64_t address, bool* inserted) {
+        if ((entries.size() + 1) * 4 > slots.size() * 3) {
+            Grow();
+        }
+
+        uint64_t tag = hash & 0xFFFFFFFF00000000ull;
+        size_t mask = slots.size() - 1;
+        size_t index = static_cast<size_t>(hash) & mask;
+        while (true) {
+            uint64_t slot = slots[index];
+            if (slot == 0) break;
+            if ((slot & 0xFFFFFFFF00000000ull) == tag) {
+                uint32_t id = static_cast<uint32_t>(slot) - 1;
+                Entry& entry = entries[id];
+                if (entry.length == length && std::memcmp(entry.data, data, length) == 0) {
+                    entry.count++;
+                    if (inserted) *inserted = false;
+                    return id;
+                }
+            }
+            index = (index + 1) & mask;
+        }
+
+        Entry entry;
+        entry.data = Allocate(data, length);
+        entry.length = static_cast<uint32_t>(length);
+        entry.count = 1;
+        entry.hash = hash;
+        entry.firstAddress = address;
+        uint32_t id = static_cast<uint32_t>(entries.size());
+        entries.push_back(entry);
+        slots[index] = tag | (static_cast<uint64_t>(id) + 1);
+        if (inserted) *inserted = true;
+        return id;
+    }
+
+    // ID of an already interned string, or kInvalidId.
+    uint32_t Find(std::string_view text) const {
+        return Find(text, HashBytes(text.data(), text.size()));
+    }
+
+    uint32_t Find(std::string_view text, uint64_t hash) const {
+        if (slots.empty()) return kInvalidId;
+        uint64_t tag = hash & 0xFFFFFFFF00000000ull;
+        size_t mask = slots.size() - 1;
+        for (size_t index = static_cast<size_t>(hash) & mask; slots[index] != 0; index = (index + 1) & mask) {
+            if ((slots[index] & 0xFFFFFFFF00000000ull) != tag) continue;
+            uint32_t id = static_cast<uint32_t>(slots[index]) - 1;
+            if (View(id) == text) return id;
+        }
+        return kInvalidId;
+    }
+
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+
+    std::string_view operator[](size_t id) const { return View(id); }
+
+    std::string_view View(size_t id) const {
+        return std::string_view(entries[id].data, entries[id].length);
+    }
+
+    uint64_t Count(size_t id) const { return entries[id].count; }
+    uint64_t FirstAddress(size_t id) const { return entries[id].firstAddress; }
+    uint64_t Hash(size_t id) const { return entries[id].hash; }
+
+    // Bytes held by the arena, the entry table and the hash table.
+    size_t MemoryUsage() const {
+        return arenaBytes + entries.capacity() * sizeof(Entry) + slots.capacity() * sizeof(uint64_t);
+    }
+
+    void clear() {
+        entries.clear();
+        slots.clear();
+        blocks.clear();
+        blockUsed = blockSize = arenaBytes = 0;
+    }
+
+private:
+    struct Entry {
+        const char* data;
+        uint32_t length;
+        uint32_t count;
+        uint64_t hash;
+        uint64_t firstAddress;
+    };
+
+    static const size_t kBlockSize = 1024 * 1024;
+
+    const char* Allocate(const char* data, size_t length) {
+        if (blockUsed + length > blockSize) {
+            blockSize = length > kBlockSize ? length : kBlockSize;
+            blocks.emplace_back(new char[blockSize]);
+            blockUsed = 0;
+            arenaBytes += blockSize;
+        }
+        char* destination = blocks.back().get() + blockUsed;
+        if (length) std::memcpy(destination, data, length);
+        blockUsed += length;
+        return destination;
+    }
+
+    void Grow() {
+        size_t capacity = slots.empty() ? 1024 : slots.size() * 2;
+        std::vector<uint64_t> grown(capacity, 0);
+        size_t mask = capacity - 1;
+        for (size_t id = 0; id < entries.size(); id++) {
+            uint64_t hash = entries[id].hash;
+            size_t index = static_cast<size_t>(hash) & mask;
+            while (grown[index] != 0) {
+                index = (index + 1) & mask;
+            }
+            grown[index] = (hash & 0xFFFFFFFF00000000ull) | (static_cast<uint64_t>(id) + 1);
+        }
+        slots.swap(grown);
+    }
+
+    std::vector<Entry> entries;
+    std::vector<uint64_t> slots;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t blockUsed = 0;
+    size_t blockSize = 0;
+    size_t arenaBytes = 0;
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+// Synthetic memory images for benchmarks.
+//
+// The contents are a seeded mix of the things a heap holds: UTF-16 strings
+// of varied length and termination, ASCII text, short zero runs, whole zero
+// pages, random bytes and tables of pointers. A ContentMix weighs how often
+// each of them is picked; the same size, mix and seed always give the same
+// bytes.
+//
+// A SyntheticImage also lays the contents out as the regions of a made-up
+// address space: private heaps of 4 KB to 8 MB, read-only and image
+// regions, mapped views, reservations and guard pages, with unmapped gaps
+// in between, so that region filtering has real work to do. It can be
+// scanned through a BufferMemorySource or saved with WriteMemoryDump.
+
+#include "memory_source.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// xorshift64: fast, and the same sequence on every platform.
+class Random {
+public:
+    explicit Random(uint64_t seed) : state(seed ? seed : 0x9E3779B97F4A7C15ull) {}
+
+    uint64_t Next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    size_t Below(size_t bound) { return static_cast<size_t>(Next() % bound); }
+
+private:
+    uint64_t state;
+};
+
+// Relative weights of each kind of content. The defaults are the corpus
+// heap_bench has always used.
+struct ContentMix {
+    unsigned utf16 = 2;
+    unsigned ascii = 1;
+    unsigned zeros = 1;         // Zero runs of up to 512 bytes
+    unsigned random = 1;
+    unsigned pointers = 1;
+    unsigned zeroPages = 0;     // Page-aligned zero pages
+};
+
+// Parses "utf16=4,zeropages=2,random=0"; kinds not named keep their weight.
+inline bool ParseContentMix(const std::string& text, ContentMix& mix, std::string& error) {
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) end = text.size();
+        std::string item = text.substr(start, end - start);
+        start = end + 1;
+
+        size_t equals = item.find('=');
+        char* last = NULL;
+        unsigned long weight = equals == std::string::npos ? 0 : std::strtoul(item.c_str() + equals + 1, &last, 10);
+        if (equals == std::string::npos || last == item.c_str() + equals + 1 || *last != '\0' || weight > 1000) {
+            error = "Invalid mix entry: " + item;
+            return false;
+        }
+        std::string kind = item.substr(0, equals);
+        unsigned* target = kind == "utf16" ? &mix.utf16 : kind == "ascii" ? &mix.ascii : kind == "zeros" ? &mix.zeros
+                         : kind == "random" ? &mix.random : kind == "pointers" ? &mix.pointers
+                         : kind == "zeropages" ? &mix.zeroPages : NULL;
+        if (target == NULL) {
+            error = "Unknown content kind: " + kind + " (utf16, ascii, zeros, random, pointers, zeropages)";
+            return false;
+        }
+        *target = static_cast<unsigned>(weight);
+    }
+    if (mix.utf16 + mix.ascii + mix.zeros + mix.random + mix.pointers + mix.zeroPages == 0) {
+        error = "The content mix has no weight";
+        return false;
+    }
+    return true;
+}
+
+inline std::string FormatContentMix(const ContentMix& mix) {
+    return "utf16=" + std::to_string(mix.utf16) + ",ascii=" + std::to_string(mix.ascii) +
+           ",zeros=" + std::to_string(mix.zeros) + ",random=" + std::to_string(mix.random) +
+           ",pointers=" + std::to_string(mix.pointers) + ",zeropages=" + std::to_string(mix.zeroPages);
+}
+
+// Builds size bytes of heap-like content.
+inline std::vector<char> BuildCorpus(size_t size, uint64_t seed, const ContentMix& mix = ContentMix()) {
+    enum Kind { Utf16, Ascii, Zeros, Bytes, Pointers, ZeroPage };
+    const unsigned weights[] = {mix.utf16, mix.ascii, mix.zeros, mix.random, mix.pointers, mix.zeroPages};
+    unsigned total = 0;
+    for (unsigned weight : weights) total += weight;
+
+    std::vector<char> corpus;
+    corpus.reserve(size + 8192);
+    Random rng(seed);
+
+    while (corpus.size() < size) {
+        size_t roll = rng.Below(total);
+        int kind = 0;
+        while (roll >= weights[kind]) roll -= weights[kind++];
+
+        switch (kind) {
+            case Utf16: {
+                size_t length = 1 + rng.Below(rng.Below(4) == 0 ? 400 : 40);
+                if (rng.Below(2)) corpus.push_back(static_cast<char>(rng.Next()));
+                for (size_t c = 0; c < length; c++) {
+                    size_t type = rng.Below(40);
+                    char lo = static_cast<char>(32 + rng.Below(95));
+                    char hi = 0;
+                    if (type == 0) lo = static_cast<char>(rng.Next());
+                    else if (type == 1) hi = static_cast<char>(1 + rng.Below(255));
+                    else if (type == 2) lo = '\t';
+                    corpus.push_back(lo);
+                    corpus.push_back(hi);
+                }
+                if (rng.Below(4)) {
+                    corpus.push_back(0);
+                    corpus.push_back(0);
+                }
+                break;
+            }
+            case Ascii: {
+                size_t length = 8 + rng.Below(200);
+                for (size_t c = 0; c < length; c++) {
+                    corpus.push_back(static_cast<char>(32 + rng.Below(95)));
+                }
+                break;
+            }
+            case Zeros: {
+                size_t length = rng.Below(512);
+                corpus.insert(corpus.end(), length, 0);
+                break;
+            }
+            case Bytes: {
+                size_t length = rng.Below(256);
+                for (size_t c = 0; c < length; c++) {
+                    corpus.push_back(static_cast<char>(rng.Next()));
+                }
+                break;
+            }
+            case Pointers: {
+                size_t count = rng.Below(32);
+                for (size_t p = 0; p < count; p++) {
+                    uint64_t pointer = 0x00007FF000000000ull + (rng.Next() & 0xFFFFFFF8ull);
+                    for (int b = 0; b < 8; b++) {
+                        corpus.push_back(static_cast<char>(pointer >> (b * 8)));
+                    }
+                }
+                break;
+            }
+            default: {
+                // Up to the next page boundary, then one to four whole pages
+                size_t length = (4096 - corpus.size() % 4096) % 4096 + 4096 * (1 + rng.Below(4));
+                corpus.insert(corpus.end(), length, 0);
+                break;
+            }
+        }
+    }
+
+    corpus.resize(size);
+    return corpus;
+}
+
+struct SyntheticImage {
+    std::vector<char> bytes;            // Contents of the readable regions, back to back
+    std::vector<MemoryRegion> regions;  // In ascending address order
+    std::vector<uint64_t> offsets;      // Into bytes, or BufferMemorySource::kNoData
+};
+
+// Lays out readable regions holding size bytes in all, plus the regions
+// that hold none, starting at a typical user-space address.
+inline SyntheticImage BuildSyntheticImage(size_t size, uint64_t seed, const ContentMix& mix = ContentMix()) {
+    const uint64_t kPage = 4096;
+    SyntheticImage image;
+    Random rng(seed ^ 0x5A5A5A5A5A5A5A5Aull);
+    uint64_t address = 0x0000010000000000ull;
+    uint64_t readable = 0;
+
+    while (readable < size) {
+        MemoryRegion region = {address, kPage * (1 + rng.Below(rng.Below(4) == 0 ? 2048 : 64)), MEM_COMMIT, MEM_PRIVATE, PAGE_READWRITE};
+        size_t roll = rng.Below(64);
+        if (roll < 40) {
+            // Heap, stack and other private read-write memory
+        } else if (roll < 44) {
+            region.Protect = PAGE_READONLY;
+        } else if (roll < 50) {
+            region.Type = MEM_IMAGE;
+            region.Protect = rng.Below(2) ? PAGE_EXECUTE_READ : PAGE_READONLY;
+        } else if (roll < 55) {
+            region.Type = MEM_MAPPED;
+            region.Protect = PAGE_READONLY;
+        } else if (roll == 55) {
+            // Mapped views of 10 MB and more are skipped by the extractor
+            region.Type = MEM_MAPPED;
+            region.Protect = PAGE_READONLY;
+            region.RegionSize = kPage * (2560 + rng.Below(1536));
+        } else if (roll < 60) {
+            region.State = MEM_RESERVE;
+            region.Protect = 0;
+            region.RegionSize *= 16;
+        } else if (roll < 62) {
+            region.RegionSize = kPage;
+            region.Protect = PAGE_READWRITE | PAGE_GUARD;
+        } else {
+            region.RegionSize = kPage;
+            region.Protect = PAGE_NOACCESS;
+        }
+
+        bool holdsBytes = region.State == MEM_COMMIT && !(region.Protect & (PAGE_NOACCESS | PAGE_GUARD));
+        if (holdsBytes) {
+            region.RegionSize = (std::min)(region.RegionSize, (size - readable + kPage - 1) / kPage * kPage);
+            image.offsets.push_back(readable);
+            readable += region.RegionSize;
+        } else {
+            image.offsets.push_back(BufferMemorySource::kNoData);
+        }
+        image.regions.push_back(region);
+
+        address += region.RegionSize;
+        if (rng.Below(4) == 0) address += kPage * (1 + rng.Below(256));
+    }
+
+    image.bytes = BuildCorpus(static_cast<size_t>(readable), seed, mix);
+    return image;
+}
@@ -0,0 +1,363 @@
+#pragma once
+
+// Scan telemetry: per-phase timers, counters and a read latency histogram.
+//
+// Every thread records into a shard of its own, so recording is a relaxed
+// load and store of a value no other thread writes: no locked instruction
+// and no cache line shared with another thread. Telemetry::Capture() adds
+// the shards up at any time and from any thread, which is how progress is
+// reported during a long scan. When a thread exits its shard is handed to
+// the next new thread, counts included, so there are never more shards than
+// threads alive at once.
+//
+// Phase times are thread time: a phase run on 8 threads for 1 s counts 8 s.
+
+#include "heap_report.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class Counter {
+    RegionsEnumerated,
+    RegionsSkippedNotCommitted,
+    RegionsSkippedUnreadable,
+    RegionsSkippedImage,
+    RegionsSkippedLargeMapping,
+    RegionsSkippedSmall,
+    ReadCalls,
+    BytesRequested,
+    BytesRead,
+    BytesMapped,            // Scanned in place through MemorySource::View
+    ReadFailures,           // Requests that read nothing
+    PartialReads,           // Requests that read some but not all bytes
+    ReadsIssued,            // Reads passed to the backend after merging (see read_planner.h)
+    ReadsMerged,            // Requests folded into another's read
+    MergedReadRetries,      // Merged reads that came back short and were redone per request
+    BytesSkippedNotResident, // Private pages not resident, left unread (see MemorySource::QueryResidency)
+    BytesSkippedZero,       // All-zero pages read but not scanned for text
+    BytesSkippedNotText,    // Pages the classifier skipped (see page_classifier.h)
+    BytesSkippedBudget,     // Left unscanned when the time or byte budget ran out (see budget_scan.h)
+    PagesClassified,
+    PagesFingerprinted,
+    StringsFound,
+    StringsUnique,
+    PatternHits,
+    HeapBlocks,             // Allocator blocks walked (see heap_walker.h)
+    HeapHeaderReads,        // Block headers read on their own, beyond the chunks at hand
+    StringsOutsideAllocations, // Dropped for starting in free heap blocks or allocator metadata
+    ReferencesFound,        // Pointers into enumerated regions (see reference_scanner.h)
+    Count
+};
+
+enum class Phase {
+    Enumerate,
+    Read,
+    Classify,
+    Scan,
+    Patterns,
+    Merge,
+    HeapWalk,
+    References,
+    Fingerprint,
+    Report,
+    Count
+};
+
+static const size_t kCounterCount = static_cast<size_t>(Counter::Count);
+static const size_t kPhaseCount = static_cast<size_t>(Phase::Count);
+static const size_t kLatencyBuckets = 40;      // Bucket b holds latencies in [2^b, 2^(b+1)) ns
+
+// JSON key and table label of each counter
+inline const char* CounterKey(Counter counter) {
+    static const char* keys[] = {
+        "regionsEnumerated", "regionsSkippedNotCommitted", "regionsSkippedUnreadable", "regionsSkippedImage",
+        "regionsSkippedLargeMapping", "regionsSkippedSmall", "readCalls", "bytesRequested", "bytesRead",
+        "bytesMapped", "readFailures", "partialReads", "readsIssued", "readsMerged", "mergedReadRetries",
+        "bytesSkippedNotResident", "bytesSkippedZero", "bytesSkippedNotText", "bytesSkippedBudget",
+        "pagesClassified", "pagesFingerprinted", "stringsFound", "stringsUnique", "patternHits", "heapBlocks",
+        "heapHeaderReads", "stringsOutsideAllocations", "referencesFound"};
+    return keys[static_cast<size_t>(counter)];
+}
+
+inline const char* CounterLabel(Counter counter) {
+    static const char* labels[] = {
+        "Regions enumerated", "Regions skipped (not committed)", "Regions skipped (unreadable)",
+        "Regions skipped (image)", "Regions skipped (mapping of 10 MB+)", "Regions skipped (under 16 bytes)",
+        "Read calls", "Bytes requested", "Bytes read", "Bytes scanned in place", "Read failures", "Partial reads",
+        "Reads issued after merging", "Requests merged", "Merged reads retried",
+        "Bytes skipped (not resident)", "Bytes skipped (zero pages)", "Bytes skipped (not text)",
+        "Bytes skipped (budget)", "Pages classified", "Pages fingerprinted", "Strings found", "Strings unique",
+        "Pattern hits", "Heap blocks walked", "Heap headers read separately", "Strings outside allocations",
+        "References found"};
+    return labels[static_cast<size_t>(counter)];
+}
+
+inline const char* PhaseName(Phase phase) {
+    static const char* names[] = {"enumerate", "read", "classify", "scan", "patterns", "merge", "heapwalk", "references", "fingerprint", "report"};
+    return names[static_cast<size_t>(phase)];
+}
+
+// The sum of all shards at one moment
+struct TelemetrySnapshot {
+    double seconds = 0;         // Since the first telemetry of the run
+    uint64_t counters[kCounterCount] = {};
+    uint64_t phaseNanoseconds[kPhaseCount] = {};
+    uint64_t readLatency[kLatencyBuckets] = {};
+
+    uint64_t operator[](Counter counter) const { return counters[static_cast<size_t>(counter)]; }
+    double PhaseSeconds(Phase phase) const { return phaseNanoseconds[static_cast<size_t>(phase)] / 1e9; }
+
+    // Upper bound of the bucket holding the given fraction of read calls
+    uint64_t ReadLatencyPercentile(double fraction) const {
+        uint64_t total = 0;
+        for (uint64_t count : readLatency) total += count;
+        uint64_t seen = 0;
+        for (size_t b = 0; b < kLatencyBuckets; b++) {
+            seen += readLatency[b];
+            if (total && seen >= fraction * total) return 2ull << b;
+        }
+        return 0;
+    }
+};
+
+class Telemetry {
+public:
+    static void Add(Counter counter, uint64_t amount = 1) {
+        Bump(Local().counters[static_cast<size_t>(counter)], amount);
+    }
+
+    static void AddTime(Phase phase, uint64_t nanoseconds) {
+        Bump(Local().phaseNanoseconds[static_cast<size_t>(phase)], nanoseconds);
+    }
+
+    static void AddReadLatency(uint64_t nanoseconds) {
+        size_t bucket = 0;
+        while (nanoseconds >= 2 && bucket + 1 < kLatencyBuckets) {
+            nanoseconds >>= 1;
+            bucket++;
+        }
+        Bump(Local().readLatency[bucket], 1);
+    }
+
+    // One call into a MemorySource to read memory
+    static void AddReadCall(uint64_t nanoseconds) {
+        Add(Counter::ReadCalls);
+        AddTime(Phase::Read, nanoseconds);
+        AddReadLatency(nanoseconds);
+    }
+
+    // One range asked of a read call and the bytes it returned
+    static void AddReadRequest(uint64_t requested, uint64_t read) {
+        Add(Counter::BytesRequested, requested);
+        Add(Counter::BytesRead, read);
+        if (read == 0) Add(Counter::ReadFailures);
+        else if (read < requested) Add(Counter::PartialReads);
+    }
+
+    static TelemetrySnapshot Capture() {
+        Registry& registry = GetRegistry();
+        TelemetrySnapshot snapshot;
+        snapshot.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - registry.start).count();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (const auto& shard : registry.shards) {
+            for (size_t i = 0; i < kCounterCount; i++) snapshot.counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+            for (size_t i = 0; i < kPhaseCount; i++) snapshot.phaseNanoseconds[i] += shard->phaseNanoseconds[i].load(std::memory_order_relaxed);
+            for (size_t i = 0; i < kLatencyBuckets; i++) snapshot.readLatency[i] += shard->readLatency[i].load(std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+
+private:
+    // A cache line of its own, so that shards of two threads never share one
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> counters[kCounterCount] = {};
+        std::atomic<uint64_t> phaseNanoseconds[kPhaseCount] = {};
+        std::atomic<uint64_t> readLatency[kLatencyBuckets] = {};
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Shard>> shards;
+        std::vector<Shard*> idle;           // Left behind by threads that exited
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    };
+
+    // Holds a thread's shard for as long as the thread lives
+    struct Lease {
+        Shard* shard;
+
+        Lease() {
+            Registry& registry = GetRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            if (registry.idle.empty()) {
+                registry.shards.emplace_back(new Shard());
+                shard = registry.shards.back().get();
+            } else {
+                shard = registry.idle.back();
+                registry.idle.pop_back();
+            }
+        }
+
+        ~Lease() {
+            Registry& registry = GetRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.idle.push_back(shard);
+        }
+    };
+
+    static Registry& GetRegistry() {
+        static Registry registry;
+        return registry;
+    }
+
+    static Shard& Local() {
+        thread_local Lease lease;
+        return *lease.shard;
+    }
+
+    // Only the owning thread writes a shard, so this needs no atomic add
+    static void Bump(std::atomic<uint64_t>& value, uint64_t amount) {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+};
+
+// Adds the time from construction to destruction to a phase.
+class ScopedPhase {
+public:
+    explicit ScopedPhase(Phase phase) : phase(phase), start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedPhase() {
+        Telemetry::AddTime(phase, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                      std::chrono::steady_clock::now() - start).count()));
+    }
+
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+private:
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+inline std::string FormatNanoseconds(uint64_t nanoseconds) {
+    std::ostringstream text;
+    if (nanoseconds < 1000) text << nanoseconds << " ns";
+    else if (nanoseconds < 1000000) text << nanoseconds / 1000 << " us";
+    else if (nanoseconds < 1000000000) text << nanoseconds / 1000000 << " ms";
+    else text << nanoseconds / 1000000000 << " s";
+    return text.str();
+}
+
+inline void WriteTelemetryTable(std::ostream& out, const TelemetrySnapshot& snapshot) {
+    out << "SCAN STATISTICS (" << std::fixed << std::setprecision(2) << snapshot.seconds << " s):" << std::endl;
+    out << "  Phases (thread time):" << std::endl;
+    for (size_t i = 0; i < kPhaseCount; i++) {
+        out << "    " << std::left << std::setw(14) << PhaseName(static_cast<Phase>(i)) << std::right << std::setw(12)
+            << std::setprecision(1) << snapshot.phaseNanoseconds[i] / 1e6 << " ms" << std::endl;
+    }
+
+    out << "  Counters:" << std::endl;
+    for (size_t i = 0; i < kCounterCount; i++) {
+        Counter counter = static_cast<Counter>(i);
+        out << "    " << std::left << std::setw(38) << CounterLabel(counter) << std::right << std::setw(14) << snapshot.counters[i];
+        if (counter == Counter::BytesRequested || counter == Counter::BytesRead || counter == Counter::BytesMapped ||
+            counter == Counter::BytesSkippedNotResident || counter == Counter::BytesSkippedZero ||
+            counter == Counter::BytesSkippedNotText || counter == Counter::BytesSkippedBudget) {
+            out << "  (" << FormatSize(snapshot.counters[i]) << ")";
+        }
+        out << std::endl;
+    }
+    uint64_t found = snapshot[Counter::StringsFound];
+    uint64_t unique = snapshot[Counter::StringsUnique];
+    out << "    " << std::left << std::setw(38) << "Strings deduplicated" << std::right << std::setw(14)
+        << (found > unique ? found - unique : 0) << std::endl;
+
+    size_t first = kLatencyBuckets, last = 0;
+    uint64_t most = 0;
+    for (size_t b = 0; b < kLatencyBuckets; b++) {
+        if (snapshot.readLatency[b] == 0) continue;
+        first = (std::min)(first, b);
+        last = b;
+        most = (std::max)(most, snapshot.readLatency[b]);
+    }
+    if (first == kLatencyBuckets) return;
+    out << "  Read latency (p50 < " << FormatNanoseconds(snapshot.ReadLatencyPercentile(0.5))
+        << ", p99 < " << FormatNanoseconds(snapshot.ReadLatencyPercentile(0.99)) << "):" << std::endl;
+    for (size_t b = first; b <= last; b++) {
+        uint64_t count = snapshot.readLatency[b];
+        out << "    < " << std::left << std::setw(8) << FormatNanoseconds(2ull << b) << std::right << std::setw(10) << count
+            << "  " << std::string(static_cast<size_t>((count * 40 + most - 1) / most), '#') << std::endl;
+    }
+}
+
+inline void WriteTelemetryJson(std::ostream& out, const TelemetrySnapshot& snapshot) {
+    out << "{\n  \"seconds\": " << std::fixed << std::setprecision(6) << snapshot.seconds << ",\n";
+    out << "  \"phaseSeconds\": {";
+    for (size_t i = 0; i < kPhaseCount; i++) {
+        out << (i ? ", " : "") << "\"" << PhaseName(static_cast<Phase>(i)) << "\": " << snapshot.phaseNanoseconds[i] / 1e9;
+    }
+    out << "},\n  \"counters\": {";
+    for (size_t i = 0; i < kCounterCount; i++) {
+        out << (i ? ", " : "") << "\"" << CounterKey(static_cast<Counter>(i)) << "\": " << snapshot.counters[i];
+    }
+    // Bucket b counts read calls that took [2^b, 2^(b+1)) ns
+    out << "},\n  \"readLatencyLog2Nanoseconds\": [";
+    for (size_t b = 0; b < kLatencyBuckets; b++) {
+        out << (b ? ", " : "") << snapshot.readLatency[b];
+    }
+    out << "]\n}\n";
+}
+
+// Prints a one-line progress report every interval on a thread of its own.
+class TelemetryReporter {
+public:
+    ~TelemetryReporter() { Stop(); }
+
+    void Start(unsigned long intervalSeconds) {
+        stopping = false;
+        thread = std::thread([this, intervalSeconds] {
+            TelemetrySnapshot previous = Telemetry::Capture();
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!wake.wait_for(lock, std::chrono::seconds(intervalSeconds), [this] { return stopping; })) {
+                TelemetrySnapshot current = Telemetry::Capture();
+                uint64_t bytes = current[Counter::BytesRead] + current[Counter::BytesMapped];
+                uint64_t recent = bytes - previous[Counter::BytesRead] - previous[Counter::BytesMapped];
+                std::ostringstream line;
+                line << "[stats " << std::fixed << std::setprecision(0) << current.seconds << " s] "
+                     << FormatSize(bytes) << " scanned (" << FormatSize(static_cast<uint64_t>(recent / (current.seconds - previous.seconds)))
+                     << "/s), " << current[Counter::ReadFailures] << " read failures, "
+                     << current[Counter::StringsFound] << " strings found, " << current[Counter::StringsUnique] << " unique\n";
+                std::cout << line.str() << std::flush;
+                previous = current;
+            }
+        });
+    }
+
+    void Stop() {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
@@ -0,0 +1,601 @@
+#pragma once
+
+// UTF-16LE string scanning kernels used by ExtractTextFromMemory.
+//
+// The scanner classifies every 2-byte character of a buffer into bitmasks
+// (printable low byte, zero high byte, 0x0000 terminator) with SIMD, derives
+// the positions where the extraction heuristic triggers, and then walks the
+// triggers with bit scans. Results are emitted as spans into the buffer
+// rather than as strings, so nothing is copied until a caller asks for it.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HEAP_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(HEAP_SCAN_X86) && (defined(__GNUC__) || defined(__clang__))
+#define HEAP_SCAN_TARGET_SSE2 __attribute__((target("sse2")))
+#define HEAP_SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#define HEAP_SCAN_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#define HEAP_SCAN_TARGET_SSE2
+#define HEAP_SCAN_TARGET_AVX2
+#define HEAP_SCAN_TARGET_AVX512
+#endif
+
+inline unsigned CountTrailingZeros64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(x));
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return static_cast<unsigned>(index);
+#else
+    unsigned count = 0;
+    while ((x & 1) == 0) {
+        x >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+inline unsigned CountLeadingZeros64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_clzll(x));
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - static_cast<unsigned>(index);
+#else
+    unsigned count = 0;
+    while ((x & 0x8000000000000000ull) == 0) {
+        x <<= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+inline unsigned PopCount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_popcountll(x));
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return static_cast<unsigned>((x * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+struct TextSpan {
+    size_t offset;      // Byte offset of the first accepted character in the buffer
+    size_t byteLength;  // Bytes from offset up to and including the last accepted character
+    size_t charCount;   // Number of printable characters, i.e. the length of the text
+};
+
+enum class ScanKernel {
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+struct CpuFeatures {
+    bool sse2;
+    bool avx2;
+    bool avx512bw;
+};
+
+inline CpuFeatures DetectCpuFeatures() {
+    CpuFeatures features = {false, false, false};
+#if defined(HEAP_SCAN_X86) && defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    int maxLeaf = regs[0];
+    __cpuid(regs, 1);
+    features.sse2 = (regs[3] & (1 << 26)) != 0;
+    bool osxsave = (regs[2] & (1 << 27)) != 0;
+    bool avx = (regs[2] & (1 << 28)) != 0;
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    if (maxLeaf >= 7) {
+        __cpuidex(regs, 7, 0);
+        features.avx2 = avx && (regs[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6;
+        features.avx512bw = (regs[1] & (1 << 16)) && (regs[1] & (1 << 30)) && (xcr0 & 0xE6) == 0xE6;
+    }
+#elif defined(HEAP_SCAN_X86)
+    __builtin_cpu_init();
+    features.sse2 = __builtin_cpu_supports("sse2") != 0;
+    features.avx2 = __builtin_cpu_supports("avx2") != 0;
+    features.avx512bw = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    return features;
+}
+
+inline const CpuFeatures& GetCpuFeatures() {
+    static const CpuFeatures features = DetectCpuFeatures();
+    return features;
+}
+
+namespace text_scan_detail {
+
+// Every kernel fills one 64-bit word per mask for each 128-byte block
+// (64 UTF-16 characters), bit c describing character c of the block.
+
+inline void BuildMasksScalar(const unsigned char* data, size_t blocks,
+                             uint64_t* printable, uint64_t* zeroHigh, uint64_t* terminator) {
+    for (size_t b = 0; b < blocks; b++) {
+        const unsigned char* block = data + b * 128;
+        uint64_t p = 0, z = 0, d = 0;
+        for (unsigned c = 0; c < 64; c++) {
+            unsigned char lo = block[c * 2];
+            unsigned char hi = block[c * 2 + 1];
+            p |= static_cast<uint64_t>(lo >= 32 && lo <= 126) << c;
+            z |= static_cast<uint64_t>(hi == 0) << c;
+            d |= static_cast<uint64_t>(lo == 0 && hi == 0) << c;
+        }
+        printable[b] = p;
+        zeroHigh[b] = z;
+        terminator[b] = d;
+    }
+}
+
+#if defined(HEAP_SCAN_X86)
+
+HEAP_SCAN_TARGET_SSE2
+inline void BuildMasksSSE2(const unsigned char* data, size_t blocks,
+                           uint64_t* printable, uint64_t* zeroHigh, uint64_t* terminator) {
+    const __m128i lowByte = _mm_set1_epi16(0x00FF);
+    const __m128i below = _mm_set1_epi16(31);
+    const __m128i above = _mm_set1_epi16(127);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (size_t b = 0; b < blocks; b++) {
+        const unsigned char* block = data + b * 128;
+        uint64_t p = 0, z = 0, d = 0;
+        for (unsigned part = 0; part < 4; part++) {
+            __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + part * 32));
+            __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + part * 32 + 16));
+            __m128i lo0 = _mm_and_si128(v0, lowByte);
+            __m128i lo1 = _mm_and_si128(v1, lowByte);
+            __m128i p0 = _mm_and_si128(_mm_cmpgt_epi16(lo0, below), _mm_cmplt_epi16(lo0, above));
+            __m128i p1 = _mm_and_si128(_mm_cmpgt_epi16(lo1, below), _mm_cmplt_epi16(lo1, above));
+            __m128i z0 = _mm_cmpeq_epi16(_mm_srli_epi16(v0, 8), zero);
+            __m128i z1 = _mm_cmpeq_epi16(_mm_srli_epi16(v1, 8), zero);
+            __m128i d0 = _mm_cmpeq_epi16(v0, zero);
+            __m128i d1 = _mm_cmpeq_epi16(v1, zero);
+            unsigned shift = part * 16;
+            p |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(p0, p1)))) << shift;
+            z |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(z0, z1)))) << shift;
+            d |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(d0, d1)))) << shift;
+        }
+        printable[b] = p;
+        zeroHigh[b] = z;
+        terminator[b] = d;
+    }
+}
+
+HEAP_SCAN_TARGET_AVX2
+inline uint32_t PackMaskAVX2(__m256i a, __m256i b) {
+    // packs works per 128-bit lane, so restore character order before movemask
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+    return static_cast<uint32_t>(_mm256_movemask_epi8(packed));
+}
+
+HEAP_SCAN_TARGET_AVX2
+inline void BuildMasksAVX2(const unsigned char* data, size_t blocks,
+                           uint64_t* printable, uint64_t* zeroHigh, uint64_t* terminator) {
+    const __m256i lowByte = _mm256_set1_epi16(0x00FF);
+    const __m256i below = _mm256_set1_epi16(31);
+    const __m256i above = _mm256_set1_epi16(127);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (size_t b = 0; b < blocks; b++) {
+        const unsigned char* block = data + b * 128;
+        uint64_t p = 0, z = 0, d = 0;
+        for (unsigned half = 0; half < 2; half++) {
+            __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + half * 64));
+            __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + half * 64 + 32));
+            __m256i lo0 = _mm256_and_si256(v0, lowByte);
+            __m256i lo1 = _mm256_and_si256(v1, lowByte);
+            __m256i p0 = _mm256_and_si256(_mm256_cmpgt_epi16(lo0, below), _mm256_cmpgt_epi16(above, lo0));
+            __m256i p1 = _mm256_and_si256(_mm256_cmpgt_epi16(lo1, below), _mm256_cmpgt_epi16(above, lo1));
+            __m256i z0 = _mm256_cmpeq_epi16(_mm256_srli_epi16(v0, 8), zero);
+            __m256i z1 = _mm256_cmpeq_epi16(_mm256_srli_epi16(v1, 8), zero);
+            __m256i d0 = _mm256_cmpeq_epi16(v0, zero);
+            __m256i d1 = _mm256_cmpeq_epi16(v1, zero);
+            unsigned shift = half * 32;
+            p |= static_cast<uint64_t>(PackMaskAVX2(p0, p1)) << shift;
+            z |= static_cast<uint64_t>(PackMaskAVX2(z0, z1)) << shift;
+            d |= static_cast<uint64_t>(PackMaskAVX2(d0, d1)) << shift;
+        }
+        printable[b] = p;
+        zeroHigh[b] = z;
+        terminator[b] = d;
+    }
+}
+
+HEAP_SCAN_TARGET_AVX512
+inline void BuildMasksAVX512(const unsigned char* data, size_t blocks,
+                             uint64_t* printable, uint64_t* zeroHigh, uint64_t* terminator) {
+    const __m512i lowByte = _mm512_set1_epi16(0x00FF);
+    const __m512i below = _mm512_set1_epi16(31);
+    const __m512i above = _mm512_set1_epi16(127);
+    const __m512i zero = _mm512_setzero_si512();
+
+    for (size_t b = 0; b < blocks; b++) {
+        const unsigned char* block = data + b * 128;
+        __m512i v0 = _mm512_loadu_si512(reinterpret_cast<const void*>(block));
+        __m512i v1 = _mm512_loadu_si512(reinterpret_cast<const void*>(block + 64));
+        __m512i lo0 = _mm512_and_si512(v0, lowByte);
+        __m512i lo1 = _mm512_and_si512(v1, lowByte);
+        uint64_t p0 = _mm512_cmpgt_epi16_mask(lo0, below) & _mm512_cmplt_epi16_mask(lo0, above);
+        uint64_t p1 = _mm512_cmpgt_epi16_mask(lo1, below) & _mm512_cmplt_epi16_mask(lo1, above);
+        uint64_t z0 = _mm512_cmpeq_epi16_mask(_mm512_srli_epi16(v0, 8), zero);
+        uint64_t z1 = _mm512_cmpeq_epi16_mask(_mm512_srli_epi16(v1, 8), zero);
+        uint64_t d0 = _mm512_cmpeq_epi16_mask(v0, zero);
+        uint64_t d1 = _mm512_cmpeq_epi16_mask(v1, zero);
+        printable[b] = p0 | (p1 << 32);
+        zeroHigh[b] = z0 | (z1 << 32);
+        terminator[b] = d0 | (d1 << 32);
+    }
+}
+
+#endif
+
+// Zero checks take a size that is a multiple of 128 bytes and stop at the
+// first block with a nonzero byte.
+
+inline bool IsZeroScalar(const unsigned char* data, size_t size) {
+    for (size_t i = 0; i < size; i += 128) {
+        uint64_t any = 0;
+        for (size_t j = 0; j < 128; j += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i + j, 8);
+            any |= word;
+        }
+        if (any) return false;
+    }
+    return true;
+}
+
+#if defined(HEAP_SCAN_X86)
+
+HEAP_SCAN_TARGET_SSE2
+inline bool IsZeroSSE2(const unsigned char* data, size_t size) {
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t i = 0; i < size; i += 128) {
+        const __m128i* block = reinterpret_cast<const __m128i*>(data + i);
+        __m128i any = _mm_or_si128(_mm_or_si128(_mm_or_si128(_mm_loadu_si128(block), _mm_loadu_si128(block + 1)),
+                                                _mm_or_si128(_mm_loadu_si128(block + 2), _mm_loadu_si128(block + 3))),
+                                   _mm_or_si128(_mm_or_si128(_mm_loadu_si128(block + 4), _mm_loadu_si128(block + 5)),
+                                                _mm_or_si128(_mm_loadu_si128(block + 6), _mm_loadu_si128(block + 7))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF) return false;
+    }
+    return true;
+}
+
+HEAP_SCAN_TARGET_AVX2
+inline bool IsZeroAVX2(const unsigned char* data, size_t size) {
+    for (size_t i = 0; i < size; i += 128) {
+        const __m256i* block = reinterpret_cast<const __m256i*>(data + i);
+        __m256i any = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(block), _mm256_loadu_si256(block + 1)),
+                                      _mm256_or_si256(_mm256_loadu_si256(block + 2), _mm256_loadu_si256(block + 3)));
+        if (!_mm256_testz_si256(any, any)) return false;
+    }
+    return true;
+}
+
+HEAP_SCAN_TARGET_AVX512
+inline bool IsZeroAVX512(const unsigned char* data, size_t size) {
+    for (size_t i = 0; i < size; i += 128) {
+        __m512i any = _mm512_or_si512(_mm512_loadu_si512(reinterpret_cast<const void*>(data + i)),
+                                      _mm512_loadu_si512(reinterpret_cast<const void*>(data + i + 64)));
+        if (_mm512_test_epi64_mask(any, any)) return false;
+    }
+    return true;
+}
+
+#endif
+
+// Index of the first set bit in [from, to), or `to` when there is none.
+inline size_t NextSetBit(const uint64_t* bits, size_t from, size_t to) {
+    if (from >= to) return to;
+    size_t w = from >> 6;
+    uint64_t word = bits[w] & (~0ull << (from & 63));
+    while (true) {
+        if (word) {
+            size_t pos = (w << 6) + CountTrailingZeros64(word);
+            return pos < to ? pos : to;
+        }
+        if ((++w << 6) >= to) return to;
+        word = bits[w];
+    }
+}
+
+// Mask of the bits of word w that fall inside [from, to).
+inline uint64_t RangeMask(size_t w, size_t from, size_t to) {
+    size_t lo = w << 6;
+    uint64_t mask = ~0ull;
+    if (from > lo) mask &= ~0ull << (from - lo);
+    if (to < lo + 64) mask &= (1ull << (to - lo)) - 1;
+    return mask;
+}
+
+inline size_t CountBits(const uint64_t* bits, size_t from, size_t to) {
+    size_t count = 0;
+    for (size_t w = from >> 6; (w << 6) < to; w++) {
+        count += PopCount64(bits[w] & RangeMask(w, from, to));
+    }
+    return count;
+}
+
+// Index of the last set bit in [from, to); callers guarantee one exists.
+inline size_t LastSetBit(const uint64_t* bits, size_t from, size_t to) {
+    size_t w = (to - 1) >> 6;
+    while (true) {
+        uint64_t word = bits[w] & RangeMask(w, from, to);
+        if (word) return (w << 6) + 63 - CountLeadingZeros64(word);
+        w--;
+    }
+}
+
+} // namespace text_scan_detail
+
+class TextScanner {
+public:
+    // Window the heuristic inspects before deciding a position starts text.
+    static const size_t kTriggerWindowChars = 10;
+    // Maximum number of characters collected into one string.
+    static const size_t kMaxTextChars = 100;
+
+    explicit TextScanner(ScanKernel requested = DetectBestKernel())
+        : kernel(IsKernelSupported(requested) ? requested : DetectBestKernel()) {}
+
+    static bool IsKernelSupported(ScanKernel kernel) {
+        const CpuFeatures& cpu = GetCpuFeatures();
+        switch (kernel) {
+            case ScanKernel::Scalar: return true;
+#if defined(HEAP_SCAN_X86)
+            case ScanKernel::SSE2: return cpu.sse2;
+            case ScanKernel::AVX2: return cpu.avx2;
+            case ScanKernel::AVX512: return cpu.avx512bw;
+#endif
+            default: (void)cpu; return false;
+        }
+    }
+
+    static ScanKernel DetectBestKernel() {
+        if (IsKernelSupported(ScanKernel::AVX512)) return ScanKernel::AVX512;
+        if (IsKernelSupported(ScanKernel::AVX2)) return ScanKernel::AVX2;
+        if (IsKernelSupported(ScanKernel::SSE2)) return ScanKernel::SSE2;
+        return ScanKernel::Scalar;
+    }
+
+    static const char* KernelName(ScanKernel kernel) {
+        switch (kernel) {
+            case ScanKernel::Scalar: return "scalar";
+            case ScanKernel::SSE2: return "sse2";
+            case ScanKernel::AVX2: return "avx2";
+            case ScanKernel::AVX512: return "avx512";
+        }
+        return "unknown";
+    }
+
+    ScanKernel Kernel() const { return kernel; }
+
+    // Appends a span for every string the UTF-16 heuristic extracts from the
+    // buffer. A position starts text when at least 6 of the next 10 characters
+    // have a printable ASCII low byte and at least 3 have a zero high byte;
+    // the text is then every printable ASCII character (zero high byte) found
+    // in the next 100 characters before a 0x0000 terminator. Strings shorter
+    // than 4 characters are dropped, and scanning resumes after the last
+    // collected character. The final 32 bytes of the buffer never start text.
+    void Scan(const char* data, size_t size, std::vector<TextSpan>& spans) {
+        Prepare(data, size);
+        Walk(0, triggerEnd, &spans);
+    }
+
+    // Bytes past a character position the heuristic may look at when
+    // deciding what that position yields.
+    static const size_t kLookaheadBytes = 2 * kMaxTextChars + 32;
+
+    // First character position whose result could depend on bytes beyond
+    // the end of a buffer that was cut short of the real data.
+    static size_t SafeLimit(size_t size) {
+        return size > kLookaheadBytes ? (size - kLookaheadBytes) / 2 : 0;
+    }
+
+    // Classifies a buffer for Walk and Converge, which work in character
+    // positions (byte offset / 2) relative to its start.
+    void Prepare(const char* data, size_t size) {
+        chars = size / 2;
+        triggerEnd = size > 32 ? (size - 31) / 2 : 0;
+        BuildMasks(reinterpret_cast<const unsigned char*>(data), chars);
+        BuildTriggers(triggerEnd);
+    }
+
+    // Follows the scan from character position `from`, appending the spans
+    // that start before `stop`, and returns the first position at or after
+    // `stop` the scan visits. That is `stop` itself unless a string that
+    // starts before it runs past it.
+    size_t Walk(size_t from, size_t stop, std::vector<TextSpan>* spans) const {
+        using namespace text_scan_detail;
+
+        const uint64_t* triggerBits = triggers.data();
+        const uint64_t* acceptedBits = accepted.data();
+        const uint64_t* terminatorBits = terminator.data();
+        size_t end = (std::min)(stop, triggerEnd);
+
+        size_t k = from;
+        while (k < end) {
+            k = NextSetBit(triggerBits, k, end);
+            if (k >= end) break;
+
+            size_t windowEnd = (std::min)(k + kMaxTextChars, chars);
+            size_t stopChar = NextSetBit(terminatorBits, k, windowEnd);
+            size_t count = CountBits(acceptedBits, k, stopChar);
+            if (count == 0) {
+                k++;
+                continue;
+            }
+
+            size_t last = LastSetBit(acceptedBits, k, stopChar);
+            if (count > 3 && spans) {
+                TextSpan span;
+                span.offset = k * 2;
+                span.byteLength = (last + 1 - k) * 2;
+                span.charCount = count;
+                spans->push_back(span);
+            }
+            k = last + 1;
+        }
+        return k < stop ? stop : k;
+    }
+
+    // Two scans of the same data that start at different positions visit
+    // identical positions once they meet. Advances the scan at `path`
+    // (appending its spans) and the one at `probe` until they meet, and
+    // returns the meeting position; from there a scan started at `probe`
+    // reproduces the scan from `path`. Gives up at `limit` and returns the
+    // position `path` reached.
+    size_t Converge(size_t path, size_t probe, size_t limit, std::vector<TextSpan>* spans) const {
+        while (path != probe) {
+            if (path >= limit || probe >= limit) break;
+            if (path < probe) {
+                path = Walk(path, probe, spans);
+            } else {
+                probe = Walk(probe, path, nullptr);
+            }
+        }
+        return path;
+    }
+
+    // Whether every byte of data is zero; size must be a multiple of 128.
+    // Used to drop pages that cannot hold text before they are classified.
+    bool IsZero(const char* data, size_t size) const {
+        using namespace text_scan_detail;
+
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        switch (kernel) {
+#if defined(HEAP_SCAN_X86)
+            case ScanKernel::AVX512: return IsZeroAVX512(bytes, size);
+            case ScanKernel::AVX2: return IsZeroAVX2(bytes, size);
+            case ScanKernel::SSE2: return IsZeroSSE2(bytes, size);
+#endif
+            default: return IsZeroScalar(bytes, size);
+        }
+    }
+
+    // Copies the printable characters covered by a span into text.
+    static void Materialize(const char* data, const TextSpan& span, std::string& text) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data) + span.offset;
+        text.resize(span.charCount);
+        size_t out = 0;
+        for (size_t i = 0; i < span.byteLength; i += 2) {
+            unsigned char lo = bytes[i];
+            if (lo >= 32 && lo <= 126 && bytes[i + 1] == 0) {
+                text[out++] = static_cast<char>(lo);
+            }
+        }
+    }
+
+private:
+    void BuildMasks(const unsigned char* data, size_t chars) {
+        using namespace text_scan_detail;
+
+        // One spare word so the trigger window can always read word w + 1
+        size_t words = (chars + 63) / 64 + 1;
+        printable.assign(words, 0);
+        zeroHigh.assign(words, 0);
+        terminator.assign(words, 0);
+
+        size_t blocks = chars / 64;
+        switch (kernel) {
+#if defined(HEAP_SCAN_X86)
+            case ScanKernel::AVX512:
+                BuildMasksAVX512(data, blocks, printable.data(), zeroHigh.data(), terminator.data());
+                break;
+            case ScanKernel::AVX2:
+                BuildMasksAVX2(data, blocks, printable.data(), zeroHigh.data(), terminator.data());
+                break;
+            case ScanKernel::SSE2:
+                BuildMasksSSE2(data, blocks, printable.data(), zeroHigh.data(), terminator.data());
+                break;
+#endif
+            default:
+                BuildMasksScalar(data, blocks, printable.data(), zeroHigh.data(), terminator.data());
+                break;
+        }
+
+        // Trailing characters that do not fill a whole block
+        for (size_t c = blocks * 64; c < chars; c++) {
+            unsigned char lo = data[c * 2];
+            unsigned char hi = data[c * 2 + 1];
+            uint64_t bit = 1ull << (c & 63);
+            if (lo >= 32 && lo <= 126) printable[c >> 6] |= bit;
+            if (hi == 0) zeroHigh[c >> 6] |= bit;
+            if (lo == 0 && hi == 0) terminator[c >> 6] |= bit;
+        }
+    }
+
+    // Marks every character position whose 10-character window passes the
+    // heuristic. Window counts are kept in bit-sliced 4-bit counters so all
+    // 64 positions of a word are evaluated at once.
+    void BuildTriggers(size_t triggerEnd) {
+        size_t words = printable.size();
+        triggers.assign(words, 0);
+        accepted.resize(words);
+        for (size_t w = 0; w < words; w++) {
+            accepted[w] = printable[w] & zeroHigh[w];
+        }
+
+        size_t triggerWords = (triggerEnd + 63) / 64;
+        for (size_t w = 0; w < triggerWords; w++) {
+            uint64_t p0 = 0, p1 = 0, p2 = 0, p3 = 0;
+            uint64_t z0 = 0, z1 = 0, z2 = 0, z3 = 0;
+            for (unsigned j = 0; j < kTriggerWindowChars; j++) {
+                uint64_t p = j ? (printable[w] >> j) | (printable[w + 1] << (64 - j)) : printable[w];
+                uint64_t z = j ? (zeroHigh[w] >> j) | (zeroHigh[w + 1] << (64 - j)) : zeroHigh[w];
+                AddBit(p, p0, p1, p2, p3);
+                AddBit(z, z0, z1, z2, z3);
+            }
+            uint64_t enoughPrintable = p3 | (p2 & p1);     // count >= 6
+            uint64_t enoughZeroHigh = z3 | z2 | (z1 & z0); // count >= 3
+            triggers[w] = enoughPrintable & enoughZeroHigh;
+        }
+        if (triggerEnd & 63) {
+            triggers[triggerWords - 1] &= (1ull << (triggerEnd & 63)) - 1;
+        }
+    }
+
+    static void AddBit(uint64_t x, uint64_t& c0, uint64_t& c1, uint64_t& c2, uint64_t& c3) {
+        uint64_t carry0 = c0 & x;
+        c0 ^= x;
+        uint64_t carry1 = c1 & carry0;
+        c1 ^= carry0;
+        uint64_t carry2 = c2 & carry1;
+        c2 ^= carry1;
+        c3 |= carry2;
+    }
+
+    ScanKernel kernel;
+    size_t chars = 0;
+    size_t triggerEnd = 0;
+    std::vector<uint64_t> printable;
+    std::vector<uint64_t> zeroHigh;
+    std::vector<uint64_t> terminator;
+    std::vector<uint64_t> accepted;
+    std::vector<uint64_t> triggers;
+};
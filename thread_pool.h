@@ -0,0 +1,161 @@
+#pragma once
+
+// Fixed-size work-stealing thread pool.
+//
+// Run() deals a batch of task indices out to the workers in contiguous
+// blocks, so neighbouring tasks (neighbouring memory) usually land on the
+// same thread. A worker takes tasks from the front of its own queue and,
+// once that is empty, steals from the back of the others' queues. This
+// suits batches whose work is all known up front, such as the page
+// fingerprints of a snapshot pass.
+//
+// RunOnEach() instead runs one long loop on every thread, with no stealing,
+// for callers that hand out work themselves. The scan pipeline does: its
+// chunks are read in address order into a fixed ring of buffers and merged
+// in that order, so a worker must take whichever chunk was read next; one
+// given a block of chunks far ahead would wait for buffers that only free
+// up once the chunks before them are merged.
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+public:
+    typedef std::function<void(size_t task, size_t worker)> TaskFn;
+
+    explicit WorkStealingPool(size_t threadCount) {
+        if (threadCount == 0) threadCount = 1;
+        for (size_t i = 0; i < threadCount; i++) {
+            queues.emplace_back(new Queue());
+        }
+        for (size_t i = 0; i < threadCount; i++) {
+            threads.emplace_back([this, i] { WorkerLoop(i); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    size_t ThreadCount() const { return threads.size(); }
+
+    // Runs fn(task, worker) for every task in [0, count) and waits for all of
+    // them. The worker index is stable per thread, so callers can keep
+    // per-worker state without locking.
+    void Run(size_t count, const TaskFn& fn) {
+        Dispatch(count, fn, true);
+    }
+
+    // Runs fn(worker, worker) once on every thread and waits for all of
+    // them; each call stays on its own thread
+    void RunOnEach(const TaskFn& fn) {
+        Dispatch(queues.size(), fn, false);
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    void Dispatch(size_t count, const TaskFn& fn, bool steal) {
+        if (count == 0) return;
+
+        size_t workerCount = queues.size();
+        for (size_t w = 0; w < workerCount; w++) {
+            std::lock_guard<std::mutex> lock(queues[w]->mutex);
+            queues[w]->tasks.clear();
+            for (size_t t = count * w / workerCount; t < count * (w + 1) / workerCount; t++) {
+                queues[w]->tasks.push_back(t);
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(stateMutex);
+        job = &fn;
+        stealing = steal;
+        remaining = count;
+        generation++;
+        wake.notify_all();
+        done.wait(lock, [this] { return remaining == 0 && busy == 0; });
+        job = nullptr;
+    }
+
+    bool TakeTask(size_t worker, size_t& task) {
+        {
+            Queue& own = *queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; stealing && i < queues.size(); i++) {
+            Queue& victim = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkerLoop(size_t worker) {
+        size_t seenGeneration = 0;
+        while (true) {
+            const TaskFn* fn;
+            {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+                if (stopping) return;
+                seenGeneration = generation;
+                fn = job;
+                busy++;
+            }
+
+            size_t completed = 0;
+            size_t task;
+            while (fn && TakeTask(worker, task)) {
+                (*fn)(task, worker);
+                completed++;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                remaining -= completed;
+                busy--;
+                if (remaining == 0 && busy == 0) done.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex stateMutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const TaskFn* job = nullptr;
+    bool stealing = true;       // Set by the dispatch, before the workers wake
+    size_t remaining = 0;
+    size_t busy = 0;
+    size_t generation = 0;
+    bool stopping = false;
+};